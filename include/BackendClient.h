@@ -6,57 +6,376 @@
  * The backend is expected to accept a POST request at the endpoint
  * `/api/v1/cards/{uid}/play` and return a JSON response. Only the
  * status code is used to determine success or failure.
+ *
+ * All network I/O happens on one long-lived worker task. Card taps are
+ * handed to it through a fixed-size lock-free queue and results come
+ * back through a matching completion queue drained from loop(), so a
+ * tap costs neither a task creation nor a heap allocation.
+ *
+ * Taps that cannot be delivered are written to a TapJournal by the
+ * worker and replayed in order once the backend is reachable again.
+ *
+ * Requests share one persistent keep-alive connection to the backend.
+ * The connection is opened as soon as Wi‑Fi is available, probed while
+ * idle and transparently re-established when the backend drops it, so
+ * a tap normally skips the TCP handshake entirely. With
+ * BACKEND_TLS_ENABLED the connection runs over TlsClient, which resumes
+ * cached TLS sessions when it has to reconnect.
+ *
+ * The play request is rendered from a template compiled in begin(), so
+ * a tap only copies its UID into a fixed buffer before sending. With
+ * BACKEND_PAYLOAD_FORMAT set to CBOR the tap also carries a small CBOR
+ * body (see PayloadCodec), per endpoint until it answers 415.
+ *
+ * Failed requests are retried with jittered exponential backoff under
+ * a timeout derived from the measured round-trip time. Every tap
+ * carries an `Idempotency-Key` so retries and journal replays cannot
+ * play a card twice. A circuit breaker stops contacting a backend that
+ * keeps failing and lets the loop fail taps fast until it recovers.
+ *
+ * While idle the worker also keeps the local CardCatalog in sync over
+ * the same connection and uploads batched Telemetry windows, either on
+ * a jittered schedule or right after a delivered tap.
+ *
+ * Besides BACKEND_HOST, every backend advertising `_musicbee._tcp` over
+ * DNS-SD is a candidate endpoint (see EndpointDirectory). A tap whose
+ * endpoint cannot be reached fails over to the next healthy one
+ * immediately.
+ *
+ * With BACKEND_SEND_REMOVAL_EVENTS the worker also reports cards
+ * leaving the reader via `/cards/{uid}/removed`, best effort.
+ *
+ * With TapTransport::Mqtt, play taps, prepare hints and removals are
+ * published on a persistent MqttSession instead. The worker does not wait for the
+ * broker: the completion is posted when the PUBACK arrives, and a tap
+ * that is never acknowledged is journalled and replayed over MQTT.
  */
 
 #pragma once
 
 #include <Arduino.h>
+#include <WiFiClient.h>
+#include <atomic>
+
+#include "CardCatalog.h"
+#include "CircuitBreaker.h"
+#include "Config.h"
+#include "EndpointDirectory.h"
+#include "HostResolver.h"
+#include "ImpairedClient.h"
+#include "MqttSession.h"
+#include "PayloadCodec.h"
+#include "SpscQueue.h"
+#include "TapTracer.h"
+#include "TapJournal.h"
+#include "Telemetry.h"
+#include "TinyHttp.h"
+#include "TlsClient.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 class BackendClient {
 public:
+  // Longest UID accepted, in hex characters (10-byte triple-size UID).
+  static constexpr size_t kMaxUidLength = 20;
+
+  /**
+   * Outcome of an asynchronous request. `cancelled` is set when a newer
+   * tap superseded the request before it finished.
+   */
+  struct Result {
+    uint32_t requestId = 0;
+    uint32_t traceId = 0;
+    bool     success = false;
+    bool     cancelled = false;
+  };
+
+  /**
+   * Connection reuse counters. `lastConnectMs` and `lastRequestMs`
+   * describe the most recent request: connect time (including any TLS
+   * handshake) is zero when the warm connection was reused.
+   * `resumedHandshakes` counts new TLS connections that resumed a
+   * cached session.
+   */
+  struct ConnectionStats {
+    uint32_t      connectsOpened = 0;
+    uint32_t      requestsOnWarmConnection = 0;
+    uint32_t      staleReconnects = 0;
+    uint32_t      resumedHandshakes = 0;
+    unsigned long totalConnectMs = 0;
+    unsigned long lastConnectMs = 0;
+    unsigned long lastHandshakeMs = 0;
+    unsigned long lastRequestMs = 0;
+  };
+
+  /**
+   * Retry, failover and circuit breaker counters. `attempts` counts
+   * every request actually sent; `fastFailures` counts taps refused
+   * while the breaker was open; `failovers` counts retries moved to
+   * another endpoint. The RTT figures are in milliseconds and describe
+   * `endpoint`, the endpoint of the current connection.
+   */
+  struct ResilienceStats {
+    uint32_t              attempts = 0;
+    uint32_t              retries = 0;
+    uint32_t              timeouts = 0;
+    uint32_t              fastFailures = 0;
+    uint32_t              failovers = 0;
+    uint32_t              breakerOpenings = 0;
+    CircuitBreaker::State breakerState = CircuitBreaker::State::Closed;
+    unsigned long         srttMs = 0;
+    unsigned long         rttvarMs = 0;
+    unsigned long         timeoutMs = 0;
+    char                  endpoint[EndpointDirectory::kMaxHostHeaderLength] = {0};
+    uint8_t               endpointsKnown = 0;
+    uint8_t               endpointsHealthy = 0;
+  };
+
+  /**
+   * The backend address is taken from `resolver`'s cache, so requests
+   * never wait on an mDNS lookup. Network stages of traced taps are
+   * stamped on `tracer`, and catalog updates are applied to `catalog`.
+   */
+  BackendClient(HostResolver &resolver, TapTracer &tracer, CardCatalog &catalog)
+      : resolver(resolver), tracer(tracer), catalog(catalog) {}
+
+  /**
+   * Start the network worker task. Safe to call more than once.
+   */
+  void begin();
+
+  /**
+   * Tell the worker whether Wi‑Fi is up. The worker opens the
+   * persistent connection once it is and probes it periodically while
+   * idle. Call from loop().
+   */
+  void loop(unsigned long now, bool wifiConnected);
+
   /**
    * Perform a POST request to the backend indicating that a card with
-   * the given UID has been presented. Returns true if the HTTP
-   * response code is in the 200‑299 range. On failure, the method
-   * returns false and logs the error via Serial.
+   * the given UID has been presented, blocking until the worker has
+   * finished it. Returns true if the HTTP response code is in the
+   * 200‑299 range. Must not be mixed with {@link pollResult} callers.
    */
   bool postPlay(const String &cardUid);
 
   /**
-   * Start the backend request on a background FreeRTOS task. Returns
-   * true if the task was created successfully. The caller can poll
-   * {@link pollResult} to obtain the outcome once the request
-   * completes.
+   * Queue the backend request for the worker task. Returns the request
+   * id, or 0 if the request could not be queued. With
+   * BACKEND_LATEST_TAP_WINS the new request supersedes every older one.
+   * The caller can poll {@link pollResult} to obtain the outcome once
+   * the request completes. A non-zero `traceId` is sent to the backend
+   * as `X-Trace-Id` and returned in the Result. `capturedAt` is the
+   * millis() time the card was read, which is earlier than now when
+   * loop() was held up or the tap came from a hub satellite; 0 means
+   * now.
+   */
+  uint32_t beginPostPlayAsync(const String &cardUid, uint32_t traceId = 0,
+                              unsigned long capturedAt = 0);
+
+  /**
+   * Record a tap that cannot be sent right now (for example while Wi‑Fi
+   * is down). The worker journals it and replays it once the backend is
+   * reachable. Returns false if the request queue is full.
    */
-  bool beginPostPlayAsync(const String &cardUid);
+  bool journalTap(const String &cardUid, unsigned long capturedAt = 0);
 
   /**
-   * Returns true while a background request is still running.
+   * Sync the card catalog as soon as the connection is idle, for
+   * example after a card the catalog does not know was refused.
+   */
+  void requestCatalogSync() { catalogSyncRequested.store(true); }
+
+  /**
+   * First phase of a tap: a card is entering the reader field. Wakes
+   * the worker to verify the warm connection or reopen it, so the
+   * handshake overlaps with reading the UID. Cheap enough to call from
+   * the RFID read path.
+   */
+  void notifyCardApproaching();
+
+  /**
+   * The UID of an approaching card is known. With
+   * BACKEND_SEND_PREPARE_HINT the worker announces it via
+   * `/cards/{uid}/prepare` ahead of the `/play` commit. Safe to call
+   * from the RFID task.
+   */
+  void prepareCard(const char *cardUid, uint32_t traceId = 0);
+
+  /**
+   * A card that was read has left the reader after `presentMs`. With
+   * BACKEND_SEND_REMOVAL_EVENTS the worker reports it once, without
+   * retries or journaling. Call from loop().
+   */
+  void notifyCardRemoved(const char *cardUid, uint32_t presentMs);
+
+  /**
+   * Returns true while the circuit breaker is open. Taps submitted now
+   * would fail without reaching the backend, so callers may journal
+   * them directly and report the error at once.
+   */
+  bool isCircuitOpen() const;
+
+  /**
+   * Switch between HTTP and MQTT for play taps. Taps already published
+   * over MQTT are still settled after switching back to HTTP.
+   */
+  void setTransport(TapTransport mode);
+  TapTransport tapTransport() const { return transport.load(); }
+
+  /**
+   * Returns true while a queued request has not finished yet.
    */
   bool isBusy() const;
 
   /**
-   * Poll for the result of the most recent asynchronous request. When
-   * the request completes, this method stores the success flag in
-   * `outSuccess` and returns true. Otherwise it returns false to
-   * indicate that the operation is still in progress.
+   * Returns true if another tap can be submitted without exceeding the
+   * in-flight limit.
+   */
+  bool hasCapacity() const;
+
+  /**
+   * Poll for the result of the oldest finished asynchronous request.
+   * When a request has completed, this method stores its outcome in
+   * `out` and returns true. Otherwise it returns false to indicate that
+   * nothing has finished since the last call.
+   */
+  bool pollResult(Result &out);
+
+  /**
+   * Snapshot of the connection reuse counters.
    */
-  bool pollResult(bool &outSuccess);
+  ConnectionStats connectionStats() const { return stats; }
 
   /**
-   * Resolve a hostname, performing an mDNS lookup when the provided
-   * host ends with `.local`. The resolved hostname (IP string or the
-   * original host if no lookup was necessary) is written to
-   * `resolvedOut`.
+   * Snapshot of the retry and circuit breaker counters. Updated by the
+   * worker, so values may be one request behind.
    */
-  static bool resolveHostname(const String &host, String &resolvedOut);
+  ResilienceStats resilienceStats() const { return resilience; }
+
+  /**
+   * Snapshot of the MQTT session counters. Updated by the worker.
+   */
+  MqttSession::Stats mqttStats() const { return mqtt.stats(); }
 
 private:
-  bool performPostPlay(const String &cardUid);
-  static void requestTask(void *param);
+  enum class DeliveryResult { Delivered, Rejected, Failed, Cancelled };
+
+  enum class RequestKind : uint8_t { Play, JournalOnly, Prepare, Removed };
+
+  struct TapRequest {
+    uint32_t      id = 0;
+    uint32_t      traceId = 0;
+    // Per-boot tap counter used for the idempotency key.
+    uint32_t      tapId = 0;
+    unsigned long capturedAt = 0;
+    // How long a removed card was present.
+    uint32_t      presentMs = 0;
+    RequestKind   kind = RequestKind::Play;
+    char          uid[kMaxUidLength + 1] = {0};
+  };
+
+  static void workerTask(void *param);
+  void runWorker();
+  bool enqueue(const char *cardUid, RequestKind kind, uint32_t traceId,
+               unsigned long capturedAt, uint32_t &requestIdOut, uint32_t presentMs = 0);
+  bool isSuperseded(uint32_t requestId) const;
+  bool waitForResponse(uint32_t requestId, unsigned long timeoutMs);
+  bool sleepUnlessSuperseded(uint32_t requestId, unsigned long durationMs);
+  void handleRequest(const TapRequest &request);
+  void finishTap(const TapRequest &request, DeliveryResult result);
+  bool publishTap(const TapRequest &request, const char *idempotencyKey);
+  void serviceMqtt(unsigned long now);
+  DeliveryResult replayOverMqtt(const TapJournal::Entry &entry, const char *idempotencyKey,
+                                unsigned long capturedAt);
+  void replayJournal(unsigned long now);
+  void maintainConnection(unsigned long now, bool force = false);
+  void syncCatalog(unsigned long now);
+  void uploadTelemetry(unsigned long now, bool piggyback = false);
+  void sendPrepareHint(const char *cardUid, uint32_t traceId);
+  int readPrepareResponses(unsigned long timeoutMs);
+  void sendRemoval(const char *cardUid, uint32_t presentMs);
+  DeliveryResult performPostPlay(const char *cardUid, const char *idempotencyKey,
+                                 unsigned long capturedAt, uint32_t requestId,
+                                 uint32_t traceId = 0, int64_t capturedWallUs = 0);
+  DeliveryResult attemptPostPlay(const char *cardUid, const char *idempotencyKey,
+                                 unsigned long capturedAt, uint32_t requestId, uint32_t traceId,
+                                 int64_t capturedWallUs);
+  const char *renderCborPlay(const char *cardUid, const char *hostHeader,
+                             const char *idempotencyKey, unsigned long capturedAt,
+                             int64_t capturedWallUs, uint32_t traceId, size_t &lengthOut);
+  bool ensureConnected(bool &reusedOut, uint32_t traceId = 0);
+  bool connectTo(EndpointDirectory::Endpoint &endpoint, uint32_t traceId);
+  bool addressOf(const EndpointDirectory::Endpoint &endpoint, IPAddress &out);
+  void refreshEndpoints();
+  EndpointDirectory::Endpoint *connectedEndpoint();
+  unsigned long currentTimeoutMs();
+  void publishBreakerState();
+  void formatIdempotencyKey(uint16_t bootId, uint32_t tapId, char *out, size_t length) const;
+  void closeConnection();
+
+  HostResolver &resolver;
+  TapTracer    &tracer;
+  CardCatalog  &catalog;
+
+  // Shared between loop() (producer of requests, consumer of
+  // completions) and the worker task (the reverse).
+  TaskHandle_t worker = nullptr;
+  SpscQueue<TapRequest, BACKEND_REQUEST_QUEUE_DEPTH> requests;
+  SpscQueue<Result, BACKEND_REQUEST_QUEUE_DEPTH>     completions;
+  // Prepare hints come from the RFID task, which is a second producer.
+  SpscQueue<TapRequest, BACKEND_REQUEST_QUEUE_DEPTH> hints;
+  std::atomic<uint32_t> lastSubmittedId{0};
+  std::atomic<uint32_t> lastFinishedId{0};
+  // Requests with a lower id have been superseded by a newer tap.
+  std::atomic<uint32_t> supersededBefore{0};
+  std::atomic<bool>     warmUpRequested{false};
+  std::atomic<bool>     catalogSyncRequested{false};
+  std::atomic<bool>     circuitOpen{false};
+  std::atomic<TapTransport> transport{BACKEND_TAP_TRANSPORT};
+  // Only touched by the loop task, which assigns tap ids in enqueue().
+  uint32_t nextTapId = 1;
+  volatile bool networkAvailable = false;
 
-  volatile bool requestInProgress = false;
-  volatile bool requestCompleted = false;
-  volatile bool lastRequestSuccess = false;
-  String pendingUid;
+  // Owned by the worker task.
+  WiFiClient socket;
+  ImpairedClient impairedClient{socket};
+  TlsClient netClient{impairedClient};
+  TinyHttpClient http{netClient};
+  HttpRequestTemplate playRequest;
+  HttpRequestTemplate cborPlayRequest;
+  char cborPlayWire[HttpRequestTemplate::kCapacity + PayloadCodec::kMaxTapLength] = {0};
+  HttpRequestTemplate prepareRequest;
+  HttpRequestTemplate removedRequest;
+  char removedWire[HttpRequestTemplate::kCapacity + 32] = {0};
+  HttpRequestTemplate catalogRequest;
+  HttpRequestTemplate telemetryRequest;
+  char telemetryWire[HttpRequestTemplate::kCapacity + Telemetry::kMaxBatchLength] = {0};
+  // Prepare hints sent on the connection whose responses have not been
+  // read yet; they arrive ahead of the next /play response.
+  uint8_t pendingPrepareResponses = 0;
+  unsigned long lastPrepareSentAt = 0;
+  IPAddress connectedAddress;
+  EndpointDirectory endpoints;
+  // Endpoint of the open connection, or of the last one if it failed.
+  uint32_t connectedEndpointId = 0;
+  uint32_t instancesGeneration = 0;
+  bool connectionOpen = false;
+  unsigned long lastProbeAt = 0;
+  ConnectionStats stats;
+  ResilienceStats resilience;
+  CircuitBreaker breaker{"backend", BACKEND_BREAKER_FAILURE_THRESHOLD, BACKEND_BREAKER_OPEN_MS,
+                         BACKEND_BREAKER_MAX_OPEN_MS};
+  uint64_t deviceId = 0;
+  TapJournal journal;
+  MqttSession mqtt{resolver};
+  unsigned long lastReplayFailureAt = 0;
+  bool replayBackoff = false;
+  unsigned long nextCatalogSyncAt = 0;
+  bool catalogSyncScheduled = false;
+  unsigned long nextTelemetryUploadAt = 0;
+  bool telemetryUploadScheduled = false;
+  // Set by a failed upload; taps stop carrying telemetry until the
+  // scheduled retry.
+  bool telemetryBackoff = false;
 };
@@ -0,0 +1,135 @@
+/*
+ * CardCatalog.h
+ *
+ * Local copy of the backend's card catalog. Cards are kept as a sorted
+ * array keyed by binary UID, so a tap is looked up with a binary search
+ * instead of a round trip, and the array is mirrored to NVS so the
+ * catalog survives a reboot without a full download.
+ *
+ * The catalog is synced incrementally from `/cards/catalog?since=N`.
+ * The response is plain text, one record per line, so it can be applied
+ * while it streams in without buffering the body:
+ *
+ *   catalog 42 delta     header: new version, `full` replaces everything
+ *   + 04A224D9123480 ff8000   add or update a card (colour is optional)
+ *   - 04A224D9123481          remove a card
+ *
+ * The backend answers 304 when the device is already up to date.
+ *
+ * Updates are applied by the backend worker task while loop() performs
+ * lookups; a short critical section keeps the two consistent.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "Config.h"
+#include "TinyHttp.h"
+#include "freertos/FreeRTOS.h"
+
+class CardCatalog {
+public:
+  static constexpr size_t kMaxUidBytes = 10;
+
+  struct Card {
+    uint8_t uidLength = 0;
+    uint8_t uid[kMaxUidBytes] = {0};
+    uint8_t flags = 0;
+    uint8_t red = 0;
+    uint8_t green = 0;
+    uint8_t blue = 0;
+    uint8_t reserved = 0;
+
+    bool hasColor() const { return (flags & kHasColor) != 0; }
+  };
+
+  /**
+   * Known: the card is in the catalog. Unknown: the catalog is complete
+   * and does not contain it. Unavailable: no usable catalog yet (never
+   * synced, mid-replace or truncated), so the backend has to decide.
+   */
+  enum class Lookup : uint8_t { Known, Unknown, Unavailable };
+
+  /**
+   * Applies one sync response to the catalog as it is received. Call
+   * commit() once the response has been read completely.
+   */
+  class Updater : public HttpBodySink {
+  public:
+    explicit Updater(CardCatalog &catalog) : _catalog(catalog) {}
+
+    bool onHeaders(const HttpResponse &response) override;
+    bool onBody(const uint8_t *data, size_t length) override;
+
+    /**
+     * Adopt the announced version and persist the result. Returns false
+     * if the body was incomplete or malformed.
+     */
+    bool commit();
+
+  private:
+    static constexpr size_t kMaxLineLength = 48;
+
+    bool processLine();
+
+    CardCatalog &_catalog;
+    char         _line[kMaxLineLength + 1] = {0};
+    size_t       _lineLength = 0;
+    bool         _active = false;
+    bool         _sawHeader = false;
+    bool         _full = false;
+    uint32_t     _version = 0;
+    uint16_t     _added = 0;
+    uint16_t     _removed = 0;
+  };
+
+  /**
+   * Load the persisted catalog from NVS.
+   */
+  void begin();
+
+  /**
+   * Look up a card by its hex UID. `out` is filled for known cards.
+   */
+  Lookup lookup(const char *uidHex, Card &out) const;
+
+  uint32_t version() const;
+  size_t   size() const;
+
+  /**
+   * Parse a hex UID into its binary form. Returns false for malformed or
+   * overlong UIDs.
+   */
+  static bool parseUid(const char *uidHex, Card &card);
+
+private:
+  static constexpr uint8_t kHasColor = 0x01;
+
+  struct StoredHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t catalogVersion;
+    uint8_t  complete;
+    uint8_t  reserved[3];
+  };
+
+  // Called by the Updater on the worker task.
+  void beginReplace();
+  void upsert(const Card &card);
+  void remove(const Card &card);
+  void finishSync(uint32_t version);
+  void persist();
+
+  // Index of the first card not ordered before `key`.
+  size_t lowerBound(const Card &key) const;
+  static int compare(const Card &a, const Card &b);
+
+  mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+  Card     _cards[CARD_CATALOG_CAPACITY];
+  size_t   _count = 0;
+  uint32_t _version = 0;
+  bool     _complete = false;
+  bool     _overflowed = false;
+};
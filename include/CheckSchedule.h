@@ -0,0 +1,54 @@
+/*
+ * CheckSchedule.h
+ *
+ * When to run a periodic check such as OtaUpdater's manifest fetch.
+ * The first check falls at a random point within a spread after
+ * start(), so readers powering up together do not all check in the
+ * same second; each later one follows the previous attempt after a
+ * fixed interval plus random jitter.
+ *
+ * The random source is passed in and nothing else from the platform is
+ * used, so tools/fleet_sim can check its model against this class on a
+ * host build.
+ */
+
+#pragma once
+
+class CheckSchedule {
+public:
+  // Uniformly random delay in [0, maxMs].
+  using RandomDelay = unsigned long (*)(unsigned long maxMs);
+
+  CheckSchedule(unsigned long firstSpreadMs, unsigned long intervalMs, unsigned long jitterMs,
+                RandomDelay randomDelay)
+      : _firstSpreadMs(firstSpreadMs),
+        _intervalMs(intervalMs),
+        _jitterMs(jitterMs),
+        _randomDelay(randomDelay) {}
+
+  /**
+   * Schedule the first check. Later calls do nothing.
+   */
+  void start(unsigned long now);
+
+  /**
+   * Whether a started schedule's next check is due at `now`.
+   */
+  bool due(unsigned long now) const;
+
+  /**
+   * A check was made at `now`; schedule the next one.
+   */
+  void attempted(unsigned long now);
+
+  bool          started() const { return _started; }
+  unsigned long nextAt() const { return _nextAt; }
+
+private:
+  unsigned long _firstSpreadMs;
+  unsigned long _intervalMs;
+  unsigned long _jitterMs;
+  RandomDelay   _randomDelay;
+  unsigned long _nextAt = 0;
+  bool          _started = false;
+};
@@ -0,0 +1,61 @@
+/*
+ * CircuitBreaker.h
+ *
+ * Classic three-state circuit breaker. After a run of consecutive
+ * failures the circuit opens and requests fail immediately instead of
+ * waiting for a timeout. Once the cool-down has passed a single probe
+ * is let through (half-open); its outcome closes the circuit again or
+ * re-opens it with a longer cool-down.
+ *
+ * Not thread-safe; owned by the task that makes the requests.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class CircuitBreaker {
+public:
+  enum class State : uint8_t { Closed, Open, HalfOpen };
+
+  CircuitBreaker(const char *name, uint8_t failureThreshold, unsigned long openMs,
+                 unsigned long maxOpenMs)
+      : _name(name),
+        _failureThreshold(failureThreshold),
+        _openMs(openMs),
+        _maxOpenMs(maxOpenMs),
+        _currentOpenMs(openMs) {}
+
+  /**
+   * Returns true if a request may be made now. An open circuit turns
+   * half-open once its cool-down has elapsed, admitting one probe.
+   */
+  bool allowRequest(unsigned long now);
+
+  void recordSuccess();
+  void recordFailure(unsigned long now);
+
+  State state() const { return _state; }
+  uint8_t consecutiveFailures() const { return _consecutiveFailures; }
+  uint32_t timesOpened() const { return _timesOpened; }
+
+  /**
+   * Milliseconds until an open circuit admits its next probe.
+   */
+  unsigned long retryInMs(unsigned long now) const;
+
+  static const char *stateName(State state);
+
+private:
+  void transition(State next, unsigned long now);
+
+  const char   *_name;
+  uint8_t       _failureThreshold;
+  unsigned long _openMs;
+  unsigned long _maxOpenMs;
+  unsigned long _currentOpenMs;
+  State         _state = State::Closed;
+  uint8_t       _consecutiveFailures = 0;
+  unsigned long _openedAt = 0;
+  uint32_t      _timesOpened = 0;
+};
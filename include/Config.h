@@ -2,7 +2,7 @@
  * Global compile‑time configuration values for the jukebox firmware.
  *
  * This header is intentionally minimal and contains only constants that
- * should rarely change between deployments. Secrets such as Wi‑Fi
+ * should rarely change between deployments. Secrets such as Wi-Fi
  * credentials and backend host details are defined in `secrets.h`,
  * which is excluded from version control. See `secrets.example.h` for
  * an example of the required definitions.
@@ -13,7 +13,7 @@
 #include <Arduino.h>
 #include "secrets.h"
 
-// Wi‑Fi credentials are provided by secrets.h via SECRET_WIFI_SSID and
+// Wi-Fi credentials are provided by secrets.h via SECRET_WIFI_SSID and
 // SECRET_WIFI_PASSWORD. If you wish to configure a fallback SSID or
 // password at compile time, you can define them here instead of in
 // secrets.h (not recommended).
@@ -30,12 +30,222 @@ static constexpr uint16_t         BACKEND_PORT  = SECRET_BACKEND_PORT;
 // Base prefix for REST endpoints exposed by the backend service.
 static constexpr const char *const BACKEND_API_PREFIX = "/api/v1";
 
+// Persistent backend connection. A single keep-alive TCP connection is
+// opened once Wi-Fi is up and reused for every card request. While idle
+// the connection is probed every BACKEND_KEEPALIVE_PROBE_INTERVAL_MS and
+// re-established (no more often than BACKEND_RECONNECT_DELAY_MS) when the
+// backend has closed it.
+static constexpr unsigned long BACKEND_HTTP_TIMEOUT_MS             = 5000;
+static constexpr unsigned long BACKEND_KEEPALIVE_PROBE_INTERVAL_MS = 5000;
+static constexpr unsigned long BACKEND_RECONNECT_DELAY_MS          = 2000;
+
+// Backend requests are handed to a long-lived network worker task via a
+// fixed-size queue. Must be a power of two.
+static constexpr size_t BACKEND_REQUEST_QUEUE_DEPTH = 4;
+
+// In-flight tap limit. With BACKEND_LATEST_TAP_WINS a new tap cancels
+// any request that is still queued or waiting for its response, so the
+// most recent card always wins. Otherwise up to BACKEND_MAX_IN_FLIGHT
+// taps are delivered in order and further taps are rejected as busy.
+static constexpr size_t BACKEND_MAX_IN_FLIGHT   = 2;
+static constexpr bool   BACKEND_LATEST_TAP_WINS = true;
+static_assert(BACKEND_MAX_IN_FLIGHT <= BACKEND_REQUEST_QUEUE_DEPTH,
+              "BACKEND_MAX_IN_FLIGHT cannot exceed the request queue depth");
+
+// Two-phase taps. A card entering the reader field always wakes the
+// backend worker to check or reopen the connection. With
+// BACKEND_SEND_PREPARE_HINT the UID is also announced via
+// `/cards/{uid}/prepare` the moment it is read, pipelined ahead of the
+// `/play` commit, so the backend can start buffering early. Requires
+// backend support. A hint without a commit is drained after
+// BACKEND_PREPARE_COMMIT_WINDOW_MS.
+static constexpr bool          BACKEND_SEND_PREPARE_HINT        = false;
+static constexpr unsigned long BACKEND_PREPARE_COMMIT_WINDOW_MS = 250;
+
+// With BACKEND_SEND_REMOVAL_EVENTS a card taken off the reader is
+// reported via `/cards/{uid}/removed` with how long it was present, so
+// the backend can, for example, pause playback. Best effort: removals
+// are neither retried nor journaled. Requires backend support.
+static constexpr bool BACKEND_SEND_REMOVAL_EVENTS = false;
+
+// Retries and circuit breaker. A failed play request is retried up to
+// BACKEND_MAX_ATTEMPTS times in total after a random delay of at most
+// BACKEND_RETRY_BASE_DELAY_MS, doubling per attempt up to
+// BACKEND_RETRY_MAX_DELAY_MS. Response timeouts adapt to the measured
+// round-trip time within [BACKEND_MIN_TIMEOUT_MS, BACKEND_HTTP_TIMEOUT_MS].
+// After BACKEND_BREAKER_FAILURE_THRESHOLD consecutive failures the
+// breaker opens for BACKEND_BREAKER_OPEN_MS, doubling up to
+// BACKEND_BREAKER_MAX_OPEN_MS while probes keep failing.
+static constexpr uint8_t       BACKEND_MAX_ATTEMPTS              = 3;
+static constexpr unsigned long BACKEND_RETRY_BASE_DELAY_MS       = 150;
+static constexpr unsigned long BACKEND_RETRY_MAX_DELAY_MS        = 1500;
+static constexpr unsigned long BACKEND_MIN_TIMEOUT_MS            = 750;
+static constexpr uint8_t       BACKEND_BREAKER_FAILURE_THRESHOLD = 3;
+static constexpr unsigned long BACKEND_BREAKER_OPEN_MS           = 5000;
+static constexpr unsigned long BACKEND_BREAKER_MAX_OPEN_MS       = 60000;
+
+// Offline tap journal. Taps that cannot be delivered (Wi-Fi down or a
+// failed request) are kept in a small ring buffer in NVS and replayed in
+// order once the backend is reachable again. Entries older than
+// TAP_JOURNAL_MAX_AGE_MS are discarded instead of replayed. The journal
+// is written to flash at most once per TAP_JOURNAL_MIN_FLUSH_INTERVAL_MS
+// to bound wear.
+static constexpr size_t        TAP_JOURNAL_CAPACITY              = 16;
+static constexpr unsigned long TAP_JOURNAL_MAX_AGE_MS            = 10UL * 60UL * 1000UL;
+static constexpr unsigned long TAP_JOURNAL_MIN_FLUSH_INTERVAL_MS = 5000;
+static constexpr unsigned long TAP_JOURNAL_REPLAY_RETRY_MS       = 5000;
+
+// Local card catalog. Up to CARD_CATALOG_CAPACITY cards are mirrored
+// from the backend and kept in NVS; the device asks for changes every
+// CARD_CATALOG_SYNC_INTERVAL_MS plus up to CARD_CATALOG_SYNC_JITTER_MS,
+// failed syncs included (CARD_CATALOG_RETRY_MS when no request could be
+// made); the first sync after boot is spread over the jitter window too
+// unless there is no catalog yet. Requires backend support; an endpoint
+// answering 404 or 405 is not asked again. With
+// CARD_CATALOG_REJECT_UNKNOWN a card missing from a complete catalog is
+// rejected without contacting the backend and a sync is started, so a
+// card registered since the last sync is refused once, not until the
+// next interval. Off by default: the backend decides.
+static constexpr bool          CARD_CATALOG_SYNC_ENABLED     = false;
+static constexpr size_t        CARD_CATALOG_CAPACITY         = 512;
+static constexpr unsigned long CARD_CATALOG_SYNC_INTERVAL_MS = 5UL * 60UL * 1000UL;
+static constexpr unsigned long CARD_CATALOG_SYNC_JITTER_MS   = 60000;
+static constexpr unsigned long CARD_CATALOG_RETRY_MS         = 30000;
+static constexpr bool          CARD_CATALOG_REJECT_UNKNOWN   = false;
+
+// Tap latency tracing. Every tap logs a per-stage breakdown; the
+// aggregated p50/p95/p99 table is dumped over serial every
+// TAP_TRACE_DUMP_EVERY finished taps (0 disables the periodic dump).
+static constexpr uint32_t TAP_TRACE_DUMP_EVERY = 20;
+
+// Wall clock. Once Wi-Fi is up the device syncs with CLOCK_NTP_SERVER
+// (or CLOCK_NTP_FALLBACK_SERVER) every CLOCK_SYNC_INTERVAL_MS in the
+// background. EventClock tracks the offset and drift of the local timer
+// between syncs, so taps, backend requests and OTA events carry
+// wall-clock microseconds. A sync more than CLOCK_STEP_THRESHOLD_MS away
+// from the prediction restarts the model instead of being treated as
+// drift.
+static constexpr const char *const CLOCK_NTP_SERVER          = "pool.ntp.org";
+static constexpr const char *const CLOCK_NTP_FALLBACK_SERVER = "time.google.com";
+static constexpr unsigned long     CLOCK_SYNC_INTERVAL_MS    = 15UL * 60UL * 1000UL;
+static constexpr unsigned long     CLOCK_STEP_THRESHOLD_MS   = 500;
+
+// Background hostname resolution shared by the backend and OTA clients.
+// Addresses are cached for HOST_RESOLVER_TTL_MS and refreshed
+// HOST_RESOLVER_REFRESH_AHEAD_MS before they expire. Failed lookups are
+// retried every HOST_RESOLVER_RETRY_DELAY_MS. Browsed DNS-SD services are
+// queried every HOST_RESOLVER_BROWSE_INTERVAL_MS.
+static constexpr unsigned long HOST_RESOLVER_TTL_MS             = 120000;
+static constexpr unsigned long HOST_RESOLVER_REFRESH_AHEAD_MS   = 20000;
+static constexpr unsigned long HOST_RESOLVER_RETRY_DELAY_MS     = 5000;
+static constexpr uint32_t      HOST_RESOLVER_MDNS_TIMEOUT_MS    = 2000;
+static constexpr unsigned long HOST_RESOLVER_BROWSE_INTERVAL_MS = 30000;
+
+// Backend discovery and failover. With BACKEND_DISCOVERY_ENABLED every
+// `_musicbee._tcp` DNS-SD instance becomes a backend endpoint. Instances
+// may advertise `priority` (lower wins) and `weight` TXT records; within
+// a priority the endpoint with the lowest measured RTT is preferred, and
+// endpoints not clearly slower than it share new connections in
+// proportion to their weight. BACKEND_HOST stays in the list at
+// BACKEND_STATIC_ENDPOINT_PRIORITY. An endpoint that fails is skipped for
+// BACKEND_ENDPOINT_HOLDDOWN_MS and the next one is tried within the same
+// tap.
+static constexpr bool              BACKEND_DISCOVERY_ENABLED        = true;
+static constexpr const char *const BACKEND_SERVICE_NAME             = "musicbee";
+static constexpr const char *const BACKEND_SERVICE_PROTOCOL         = "tcp";
+static constexpr uint16_t          BACKEND_STATIC_ENDPOINT_PRIORITY = 100;
+static constexpr unsigned long     BACKEND_ENDPOINT_HOLDDOWN_MS     = 30000;
+
+// TLS to the backend. With BACKEND_TLS_ENABLED the backend connection
+// (plays, prepare hints, catalog syncs) and the OTA manifest fetch use
+// TLS 1.2 on the usual ports, verified against BACKEND_CA_CERT and the
+// backend's host name; `https://` firmware URLs are accepted either way.
+// Up to TLS_SESSION_CACHE_SIZE sessions are kept for
+// TLS_SESSION_MAX_AGE_MS and resumed on reconnect, which replaces the
+// certificate check and key exchange with an abbreviated handshake. The
+// persistent connection is opened, and so the handshake done, as soon
+// as Wi-Fi is up. MQTT stays on plain TCP.
+#ifdef SECRET_BACKEND_CA_CERT
+static constexpr const char *const BACKEND_CA_CERT = SECRET_BACKEND_CA_CERT;
+#else
+static constexpr const char *const BACKEND_CA_CERT = nullptr;
+#endif
+static constexpr bool          BACKEND_TLS_ENABLED    = false;
+static constexpr size_t        TLS_SESSION_CACHE_SIZE = 4;
+static constexpr unsigned long TLS_SESSION_MAX_AGE_MS = 60UL * 60UL * 1000UL;
+
+// Tap transport. TapTransport::Mqtt publishes taps at QoS 1 on a
+// persistent MQTT session instead of sending one HTTP request per tap
+// (see MqttSession); catalog sync and OTA stay on HTTP. The transport
+// can also be switched at runtime with the `tap_transport` debug
+// action. Up to MQTT_OUTBOX_CAPACITY taps wait for the broker's
+// acknowledgement; a tap not acknowledged within
+// MQTT_PUBLISH_TIMEOUT_MS is journalled like a failed HTTP request.
+enum class TapTransport : uint8_t { Http, Mqtt };
+
+static constexpr TapTransport      BACKEND_TAP_TRANSPORT   = TapTransport::Http;
+static constexpr const char *const MQTT_BROKER_HOST        = BACKEND_HOST;
+static constexpr uint16_t          MQTT_BROKER_PORT        = 1883;
+static constexpr const char *const MQTT_TOPIC_PREFIX       = "musicbee";
+static constexpr uint16_t          MQTT_KEEPALIVE_S        = 30;
+static constexpr size_t            MQTT_OUTBOX_CAPACITY    = 8;
+static constexpr unsigned long     MQTT_PUBLISH_TIMEOUT_MS = BACKEND_HTTP_TIMEOUT_MS;
+static constexpr unsigned long     MQTT_POLL_INTERVAL_MS   = 5;
+
+// Payload encoding. With PayloadFormat::Cbor a play request carries the
+// tap (UID bytes, age and trace id) as a CBOR body and the OTA manifest
+// is requested as CBOR. An endpoint that answers 415 gets JSON from
+// then on, and a JSON manifest is still accepted.
+enum class PayloadFormat : uint8_t { Json, Cbor };
+
+static constexpr PayloadFormat BACKEND_PAYLOAD_FORMAT = PayloadFormat::Json;
+
+// Hub mode for rooms with several readers. A HubRole::Satellite build
+// never joins Wi-Fi: it sends taps over ESP-NOW to the one
+// HubRole::Gateway, which forwards them through its BackendClient and
+// sends the result back (see HubRelay). Satellites must use the
+// gateway's radio channel, which is its access point's; with
+// HUB_CHANNEL 0 they scan for WIFI_SSID to find it. With
+// HUB_GATEWAY_MAC all zero a satellite broadcasts until a gateway
+// answers. Frames are retransmitted up to HUB_MAX_ATTEMPTS times under
+// an RTT-based timeout, and a satellite shows an error when no result
+// arrives within HUB_RESULT_TIMEOUT_MS.
+enum class HubRole : uint8_t { Standalone, Gateway, Satellite };
+
+static constexpr HubRole       HUB_ROLE               = HubRole::Standalone;
+static constexpr uint8_t       HUB_CHANNEL            = 0;
+static constexpr uint8_t       HUB_GATEWAY_MAC[6]     = {0, 0, 0, 0, 0, 0};
+static constexpr uint8_t       HUB_MAX_ATTEMPTS       = 6;
+static constexpr unsigned long HUB_MIN_ACK_TIMEOUT_MS = 20;
+static constexpr unsigned long HUB_MAX_ACK_TIMEOUT_MS = 200;
+static constexpr unsigned long HUB_RESULT_TIMEOUT_MS  = 2 * BACKEND_HTTP_TIMEOUT_MS;
+
+// Fleet telemetry. Counters, latency histograms, RSSI and free heap
+// (sampled every TELEMETRY_SAMPLE_INTERVAL_MS) are aggregated into
+// windows of TELEMETRY_INTERVAL_MS and uploaded in one batch to
+// `/devices/{id}/telemetry` up to TELEMETRY_JITTER_MS after a window
+// closes, or straight after the next tap on the warm connection. Up to
+// TELEMETRY_MAX_WINDOWS windows are kept while the backend is
+// unreachable; older ones are dropped. Satellites do not report.
+// Requires backend support; an endpoint answering 404 or 405 is not
+// asked again.
+static constexpr bool          TELEMETRY_ENABLED            = false;
+static constexpr unsigned long TELEMETRY_INTERVAL_MS        = 5UL * 60UL * 1000UL;
+static constexpr unsigned long TELEMETRY_JITTER_MS          = 60UL * 1000UL;
+static constexpr size_t        TELEMETRY_MAX_WINDOWS        = 6;
+static constexpr unsigned long TELEMETRY_SAMPLE_INTERVAL_MS = 10000;
+
 // Optional debug HTTP server used to trigger firmware actions without
 // physical hardware. Enable it during development to expose
 // troubleshooting endpoints on DEBUG_SERVER_PORT.
 static constexpr bool     ENABLE_DEBUG_ACTIONS = false;
 static constexpr uint16_t DEBUG_SERVER_PORT    = 8081;
 
+// Route backend and OTA traffic through ImpairedClient so latency,
+// stalls, bandwidth caps and resets can be injected at runtime with the
+// `network_impairment` debug action. Off in production builds.
+static constexpr bool NETWORK_IMPAIRMENT_ENABLED = false;
+
 // RFID/NFC reader selection. Choose which hardware backend should be
 // compiled into the firmware. Add new enum values if additional reader
 // types are supported in the future. The PlatformIO environment
@@ -71,6 +281,13 @@ static constexpr uint8_t PN532_RST_PIN  = 16;  // Optional PN532 reset pin
 static constexpr uint8_t PN532_SDA_PIN  = 21;  // I²C SDA
 static constexpr uint8_t PN532_SCL_PIN  = 22;  // I²C SCL
 
+// With PN532_IRQ_DETECTION the PN532 keeps searching for a card on its
+// own after one detection command and pulls IRQ low when it finds one;
+// the bus stays idle until then and the UID is fetched straight away.
+// begin() checks that IRQ actually signals a response and falls back to
+// polling the chip if it does not; turn it off to skip the check.
+static constexpr bool PN532_IRQ_DETECTION = true;
+
 // PN532 (SPI) wiring defaults. Define USE_PN532_SPI to activate these pins
 // and the SPI transport in the firmware.
 
@@ -84,10 +301,51 @@ static constexpr uint8_t  LED_DATA_PIN           = 47;  // Data in to the strip
 static constexpr uint16_t LED_COUNT_DEFAULT      = 11;  // Number of pixels in the strip
 static constexpr uint8_t  LED_BRIGHTNESS_DEFAULT = 200; // 0-255 brightness scaling
 
-// Debounce interval (ms) to ignore repeated reads of the same card.
-static constexpr unsigned long CARD_DEBOUNCE_MS = 800;
+// RFID task. The reader is polled on its own task, above loop() at
+// RFID_TASK_PRIORITY, so a blocking OTA download or a slow debug request
+// cannot delay detection. Up to RFID_QUEUE_DEPTH card reads wait for
+// loop() (a power of two).
+static constexpr UBaseType_t RFID_TASK_PRIORITY = 2;
+static constexpr size_t      RFID_QUEUE_DEPTH   = 4;
+
+// RFID power profiles trade detection latency for current and bus
+// traffic. The task polls every activeIntervalMs while a card is being
+// read and for activeHoldMs after the last card, then doubles the
+// interval on each quiet poll up to idleIntervalMs. With lowPowerDetect
+// the reader also sleeps between idle polls (the MFRC522 in soft
+// power-down with its antenna off, the PN532 in power-down) and wakes
+// for one short probe per poll, so a card can go unnoticed for up to
+// idleIntervalMs. A PN532 with PN532_IRQ_DETECTION is woken by its IRQ
+// line whenever it is searching, whatever the interval. The profile can
+// be switched at runtime with the `rfid_status` debug action.
+enum class RfidPowerProfile : uint8_t { Responsive, Balanced, LowPower };
+
+struct RfidPollProfile {
+  const char   *name;
+  unsigned long activeIntervalMs;
+  unsigned long idleIntervalMs;
+  unsigned long activeHoldMs;
+  bool          lowPowerDetect;
+};
+
+// In RfidPowerProfile order.
+static constexpr RfidPollProfile RFID_POLL_PROFILES[] = {
+    {"responsive", 10, 10, 0, false},       // fixed rate, field always on
+    {"balanced", 10, 100, 30000, false},    // fast after a tap, ~100 ms idle
+    {"low_power", 10, 300, 10000, true},    // reader asleep between probes
+};
+
+static constexpr RfidPowerProfile RFID_POWER_PROFILE = RfidPowerProfile::Balanced;
+
+// Card presence. A card that stays on the reader is re-selected by UID
+// every RFID_PRESENCE_CHECK_MS (no anticollision, so it costs two short
+// frames) and reported once: arriving, then removed after it has gone
+// unanswered for RFID_REMOVAL_TIMEOUT_MS. Taking a card off and putting
+// it back is a new tap straight away.
+static constexpr unsigned long RFID_PRESENCE_CHECK_MS  = 100;
+static constexpr unsigned long RFID_REMOVAL_TIMEOUT_MS = 300;
 
-// Wi‑Fi reconnection settings. Adjust if you need to tune how
+// Wi-Fi reconnection settings. Adjust if you need to tune how
 // aggressively the device should retry connections.
 static constexpr unsigned long WIFI_RETRY_DELAY_MS = 2000;
 static constexpr uint8_t       MAX_WIFI_RETRIES     = 20;
@@ -99,6 +357,11 @@ static constexpr const char *const OTA_MANIFEST_PATH        = "/firmware/manifes
 static constexpr unsigned long     OTA_CHECK_INTERVAL_MS    =
     24UL * 60UL * 60UL * 1000UL;  // 24 hours
 static constexpr unsigned long OTA_HTTP_TIMEOUT_MS = 10000;
+// Checks are spread out so a fleet does not hit the backend together:
+// the first one runs up to OTA_FIRST_CHECK_SPREAD_MS after boot, later
+// ones OTA_CHECK_INTERVAL_MS plus up to OTA_CHECK_JITTER_MS apart.
+static constexpr unsigned long OTA_FIRST_CHECK_SPREAD_MS = 5UL * 60UL * 1000UL;
+static constexpr unsigned long OTA_CHECK_JITTER_MS       = 60UL * 60UL * 1000UL;
 
 
 // Legacy discrete RGB LED configuration removed; use the NeoPixel strip instead.
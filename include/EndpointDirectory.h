@@ -0,0 +1,108 @@
+/*
+ * EndpointDirectory.h
+ *
+ * Ranked list of backend endpoints: the compile-time BACKEND_HOST plus
+ * any instances found through DNS-SD. Endpoints are ordered by
+ * advertised priority, then by measured round-trip time. Endpoints of
+ * the best priority whose RTT is not clearly worse than the best one's
+ * share new connections in proportion to their weight. An endpoint
+ * that fails is held down for a while so the next request goes straight
+ * to the next one.
+ *
+ * The directory is not thread-safe; it is owned by the backend worker
+ * task.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#include "Config.h"
+#include "HostResolver.h"
+#include "RttEstimator.h"
+
+class EndpointDirectory {
+public:
+  static constexpr size_t kMaxEndpoints = HostResolver::kMaxServiceInstances + 1;
+  static constexpr size_t kMaxHostHeaderLength = HostResolver::kMaxHostLength + 8;
+
+  struct Endpoint {
+    // Unique for the lifetime of the directory; 0 marks a free slot.
+    uint32_t      id = 0;
+    bool          discovered = false;
+    char          host[HostResolver::kMaxHostLength] = {0};
+    char          hostHeader[kMaxHostHeaderLength] = {0};
+    // Known up front for discovered endpoints; the static one is
+    // looked up through the HostResolver.
+    IPAddress     ip;
+    uint16_t      port = 0;
+    uint16_t      priority = 0;
+    uint16_t      weight = 1;
+    RttEstimator  rtt{BACKEND_MIN_TIMEOUT_MS, BACKEND_HTTP_TIMEOUT_MS};
+    uint8_t       consecutiveFailures = 0;
+    uint32_t      failures = 0;
+    unsigned long downUntil = 0;
+    // Answered a CBOR play request with 415; sent JSON from then on.
+    bool          cborUnsupported = false;
+    // Answered a telemetry upload with 404 or 405; not asked again.
+    bool          telemetryUnsupported = false;
+    // Answered a catalog sync with 404 or 405; not asked again.
+    bool          catalogUnsupported = false;
+
+    bool isHealthy(unsigned long now) const {
+      return consecutiveFailures == 0 || static_cast<long>(now - downUntil) >= 0;
+    }
+  };
+
+  /**
+   * Add the compile-time endpoint. Call once before anything else.
+   */
+  void addStatic(const char *host, uint16_t port, uint16_t priority);
+
+  /**
+   * Replace the discovered endpoints with `instances`, keeping RTT and
+   * health history for the ones that are still advertised.
+   */
+  void merge(const HostResolver::ServiceInstance *instances, size_t count);
+
+  Endpoint *find(uint32_t id);
+
+  /**
+   * Best endpoint whose id is not listed in `skip`. Healthy endpoints
+   * win, and among equally good ones the pick is random by weight;
+   * when every candidate is held down, the one whose hold-down ends
+   * first is returned so requests keep probing. Returns nullptr when
+   * all endpoints are skipped.
+   */
+  Endpoint *best(unsigned long now, const uint32_t *skip = nullptr, size_t skipCount = 0);
+
+  /**
+   * True when `candidate` is clearly preferable to the connected
+   * endpoint: a better priority, or an RTT at least a quarter lower.
+   */
+  bool shouldSwitch(const Endpoint &current, const Endpoint &candidate) const;
+
+  void recordSuccess(Endpoint &endpoint, unsigned long rttMs);
+  void recordFailure(Endpoint &endpoint, unsigned long now);
+
+  size_t size() const;
+  size_t healthyCount(unsigned long now) const;
+
+  /**
+   * Log every endpoint with its ranking inputs.
+   */
+  void log() const;
+
+private:
+  static bool ranksBefore(const Endpoint &a, const Endpoint &b);
+  // RTT at least a quarter lower; both must have samples.
+  static bool clearlyFaster(const Endpoint &a, const Endpoint &b);
+  static bool sharesLoadWith(const Endpoint &endpoint, const Endpoint &best,
+                             unsigned long now);
+  static bool isListed(uint32_t id, const uint32_t *ids, size_t count);
+  Endpoint *claimSlot();
+
+  Endpoint _endpoints[kMaxEndpoints];
+  uint32_t _nextId = 1;
+};
@@ -0,0 +1,84 @@
+/*
+ * EspNowLink.h
+ *
+ * HubLink over ESP-NOW: connectionless 802.11 action frames between
+ * devices on the same channel, with no access point involved. A
+ * satellite keeps the radio in station mode without associating and
+ * tunes it to the gateway's channel; the gateway stays associated and
+ * receives ESP-NOW frames on its access point's channel alongside
+ * normal Wi-Fi traffic.
+ *
+ * Frames arrive on the Wi-Fi task and are handed to loop() through a
+ * lock-free queue. Peers are registered on first send.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_idf_version.h>
+#include <esp_now.h>
+
+#include "HubLink.h"
+#include "SpscQueue.h"
+
+class EspNowLink : public HubLink {
+public:
+  struct Stats {
+    uint32_t sent = 0;
+    // Unicast frames the peer's radio did not acknowledge.
+    uint32_t notAcknowledged = 0;
+    uint32_t received = 0;
+    // Frames dropped because loop() fell behind.
+    uint32_t overflows = 0;
+  };
+
+  /**
+   * Start ESP-NOW. With `channel` 0 the radio stays on its current
+   * channel, which is what an associated gateway wants; otherwise it is
+   * tuned to `channel`. Wi-Fi must already be in station mode.
+   */
+  bool begin(uint8_t channel);
+
+  /**
+   * Move an unassociated radio to `channel`, for a satellite whose
+   * gateway has moved.
+   */
+  void setChannel(uint8_t channel);
+
+  /**
+   * Scan for `ssid` and return its channel, or 0 if it was not found.
+   * Blocks for the scan, about two seconds.
+   */
+  static uint8_t findChannel(const char *ssid);
+
+  HubAddress localAddress() const;
+  uint8_t channel() const;
+
+  bool send(const HubAddress &to, const uint8_t *data, size_t length) override;
+  bool receive(HubAddress &from, uint8_t *data, size_t &length) override;
+
+  Stats stats() const;
+
+private:
+  struct Frame {
+    HubAddress from;
+    uint8_t    length = 0;
+    uint8_t    data[kMaxFrameLength] = {0};
+  };
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+  static void receiveCallback(const esp_now_recv_info_t *info, const uint8_t *data, int length);
+#else
+  static void receiveCallback(const uint8_t *mac, const uint8_t *data, int length);
+#endif
+  static void sendCallback(const uint8_t *mac, esp_now_send_status_t status);
+  bool ensurePeer(const HubAddress &address);
+
+  bool _started = false;
+  SpscQueue<Frame, 8> _received;
+  std::atomic<uint32_t> _sent{0};
+  std::atomic<uint32_t> _notAcknowledged{0};
+  std::atomic<uint32_t> _receivedCount{0};
+  std::atomic<uint32_t> _overflows{0};
+};
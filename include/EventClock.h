@@ -0,0 +1,76 @@
+/*
+ * EventClock.h
+ *
+ * SNTP-disciplined wall clock for stamping events so device and backend
+ * logs can be lined up. SNTP runs in the background (lwIP task) and
+ * every completed sync is fed to a small model of the local esp_timer:
+ * the wall time at the last sync plus the elapsed timer ticks scaled by
+ * the measured drift. Reading the clock never touches the network, so
+ * it is safe on the loop and RFID paths.
+ *
+ * nowUs() never goes backwards, even when a sync moves the estimate
+ * back; stamps are held until the clock catches up. Before the first
+ * sync there is no wall time and every read returns 0.
+ *
+ * Thread-safe. All members are static, as there is one SNTP client per
+ * device.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <sys/time.h>
+
+class EventClock {
+public:
+  struct Stats {
+    bool     synced = false;
+    uint32_t syncs = 0;
+    // Syncs too far from the prediction to be drift.
+    uint32_t steps = 0;
+    float    driftPpm = 0.0f;
+    // Prediction error of the most recent sync, in µs.
+    int64_t  lastErrorUs = 0;
+    // Local timer value of the most recent sync, in µs.
+    int64_t  lastSyncAtUs = 0;
+  };
+
+  /**
+   * Start background SNTP. Returns at once; call when Wi-Fi is up. Safe
+   * to call more than once.
+   */
+  static void begin();
+
+  static bool isSynced();
+
+  /**
+   * Current wall time in µs since the Unix epoch, or 0 before the first
+   * sync. Never smaller than a previous result.
+   */
+  static int64_t nowUs();
+
+  /**
+   * Wall time of an earlier esp_timer_get_time() stamp, or 0 before the
+   * first sync.
+   */
+  static int64_t wallUsAt(int64_t timerUs);
+
+  /**
+   * Wall time of an earlier millis() stamp, or 0 before the first sync.
+   * The stamp is converted by its age, so it stays correct after
+   * millis() wraps (every 49.7 days) while esp_timer does not.
+   */
+  static int64_t wallUsAtMillis(unsigned long ms);
+
+  /**
+   * Format a wall time as ISO 8601 UTC with microseconds
+   * (2026-01-31T12:34:56.123456Z), or "unsynced" for 0.
+   */
+  static const char *format(int64_t wallUs, char *out, size_t length);
+
+  static Stats stats();
+
+private:
+  static void onSync(struct timeval *tv);
+  static void addSample(int64_t timerUs, int64_t wallUs);
+};
@@ -0,0 +1,147 @@
+/*
+ * HostResolver.h
+ *
+ * Background hostname resolver shared by the backend and OTA clients.
+ * Hostnames are resolved on a dedicated FreeRTOS task (mDNS for
+ * `.local` names, regular DNS otherwise) and cached with a TTL. Cached
+ * entries are refreshed shortly before they expire, so callers on the
+ * tap path always get an address immediately without blocking on a
+ * network lookup.
+ *
+ * The same task can also browse one DNS-SD service type and keep the
+ * list of advertised instances current.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+class HostResolver {
+public:
+  static constexpr size_t kMaxHostLength = 64;
+  static constexpr size_t kMaxServiceInstances = 4;
+
+  enum class Status { Unknown, Pending, Resolved, Failed };
+
+  /**
+   * One advertised instance of the browsed service. The mDNS API does
+   * not expose SRV priority and weight, so they are read from the
+   * `priority` and `weight` TXT records (defaults 0 and 1).
+   */
+  struct ServiceInstance {
+    char          host[kMaxHostLength] = {0};
+    IPAddress     ip;
+    uint16_t      port = 0;
+    uint16_t      priority = 0;
+    uint16_t      weight = 1;
+    unsigned long lastSeenAt = 0;
+  };
+
+  struct Update {
+    Status        status = Status::Unknown;
+    IPAddress     ip;
+    unsigned long startedAt = 0;
+    unsigned long finishedAt = 0;
+  };
+
+  /**
+   * Start the resolver task. Safe to call more than once.
+   */
+  void begin();
+
+  /**
+   * Pause or resume background lookups. Cached addresses are kept while
+   * the network is down and refreshed once it returns.
+   */
+  void setNetworkAvailable(bool available);
+
+  /**
+   * Register a hostname for background resolution and refresh. When the
+   * cache is full the least recently used host is evicted. Returns false
+   * for empty or over-long hostnames.
+   */
+  bool track(const char *host);
+
+  /**
+   * Non-blocking cached lookup. Returns true and fills `out` when an
+   * address is known (possibly slightly stale while a refresh is in
+   * flight). Unknown hosts are registered for background resolution.
+   */
+  bool lookup(const char *host, IPAddress &out);
+
+  /**
+   * Like lookup(), but waits up to `waitMs` for the background task to
+   * produce an address. Intended for paths that may block, such as OTA.
+   */
+  bool resolve(const char *host, IPAddress &out, unsigned long waitMs);
+
+  /**
+   * Report a change in the availability of `host`. Returns true only
+   * when the status differs from the previous call, so refreshes that
+   * keep an address do not generate updates.
+   */
+  bool fetchUpdate(const char *host, Update &out);
+
+  /**
+   * Browse a DNS-SD service type (for example "musicbee", "tcp") every
+   * HOST_RESOLVER_BROWSE_INTERVAL_MS. Instances missing from browses for
+   * longer than HOST_RESOLVER_TTL_MS are dropped. Only one service type
+   * is browsed; a later call replaces the earlier one.
+   */
+  void browseService(const char *service, const char *proto);
+
+  /**
+   * Copy the known instances into `out` if they changed since
+   * `generation`, which is then updated. Returns false when the caller
+   * is already up to date.
+   */
+  bool fetchServiceInstances(uint32_t &generation, ServiceInstance *out, size_t capacity,
+                             size_t &countOut);
+
+private:
+  static constexpr size_t kMaxEntries = 4;
+  static constexpr size_t kMaxServiceNameLength = 24;
+
+  struct Entry {
+    char          host[kMaxHostLength] = {0};
+    IPAddress     ip;
+    bool          inUse = false;
+    bool          hasAddress = false;
+    bool          failed = false;
+    bool          attempted = false;
+    unsigned long resolvedAt = 0;
+    unsigned long lastAttemptAt = 0;
+    unsigned long lastUsedAt = 0;
+    unsigned long startedAt = 0;
+    unsigned long finishedAt = 0;
+    Status        reportedStatus = Status::Unknown;
+  };
+
+  static void taskEntry(void *param);
+  void runTask();
+  Entry *findEntry(const char *host);
+  Entry *claimEntry(const char *host, unsigned long now);
+  bool needsResolution(const Entry &entry, unsigned long now) const;
+  static bool resolveNow(const char *host, IPAddress &out);
+  static Status statusOf(const Entry &entry);
+  void browseIfDue();
+  bool mergeInstance(const ServiceInstance &instance);
+
+  Entry             _entries[kMaxEntries];
+  SemaphoreHandle_t _mutex = nullptr;
+  TaskHandle_t      _task = nullptr;
+  volatile bool     _networkAvailable = false;
+
+  char            _service[kMaxServiceNameLength] = {0};
+  char            _proto[kMaxServiceNameLength] = {0};
+  ServiceInstance _instances[kMaxServiceInstances];
+  size_t          _instanceCount = 0;
+  uint32_t        _instancesGeneration = 0;
+  unsigned long   _lastBrowseAt = 0;
+  bool            _browsed = false;
+};
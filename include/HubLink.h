@@ -0,0 +1,75 @@
+/*
+ * HubLink.h
+ *
+ * Datagram radio link used by HubRelay in hub mode. A link delivers
+ * short frames between devices identified by their 6-byte MAC address;
+ * it may lose frames but never corrupts or splits them. HubRelay adds
+ * acknowledgements, retransmission and deduplication on top, so an
+ * implementation only has to move bytes.
+ *
+ * EspNowLink is the radio implementation. HubRelay uses nothing else
+ * from the platform, so it can be driven by a simulated link that
+ * drops, delays or duplicates frames on a host build.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+struct HubAddress {
+  static constexpr size_t kLength = 6;
+
+  uint8_t bytes[kLength] = {0};
+
+  static HubAddress broadcast() {
+    HubAddress address;
+    memset(address.bytes, 0xFF, kLength);
+    return address;
+  }
+
+  bool isZero() const {
+    for (uint8_t value : bytes) {
+      if (value != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool isBroadcast() const {
+    for (uint8_t value : bytes) {
+      if (value != 0xFF) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool operator==(const HubAddress &other) const {
+    return memcmp(bytes, other.bytes, kLength) == 0;
+  }
+  bool operator!=(const HubAddress &other) const { return !(*this == other); }
+};
+
+class HubLink {
+public:
+  // Largest frame every implementation must carry (ESP-NOW's limit).
+  static constexpr size_t kMaxFrameLength = 250;
+
+  virtual ~HubLink() = default;
+
+  /**
+   * Hand a frame to the radio. Returns false if it could not even be
+   * queued; true does not mean it arrived.
+   */
+  virtual bool send(const HubAddress &to, const uint8_t *data, size_t length) = 0;
+
+  /**
+   * Take the oldest received frame. `length` is the capacity of `data`
+   * on entry and the frame length on return. Returns false when nothing
+   * is waiting.
+   */
+  virtual bool receive(HubAddress &from, uint8_t *data, size_t &length) = 0;
+};
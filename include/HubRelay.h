@@ -0,0 +1,234 @@
+/*
+ * HubRelay.h
+ *
+ * Tap relay between satellite readers and a gateway in hub mode (see
+ * HUB_ROLE). A satellite sends each tap as a small frame over a HubLink
+ * and the gateway answers with an acknowledgement at once and, once its
+ * BackendClient has finished the request, with the result. Both taps
+ * and results are retransmitted until acknowledged, with a timeout
+ * derived from the peer's measured round-trip time, and both sides
+ * drop frames they have already seen, so a lost acknowledgement never
+ * plays a card twice.
+ *
+ * Every frame carries the sender's boot id and a sequence number.
+ * Receivers keep a 32-frame window per peer and boot, like IPsec's
+ * replay window; duplicates are acknowledged again but not delivered.
+ *
+ * A satellite without HUB_GATEWAY_MAC broadcasts its taps until a
+ * gateway acknowledges one and unicasts to that gateway from then on.
+ *
+ * Wire format, little endian:
+ *
+ *   header  'M' version type bootId:u16 seq:u16
+ *   tap     ageMs:u32 uidLength:u8 uid[uidLength]   (UID as bytes)
+ *   ack     ackedBoot:u16 ackedSeq:u16
+ *   result  tapBoot:u16 tapSeq:u16 status:u8
+ *
+ * Only uses the HubLink interface and takes its timing as constructor
+ * arguments, so it builds off-target and can run against a simulated
+ * link (see test/test_hub_relay). Not thread-safe; call everything from
+ * loop().
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "HubLink.h"
+#include "RttEstimator.h"
+
+class HubRelay {
+public:
+  // Longest UID accepted, in hex characters (10-byte triple-size UID).
+  static constexpr size_t kMaxUidLength = 20;
+  // Satellites tracked at once, and taps waiting for the gateway's loop().
+  static constexpr size_t kMaxPeers = 8;
+  // Frames awaiting acknowledgement or a result.
+  static constexpr size_t kOutboxCapacity = 4;
+
+  enum class Status : uint8_t { Failed = 0, Delivered = 1, Cancelled = 2 };
+
+  /**
+   * A tap received by the gateway. `ageMs` is how long ago the
+   * satellite read the card, as of `receivedAt`.
+   */
+  struct Tap {
+    HubAddress    from;
+    uint16_t      bootId = 0;
+    uint16_t      seq = 0;
+    uint32_t      ageMs = 0;
+    unsigned long receivedAt = 0;
+    char          uid[kMaxUidLength + 1] = {0};
+  };
+
+  /**
+   * Outcome of a tap sent by a satellite. `ackMs` is the time to the
+   * gateway's acknowledgement and `resultMs` the time to the result,
+   * both from the first transmission. `acknowledged` is false when the
+   * gateway never answered at all.
+   */
+  struct Result {
+    uint32_t      requestId = 0;
+    uint32_t      traceId = 0;
+    Status        status = Status::Failed;
+    bool          acknowledged = false;
+    unsigned long ackMs = 0;
+    unsigned long resultMs = 0;
+  };
+
+  struct PeerStats {
+    HubAddress    address;
+    uint32_t      framesReceived = 0;
+    uint32_t      duplicates = 0;
+    uint32_t      framesSent = 0;
+    uint32_t      retransmits = 0;
+    uint32_t      undelivered = 0;
+    unsigned long srttMs = 0;
+    unsigned long rttvarMs = 0;
+    unsigned long lastRttMs = 0;
+    unsigned long lastSeenAt = 0;
+  };
+
+  struct Stats {
+    uint32_t tapsSent = 0;
+    uint32_t tapsRelayed = 0;
+    uint32_t resultsSent = 0;
+    uint32_t resultsTimedOut = 0;
+    uint32_t retransmits = 0;
+    uint32_t duplicates = 0;
+    uint32_t undelivered = 0;
+    uint32_t malformedFrames = 0;
+    uint32_t outboxFull = 0;
+    uint8_t  peers = 0;
+  };
+
+  /**
+   * Frames are sent up to `maxAttempts` times, under a per-peer
+   * timeout kept between the two ack bounds. A satellite gives up on a
+   * tap's result after `resultTimeoutMs`.
+   */
+  HubRelay(HubLink &link, uint8_t maxAttempts, unsigned long minAckTimeoutMs,
+           unsigned long maxAckTimeoutMs, unsigned long resultTimeoutMs)
+      : _link(link),
+        _maxAttempts(maxAttempts),
+        _minAckTimeoutMs(minAckTimeoutMs),
+        _maxAckTimeoutMs(maxAckTimeoutMs),
+        _resultTimeoutMs(resultTimeoutMs) {}
+
+  /**
+   * `bootId` tells this boot's frames apart from the previous one's.
+   * Satellites send to `gateway`, or discover one when it is all zero.
+   */
+  void begin(uint16_t bootId, const HubAddress &gateway);
+
+  /**
+   * Read frames from the link, acknowledge them and retransmit or
+   * expire unacknowledged ones. Call every loop().
+   */
+  void loop(unsigned long now);
+
+  /**
+   * Satellite: send a tap read at `capturedAt`. Returns a request id,
+   * or 0 when the outbox is full or the UID is not valid hex. The
+   * outcome is reported through pollResult().
+   */
+  uint32_t sendTap(const char *uid, uint32_t traceId, unsigned long capturedAt,
+                   unsigned long now);
+  bool pollResult(Result &out);
+
+  /**
+   * Satellite: whether a gateway has answered, so taps are unicast.
+   */
+  bool gatewayKnown() const { return !_gateway.isBroadcast(); }
+
+  /**
+   * Gateway: take the oldest new tap from a satellite.
+   */
+  bool pollTap(Tap &out);
+
+  /**
+   * Gateway: report the backend's outcome for `tap` to its satellite.
+   * Returns false when the outbox is full.
+   */
+  bool sendResult(const Tap &tap, Status status, unsigned long now);
+
+  Stats stats() const;
+
+  /**
+   * Copy up to `capacity` peer entries into `out`; returns the count.
+   */
+  size_t peerStats(PeerStats *out, size_t capacity) const;
+
+private:
+  enum class FrameType : uint8_t { Tap = 1, Ack = 2, Result = 3 };
+
+  struct Peer {
+    bool         used = false;
+    bool         hasWindow = false;
+    uint16_t     bootId = 0;
+    uint16_t     highestSeq = 0;
+    uint32_t     window = 0;
+    RttEstimator rtt{0, 0};  // Bounds set by peerFor().
+    PeerStats    stats;
+  };
+
+  struct Pending {
+    bool          used = false;
+    bool          acked = false;
+    FrameType     type = FrameType::Tap;
+    HubAddress    to;
+    uint16_t      seq = 0;
+    uint8_t       attempts = 0;
+    unsigned long firstSentAt = 0;
+    unsigned long lastSentAt = 0;
+    unsigned long ackedAt = 0;
+    // Tap
+    uint32_t      requestId = 0;
+    uint32_t      traceId = 0;
+    unsigned long capturedAt = 0;
+    uint8_t       uidLength = 0;
+    uint8_t       uid[kMaxUidLength / 2] = {0};
+    // Result
+    uint16_t      tapBoot = 0;
+    uint16_t      tapSeq = 0;
+    Status        status = Status::Failed;
+  };
+
+  void handleFrame(const HubAddress &from, const uint8_t *data, size_t length,
+                   unsigned long now);
+  void handleAck(const HubAddress &from, Peer &peer, uint16_t ackedBoot, uint16_t ackedSeq,
+                 unsigned long now);
+  void handleTap(const HubAddress &from, uint16_t bootId, uint16_t seq, const uint8_t *body,
+                 unsigned long now);
+  void handleResult(uint16_t tapBoot, uint16_t tapSeq, uint8_t status, unsigned long now);
+  bool acceptSequence(Peer &peer, uint16_t bootId, uint16_t seq);
+  void sendAck(const HubAddress &to, uint16_t ackedBoot, uint16_t ackedSeq);
+  void transmit(Pending &entry, unsigned long now);
+  void retransmitOrExpire(unsigned long now);
+  void finishTap(Pending &entry, Status status, unsigned long now);
+  Pending *allocate();
+  Peer *peerFor(const HubAddress &address, unsigned long now);
+  uint16_t nextSeq();
+
+  HubLink      &_link;
+  uint8_t       _maxAttempts;
+  unsigned long _minAckTimeoutMs;
+  unsigned long _maxAckTimeoutMs;
+  unsigned long _resultTimeoutMs;
+  HubAddress    _gateway = HubAddress::broadcast();
+  bool          _gatewayConfigured = false;
+  uint16_t      _bootId = 0;
+  uint16_t      _lastSeq = 0;
+  uint32_t      _nextRequestId = 1;
+
+  Peer    _peers[kMaxPeers];
+  Pending _outbox[kOutboxCapacity];
+  Tap     _taps[kMaxPeers];
+  size_t  _tapHead = 0;
+  size_t  _tapCount = 0;
+  Result  _results[kOutboxCapacity];
+  size_t  _resultHead = 0;
+  size_t  _resultCount = 0;
+  Stats   _stats;
+};
@@ -0,0 +1,113 @@
+/*
+ * ImpairedClient.h
+ *
+ * WiFiClient wrapper that can make a good link behave like a congested
+ * 2.4 GHz one: extra response latency and jitter, stalls that stand in
+ * for lost segments, a bandwidth cap and connections reset mid-stream.
+ * BackendClient and OtaUpdater talk through it, so their timeout, retry
+ * and streaming paths can be exercised on a desk.
+ *
+ * The impairments are applied to the receive side, which is where the
+ * firmware waits: data the socket has already received is held back
+ * until the simulated delay has passed, and is released no faster than
+ * the bandwidth cap. Stalls and resets are rolled for every request
+ * written and for every kSegmentBytes received.
+ *
+ * With NETWORK_IMPAIRMENT_ENABLED false every call goes straight to the
+ * wrapped client. Otherwise the active profile is chosen at runtime
+ * (see the `network_impairment` debug action) and takes effect from
+ * the next connection or request.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <atomic>
+
+#include "Config.h"
+
+struct ImpairmentProfile {
+  const char *name = "none";
+  // Added to the first byte of every response and to connection setup.
+  uint16_t latencyMs = 0;
+  uint16_t jitterMs = 0;
+  // Chance per segment, in thousandths, that the link stalls for stallMs.
+  uint16_t stallPermille = 0;
+  uint16_t stallMs = 0;
+  // Receive rate cap; 0 means unlimited.
+  uint32_t bandwidthBytesPerSecond = 0;
+  // Chance per segment, in thousandths, that the connection is reset.
+  uint16_t resetPermille = 0;
+
+  bool isNone() const {
+    return latencyMs == 0 && jitterMs == 0 && stallPermille == 0 &&
+           bandwidthBytesPerSecond == 0 && resetPermille == 0;
+  }
+};
+
+class ImpairedClient : public Client {
+public:
+  static constexpr size_t kSegmentBytes = 1460;
+
+  struct Stats {
+    uint32_t connections = 0;
+    uint32_t stalls = 0;
+    uint32_t resets = 0;
+    uint32_t bytesReceived = 0;
+  };
+
+  explicit ImpairedClient(WiFiClient &inner) : _inner(inner) {}
+
+  /**
+   * Built-in profiles, starting with "none".
+   */
+  static const ImpairmentProfile *profiles(size_t &count);
+  static const ImpairmentProfile *findProfile(const char *name);
+
+  /**
+   * Profile for connections opened from now on. Thread-safe.
+   */
+  static void setProfile(const ImpairmentProfile &profile);
+  static ImpairmentProfile profile();
+
+  static Stats stats();
+  static void resetStats();
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  int connect(IPAddress ip, uint16_t port, int32_t timeoutMs);
+
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  void flush() override;
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+
+  int setNoDelay(bool noDelay) { return _inner.setNoDelay(noDelay); }
+
+private:
+  // Applies the connection delay; false if it exceeds timeoutMs.
+  bool beginConnection(int32_t timeoutMs);
+  int releasableBytes();
+  void consume(size_t bytes);
+  // Rolls the per-segment stall and reset chances.
+  void impairSegment();
+  unsigned long jitteredLatency() const;
+
+  WiFiClient       &_inner;
+  ImpairmentProfile _profile;
+  bool              _wasReset = false;
+  unsigned long     _readableAt = 0;
+  unsigned long     _stalledUntil = 0;
+  size_t            _segmentBytes = 0;
+  float             _tokens = 0.0f;
+  unsigned long     _tokensUpdatedAt = 0;
+};
@@ -28,11 +28,18 @@ public:
   uint16_t size() const { return _ledCount; }
   uint32_t color(uint8_t red, uint8_t green, uint8_t blue);
 
+  // Number of frames pushed to the strip and the esp_timer time of the
+  // latest one, used to trace when a state change becomes visible.
+  uint32_t frameCount() const { return _frameCount; }
+  int64_t lastFrameAtUs() const { return _lastFrameAtUs; }
+
 private:
   uint8_t _dataPin;
   uint16_t _ledCount;
   neoPixelType _pixelType;
   Adafruit_NeoPixel _strip;
   bool _begun;
+  uint32_t _frameCount = 0;
+  int64_t _lastFrameAtUs = 0;
 };
 
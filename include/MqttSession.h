@@ -0,0 +1,163 @@
+/*
+ * MqttSession.h
+ *
+ * Persistent MQTT session used when taps are sent with
+ * TapTransport::Mqtt. A tap is published at QoS 1 to
+ * `{MQTT_TOPIC_PREFIX}/{device}/taps` and kept in a small in-memory
+ * outbox until the broker acknowledges it, so the worker does not wait
+ * a round trip per tap. The session is not clean: after a reconnect the
+ * broker keeps the device's subscription, and unacknowledged taps are
+ * sent again with the DUP flag. Each tap carries the same idempotency
+ * key as the HTTP request, so backends can drop redeliveries.
+ *
+ * The backend talks back on `{prefix}/{device}/inbox`:
+ *
+ *   {"type":"ack","key":"...","ok":true}   result for one tap (logged)
+ *   {"type":"sync_catalog"}                fetch catalog changes now
+ *
+ * `{prefix}/{device}/status` holds a retained "online", replaced by
+ * the broker with "offline" when the device disappears.
+ *
+ * Owned by the backend worker task; not thread-safe.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include "Config.h"
+#include "HostResolver.h"
+#include "ImpairedClient.h"
+#include "RttEstimator.h"
+#include "TinyMqtt.h"
+
+class MqttSession {
+public:
+  static constexpr size_t kMaxUidLength = 20;
+  static constexpr size_t kMaxKeyLength = 31;
+  static constexpr size_t kMaxTopicLength = 64;
+
+  struct Tap {
+    uint32_t      requestId = 0;
+    uint32_t      traceId = 0;
+    uint32_t      tapId = 0;
+    unsigned long capturedAt = 0;
+    // Wall-clock capture time when already known (journal replays);
+    // otherwise derived from `capturedAt`.
+    int64_t       capturedWallUs = 0;
+    char          uid[kMaxUidLength + 1] = {0};
+    char          key[kMaxKeyLength + 1] = {0};
+  };
+
+  struct Outcome {
+    Tap           tap;
+    bool          delivered = false;
+    unsigned long ackMs = 0;
+  };
+
+  struct Stats {
+    uint32_t      connects = 0;
+    uint32_t      published = 0;
+    uint32_t      acknowledged = 0;
+    uint32_t      redelivered = 0;
+    uint32_t      expired = 0;
+    uint32_t      inboxMessages = 0;
+    uint32_t      backendRejections = 0;
+    unsigned long srttMs = 0;
+    bool          connected = false;
+  };
+
+  explicit MqttSession(HostResolver &resolver) : _resolver(resolver) {}
+
+  /**
+   * Build the client id and topics from the device id.
+   */
+  void begin(uint64_t deviceId);
+
+  /**
+   * Connect or reconnect, read acknowledgements and inbox messages,
+   * keep the session alive and expire taps the broker never
+   * acknowledged. Call often while taps are pending.
+   */
+  void service(unsigned long now, bool networkAvailable);
+
+  /**
+   * Publish a tap. Returns false when there is no session or the outbox
+   * is full; the caller then journals the tap. The outcome is reported
+   * through popOutcome().
+   */
+  bool publishTap(const Tap &tap);
+
+  /**
+   * Publish a tap and wait for its outcome. Only used with an empty
+   * outbox, for journal replays.
+   */
+  bool publishTapAndWait(const Tap &tap);
+
+  /**
+   * Announce a card at QoS 0, the MQTT form of the prepare hint.
+   */
+  bool publishPrepare(const char *uid);
+
+  /**
+   * Report at QoS 0 that a card has left the reader after `presentMs`.
+   */
+  bool publishRemoved(const char *uid, uint32_t presentMs);
+
+  bool popOutcome(Outcome &out);
+  bool hasPending() const { return _pending > 0; }
+  bool isConnected() const { return _connected; }
+
+  /**
+   * True once after the backend asked for a catalog sync.
+   */
+  bool takeCatalogSyncRequest();
+
+  Stats stats() const;
+
+private:
+  struct Entry {
+    bool          used = false;
+    uint16_t      packetId = 0;
+    unsigned long sentAt = 0;
+    Tap           tap;
+  };
+
+  bool connect(unsigned long now);
+  bool waitForConnack(bool &sessionPresent);
+  void close();
+  void readPackets(unsigned long now);
+  void handleInbox(const TinyMqttClient::Message &message);
+  void acknowledge(uint16_t packetId, unsigned long now);
+  void expireEntries(unsigned long now);
+  bool sendTap(const Entry &entry, bool dup);
+  void finish(Entry &entry, bool delivered, unsigned long now);
+  uint16_t nextPacketId();
+
+  HostResolver  &_resolver;
+  WiFiClient     _socket;
+  ImpairedClient _net{_socket};
+  TinyMqttClient _mqtt{_net};
+
+  char _clientId[24] = {0};
+  char _tapTopic[kMaxTopicLength] = {0};
+  char _prepareTopic[kMaxTopicLength] = {0};
+  char _removedTopic[kMaxTopicLength] = {0};
+  char _statusTopic[kMaxTopicLength] = {0};
+  char _inboxTopic[kMaxTopicLength] = {0};
+
+  Entry    _outbox[MQTT_OUTBOX_CAPACITY];
+  size_t   _pending = 0;
+  Outcome  _outcomes[MQTT_OUTBOX_CAPACITY];
+  size_t   _outcomeHead = 0;
+  size_t   _outcomeCount = 0;
+  uint16_t _lastPacketId = 0;
+
+  bool          _connected = false;
+  unsigned long _lastConnectAttemptAt = 0;
+  unsigned long _lastReceivedAt = 0;
+  bool          _catalogSyncRequested = false;
+  RttEstimator  _ackRtt{BACKEND_MIN_TIMEOUT_MS, MQTT_PUBLISH_TIMEOUT_MS};
+  Stats         _stats;
+};
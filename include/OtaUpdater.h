@@ -10,23 +10,41 @@
 
 #include <Arduino.h>
 
+#include "CheckSchedule.h"
+#include "HostResolver.h"
+
+class HttpBodySink;
+
 class OtaUpdater {
 public:
-  OtaUpdater();
+  struct DownloadMeasurement {
+    int           statusCode = 0;
+    size_t        bytes = 0;
+    unsigned long elapsedMs = 0;
+  };
+
+  explicit OtaUpdater(HostResolver &resolver);
 
   void loop(unsigned long now, bool wifiConnected);
 
+  /**
+   * Fetch the manifest and download the image it points to without
+   * installing it, to measure download throughput. Blocks until done.
+   */
+  bool measureDownload(DownloadMeasurement &out);
+
 private:
-  bool shouldCheck(unsigned long now) const;
-  void scheduleAfterAttempt(unsigned long now);
   void checkForUpdates();
   bool fetchManifest(String &versionOut, String &firmwareUrlOut,
-                     String &resolvedHostOut);
-  bool downloadAndInstall(const String &url, const String &manifestHost,
+                     IPAddress &resolvedHostOut);
+  // Streams the image at `url` into `sink`. Returns the HTTP status or
+  // a TinyHttp error, or 0 if no request could be made.
+  int fetchFirmware(const String &url, const IPAddress &manifestHost, HttpBodySink &sink);
+  bool downloadAndInstall(const String &url, const IPAddress &manifestHost,
                           const String &newVersion);
   static int compareVersions(const String &lhs, const String &rhs);
 
-  unsigned long _lastCheckAt;
-  bool _checkedSinceBoot;
+  HostResolver &_resolver;
+  CheckSchedule _checks;
 };
 
@@ -0,0 +1,83 @@
+/*
+ * PayloadCodec.h
+ *
+ * Encodes the payloads exchanged with the backend as JSON or CBOR,
+ * selected per request through Content-Type and Accept. Both formats
+ * map onto the same fixed structs: JSON goes through ArduinoJson, CBOR
+ * through TinyCbor without a document tree or heap allocation.
+ *
+ * Tap body (CBOR keys are the same as the JSON ones):
+ *
+ *   {"uid": "04A224D9123480", "age_ms": 12, "trace": 17,
+ *    "captured_us": 1767225600123456}
+ *
+ * In CBOR the UID is a byte string rather than hex text. `captured_us`
+ * is the wall-clock read time from EventClock, 0 before the first
+ * sync. Play requests only carry this body in CBOR; JSON play requests
+ * keep the empty `{}` body existing backends expect, and the JSON
+ * encoding is the reference for the `payload_codec` benchmark.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "Config.h"
+
+struct TapEvent {
+  // 10-byte triple-size UID.
+  static constexpr size_t kMaxUidBytes = 10;
+
+  uint8_t  uid[kMaxUidBytes] = {0};
+  uint8_t  uidLength = 0;
+  // Time since the card was read; grows while a tap waits in the journal.
+  uint32_t ageMs = 0;
+  uint32_t traceId = 0;
+  // µs since the Unix epoch, or 0 when the clock has not synced.
+  uint64_t capturedAtUs = 0;
+
+  /**
+   * Take the UID from its hex form. Returns false for odd, over-long or
+   * non-hex input.
+   */
+  bool setUid(const char *hex);
+};
+
+struct OtaManifest {
+  char version[24] = {0};
+  char firmwareUrl[160] = {0};
+};
+
+class PayloadCodec {
+public:
+  static constexpr const char *kJsonContentType = "application/json";
+  static constexpr const char *kCborContentType = "application/cbor";
+  // Large enough for a tap in either format.
+  static constexpr size_t kMaxTapLength = 112;
+
+  /**
+   * Format named by a Content-Type header value. Anything that is not
+   * CBOR is treated as JSON.
+   */
+  static PayloadFormat formatOf(const char *contentType);
+  static const char *contentType(PayloadFormat format);
+
+  /**
+   * Accept header value preferring `format`, with JSON as the fallback.
+   */
+  static const char *accept(PayloadFormat format);
+
+  /**
+   * Encode a tap into `out`. Returns the encoded length, or 0 if it does
+   * not fit.
+   */
+  static size_t encodeTap(PayloadFormat format, const TapEvent &tap, uint8_t *out,
+                          size_t capacity);
+
+  /**
+   * Decode an OTA manifest. Unknown fields are ignored; false if
+   * `version` or `firmware_url` is missing or does not fit.
+   */
+  static bool decodeManifest(PayloadFormat format, const uint8_t *data, size_t length,
+                             OtaManifest &out);
+};
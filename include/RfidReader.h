@@ -5,39 +5,252 @@
  * initialisation and reading the UID of presented tags. After reading
  * a card the reader is halted to allow further detection. See
  * RfidReader.cpp for implementation details.
+ *
+ * The reader runs on its own FreeRTOS task at RFID_TASK_PRIORITY, so
+ * detection latency does not depend on what loop() is busy with. The
+ * poll interval follows the selected RfidPollProfile: fast while and
+ * just after a card is read, slowing down while the field stays quiet,
+ * with the reader asleep between idle polls where the profile asks.
+ * Each card read becomes a timestamped RfidCardRead in a lock-free
+ * queue drained by loop(). A backend with an interrupt line
+ * (PN532_IRQ_DETECTION) wakes the task as soon as a card is found
+ * instead of waiting for the next poll.
+ *
+ * Backends never wait on the reader inside readCard(): each call starts
+ * or checks one step of the exchange with the card and returns. The
+ * time each step takes is recorded per RfidStep so readers can be
+ * compared.
  */
 
 #pragma once
 
 #include <Arduino.h>
+#include <atomic>
 #include <memory>
 
+#include "Config.h"
+#include "SpscQueue.h"
+#include "TapTracer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * Early stages of a card read, reported while the backend is still
+ * reading. FieldDetected fires when a card enters the field, before its
+ * UID is known; UidRead fires as soon as the UID is decoded, ahead of the
+ * reader housekeeping and logging that follow.
+ */
+enum class RfidCardEvent { FieldDetected, UidRead };
+using RfidCardEventListener = void (*)(RfidCardEvent event, const char *uidHex,
+                                       void *context);
+
+/**
+ * Presence changes reported by the RFID task. A card that stays in the
+ * field is kept alive quietly and reported once when it arrives and
+ * once when it is removed.
+ */
+enum class RfidPresence : uint8_t { Arrived, Removed };
+
+/**
+ * A presence change from the RFID task. Times are esp_timer
+ * microseconds; `fieldDetectedAtUs` is 0 when the backend could not
+ * tell when the card entered the field. For a removal, `uidReadAtUs` is
+ * when the card last answered and `presentMs` how long it had been on
+ * the reader by then.
+ */
+struct RfidCardRead {
+  static constexpr size_t kMaxUidLength = 20;
+
+  RfidPresence  presence = RfidPresence::Arrived;
+  char          uid[kMaxUidLength + 1] = {0};
+  unsigned long readAt = 0;  // millis() of the UID read or the removal
+  int64_t       fieldDetectedAtUs = 0;
+  int64_t       uidReadAtUs = 0;
+  uint32_t      presentMs = 0;
+};
+
+/**
+ * Timed steps of a card read. Poll and Removal are measured by
+ * RfidReader for every backend; the PN532 records its detection command
+ * as Request and the UID transfer as Select, and has no Anticollision or
+ * Halt step.
+ */
+enum class RfidStep : uint8_t {
+  Poll,           // one readCard() call, i.e. how long the task is busy
+  Request,        // RC522 REQA to ATQA
+  Anticollision,  // RC522 anticollision frame, per cascade level
+  Select,         // RC522 SELECT to SAK
+  Halt,           // RC522 HLTA
+  FieldToUid,     // card noticed to UID decoded
+  KeepAlive,      // re-selecting a card that is still present
+  Removal,        // a card's last answer to its removal being reported
+  Count
+};
+
+const char *rfidStepName(RfidStep step);
+
 class IRfidBackend {
 public:
+  static constexpr size_t kStepCount = static_cast<size_t>(RfidStep::Count);
+
   virtual ~IRfidBackend() = default;
   virtual bool begin() = 0;
   virtual bool readCard(String &uidHex) = 0;
   virtual bool isReady() const = 0;
   virtual bool hasFailed() const = 0;
+
+  /**
+   * True while a read is under way, for example while waiting for a
+   * card's answer, so the task keeps polling at the active rate.
+   */
+  virtual bool isBusy() const { return false; }
+
+  /**
+   * True while a frame to the card is in flight and will be answered
+   * or time out within a few milliseconds, so the task looks again on
+   * the next tick instead of after a poll interval.
+   */
+  virtual bool hasFrameInFlight() const { return false; }
+
+  /**
+   * Sleep between polls where the chip allows it, trading detection
+   * latency for current. Takes effect on the next readCard().
+   */
+  virtual void setLowPower(bool enabled) { (void)enabled; }
+
+  void setEventListener(RfidCardEventListener listener, void *context) {
+    _listener = listener;
+    _listenerContext = context;
+  }
+
+  /**
+   * Task to notify from an interrupt when a card is waiting, so it need
+   * not wait for its next poll.
+   */
+  void setWakeTask(TaskHandle_t task) { _wakeTask = task; }
+
+  /**
+   * Called from the RFID task; the histograms may be read from any task.
+   */
+  void recordStep(RfidStep step, uint32_t durationUs);
+  LatencyHistogram stepTiming(RfidStep step) const;
+  void resetStepTimings();
+
+protected:
+  void notify(RfidCardEvent event, const char *uidHex = nullptr) const {
+    if (_listener != nullptr) {
+      _listener(event, uidHex, _listenerContext);
+    }
+  }
+
+  TaskHandle_t wakeTask() const { return _wakeTask; }
+
+private:
+  RfidCardEventListener _listener = nullptr;
+  void                 *_listenerContext = nullptr;
+  TaskHandle_t          _wakeTask = nullptr;
+  mutable portMUX_TYPE  _stepLock = portMUX_INITIALIZER_UNLOCKED;
+  LatencyHistogram      _steps[kStepCount];
 };
 
 class RfidReader {
 public:
   /**
-   * Initialise the configured RFID/NFC backend. Pin assignments and
-   * hardware type are defined in Config.h.
+   * `maxPollGapUs` is the longest time between two polls since the
+   * last reset, which bounds how late a card can be noticed.
+   */
+  struct Stats {
+    uint32_t polls = 0;
+    uint32_t cards = 0;      // arrivals
+    uint32_t keepAlives = 0;
+    uint32_t removals = 0;
+    // Reads lost because loop() did not drain the queue in time.
+    uint32_t dropped = 0;
+    uint32_t maxPollGapUs = 0;
+    uint32_t intervalMs = 0;  // current poll interval
+    bool     lowPower = false;
+  };
+
+  /**
+   * Start the RFID task, which initialises the configured backend and
+   * then polls it. Pin assignments and hardware type are defined in
+   * Config.h. Safe to call more than once.
    */
   void begin();
 
   /**
-   * Attempt to read a card UID. Returns true if a new card is
-   * present and the UID has been populated into `uidHex`. The UID
-   * string will be uppercase hexadecimal without separators.
+   * Take the oldest arrival or removal. The UID is uppercase
+   * hexadecimal without separators. Returns false when nothing has
+   * changed. Call from one task only.
+   */
+  bool pollCard(RfidCardRead &out);
+
+  /**
+   * Register a callback for {@link RfidCardEvent}s. Call before begin().
+   * It runs on the RFID task, so it must be thread-safe and return
+   * quickly.
    */
-  bool readCard(String &uidHex);
+  void setEventListener(RfidCardEventListener listener, void *context = nullptr);
+
+  Stats stats() const;
+
+  /**
+   * Switch the RfidPollProfile; the task picks it up on its next poll.
+   */
+  void setPowerProfile(RfidPowerProfile profile);
+  RfidPowerProfile powerProfile() const;
+
+  /**
+   * Timing of one read step, empty until the backend is ready.
+   */
+  LatencyHistogram stepTiming(RfidStep step) const;
+
+  /**
+   * Clears the counters and the step timings.
+   */
+  void resetStats();
 
 private:
+  static void taskEntry(void *param);
+  static void handleBackendEvent(RfidCardEvent event, const char *uidHex, void *context);
+  void runTask();
+  void beginBackend();
+  // Returns true when a card arrived, left or entered the field.
+  bool poll();
+  void trackPresence(const String &uidHex, int64_t now);
+  void reportRemoval(int64_t now);
+  void publish(const RfidCardRead &read);
+  // Milliseconds until the next poll; 0 means the next tick.
+  unsigned long nextInterval(bool activity);
+
   std::unique_ptr<IRfidBackend> _backend;
-  bool                         _backendReady = false;
+  RfidCardEventListener        _listener = nullptr;
+  void                        *_listenerContext = nullptr;
+  std::atomic<bool>            _backendReady{false};
   bool                         _backendFailed = false;
+
+  // Owned by the RFID task.
+  TaskHandle_t _task = nullptr;
+  int64_t      _fieldDetectedAtUs = 0;
+  int64_t      _uidReadAtUs = 0;
+  int64_t      _lastPollAtUs = 0;
+  int64_t      _lastActivityAtUs = 0;
+  bool         _activitySeen = false;
+  // The card currently on the reader, if any.
+  bool         _present = false;
+  char         _presentUid[RfidCardRead::kMaxUidLength + 1] = {0};
+  int64_t      _presentSinceUs = 0;
+  int64_t      _lastSeenAtUs = 0;
+
+  // The RFID task produces, loop() consumes.
+  SpscQueue<RfidCardRead, RFID_QUEUE_DEPTH> _reads;
+  std::atomic<uint32_t> _polls{0};
+  std::atomic<uint32_t> _cards{0};
+  std::atomic<uint32_t> _keepAlives{0};
+  std::atomic<uint32_t> _removals{0};
+  std::atomic<uint32_t> _dropped{0};
+  std::atomic<uint32_t> _maxPollGapUs{0};
+  std::atomic<uint32_t> _intervalMs{0};
+  std::atomic<bool>     _lowPowerActive{false};
+  std::atomic<RfidPowerProfile> _profile{RFID_POWER_PROFILE};
 };
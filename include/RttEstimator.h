@@ -0,0 +1,48 @@
+/*
+ * RttEstimator.h
+ *
+ * Smoothed round-trip time estimator (Jacobson/Karels, as used by TCP)
+ * that turns observed request durations into an adaptive timeout:
+ * srtt + 4 * rttvar, clamped to a configured range. After a timeout the
+ * value is doubled until the next successful sample arrives.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+class RttEstimator {
+public:
+  RttEstimator(unsigned long minTimeoutMs, unsigned long maxTimeoutMs)
+      : _minTimeoutMs(minTimeoutMs), _maxTimeoutMs(maxTimeoutMs) {}
+
+  /**
+   * Record the duration of a request that completed normally.
+   */
+  void addSample(unsigned long rttMs);
+
+  /**
+   * A request timed out; back the timeout off exponentially.
+   */
+  void backOff();
+
+  /**
+   * Timeout to use for the next request. The maximum is used until the
+   * first sample has been recorded.
+   */
+  unsigned long timeoutMs() const;
+
+  bool          hasSamples() const { return _hasSamples; }
+  unsigned long srttMs() const { return static_cast<unsigned long>(_srttMs); }
+  unsigned long rttvarMs() const { return static_cast<unsigned long>(_rttvarMs); }
+
+private:
+  static constexpr uint8_t kMaxBackoffShift = 4;
+
+  unsigned long _minTimeoutMs;
+  unsigned long _maxTimeoutMs;
+  float         _srttMs = 0;
+  float         _rttvarMs = 0;
+  bool          _hasSamples = false;
+  uint8_t       _backoffShift = 0;
+};
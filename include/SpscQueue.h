@@ -0,0 +1,65 @@
+/*
+ * SpscQueue.h
+ *
+ * Fixed-capacity, lock-free single-producer/single-consumer ring
+ * buffer. One task may call push() and one (possibly different) task
+ * may call pop() without further synchronisation. Storage is allocated
+ * inline, so queues never touch the heap.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+public:
+  /**
+   * Append an item. Returns false if the queue is full. Producer only.
+   */
+  bool push(const T &item) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_acquire);
+    if (tail - head >= Capacity) {
+      return false;
+    }
+    _items[tail & (Capacity - 1)] = item;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Remove the oldest item into `out`. Returns false if the queue is
+   * empty. Consumer only.
+   */
+  bool pop(T &out) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    if (head == tail) {
+      return false;
+    }
+    out = _items[head & (Capacity - 1)];
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+  }
+
+  size_t size() const {
+    return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  std::array<T, Capacity> _items{};
+  std::atomic<size_t>     _head{0};
+  std::atomic<size_t>     _tail{0};
+};
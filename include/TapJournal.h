@@ -0,0 +1,105 @@
+/*
+ * TapJournal.h
+ *
+ * Crash-safe ring buffer of card taps that could not be delivered to
+ * the backend. The journal lives in RAM and is mirrored to a single NVS
+ * blob, which NVS replaces atomically, so a reset mid-write leaves the
+ * previous copy intact. Writes are coalesced and rate limited to bound
+ * flash wear.
+ *
+ * millis() restarts at every boot, so each entry also carries its
+ * EventClock wall-clock capture time. Entries that survive a reset are
+ * aged by that stamp once the clock has synced again.
+ *
+ * The journal is not thread-safe; it is owned by the backend worker
+ * task so that flash writes never happen on the LED/RFID path.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+
+#include "Config.h"
+
+class TapJournal {
+public:
+  static constexpr size_t kMaxUidLength = 20;
+
+  // `bootId` and `tapId` identify the tap itself (they form its
+  // idempotency key), so a replay is recognisable as the same tap.
+  // `capturedWallUs` is 0 until the event clock has synced.
+  struct Entry {
+    uint32_t seq = 0;
+    uint32_t capturedAtMs = 0;
+    int64_t  capturedWallUs = 0;
+    uint32_t tapId = 0;
+    uint16_t bootId = 0;
+    char     uid[kMaxUidLength + 1] = {0};
+  };
+
+  /**
+   * Load the journal from NVS and advance the boot counter. Entries from
+   * earlier boots are kept; their age is checked when they are replayed.
+   */
+  void begin();
+
+  /**
+   * Record an undelivered tap. When the journal is full the oldest
+   * entry is overwritten.
+   */
+  void append(const char *uid, unsigned long capturedAtMs, uint32_t tapId);
+
+  /**
+   * Oldest entry still waiting for delivery.
+   */
+  bool peekOldest(Entry &out) const;
+  void dropOldest();
+
+  /**
+   * Discard every entry captured before a tap that has just been
+   * delivered; replaying them would undo the newer tap.
+   */
+  void dropCapturedBefore(unsigned long capturedAtMs);
+
+  enum class Freshness : uint8_t { Fresh, Expired, Unknown };
+
+  /**
+   * Whether `entry` is recent enough to be replayed; for a fresh entry
+   * its age goes to `ageMsOut`. An entry from an earlier boot is aged by
+   * its wall-clock stamp, so its freshness is Unknown until the clock
+   * has synced, and it counts as expired if it was journaled before the
+   * clock ever synced.
+   */
+  Freshness freshness(const Entry &entry, unsigned long now, uint32_t &ageMsOut) const;
+
+  /**
+   * Persist pending changes, at most once per
+   * TAP_JOURNAL_MIN_FLUSH_INTERVAL_MS unless `force` is set.
+   */
+  void flush(unsigned long now, bool force = false);
+
+  uint16_t bootId() const { return _bootId; }
+  size_t   size() const { return _count; }
+  bool     empty() const { return _count == 0; }
+
+private:
+  struct StoredJournal {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t nextSeq;
+    Entry    entries[TAP_JOURNAL_CAPACITY];
+  };
+
+  const Entry &at(size_t index) const;
+
+  std::array<Entry, TAP_JOURNAL_CAPACITY> _entries{};
+  size_t        _head = 0;
+  size_t        _count = 0;
+  uint32_t      _nextSeq = 1;
+  uint16_t      _bootId = 0;
+  bool          _dirty = false;
+  bool          _loaded = false;
+  unsigned long _lastFlushAt = 0;
+};
@@ -0,0 +1,128 @@
+/*
+ * TapTracer.h
+ *
+ * End-to-end latency tracing for card taps. Each tap gets a trace id
+ * that travels with it from the RFID reader through the backend worker
+ * to the LED. Stages are stamped with esp_timer microsecond timestamps
+ * and, when the trace finishes, the time spent reaching each stage is
+ * folded into fixed-bucket histograms that can be queried for
+ * percentiles at runtime or dumped over serial.
+ *
+ * Stamps may come from the loop and the backend worker task; a short
+ * critical section keeps them consistent. Nothing here allocates.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Log-linear histogram of microsecond durations: four buckets per power
+ * of two, so reported percentiles are within 25% of the true value.
+ */
+class LatencyHistogram {
+public:
+  static constexpr size_t kBucketCount = 104;  // up to ~2 min
+
+  void record(uint32_t valueUs);
+  void reset();
+
+  /**
+   * Upper bound of the bucket holding the given percentile (0–100), or
+   * 0 when nothing has been recorded.
+   */
+  uint32_t percentile(float percent) const;
+
+  uint32_t count() const { return _count; }
+  uint32_t maxUs() const { return _maxUs; }
+  uint32_t meanUs() const { return _count > 0 ? static_cast<uint32_t>(_sumUs / _count) : 0; }
+
+private:
+  static size_t bucketFor(uint32_t valueUs);
+  static uint32_t bucketUpperBound(size_t bucket);
+
+  uint32_t _buckets[kBucketCount] = {0};
+  uint32_t _count = 0;
+  uint32_t _maxUs = 0;
+  uint64_t _sumUs = 0;
+};
+
+class TapTracer {
+public:
+  enum class Stage : uint8_t {
+    FieldDetected,  // card entered the reader field
+    UidRead,        // UID decoded by the RFID backend
+    CardProcessed,  // accepted by processCardUid()
+    Resolved,       // backend address looked up (new connections only)
+    Connected,      // TCP connection established (new connections only)
+    Secured,        // TLS handshake done (new TLS connections only)
+    RequestSent,    // request written to the socket
+    FirstByte,      // first response byte available
+    Completed,      // result handled on the loop task
+    FirstFrame,     // first LED frame of the resulting visual state
+    Count
+  };
+
+  static constexpr size_t kStageCount = static_cast<size_t>(Stage::Count);
+
+  /**
+   * Open a new trace and return its id (never 0). The oldest open trace
+   * is dropped if too many are open.
+   */
+  uint32_t begin();
+
+  /**
+   * Stamp `stage` of a trace. Unknown or zero ids are ignored, so
+   * untraced requests can share the same code paths.
+   */
+  void mark(uint32_t traceId, Stage stage);
+  void markAt(uint32_t traceId, Stage stage, int64_t timestampUs);
+
+  /**
+   * Close a trace, record its stage durations and log a one-line
+   * summary.
+   */
+  void finish(uint32_t traceId);
+
+  /**
+   * Close a trace without recording it (duplicate read, superseded
+   * request, card removed early).
+   */
+  void abandon(uint32_t traceId);
+
+  void reset();
+
+  /**
+   * Print p50/p95/p99 for every stage and for the whole tap.
+   */
+  void dump(Print &out) const;
+
+  /**
+   * Histogram of the time from the previous stamped stage to `stage`,
+   * or of the whole tap for Stage::Count.
+   */
+  const LatencyHistogram &histogram(Stage stage) const;
+
+  uint32_t finishedTraces() const { return _finished; }
+
+  static const char *stageName(Stage stage);
+
+private:
+  static constexpr size_t kMaxOpenTraces = 4;
+
+  struct Trace {
+    uint32_t id = 0;
+    int64_t  stampUs[kStageCount] = {0};
+  };
+
+  Trace *find(uint32_t traceId);
+
+  mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+  Trace                _open[kMaxOpenTraces];
+  uint32_t             _nextId = 1;
+  uint32_t             _finished = 0;
+  LatencyHistogram     _stages[kStageCount];
+  LatencyHistogram     _total;
+};
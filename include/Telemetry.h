@@ -0,0 +1,115 @@
+/*
+ * Telemetry.h
+ *
+ * In-memory fleet telemetry. Counters (taps, backend retries and
+ * failures, Wi-Fi drops, RFID errors), two latency histograms and
+ * sampled Wi-Fi RSSI and free heap are aggregated into windows of
+ * TELEMETRY_INTERVAL_MS. Closed windows wait in a small ring until the
+ * backend worker uploads them as one batch (see
+ * BackendClient::uploadTelemetry), so a device costs the backend about
+ * one request every few minutes however busy it is. While the backend
+ * is unreachable the ring keeps the newest TELEMETRY_MAX_WINDOWS
+ * windows and drops the oldest.
+ *
+ * Windows are numbered per boot; a batch lists its windows in order and
+ * the backend can use the numbers to drop a batch it has already seen
+ * when an acknowledgement was lost.
+ *
+ * Thread-safe: counters and histograms are updated from the loop and
+ * the backend worker under a short critical section. Nothing here
+ * allocates. All members are static, as there is one device to report.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class Telemetry {
+public:
+  enum class Counter : uint8_t {
+    Taps,                 // cards accepted by processCardUid()
+    TapsDelivered,        // play requests the backend accepted
+    TapsRejected,         // play requests the backend refused (4xx)
+    TapsFailed,           // play requests that ended in the journal
+    TapsJournaled,        // journal appends, including offline taps
+    BackendRetries,
+    BackendTimeouts,
+    BreakerFastFailures,  // taps refused while the breaker was open
+    WifiDisconnects,
+    RfidReadErrors,
+    RfidInitFailures,
+    Count
+  };
+
+  enum class Histogram : uint8_t {
+    TapToResult,  // card read to backend answer
+    Request,      // request sent to response read
+    Count
+  };
+
+  static constexpr size_t kCounterCount = static_cast<size_t>(Counter::Count);
+  static constexpr size_t kHistogramCount = static_cast<size_t>(Histogram::Count);
+  // Seven bounded buckets and one for everything slower.
+  static constexpr size_t kBucketCount = 8;
+  // Longest batch body; windows that do not fit wait for the next one.
+  static constexpr size_t kMaxBatchLength = 1536;
+
+  struct Stats {
+    uint32_t      windowsClosed = 0;
+    uint32_t      windowsDropped = 0;
+    uint32_t      uploads = 0;
+    uint32_t      uploadFailures = 0;
+    uint8_t       pendingWindows = 0;
+    unsigned long lastUploadAt = 0;
+  };
+
+  static void count(Counter counter, uint32_t amount = 1);
+  static void observe(Histogram histogram, unsigned long durationMs);
+
+  /**
+   * Sample RSSI (while `wifiConnected`) and free heap every
+   * TELEMETRY_SAMPLE_INTERVAL_MS and close the window once it is
+   * TELEMETRY_INTERVAL_MS old. Call from loop().
+   */
+  static void loop(unsigned long now, bool wifiConnected);
+
+  /**
+   * Close the current window early and ask the worker to upload at once.
+   */
+  static void flush(unsigned long now);
+
+  /**
+   * Returns true once after flush(); the worker then skips the jitter.
+   */
+  static bool takeUploadRequest();
+
+  static size_t pendingWindows();
+
+  /**
+   * Render the oldest pending windows as one JSON batch into `out`.
+   * Returns the body length, or 0 when nothing is pending.
+   * `lastSeqOut` is the number of the newest window included, for
+   * acknowledge().
+   */
+  static size_t renderBatch(const char *deviceId, uint16_t bootId, char *out, size_t capacity,
+                            uint32_t &lastSeqOut);
+
+  /**
+   * The backend has stored every window up to `lastSeq`.
+   */
+  static void acknowledge(uint32_t lastSeq, unsigned long now);
+  static void recordUploadFailure();
+
+  static Stats stats();
+
+  /**
+   * Counter values of the window that is still open.
+   */
+  static uint32_t currentCount(Counter counter);
+
+  static const char *counterName(Counter counter);
+  static const char *histogramName(Histogram histogram);
+
+private:
+  static void closeWindow(unsigned long now);
+};
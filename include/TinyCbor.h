@@ -0,0 +1,86 @@
+/*
+ * TinyCbor.h
+ *
+ * Minimal allocation-free CBOR (RFC 8949) writer and reader. The
+ * writer appends items to a caller-supplied buffer; the reader walks a
+ * received buffer item by item, so a payload can be decoded straight
+ * into a fixed struct without building a document tree. Text and byte
+ * strings are returned as pointers into the input.
+ *
+ * Only definite-length items are supported, which is what every
+ * mainstream encoder produces for maps and arrays of known size.
+ * Floats and tags are skipped rather than decoded.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class CborWriter {
+public:
+  CborWriter(uint8_t *buffer, size_t capacity) : _buffer(buffer), _capacity(capacity) {}
+
+  bool beginMap(size_t entries);
+  bool beginArray(size_t items);
+  bool putUint(uint64_t value);
+  bool putBool(bool value);
+  bool putText(const char *text);
+  bool putText(const char *text, size_t length);
+  bool putBytes(const uint8_t *data, size_t length);
+
+  /**
+   * False once anything did not fit; the buffer content is then
+   * incomplete.
+   */
+  bool ok() const { return !_overflow; }
+  size_t length() const { return _length; }
+
+private:
+  bool putHeader(uint8_t major, uint64_t value);
+  bool putRaw(const void *data, size_t length);
+
+  uint8_t *_buffer;
+  size_t   _capacity;
+  size_t   _length = 0;
+  bool     _overflow = false;
+};
+
+class CborReader {
+public:
+  enum class Type : uint8_t { Uint, NegativeInt, Bytes, Text, Array, Map, Tag, Simple, Invalid };
+
+  CborReader(const uint8_t *data, size_t length) : _data(data), _length(length) {}
+
+  /**
+   * Type of the next item without consuming it; Invalid at the end of
+   * the input.
+   */
+  Type peekType() const;
+
+  // Each read consumes one item and fails, without consuming it, if
+  // the next item has a different type.
+  bool readUint(uint64_t &out);
+  bool readBool(bool &out);
+  bool readText(const char *&text, size_t &length);
+  bool readBytes(const uint8_t *&data, size_t &length);
+  bool readMap(size_t &entries);
+  bool readArray(size_t &items);
+
+  /**
+   * Consume the next item, including everything nested in it.
+   */
+  bool skip();
+
+  bool atEnd() const { return _offset >= _length; }
+
+private:
+  // Decodes the header at `offset`. Returns the header size, or 0 if it
+  // is truncated or uses an indefinite length.
+  size_t decodeHeader(size_t offset, uint8_t &major, uint64_t &value) const;
+  bool readString(uint8_t major, const uint8_t *&data, size_t &length);
+  bool readContainer(uint8_t major, size_t &count);
+
+  const uint8_t *_data;
+  size_t         _length;
+  size_t         _offset = 0;
+};
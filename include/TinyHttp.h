@@ -0,0 +1,187 @@
+/*
+ * TinyHttp.h
+ *
+ * Small allocation-free HTTP/1.1 client used by the backend and OTA
+ * code. Requests are rendered from a precompiled template into a fixed
+ * buffer, and responses are parsed in place: the status line and the
+ * few headers we care about are decoded without building Strings, and
+ * body bytes (plain, length-delimited or chunked) are streamed straight
+ * to a caller-supplied sink.
+ *
+ * The client does not open sockets itself; it talks over any connected
+ * Arduino `Client`, which keeps connection reuse with the caller.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+/**
+ * Request text with placeholders. `{name}` marks a slot that is filled
+ * at render time, in order of appearance; `{}` is kept literally so JSON
+ * bodies can be part of the template. The text before the first slot
+ * is copied into the output buffer once, so rendering only writes the
+ * slot values and what follows them.
+ */
+class HttpRequestTemplate {
+public:
+  static constexpr size_t kCapacity = 384;
+  static constexpr size_t kMaxSlots = 5;
+
+  /**
+   * Precompile `pattern`. Returns false if it does not fit.
+   */
+  bool compile(const char *pattern);
+
+  size_t slotCount() const { return _slotCount; }
+
+  /**
+   * Render the request with `values[i]` substituted for slot i. Returns
+   * the request text (valid until the next render) or nullptr if the
+   * result does not fit.
+   */
+  const char *render(const char *const *values, size_t count, size_t &lengthOut);
+
+private:
+  char     _literals[kCapacity] = {0};
+  uint16_t _segmentEnd[kMaxSlots + 1] = {0};
+  size_t   _slotCount = 0;
+  bool     _compiled = false;
+  char     _output[kCapacity] = {0};
+};
+
+/**
+ * The parts of a response the firmware looks at.
+ */
+struct HttpResponse {
+  static constexpr size_t kMaxContentTypeLength = 48;
+
+  int    statusCode = 0;
+  long   contentLength = -1;
+  bool   chunked = false;
+  bool   keepAlive = true;
+  size_t bodyBytes = 0;
+  char   contentType[kMaxContentTypeLength] = {0};
+};
+
+/**
+ * Receives the response as it is parsed. Returning false from either
+ * callback aborts the response.
+ */
+class HttpBodySink {
+public:
+  virtual ~HttpBodySink() = default;
+  virtual bool onHeaders(const HttpResponse &response) {
+    (void)response;
+    return true;
+  }
+  virtual bool onBody(const uint8_t *data, size_t length) = 0;
+};
+
+/**
+ * Incremental response parser. Bytes can be fed in arbitrary pieces;
+ * feed() stops at the end of the response and reports how many bytes
+ * it consumed so that anything following belongs to the next response.
+ */
+class HttpResponseParser {
+public:
+  void reset(HttpResponse *response, HttpBodySink *sink);
+  size_t feed(const uint8_t *data, size_t length);
+
+  /**
+   * The connection closed. Completes a body that is delimited by the
+   * connection close; anything else is an error.
+   */
+  void finishOnClose();
+
+  bool done() const { return _state == State::Done; }
+  bool failed() const { return _state == State::Error; }
+  bool abortedBySink() const { return _abortedBySink; }
+  bool receivedAnything() const { return _receivedAnything; }
+
+private:
+  static constexpr size_t kMaxLineLength = 128;
+
+  enum class State {
+    StatusLine,
+    Headers,
+    Body,
+    ChunkSize,
+    ChunkData,
+    ChunkDataEnd,
+    Trailers,
+    Done,
+    Error
+  };
+
+  bool processLine();
+  bool processStatusLine();
+  bool processHeaderLine();
+  bool finishHeaders();
+  bool processChunkSize();
+
+  HttpResponse *_response = nullptr;
+  HttpBodySink *_sink = nullptr;
+  State         _state = State::StatusLine;
+  char          _line[kMaxLineLength] = {0};
+  size_t        _lineLength = 0;
+  bool          _lineOverflow = false;
+  size_t        _remaining = 0;
+  bool          _untilClose = false;
+  bool          _abortedBySink = false;
+  bool          _receivedAnything = false;
+};
+
+/**
+ * Sends rendered requests and reads responses over a connected Client.
+ */
+class TinyHttpClient {
+public:
+  static constexpr int kErrorConnection = -1;
+  static constexpr int kErrorTimeout = -2;
+  static constexpr int kErrorProtocol = -3;
+  static constexpr int kErrorAborted = -4;
+
+  explicit TinyHttpClient(Client &client) : _client(client) {}
+
+  bool send(const char *data, size_t length);
+
+  /**
+   * Read one response. `timeoutMs` is an inactivity timeout, so long
+   * downloads keep going as long as data arrives. Returns the status
+   * code, or one of the negative error codes above.
+   */
+  int readResponse(HttpResponse &response, HttpBodySink *sink, unsigned long timeoutMs);
+
+  /**
+   * Forget bytes buffered from the previous connection.
+   */
+  void reset();
+
+  static const char *errorName(int code);
+
+private:
+  static constexpr size_t kReadChunk = 256;
+
+  Client &_client;
+  uint8_t _buffer[kReadChunk] = {0};
+  size_t  _bufferOffset = 0;
+  size_t  _bufferLength = 0;
+};
+
+/**
+ * Keeps the first bytes of a body for logging and drops the rest.
+ */
+class HttpPreviewSink : public HttpBodySink {
+public:
+  static constexpr size_t kCapacity = 96;
+
+  bool onBody(const uint8_t *data, size_t length) override;
+  const char *text() const { return _text; }
+  size_t length() const { return _length; }
+
+private:
+  char   _text[kCapacity + 1] = {0};
+  size_t _length = 0;
+};
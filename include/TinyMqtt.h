@@ -0,0 +1,108 @@
+/*
+ * TinyMqtt.h
+ *
+ * Small allocation-free MQTT 3.1.1 client, the MQTT counterpart of
+ * TinyHttp. Outgoing packets are built in a fixed buffer and written
+ * with a single call; incoming packets are collected as they arrive
+ * and handed out in place. Only what the tap transport needs is
+ * implemented: CONNECT with a will, PUBLISH at QoS 0 and 1, PUBACK,
+ * SUBSCRIBE, PINGREQ and DISCONNECT.
+ *
+ * Like TinyHttpClient it does not open sockets itself; it talks over a
+ * connected Arduino `Client` owned by the caller.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+
+class TinyMqttClient {
+public:
+  static constexpr size_t kCapacity = 384;
+
+  enum PacketType : uint8_t {
+    kConnack = 2,
+    kPublish = 3,
+    kPuback = 4,
+    kSuback = 9,
+    kPingresp = 13,
+  };
+
+  /**
+   * One received packet. `body` points into the client's buffer and is
+   * valid until the next call to poll().
+   */
+  struct Packet {
+    uint8_t        type = 0;
+    uint8_t        flags = 0;
+    const uint8_t *body = nullptr;
+    size_t         length = 0;
+  };
+
+  /**
+   * A decoded PUBLISH. Topic and payload are not NUL-terminated.
+   */
+  struct Message {
+    const char    *topic = nullptr;
+    size_t         topicLength = 0;
+    uint8_t        qos = 0;
+    uint16_t       packetId = 0;
+    const uint8_t *payload = nullptr;
+    size_t         payloadLength = 0;
+  };
+
+  explicit TinyMqttClient(Client &client) : _client(client) {}
+
+  /**
+   * Send CONNECT. The will, if given, is published retained at QoS 0
+   * when the broker loses the connection.
+   */
+  bool sendConnect(const char *clientId, uint16_t keepAliveS, bool cleanSession,
+                   const char *willTopic = nullptr, const char *willMessage = nullptr);
+  bool sendPublish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos,
+                   uint16_t packetId, bool dup = false, bool retain = false);
+  bool sendPuback(uint16_t packetId);
+  bool sendSubscribe(uint16_t packetId, const char *topic, uint8_t qos);
+  bool sendPing();
+  bool sendDisconnect();
+
+  /**
+   * Read what has arrived without blocking. Returns 1 with a complete
+   * packet in `out`, 0 if none is complete yet and -1 once the
+   * connection has closed. Packets larger than kCapacity are skipped.
+   */
+  int poll(Packet &out);
+
+  static bool decodePublish(const Packet &packet, Message &out);
+
+  /**
+   * Forget partially received data, for example after reconnecting.
+   */
+  void reset();
+
+  unsigned long lastSentAt() const { return _lastSentAt; }
+
+private:
+  enum class ReadState : uint8_t { Header, Length, Body };
+
+  bool beginPacket(uint8_t header, size_t remainingLength);
+  bool putBytes(const void *data, size_t length);
+  bool putString(const char *text);
+  bool putUint16(uint16_t value);
+  bool flushPacket();
+
+  Client       &_client;
+  uint8_t       _tx[kCapacity] = {0};
+  size_t        _txLength = 0;
+  bool          _txOverflow = false;
+  unsigned long _lastSentAt = 0;
+
+  uint8_t   _rx[kCapacity] = {0};
+  ReadState _readState = ReadState::Header;
+  uint8_t   _rxHeader = 0;
+  size_t    _rxExpected = 0;
+  size_t    _rxLength = 0;
+  uint8_t   _lengthShift = 0;
+  bool      _rxSkipping = false;
+};
@@ -0,0 +1,140 @@
+/*
+ * TlsClient.h
+ *
+ * Client wrapper that runs TLS 1.2 (mbedTLS) over an ImpairedClient,
+ * so BackendClient and OtaUpdater keep using TinyHttp unchanged and
+ * link impairments apply to the handshake too. The server certificate
+ * is verified against BACKEND_CA_CERT and the expected host name.
+ *
+ * A full handshake (ECDHE key exchange plus certificate chain check)
+ * costs a few hundred milliseconds on the ESP32-S3, so every completed
+ * session is cached per host and port and offered again on the next
+ * connection. A server that still knows the session ticket or ID
+ * resumes it with an abbreviated handshake of one round trip and no
+ * public-key operations. The cache is shared by all instances: an OTA
+ * check resumes the session the backend connection established.
+ *
+ * Connecting is split in two: connect() opens TCP, handshake() then
+ * secures it, so callers can time and report the steps separately.
+ * With secure off every call goes straight to the wrapped client.
+ *
+ * An instance is used by one task at a time; the session cache and the
+ * statistics are thread-safe.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#include "ImpairedClient.h"
+
+class TlsClient : public Client {
+public:
+  static constexpr size_t kMaxServerNameLength = 64;
+  // Serialised session, including the peer certificate and ticket.
+  static constexpr size_t kMaxSessionBytes = 2048;
+
+  struct Handshake {
+    bool          resumed = false;
+    // A cached session was offered but the server did a full handshake.
+    bool          resumeRejected = false;
+    unsigned long durationMs = 0;
+  };
+
+  struct Stats {
+    uint32_t      fullHandshakes = 0;
+    uint32_t      resumedHandshakes = 0;
+    uint32_t      resumesRejected = 0;
+    uint32_t      failedHandshakes = 0;
+    unsigned long totalFullMs = 0;
+    unsigned long totalResumedMs = 0;
+    unsigned long lastFullMs = 0;
+    unsigned long lastResumedMs = 0;
+    uint8_t       cachedSessions = 0;
+  };
+
+  explicit TlsClient(ImpairedClient &inner);
+  ~TlsClient() override;
+
+  TlsClient(const TlsClient &) = delete;
+  TlsClient &operator=(const TlsClient &) = delete;
+
+  static Stats stats();
+  static void resetStats();
+
+  /**
+   * Forget every cached session, so the next handshakes are full ones.
+   */
+  static void clearSessions();
+
+  /**
+   * Whether the next connection uses TLS. Takes effect on connect().
+   */
+  void setSecure(bool secure) { _secure = secure; }
+  bool isSecure() const { return _secure; }
+
+  /**
+   * Open the TCP connection. When secure, handshake() must follow
+   * before any data is exchanged.
+   */
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  int connect(IPAddress ip, uint16_t port, int32_t timeoutMs);
+
+  /**
+   * Run the TLS handshake for `serverName` on the open connection,
+   * offering a cached session if there is one. Returns true at once
+   * when secure is off. On failure the connection is closed.
+   */
+  bool handshake(const char *serverName, unsigned long timeoutMs);
+
+  /**
+   * Outcome and duration of the last successful handshake.
+   */
+  const Handshake &lastHandshake() const { return _handshake; }
+
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  void flush() override;
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+
+  int setNoDelay(bool noDelay) { return _inner.setNoDelay(noDelay); }
+
+private:
+  static int sendCallback(void *context, const unsigned char *data, size_t length);
+  static int receiveCallback(void *context, unsigned char *data, size_t length);
+  static int verifyCallback(void *context, mbedtls_x509_crt *certificate, int depth,
+                            uint32_t *flags);
+
+  bool configure();
+  bool offerCachedSession();
+  void cacheSession();
+  void releaseSession();
+
+  ImpairedClient     &_inner;
+  bool                _secure = false;
+  bool                _configured = false;
+  bool                _ready = false;
+  bool                _sessionActive = false;
+  bool                _established = false;
+  bool                _peerClosed = false;
+  bool                _certificateVerified = false;
+  char                _serverName[kMaxServerNameLength + 1] = {0};
+  uint16_t            _port = 0;
+  unsigned long       _timeoutMs = 0;
+  Handshake           _handshake;
+  mbedtls_ssl_config  _config;
+  mbedtls_x509_crt    _ca;
+  mbedtls_ssl_context _ssl;
+};
@@ -20,4 +20,12 @@
 // define SECRET_BACKEND_HOST as "192.168.1.100" and
 // SECRET_BACKEND_PORT as 3000.
 #define SECRET_BACKEND_HOST   "musicbee.local"
-#define SECRET_BACKEND_PORT   8080
\ No newline at end of file
+#define SECRET_BACKEND_PORT   8080
+
+// Optional: PEM certificate of the CA that signed the backend's TLS
+// certificate, used when BACKEND_TLS_ENABLED is set in Config.h (see
+// tools/backend_standin for a self-signed test CA).
+// #define SECRET_BACKEND_CA_CERT \
+//   "-----BEGIN CERTIFICATE-----\n" \
+//   "MIIB...\n" \
+//   "-----END CERTIFICATE-----\n"
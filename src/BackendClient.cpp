@@ -2,153 +2,1305 @@
  * BackendClient.cpp
  *
  * Implements communication with the jukebox backend service using
- * ArduinoHttpClient with mDNS support for .local domains.
+ * TinyHttp over a persistent keep-alive connection, driven by
+ * a single network worker task. The backend address comes from the
+ * shared HostResolver cache.
  */
 
 #include "BackendClient.h"
 #include "Config.h"
-#include <WiFiClient.h>
-#include <HttpClient.h>
-#include <ESPmDNS.h>
+#include "EventClock.h"
+#include "Telemetry.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
-bool BackendClient::postPlay(const String &cardUid) {
-  return performPostPlay(cardUid);
+namespace {
+// mbedTLS handshakes need about 4 KB of stack on top of the HTTP path.
+constexpr uint32_t      kWorkerTaskStackSize = BACKEND_TLS_ENABLED ? 10240 : 6144;
+constexpr size_t        kIdempotencyKeyLength = 32;
+constexpr UBaseType_t   kWorkerTaskPriority = 1;
+constexpr unsigned long kResultPollIntervalMs = 10;
+constexpr unsigned long kResponsePollIntervalMs = 2;
+
+// Uniformly random delay in [0, maxMs].
+unsigned long randomDelay(unsigned long maxMs) {
+  return static_cast<unsigned long>(random(0, static_cast<long>(maxMs) + 1));
+}
+}
+
+void BackendClient::begin() {
+  if (worker != nullptr) {
+    return;
+  }
+
+  netClient.setSecure(BACKEND_TLS_ENABLED);
+
+  char pattern[HttpRequestTemplate::kCapacity];
+  snprintf(pattern, sizeof(pattern),
+           "POST %s/cards/{uid}/play HTTP/1.1\r\n"
+           "Host: {host}\r\n"
+           "Idempotency-Key: {key}\r\n"
+           "X-Trace-Id: {trace}\r\n"
+           "X-Captured-At: {captured}\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: 2\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n"
+           "{}",
+           BACKEND_API_PREFIX);
+  if (!playRequest.compile(pattern)) {
+    Serial.println("[Backend] Play request template does not fit its buffer");
+    return;
+  }
+  // The trace id and capture time travel in the CBOR body instead of
+  // headers.
+  snprintf(pattern, sizeof(pattern),
+           "POST %s/cards/{uid}/play HTTP/1.1\r\n"
+           "Host: {host}\r\n"
+           "Idempotency-Key: {key}\r\n"
+           "Content-Type: %s\r\n"
+           "Accept: %s\r\n"
+           "Content-Length: {length}\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n",
+           BACKEND_API_PREFIX, PayloadCodec::kCborContentType,
+           PayloadCodec::accept(PayloadFormat::Cbor));
+  if (!cborPlayRequest.compile(pattern)) {
+    Serial.println("[Backend] CBOR play request template does not fit its buffer");
+    return;
+  }
+  snprintf(pattern, sizeof(pattern),
+           "POST %s/cards/{uid}/prepare HTTP/1.1\r\n"
+           "Host: {host}\r\n"
+           "X-Trace-Id: {trace}\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: 2\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n"
+           "{}",
+           BACKEND_API_PREFIX);
+  if (!prepareRequest.compile(pattern)) {
+    Serial.println("[Backend] Prepare request template does not fit its buffer");
+    return;
+  }
+  snprintf(pattern, sizeof(pattern),
+           "POST %s/cards/{uid}/removed HTTP/1.1\r\n"
+           "Host: {host}\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: {length}\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n",
+           BACKEND_API_PREFIX);
+  if (!removedRequest.compile(pattern)) {
+    Serial.println("[Backend] Removed request template does not fit its buffer");
+    return;
+  }
+  snprintf(pattern, sizeof(pattern),
+           "GET %s/cards/catalog?since={version} HTTP/1.1\r\n"
+           "Host: {host}\r\n"
+           "Accept: text/plain\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n",
+           BACKEND_API_PREFIX);
+  if (!catalogRequest.compile(pattern)) {
+    Serial.println("[Backend] Catalog request template does not fit its buffer");
+    return;
+  }
+  snprintf(pattern, sizeof(pattern),
+           "POST %s/devices/{device}/telemetry HTTP/1.1\r\n"
+           "Host: {host}\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: {length}\r\n"
+           "Connection: keep-alive\r\n"
+           "\r\n",
+           BACKEND_API_PREFIX);
+  if (!telemetryRequest.compile(pattern)) {
+    Serial.println("[Backend] Telemetry request template does not fit its buffer");
+    return;
+  }
+
+  // The MAC makes idempotency keys unique across readers.
+  deviceId = ESP.getEfuseMac();
+  mqtt.begin(deviceId);
+  endpoints.addStatic(BACKEND_HOST, BACKEND_PORT, BACKEND_STATIC_ENDPOINT_PRIORITY);
+
+  BaseType_t created = xTaskCreate(BackendClient::workerTask, "BackendWorker",
+                                   kWorkerTaskStackSize, this, kWorkerTaskPriority,
+                                   &worker);
+  if (created != pdPASS) {
+    Serial.println("[Backend] Failed to start backend worker task");
+    worker = nullptr;
+  }
+}
+
+void BackendClient::loop(unsigned long now, bool wifiConnected) {
+  (void)now;
+  if (wifiConnected != networkAvailable) {
+    networkAvailable = wifiConnected;
+    if (worker != nullptr) {
+      xTaskNotifyGive(worker);
+    }
+  }
 }
 
-bool BackendClient::beginPostPlayAsync(const String &cardUid) {
-  if (requestInProgress) {
-    Serial.println("[Backend] Ignoring async request while another is running");
+bool BackendClient::postPlay(const String &cardUid) {
+  uint32_t requestId = beginPostPlayAsync(cardUid);
+  if (requestId == 0) {
     return false;
   }
 
-  if (cardUid.length() == 0) {
+  Result result;
+  while (!pollResult(result) || result.requestId != requestId) {
+    delay(kResultPollIntervalMs);
+  }
+  return result.success;
+}
+
+uint32_t BackendClient::beginPostPlayAsync(const String &cardUid, uint32_t traceId,
+                                           unsigned long capturedAt) {
+  uint32_t requestId = 0;
+  if (!enqueue(cardUid.c_str(), RequestKind::Play, traceId, capturedAt, requestId)) {
+    return 0;
+  }
+  return requestId;
+}
+
+bool BackendClient::journalTap(const String &cardUid, unsigned long capturedAt) {
+  uint32_t unused = 0;
+  return enqueue(cardUid.c_str(), RequestKind::JournalOnly, 0, capturedAt, unused);
+}
+
+void BackendClient::notifyCardApproaching() {
+  if (worker == nullptr || !networkAvailable) {
+    return;
+  }
+  warmUpRequested.store(true);
+  xTaskNotifyGive(worker);
+}
+
+void BackendClient::prepareCard(const char *cardUid, uint32_t traceId) {
+  if (!BACKEND_SEND_PREPARE_HINT || !networkAvailable) {
+    return;
+  }
+  uint32_t unused = 0;
+  enqueue(cardUid, RequestKind::Prepare, traceId, 0, unused);
+}
+
+void BackendClient::notifyCardRemoved(const char *cardUid, uint32_t presentMs) {
+  if (!BACKEND_SEND_REMOVAL_EVENTS || !networkAvailable) {
+    return;
+  }
+  uint32_t unused = 0;
+  enqueue(cardUid, RequestKind::Removed, 0, 0, unused, presentMs);
+}
+
+bool BackendClient::enqueue(const char *cardUid, RequestKind kind, uint32_t traceId,
+                            unsigned long capturedAt, uint32_t &requestIdOut,
+                            uint32_t presentMs) {
+  size_t length = cardUid != nullptr ? strlen(cardUid) : 0;
+  if (length == 0) {
     Serial.println("[Backend] Empty UID provided to beginPostPlayAsync");
     return false;
   }
 
-  pendingUid = cardUid;
-  requestInProgress = true;
-  requestCompleted = false;
-  lastRequestSuccess = false;
+  if (length > kMaxUidLength) {
+    Serial.printf("[Backend] UID %s is longer than %u characters\n", cardUid,
+                  static_cast<unsigned int>(kMaxUidLength));
+    return false;
+  }
 
-  BaseType_t created = xTaskCreate(BackendClient::requestTask, "BackendPostPlay", 4096, this, 1, nullptr);
-  if (created != pdPASS) {
-    Serial.println("[Backend] Failed to start backend task");
-    requestInProgress = false;
-    pendingUid = "";
+  if (worker == nullptr) {
+    Serial.println("[Backend] Backend worker is not running");
+    return false;
+  }
+
+  bool isPlay = kind == RequestKind::Play;
+  if (isPlay && !hasCapacity()) {
+    Serial.printf("[Backend] %u request(s) already in flight, rejecting card\n",
+                  static_cast<unsigned int>(lastSubmittedId.load() - lastFinishedId.load()));
     return false;
   }
 
+  // Journal-only entries, prepare hints and removals produce no
+  // completion, so they do not take a request id and never make
+  // isBusy() true. Only taps take a tap id.
+  bool isTap = isPlay || kind == RequestKind::JournalOnly;
+  TapRequest request;
+  request.id = isPlay ? lastSubmittedId.load() + 1 : 0;
+  request.traceId = traceId;
+  request.tapId = isTap ? nextTapId : 0;
+  request.capturedAt = capturedAt != 0 ? capturedAt : millis();
+  request.presentMs = presentMs;
+  request.kind = kind;
+  memcpy(request.uid, cardUid, length + 1);
+  auto &queue = kind == RequestKind::Prepare ? hints : requests;
+  if (!queue.push(request)) {
+    if (kind != RequestKind::Prepare) {
+      Serial.println("[Backend] Request queue full, dropping card");
+    }
+    return false;
+  }
+
+  if (isTap) {
+    nextTapId++;
+  }
+  if (isPlay) {
+    lastSubmittedId.store(request.id);
+    if (BACKEND_LATEST_TAP_WINS) {
+      supersededBefore.store(request.id);
+    }
+  }
+  requestIdOut = request.id;
+  xTaskNotifyGive(worker);
   return true;
 }
 
+bool BackendClient::isCircuitOpen() const {
+  // The breaker only guards HTTP taps; MQTT taps fail on their own
+  // publish timeout.
+  return transport.load() == TapTransport::Http && circuitOpen.load();
+}
+
+void BackendClient::setTransport(TapTransport mode) {
+  transport.store(mode);
+  if (worker != nullptr) {
+    xTaskNotifyGive(worker);
+  }
+}
+
 bool BackendClient::isBusy() const {
-  return requestInProgress;
+  return lastSubmittedId.load() != lastFinishedId.load();
 }
 
-bool BackendClient::pollResult(bool &outSuccess) {
-  if (!requestCompleted) {
-    return false;
+bool BackendClient::hasCapacity() const {
+  // Superseded requests drain immediately, so with latest-wins only the
+  // queue itself can run out of room.
+  if (BACKEND_LATEST_TAP_WINS) {
+    return requests.size() < requests.capacity();
   }
+  return lastSubmittedId.load() - lastFinishedId.load() < BACKEND_MAX_IN_FLIGHT;
+}
 
-  outSuccess = lastRequestSuccess;
-  requestCompleted = false;
-  return true;
+bool BackendClient::pollResult(Result &out) {
+  return completions.pop(out);
 }
 
-bool BackendClient::resolveHostname(const String &host, String &resolvedOut) {
-  if (!host.endsWith(".local")) {
-    resolvedOut = host;
-    return true;
+bool BackendClient::isSuperseded(uint32_t requestId) const {
+  // Journal replays (id 0) give way to any live tap.
+  if (requestId == 0) {
+    return !requests.empty();
   }
+  return requestId < supersededBefore.load();
+}
 
-  String hostname = host;
-  hostname.replace(".local", "");
+void BackendClient::workerTask(void *param) {
+  static_cast<BackendClient *>(param)->runWorker();
+}
 
-  Serial.printf("[Backend] Resolving mDNS hostname %s.local...\n", hostname.c_str());
-  IPAddress serverIP = MDNS.queryHost(hostname);
-  if (serverIP == IPAddress(0, 0, 0, 0)) {
-    Serial.printf("[Backend] ERROR: mDNS resolution failed for %s.local\n", hostname.c_str());
-    Serial.println("[Backend] Make sure:");
-    Serial.println("  - The host device is running");
-    Serial.println("  - An mDNS service is advertising the hostname");
-    Serial.println("  - Both devices share the same network");
-    return false;
+void BackendClient::runWorker() {
+  journal.begin();
+
+  for (;;) {
+    unsigned long waitMs = connectionOpen ? BACKEND_KEEPALIVE_PROBE_INTERVAL_MS
+                                          : BACKEND_RECONNECT_DELAY_MS;
+    if (!journal.empty() && TAP_JOURNAL_REPLAY_RETRY_MS < waitMs) {
+      waitMs = TAP_JOURNAL_REPLAY_RETRY_MS;
+    }
+    if (pendingPrepareResponses > 0 && BACKEND_PREPARE_COMMIT_WINDOW_MS < waitMs) {
+      waitMs = BACKEND_PREPARE_COMMIT_WINDOW_MS;
+    }
+    // Acknowledgements for published taps are read by polling.
+    if (mqtt.hasPending() && MQTT_POLL_INTERVAL_MS < waitMs) {
+      waitMs = MQTT_POLL_INTERVAL_MS;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+
+    refreshEndpoints();
+    if (warmUpRequested.exchange(false)) {
+      maintainConnection(millis(), true);
+    }
+
+    // A hint is queued before the read that leads to its play request,
+    // so draining hints after taking a request keeps them in order.
+    TapRequest request;
+    for (;;) {
+      bool havePlay = requests.pop(request);
+      TapRequest hint;
+      while (hints.pop(hint)) {
+        handleRequest(hint);
+      }
+      if (!havePlay) {
+        break;
+      }
+      handleRequest(request);
+    }
+
+    // A hint whose commit never came (for example a debounced re-read)
+    // still has a response waiting on the connection.
+    unsigned long now = millis();
+    if (pendingPrepareResponses > 0 &&
+        now - lastPrepareSentAt >= BACKEND_PREPARE_COMMIT_WINDOW_MS &&
+        readPrepareResponses(currentTimeoutMs()) < 0) {
+      closeConnection();
+    }
+
+    serviceMqtt(millis());
+    maintainConnection(now);
+    replayJournal(now);
+    syncCatalog(millis());
+    uploadTelemetry(millis());
+    journal.flush(millis());
+  }
+}
+
+void BackendClient::handleRequest(const TapRequest &request) {
+  if (request.kind == RequestKind::JournalOnly) {
+    journal.append(request.uid, request.capturedAt, request.tapId);
+    Telemetry::count(Telemetry::Counter::TapsJournaled);
+    return;
+  }
+  if (request.kind == RequestKind::Prepare) {
+    if (transport.load() == TapTransport::Mqtt) {
+      mqtt.publishPrepare(request.uid);
+    } else {
+      sendPrepareHint(request.uid, request.traceId);
+    }
+    return;
+  }
+  if (request.kind == RequestKind::Removed) {
+    if (transport.load() == TapTransport::Mqtt) {
+      mqtt.publishRemoved(request.uid, request.presentMs);
+    } else {
+      sendRemoval(request.uid, request.presentMs);
+    }
+    return;
+  }
+
+  char key[kIdempotencyKeyLength];
+  formatIdempotencyKey(journal.bootId(), request.tapId, key, sizeof(key));
+  if (isSuperseded(request.id)) {
+    finishTap(request, DeliveryResult::Cancelled);
+    return;
+  }
+  if (transport.load() == TapTransport::Mqtt) {
+    // The outcome arrives later through serviceMqtt().
+    if (publishTap(request, key)) {
+      return;
+    }
+    finishTap(request, DeliveryResult::Failed);
+    return;
+  }
+  DeliveryResult result =
+      performPostPlay(request.uid, key, request.capturedAt, request.id, request.traceId);
+  finishTap(request, result);
+  // The connection is warm and the backend just answered, so pending
+  // telemetry rides along now rather than costing a wake-up later.
+  if (result == DeliveryResult::Delivered) {
+    uploadTelemetry(millis(), true);
+  }
+}
+
+void BackendClient::finishTap(const TapRequest &request, DeliveryResult result) {
+  if (result == DeliveryResult::Failed) {
+    journal.append(request.uid, request.capturedAt, request.tapId);
+    Telemetry::count(Telemetry::Counter::TapsFailed);
+    Telemetry::count(Telemetry::Counter::TapsJournaled);
+  } else if (result == DeliveryResult::Delivered) {
+    journal.dropCapturedBefore(request.capturedAt);
+    Telemetry::count(Telemetry::Counter::TapsDelivered);
+    Telemetry::observe(Telemetry::Histogram::TapToResult, millis() - request.capturedAt);
+  } else if (result == DeliveryResult::Rejected) {
+    Telemetry::count(Telemetry::Counter::TapsRejected);
+  } else if (result == DeliveryResult::Cancelled) {
+    Serial.printf("[Backend] Request #%lu for %s superseded by a newer tap\n",
+                  static_cast<unsigned long>(request.id), request.uid);
   }
 
-  resolvedOut = serverIP.toString();
-  Serial.printf("[Backend] mDNS resolved to: %s\n", resolvedOut.c_str());
+  Result completion;
+  completion.requestId = request.id;
+  completion.traceId = request.traceId;
+  completion.success = result == DeliveryResult::Delivered;
+  completion.cancelled = result == DeliveryResult::Cancelled;
+  if (!completions.push(completion)) {
+    Serial.println("[Backend] Completion queue full, dropping result");
+  }
+  // A tap that fails to publish can finish ahead of older ones still
+  // waiting for the broker.
+  if (request.id > lastFinishedId.load()) {
+    lastFinishedId.store(request.id);
+  }
+}
+
+bool BackendClient::publishTap(const TapRequest &request, const char *idempotencyKey) {
+  MqttSession::Tap tap;
+  tap.requestId = request.id;
+  tap.traceId = request.traceId;
+  tap.tapId = request.tapId;
+  tap.capturedAt = request.capturedAt;
+  strncpy(tap.uid, request.uid, sizeof(tap.uid) - 1);
+  strncpy(tap.key, idempotencyKey, sizeof(tap.key) - 1);
+  // Connects on demand when the transport was just switched.
+  mqtt.service(millis(), networkAvailable);
+  if (!mqtt.publishTap(tap)) {
+    Serial.printf("[Backend] Could not publish tap %s over MQTT\n", request.uid);
+    return false;
+  }
+  tracer.mark(request.traceId, TapTracer::Stage::RequestSent);
+  Serial.printf("[Backend] Published tap %s (key %s)\n", request.uid, idempotencyKey);
   return true;
 }
 
-bool BackendClient::performPostPlay(const String &cardUid) {
+void BackendClient::serviceMqtt(unsigned long now) {
+  // The session is kept open while MQTT is in use and until taps
+  // published before a switch back to HTTP have been settled.
+  bool wanted = transport.load() == TapTransport::Mqtt || mqtt.hasPending();
+  mqtt.service(now, networkAvailable && wanted);
+
+  MqttSession::Outcome outcome;
+  while (mqtt.popOutcome(outcome)) {
+    TapRequest request;
+    request.id = outcome.tap.requestId;
+    request.traceId = outcome.tap.traceId;
+    request.tapId = outcome.tap.tapId;
+    request.capturedAt = outcome.tap.capturedAt;
+    memcpy(request.uid, outcome.tap.uid, sizeof(request.uid));
+    if (outcome.delivered) {
+      tracer.mark(request.traceId, TapTracer::Stage::FirstByte);
+      Serial.printf("[Backend] Broker acknowledged tap %s in %lums\n", request.uid,
+                    outcome.ackMs);
+    }
+    finishTap(request, outcome.delivered ? DeliveryResult::Delivered : DeliveryResult::Failed);
+  }
+  if (mqtt.takeCatalogSyncRequest()) {
+    Serial.println("[Backend] Backend asked for a catalog sync");
+    nextCatalogSyncAt = now;
+  }
+}
+
+void BackendClient::replayJournal(unsigned long now) {
+  if (!networkAvailable || journal.empty()) {
+    return;
+  }
+  if (replayBackoff && now - lastReplayFailureAt < TAP_JOURNAL_REPLAY_RETRY_MS) {
+    return;
+  }
+
+  TapJournal::Entry entry;
+  while (journal.peekOldest(entry)) {
+    // Live taps always go first.
+    if (!requests.empty()) {
+      return;
+    }
+
+    uint32_t ageMs = 0;
+    TapJournal::Freshness freshness = journal.freshness(entry, millis(), ageMs);
+    if (freshness == TapJournal::Freshness::Unknown) {
+      // A tap from before a reboot waits for the clock to date it.
+      return;
+    }
+    if (freshness == TapJournal::Freshness::Expired) {
+      Serial.printf("[Backend] Dropping expired journaled tap %s (#%lu)\n", entry.uid,
+                    static_cast<unsigned long>(entry.seq));
+      journal.dropOldest();
+      continue;
+    }
+    // On this boot's millis(), so a tap from an earlier boot reports
+    // its real age.
+    unsigned long capturedAt = millis() - ageMs;
+
+    Serial.printf("[Backend] Replaying journaled tap %s (#%lu)\n", entry.uid,
+                  static_cast<unsigned long>(entry.seq));
+    char key[kIdempotencyKeyLength];
+    formatIdempotencyKey(entry.bootId, entry.tapId, key, sizeof(key));
+    DeliveryResult result = transport.load() == TapTransport::Mqtt
+                                ? replayOverMqtt(entry, key, capturedAt)
+                                : performPostPlay(entry.uid, key, capturedAt, 0, 0,
+                                                  entry.capturedWallUs);
+    if (result == DeliveryResult::Cancelled) {
+      return;
+    }
+    if (result == DeliveryResult::Failed) {
+      replayBackoff = true;
+      lastReplayFailureAt = millis();
+      return;
+    }
+    journal.dropOldest();
+  }
+  replayBackoff = false;
+}
+
+BackendClient::DeliveryResult BackendClient::replayOverMqtt(const TapJournal::Entry &entry,
+                                                           const char *idempotencyKey,
+                                                           unsigned long capturedAt) {
+  // Replays go one at a time behind any live taps still in the outbox.
+  if (!mqtt.isConnected() || mqtt.hasPending()) {
+    return DeliveryResult::Cancelled;
+  }
+  MqttSession::Tap tap;
+  tap.tapId = entry.tapId;
+  tap.capturedAt = capturedAt;
+  tap.capturedWallUs = entry.capturedWallUs;
+  strncpy(tap.uid, entry.uid, sizeof(tap.uid) - 1);
+  strncpy(tap.key, idempotencyKey, sizeof(tap.key) - 1);
+  return mqtt.publishTapAndWait(tap) ? DeliveryResult::Delivered : DeliveryResult::Failed;
+}
+
+void BackendClient::maintainConnection(unsigned long now, bool force) {
+  if (!networkAvailable) {
+    if (connectionOpen) {
+      Serial.println("[Backend] Wi-Fi lost, closing persistent connection");
+      closeConnection();
+    }
+    return;
+  }
+
+  unsigned long interval = connectionOpen ? BACKEND_KEEPALIVE_PROBE_INTERVAL_MS
+                                          : BACKEND_RECONNECT_DELAY_MS;
+  if (!force && lastProbeAt != 0 && now - lastProbeAt < interval) {
+    return;
+  }
+  lastProbeAt = now;
+
+  // connected() is a non-blocking peek on the socket, which notices a
+  // connection the backend has closed in the meantime.
+  EndpointDirectory::Endpoint *best = endpoints.best(now);
+  if (connectionOpen && netClient.connected()) {
+    // Move an idle connection over when a better endpoint appears, for
+    // example a higher-priority backend coming back, or when the
+    // current one is held down after failing.
+    EndpointDirectory::Endpoint *current = connectedEndpoint();
+    bool moveAway = current == nullptr ||
+                    (best != nullptr && best != current && best->isHealthy(now) &&
+                     (!current->isHealthy(now) || endpoints.shouldSwitch(*current, *best)));
+    if (!moveAway) {
+      return;
+    }
+    Serial.printf("[Backend] Moving persistent connection to %s\n",
+                  best != nullptr ? best->hostHeader : "(none)");
+    closeConnection();
+  }
+  if (connectionOpen) {
+    Serial.println("[Backend] Persistent connection closed by peer");
+    closeConnection();
+  }
+
+  // Wait for the resolver rather than failing a warm-up every probe.
+  IPAddress address;
+  if (best == nullptr || !addressOf(*best, address)) {
+    return;
+  }
+  bool reused = false;
+  ensureConnected(reused);
+}
+
+void BackendClient::refreshEndpoints() {
+  HostResolver::ServiceInstance instances[HostResolver::kMaxServiceInstances];
+  size_t count = 0;
+  if (!resolver.fetchServiceInstances(instancesGeneration, instances,
+                                      HostResolver::kMaxServiceInstances, count)) {
+    return;
+  }
+  endpoints.merge(instances, count);
+  if (connectionOpen && connectedEndpoint() == nullptr) {
+    Serial.println("[Backend] Connected endpoint disappeared, closing connection");
+    closeConnection();
+  }
+  Serial.printf("[Backend] %u endpoint(s) known:\n", static_cast<unsigned int>(endpoints.size()));
+  endpoints.log();
+  publishBreakerState();
+}
+
+void BackendClient::syncCatalog(unsigned long now) {
+  if (!CARD_CATALOG_SYNC_ENABLED) {
+    return;
+  }
+  if (!catalogSyncScheduled) {
+    // A device that already has a catalog waits a random part of the
+    // jitter window, so readers powering up together do not all sync
+    // in the same second.
+    unsigned long delayMs = catalog.version() != 0 ? randomDelay(CARD_CATALOG_SYNC_JITTER_MS) : 0;
+    nextCatalogSyncAt = now + delayMs;
+    catalogSyncScheduled = true;
+  }
+  if (catalogSyncRequested.exchange(false)) {
+    nextCatalogSyncAt = now;
+  }
+  // Only on an idle, healthy connection: a sync must not delay a tap.
+  if (!networkAvailable || !connectionOpen || !requests.empty() ||
+      pendingPrepareResponses > 0 || breaker.state() == CircuitBreaker::State::Open) {
+    return;
+  }
+  if (static_cast<long>(now - nextCatalogSyncAt) < 0) {
+    return;
+  }
+  // Retried soon only if no request could be made at all; a sync that
+  // was sent waits for the regular interval whatever the answer, so a
+  // failing backend is not asked every few seconds.
+  nextCatalogSyncAt = now + CARD_CATALOG_RETRY_MS;
+  unsigned long nextRegularSyncAt =
+      now + CARD_CATALOG_SYNC_INTERVAL_MS + randomDelay(CARD_CATALOG_SYNC_JITTER_MS);
+
+  bool reused = false;
+  if (!ensureConnected(reused)) {
+    return;
+  }
+  EndpointDirectory::Endpoint *endpoint = connectedEndpoint();
+  if (endpoint->catalogUnsupported) {
+    return;
+  }
+  char versionText[11];
+  snprintf(versionText, sizeof(versionText), "%lu",
+           static_cast<unsigned long>(catalog.version()));
+  size_t requestLength = 0;
+  const char *values[] = {versionText, endpoint->hostHeader};
+  const char *request = catalogRequest.render(values, 2, requestLength);
+  if (request == nullptr) {
+    return;
+  }
+
+  CardCatalog::Updater updater(catalog);
+  HttpResponse response;
+  int code = http.send(request, requestLength)
+                 ? http.readResponse(response, &updater, BACKEND_HTTP_TIMEOUT_MS)
+                 : TinyHttpClient::kErrorConnection;
+  nextCatalogSyncAt = nextRegularSyncAt;
+  if (code < 0) {
+    Serial.printf("[Backend] Catalog sync failed: %s\n", TinyHttpClient::errorName(code));
+    closeConnection();
+    return;
+  }
+  if (!response.keepAlive) {
+    closeConnection();
+  }
+  if (code == 304) {
+    return;
+  }
+  if (code == 404 || code == 405) {
+    // A backend without the route would refuse every sync.
+    endpoint->catalogUnsupported = true;
+    Serial.printf("[Backend] %s has no card catalog (%d), not asking there again\n",
+                  endpoint->hostHeader, code);
+    return;
+  }
+  if (code != 200) {
+    Serial.printf("[Backend] Catalog sync answered with %d\n", code);
+    return;
+  }
+  updater.commit();
+}
+
+void BackendClient::uploadTelemetry(unsigned long now, bool piggyback) {
+  if (!TELEMETRY_ENABLED) {
+    return;
+  }
+  if (Telemetry::pendingWindows() == 0) {
+    telemetryUploadScheduled = false;
+    return;
+  }
+  if (!telemetryUploadScheduled) {
+    // Windows close on every device at about the same time after a
+    // power cut; the jitter spreads the uploads out again.
+    nextTelemetryUploadAt = now + randomDelay(TELEMETRY_JITTER_MS);
+    telemetryUploadScheduled = true;
+  }
+  if (Telemetry::takeUploadRequest()) {
+    nextTelemetryUploadAt = now;
+    telemetryBackoff = false;
+  }
+  // Only on an idle, healthy connection: telemetry must not delay a tap,
+  // and never opens a connection of its own.
+  if (!networkAvailable || !connectionOpen || !requests.empty() ||
+      pendingPrepareResponses > 0 || breaker.state() == CircuitBreaker::State::Open) {
+    return;
+  }
+  // A tap only brings the upload forward while the last one worked, so
+  // a failing backend sees one attempt per interval, not one per tap.
+  if ((!piggyback || telemetryBackoff) && static_cast<long>(now - nextTelemetryUploadAt) < 0) {
+    return;
+  }
+  bool reused = false;
+  if (!ensureConnected(reused)) {
+    return;
+  }
+  EndpointDirectory::Endpoint *endpoint = connectedEndpoint();
+  if (endpoint->telemetryUnsupported) {
+    return;
+  }
+
+  // The body is rendered behind the room reserved for the head, whose
+  // Content-Length depends on it, and then moved up to follow the head.
+  char deviceText[13];
+  snprintf(deviceText, sizeof(deviceText), "%012llX", static_cast<unsigned long long>(deviceId));
+  char *body = telemetryWire + HttpRequestTemplate::kCapacity;
+  uint32_t lastSeq = 0;
+  size_t bodyLength = Telemetry::renderBatch(deviceText, journal.bootId(), body,
+                                             Telemetry::kMaxBatchLength, lastSeq);
+  if (bodyLength == 0) {
+    return;
+  }
+  char lengthText[6];
+  snprintf(lengthText, sizeof(lengthText), "%u", static_cast<unsigned int>(bodyLength));
+  const char *values[] = {deviceText, endpoint->hostHeader, lengthText};
+  size_t headLength = 0;
+  const char *head = telemetryRequest.render(values, 3, headLength);
+  if (head == nullptr) {
+    return;
+  }
+  memcpy(telemetryWire, head, headLength);
+  memmove(telemetryWire + headLength, body, bodyLength);
+
+  HttpResponse response;
+  int code = http.send(telemetryWire, headLength + bodyLength)
+                 ? http.readResponse(response, nullptr, currentTimeoutMs())
+                 : TinyHttpClient::kErrorConnection;
+  if (code < 0 || !response.keepAlive) {
+    closeConnection();
+  }
+  if (code >= 200 && code < 300) {
+    Telemetry::acknowledge(lastSeq, millis());
+    telemetryUploadScheduled = false;
+    telemetryBackoff = false;
+    Serial.printf("[Backend] Uploaded telemetry up to window #%lu (%u bytes)\n",
+                  static_cast<unsigned long>(lastSeq), static_cast<unsigned int>(bodyLength));
+    return;
+  }
+  // Kept for the next window; the ring drops the oldest if this lasts.
+  Telemetry::recordUploadFailure();
+  nextTelemetryUploadAt = now + TELEMETRY_INTERVAL_MS + randomDelay(TELEMETRY_JITTER_MS);
+  telemetryBackoff = true;
+  if (code == 404 || code == 405) {
+    // A backend without the route would refuse every batch.
+    endpoint->telemetryUnsupported = true;
+    Serial.printf("[Backend] %s has no telemetry endpoint (%d), not uploading there again\n",
+                  endpoint->hostHeader, code);
+  } else if (code < 0) {
+    Serial.printf("[Backend] Telemetry upload failed: %s\n", TinyHttpClient::errorName(code));
+  } else {
+    Serial.printf("[Backend] Telemetry upload answered with %d\n", code);
+  }
+}
+
+void BackendClient::sendPrepareHint(const char *cardUid, uint32_t traceId) {
+  bool reused = false;
+  if (!ensureConnected(reused, traceId)) {
+    return;
+  }
+  char traceText[11];
+  snprintf(traceText, sizeof(traceText), "%lu", static_cast<unsigned long>(traceId));
+  size_t requestLength = 0;
+  const char *values[] = {cardUid, connectedEndpoint()->hostHeader, traceText};
+  const char *request = prepareRequest.render(values, 3, requestLength);
+  if (request == nullptr) {
+    return;
+  }
+
+  // The response is read later, together with the /play response that
+  // normally follows within milliseconds, so the hint costs no round
+  // trip of its own.
+  if (!http.send(request, requestLength)) {
+    closeConnection();
+    return;
+  }
+  pendingPrepareResponses++;
+  lastPrepareSentAt = millis();
+  Serial.printf("[Backend] Sent prepare hint for %s\n", cardUid);
+}
+
+void BackendClient::sendRemoval(const char *cardUid, uint32_t presentMs) {
+  // Best effort: a removal that cannot be sent now is not worth a retry.
+  if (breaker.state() == CircuitBreaker::State::Open) {
+    return;
+  }
+  if (pendingPrepareResponses > 0 && readPrepareResponses(currentTimeoutMs()) < 0) {
+    closeConnection();
+  }
+  bool reused = false;
+  if (!ensureConnected(reused)) {
+    return;
+  }
+
+  char *body = removedWire + HttpRequestTemplate::kCapacity;
+  int bodyLength = snprintf(body, sizeof(removedWire) - HttpRequestTemplate::kCapacity,
+                            "{\"present_ms\":%lu}", static_cast<unsigned long>(presentMs));
+  char lengthText[6];
+  snprintf(lengthText, sizeof(lengthText), "%d", bodyLength);
+  const char *values[] = {cardUid, connectedEndpoint()->hostHeader, lengthText};
+  size_t headLength = 0;
+  const char *head = removedRequest.render(values, 3, headLength);
+  if (head == nullptr) {
+    return;
+  }
+  memcpy(removedWire, head, headLength);
+  memmove(removedWire + headLength, body, static_cast<size_t>(bodyLength));
+
+  HttpResponse response;
+  int code = http.send(removedWire, headLength + static_cast<size_t>(bodyLength))
+                 ? http.readResponse(response, nullptr, currentTimeoutMs())
+                 : TinyHttpClient::kErrorConnection;
+  if (code < 0 || !response.keepAlive) {
+    closeConnection();
+  }
+  if (code < 0) {
+    Serial.printf("[Backend] Removal of %s not reported: %s\n", cardUid,
+                  TinyHttpClient::errorName(code));
+  } else if (code < 200 || code >= 300) {
+    Serial.printf("[Backend] Removal of %s answered with %d\n", cardUid, code);
+  }
+}
+
+int BackendClient::readPrepareResponses(unsigned long timeoutMs) {
+  while (pendingPrepareResponses > 0) {
+    HttpResponse response;
+    int code = http.readResponse(response, nullptr, timeoutMs);
+    pendingPrepareResponses--;
+    if (code < 0) {
+      return code;
+    }
+    if (code < 200 || code >= 300) {
+      Serial.printf("[Backend] Prepare hint answered with %d\n", code);
+    }
+    // Anything pipelined behind a closing response is lost.
+    if (!response.keepAlive) {
+      return TinyHttpClient::kErrorConnection;
+    }
+  }
+  return 0;
+}
+
+BackendClient::DeliveryResult BackendClient::performPostPlay(const char *cardUid,
+                                                            const char *idempotencyKey,
+                                                            unsigned long capturedAt,
+                                                            uint32_t requestId,
+                                                            uint32_t traceId,
+                                                            int64_t capturedWallUs) {
   // Guard: ensure we have a valid UID
-  if (cardUid.length() == 0) {
+  if (cardUid == nullptr || cardUid[0] == '\0') {
     Serial.println("[Backend] Empty UID provided to postPlay");
-    return false;
+    return DeliveryResult::Rejected;
   }
 
-  // Build the request path
-  String path = String(BACKEND_API_PREFIX) + "/cards/" + cardUid + "/play";
+  for (uint8_t attempt = 1;; ++attempt) {
+    unsigned long now = millis();
+    if (!breaker.allowRequest(now)) {
+      resilience.fastFailures++;
+      Telemetry::count(Telemetry::Counter::BreakerFastFailures);
+      publishBreakerState();
+      Serial.printf("[Backend] Circuit open, failing %s fast (next probe in %lums)\n", cardUid,
+                    breaker.retryInMs(now));
+      return DeliveryResult::Failed;
+    }
+    publishBreakerState();
 
-  String targetHost = String(BACKEND_HOST);
-  Serial.printf("[Backend] Target: %s:%d\n", BACKEND_HOST, BACKEND_PORT);
-  Serial.printf("[Backend] Path: %s\n", path.c_str());
+    resilience.attempts++;
+    DeliveryResult result =
+        attemptPostPlay(cardUid, idempotencyKey, capturedAt, requestId, traceId, capturedWallUs);
+    if (result == DeliveryResult::Cancelled) {
+      return result;
+    }
+    if (result != DeliveryResult::Failed) {
+      // Any answer, even a rejection, shows the backend is alive.
+      breaker.recordSuccess();
+      publishBreakerState();
+      return result;
+    }
 
-  String resolvedHost;
-  if (!resolveHostname(targetHost, resolvedHost)) {
-    return false;
+    // The failed endpoint is now held down. If another one is healthy
+    // the retry goes there at once; the breaker only counts failures
+    // once there is nowhere left to fail over to.
+    EndpointDirectory::Endpoint *next = endpoints.best(millis());
+    if (attempt < BACKEND_MAX_ATTEMPTS && next != nullptr && next->isHealthy(millis())) {
+      resilience.retries++;
+      resilience.failovers++;
+      Telemetry::count(Telemetry::Counter::BackendRetries);
+      publishBreakerState();
+      Serial.printf("[Backend] Attempt %u/%u for %s failed, failing over to %s\n", attempt,
+                    BACKEND_MAX_ATTEMPTS, cardUid, next->hostHeader);
+      continue;
+    }
+
+    breaker.recordFailure(millis());
+    publishBreakerState();
+    if (attempt >= BACKEND_MAX_ATTEMPTS || breaker.state() == CircuitBreaker::State::Open) {
+      return DeliveryResult::Failed;
+    }
+
+    // Full jitter keeps a fleet of readers from retrying in lockstep.
+    unsigned long ceiling = BACKEND_RETRY_BASE_DELAY_MS << (attempt - 1);
+    if (ceiling > BACKEND_RETRY_MAX_DELAY_MS) {
+      ceiling = BACKEND_RETRY_MAX_DELAY_MS;
+    }
+    unsigned long backoffMs = randomDelay(ceiling);
+    resilience.retries++;
+    Telemetry::count(Telemetry::Counter::BackendRetries);
+    Serial.printf("[Backend] Attempt %u/%u for %s failed, retrying in %lums (key %s)\n",
+                  attempt, BACKEND_MAX_ATTEMPTS, cardUid, backoffMs, idempotencyKey);
+    if (!sleepUnlessSuperseded(requestId, backoffMs)) {
+      return DeliveryResult::Cancelled;
+    }
+  }
+}
+
+BackendClient::DeliveryResult BackendClient::attemptPostPlay(const char *cardUid,
+                                                            const char *idempotencyKey,
+                                                            unsigned long capturedAt,
+                                                            uint32_t requestId,
+                                                            uint32_t traceId,
+                                                            int64_t capturedWallUs) {
+  // Replayed taps are untraced and carry trace id 0.
+  char traceText[11];
+  snprintf(traceText, sizeof(traceText), "%lu", static_cast<unsigned long>(traceId));
+  // Wall-clock read time, so the backend can measure tap-to-play latency
+  // on its own clock. Journaled taps keep their original capture time.
+  if (capturedWallUs == 0) {
+    capturedWallUs = EventClock::wallUsAtMillis(capturedAt);
   }
+  char capturedText[21];
+  snprintf(capturedText, sizeof(capturedText), "%lld", static_cast<long long>(capturedWallUs));
 
-  targetHost = resolvedHost;
+  HttpResponse response;
+  HttpPreviewSink body;
+  int responseCode = 0;
+  bool reused = false;
+  unsigned long requestStart = 0;
+  unsigned long timeoutMs = 0;
+  bool sentCbor = false;
+  EndpointDirectory::Endpoint *endpoint = nullptr;
+  // A reused keep-alive connection may have been closed by the backend
+  // without us noticing yet; in that case reconnect and send once more.
+  for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+    if (isSuperseded(requestId)) {
+      return DeliveryResult::Cancelled;
+    }
+    if (!ensureConnected(reused, traceId)) {
+      return DeliveryResult::Failed;
+    }
+    endpoint = connectedEndpoint();
+    timeoutMs = endpoint->rtt.timeoutMs();
 
-  Serial.println("[Backend] Starting HTTP request...");
+    size_t requestLength = 0;
+    sentCbor = BACKEND_PAYLOAD_FORMAT == PayloadFormat::Cbor && !endpoint->cborUnsupported;
+    const char *request = nullptr;
+    if (sentCbor) {
+      request = renderCborPlay(cardUid, endpoint->hostHeader, idempotencyKey, capturedAt,
+                               capturedWallUs, traceId, requestLength);
+    } else {
+      const char *values[] = {cardUid, endpoint->hostHeader, idempotencyKey, traceText,
+                              capturedText};
+      request = playRequest.render(values, 5, requestLength);
+    }
+    if (request == nullptr) {
+      Serial.printf("[Backend] Could not render request for UID %s\n", cardUid);
+      return DeliveryResult::Rejected;
+    }
 
-  // Set up the HTTP client
-  WiFiClient netClient;
-  HttpClient httpClient(netClient, targetHost.c_str(), BACKEND_PORT);
-  
-  // Set a reasonable timeout
-  httpClient.setTimeout(5000);
+    Serial.printf("[Backend] Target: %s\n", endpoint->hostHeader);
+    Serial.printf("[Backend] Path: %s/cards/%s/play\n", BACKEND_API_PREFIX, cardUid);
+    char startedText[32];
+    Serial.printf("[Backend] Starting HTTP request at %s (timeout %lums)...\n",
+                  EventClock::format(EventClock::nowUs(), startedText, sizeof(startedText)),
+                  timeoutMs);
+    requestStart = millis();
+    if (!http.send(request, requestLength)) {
+      responseCode = TinyHttpClient::kErrorConnection;
+    } else {
+      tracer.mark(traceId, TapTracer::Stage::RequestSent);
+      // The request is on the wire; while waiting for the answer a newer
+      // tap may cancel it. The late response would otherwise arrive on
+      // the shared connection, so it is closed and reopened for the next
+      // tap.
+      if (!waitForResponse(requestId, timeoutMs)) {
+        closeConnection();
+        return DeliveryResult::Cancelled;
+      }
+      body = HttpPreviewSink();
+      if (netClient.available()) {
+        tracer.mark(traceId, TapTracer::Stage::FirstByte);
+        responseCode = readPrepareResponses(timeoutMs);
+        if (responseCode >= 0) {
+          responseCode = http.readResponse(response, &body, timeoutMs);
+        }
+      } else if (netClient.connected()) {
+        responseCode = TinyHttpClient::kErrorTimeout;
+      } else {
+        responseCode = TinyHttpClient::kErrorConnection;
+      }
+    }
+    if (responseCode != TinyHttpClient::kErrorConnection || !reused) {
+      break;
+    }
 
-  // Begin the request
-  int statusCode = httpClient.post(path, "application/json", "{}");
-  if (statusCode < 0) {
-    Serial.printf("[Backend] ERROR: Connection failed with code: %d\n", statusCode);
+    Serial.println("[Backend] Warm connection was stale, reconnecting...");
+    stats.staleReconnects++;
+    closeConnection();
+  }
+
+  if (responseCode < 0) {
+    Serial.printf("[Backend] ERROR: Request failed: %s\n",
+                  TinyHttpClient::errorName(responseCode));
+    if (responseCode == TinyHttpClient::kErrorTimeout) {
+      resilience.timeouts++;
+      Telemetry::count(Telemetry::Counter::BackendTimeouts);
+      endpoint->rtt.backOff();
+    }
+    endpoints.recordFailure(*endpoint, millis());
     Serial.println("[Backend] Possible causes:");
     Serial.println("  - Backend server not running");
     Serial.println("  - Wrong host/port in secrets.h");
     Serial.println("  - Network connectivity issues");
     Serial.println("  - Firewall blocking connection");
-    httpClient.stop();
-    return false;
+    closeConnection();
+    return DeliveryResult::Failed;
+  }
+
+  // Content negotiation: a backend that cannot read CBOR says so with
+  // 415, and the tap is sent again as JSON straight away.
+  if (responseCode == 415 && sentCbor) {
+    Serial.printf("[Backend] %s does not accept CBOR, falling back to JSON\n",
+                  endpoint->hostHeader);
+    endpoint->cborUnsupported = true;
+    if (!response.keepAlive) {
+      closeConnection();
+    }
+    return attemptPostPlay(cardUid, idempotencyKey, capturedAt, requestId, traceId,
+                           capturedWallUs);
   }
 
-  // Read the response status
-  int responseCode = httpClient.responseStatusCode();
-  String responseBody = httpClient.responseBody();
-  httpClient.stop();
+  // The body has been drained completely, so unless the backend asked
+  // to close, the connection can carry the next request.
+  stats.lastRequestMs = millis() - requestStart;
+  Telemetry::observe(Telemetry::Histogram::Request, stats.lastRequestMs);
+  if (responseCode >= 500) {
+    endpoint->rtt.addSample(stats.lastRequestMs);
+    endpoints.recordFailure(*endpoint, millis());
+  } else {
+    endpoints.recordSuccess(*endpoint, stats.lastRequestMs);
+  }
+  if (reused) {
+    stats.lastConnectMs = 0;
+    stats.requestsOnWarmConnection++;
+  }
+  if (!response.keepAlive) {
+    closeConnection();
+  }
 
   Serial.printf("[Backend] Response code: %d\n", responseCode);
-  if (responseBody.length() > 0) {
-    Serial.printf("[Backend] Response body: %s\n", responseBody.c_str());
+  if (PayloadCodec::formatOf(response.contentType) == PayloadFormat::Cbor) {
+    Serial.printf("[Backend] Response body: %u bytes of CBOR\n",
+                  static_cast<unsigned int>(response.bodyBytes));
+  } else if (body.length() > 0) {
+    Serial.printf("[Backend] Response body: %s%s\n", body.text(),
+                  response.bodyBytes > body.length() ? "..." : "");
+  }
+  Serial.printf("[Backend] Timing: connect %lums (%s), request %lums\n",
+                stats.lastConnectMs, reused ? "reused" : "new", stats.lastRequestMs);
+  Serial.printf("[Backend] RTT to %s: srtt %lums, rttvar %lums, next timeout %lums\n",
+                endpoint->hostHeader, endpoint->rtt.srttMs(), endpoint->rtt.rttvarMs(),
+                endpoint->rtt.timeoutMs());
+  if (stats.connectsOpened > 0) {
+    Serial.printf("[Backend] Connection reuse: %lu warm / %lu opened, avg connect %lums\n",
+                  static_cast<unsigned long>(stats.requestsOnWarmConnection),
+                  static_cast<unsigned long>(stats.connectsOpened),
+                  stats.totalConnectMs / stats.connectsOpened);
+  }
+
+  // Success if 2xx. Server errors and broken responses are worth
+  // retrying later; any other status means the backend saw the tap.
+  if (responseCode >= 200 && responseCode < 300) {
+    return DeliveryResult::Delivered;
+  }
+  if (responseCode >= 500) {
+    return DeliveryResult::Failed;
+  }
+  return DeliveryResult::Rejected;
+}
+
+const char *BackendClient::renderCborPlay(const char *cardUid, const char *hostHeader,
+                                         const char *idempotencyKey, unsigned long capturedAt,
+                                         int64_t capturedWallUs, uint32_t traceId,
+                                         size_t &lengthOut) {
+  TapEvent tap;
+  if (!tap.setUid(cardUid)) {
+    Serial.printf("[Backend] UID %s is not valid hex\n", cardUid);
+    return nullptr;
   }
+  tap.ageMs = static_cast<uint32_t>(millis() - capturedAt);
+  tap.traceId = traceId;
+  tap.capturedAtUs = static_cast<uint64_t>(capturedWallUs);
+  uint8_t body[PayloadCodec::kMaxTapLength];
+  size_t bodyLength = PayloadCodec::encodeTap(PayloadFormat::Cbor, tap, body, sizeof(body));
+  if (bodyLength == 0) {
+    return nullptr;
+  }
+
+  char lengthText[6];
+  snprintf(lengthText, sizeof(lengthText), "%u", static_cast<unsigned int>(bodyLength));
+  const char *values[] = {cardUid, hostHeader, idempotencyKey, lengthText};
+  size_t headLength = 0;
+  const char *head = cborPlayRequest.render(values, 4, headLength);
+  if (head == nullptr || headLength + bodyLength > sizeof(cborPlayWire)) {
+    return nullptr;
+  }
+  // Head and body leave in one write, as the JSON request does.
+  memcpy(cborPlayWire, head, headLength);
+  memcpy(cborPlayWire + headLength, body, bodyLength);
+  lengthOut = headLength + bodyLength;
+  return cborPlayWire;
+}
 
-  // Success if 2xx
-  return (responseCode >= 200 && responseCode < 300);
+bool BackendClient::sleepUnlessSuperseded(uint32_t requestId, unsigned long durationMs) {
+  unsigned long start = millis();
+  while (millis() - start < durationMs) {
+    if (isSuperseded(requestId)) {
+      return false;
+    }
+    delay(kResponsePollIntervalMs);
+  }
+  return !isSuperseded(requestId);
 }
 
-void BackendClient::requestTask(void *param) {
-  auto *client = static_cast<BackendClient *>(param);
-  String uid = client->pendingUid;
-  bool success = client->performPostPlay(uid);
+void BackendClient::publishBreakerState() {
+  bool open = breaker.state() == CircuitBreaker::State::Open;
+  circuitOpen.store(open);
+  resilience.breakerState = breaker.state();
+  resilience.breakerOpenings = breaker.timesOpened();
+  resilience.endpointsKnown = static_cast<uint8_t>(endpoints.size());
+  resilience.endpointsHealthy = static_cast<uint8_t>(endpoints.healthyCount(millis()));
+  const EndpointDirectory::Endpoint *endpoint = connectedEndpoint();
+  if (endpoint != nullptr) {
+    resilience.srttMs = endpoint->rtt.srttMs();
+    resilience.rttvarMs = endpoint->rtt.rttvarMs();
+    resilience.timeoutMs = endpoint->rtt.timeoutMs();
+    strncpy(resilience.endpoint, endpoint->hostHeader, sizeof(resilience.endpoint) - 1);
+  }
+}
 
-  client->pendingUid = "";
-  client->lastRequestSuccess = success;
-  client->requestCompleted = true;
-  client->requestInProgress = false;
+EndpointDirectory::Endpoint *BackendClient::connectedEndpoint() {
+  return endpoints.find(connectedEndpointId);
+}
+
+unsigned long BackendClient::currentTimeoutMs() {
+  const EndpointDirectory::Endpoint *endpoint = connectedEndpoint();
+  return endpoint != nullptr ? endpoint->rtt.timeoutMs() : BACKEND_HTTP_TIMEOUT_MS;
+}
+
+void BackendClient::formatIdempotencyKey(uint16_t bootId, uint32_t tapId, char *out,
+                                         size_t length) const {
+  snprintf(out, length, "%012llX-%04X-%lu", static_cast<unsigned long long>(deviceId),
+           bootId, static_cast<unsigned long>(tapId));
+}
+
+bool BackendClient::waitForResponse(uint32_t requestId, unsigned long timeoutMs) {
+  unsigned long start = millis();
+  while (!netClient.available()) {
+    // The caller reports disconnects and timeouts.
+    if (!netClient.connected() || millis() - start >= timeoutMs) {
+      return true;
+    }
+    if (isSuperseded(requestId)) {
+      return false;
+    }
+    delay(kResponsePollIntervalMs);
+  }
+  return true;
+}
+
+bool BackendClient::ensureConnected(bool &reusedOut, uint32_t traceId) {
+  reusedOut = false;
+  if (connectionOpen && netClient.connected()) {
+    reusedOut = true;
+    return true;
+  }
+  if (connectionOpen) {
+    closeConnection();
+  }
+
+  // Endpoints are tried best first. One that cannot be reached is held
+  // down and the next is tried straight away, so a dead backend costs a
+  // tap a single connect timeout.
+  uint32_t tried[EndpointDirectory::kMaxEndpoints];
+  size_t triedCount = 0;
+  while (triedCount < EndpointDirectory::kMaxEndpoints) {
+    EndpointDirectory::Endpoint *endpoint = endpoints.best(millis(), tried, triedCount);
+    if (endpoint == nullptr) {
+      break;
+    }
+    tried[triedCount++] = endpoint->id;
+    if (connectTo(*endpoint, traceId)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BackendClient::addressOf(const EndpointDirectory::Endpoint &endpoint, IPAddress &out) {
+  if (endpoint.discovered) {
+    out = endpoint.ip;
+    return true;
+  }
+  return resolver.lookup(endpoint.host, out);
+}
+
+bool BackendClient::connectTo(EndpointDirectory::Endpoint &endpoint, uint32_t traceId) {
+  IPAddress address;
+  if (!addressOf(endpoint, address)) {
+    Serial.printf("[Backend] ERROR: %s has not been resolved yet\n", endpoint.host);
+    Serial.println("[Backend] Make sure:");
+    Serial.println("  - The host device is running");
+    Serial.println("  - An mDNS service is advertising the hostname");
+    Serial.println("  - Both devices share the same network");
+    return false;
+  }
+  tracer.mark(traceId, TapTracer::Stage::Resolved);
+
+  unsigned long connectStart = millis();
+  unsigned long timeoutMs = endpoint.rtt.timeoutMs();
+  if (!netClient.connect(address, endpoint.port, static_cast<int32_t>(timeoutMs))) {
+    Serial.printf("[Backend] ERROR: TCP connect to %s (%s) failed\n", endpoint.hostHeader,
+                  address.toString().c_str());
+    endpoints.recordFailure(endpoint, millis());
+    return false;
+  }
+  netClient.setNoDelay(true);
+  tracer.mark(traceId, TapTracer::Stage::Connected);
+
+  // The handshake gets its own timeout: a full one is dominated by
+  // public-key operations on the device, not by the round trip.
+  if (netClient.isSecure()) {
+    if (!netClient.handshake(endpoint.host, BACKEND_HTTP_TIMEOUT_MS)) {
+      Serial.printf("[Backend] ERROR: TLS handshake with %s failed\n", endpoint.hostHeader);
+      endpoints.recordFailure(endpoint, millis());
+      return false;
+    }
+    tracer.mark(traceId, TapTracer::Stage::Secured);
+    const TlsClient::Handshake &handshake = netClient.lastHandshake();
+    stats.lastHandshakeMs = handshake.durationMs;
+    if (handshake.resumed) {
+      stats.resumedHandshakes++;
+    }
+  }
+
+  unsigned long connectMs = millis() - connectStart;
+  stats.connectsOpened++;
+  stats.totalConnectMs += connectMs;
+  stats.lastConnectMs = connectMs;
+
+  connectedAddress = address;
+  connectedEndpointId = endpoint.id;
+  http.reset();
+  connectionOpen = true;
+  const char *tls = "";
+  if (netClient.isSecure()) {
+    tls = netClient.lastHandshake().resumed ? ", TLS session resumed" : ", full TLS handshake";
+  }
+  Serial.printf("[Backend] Persistent connection to %s (%s) opened in %lums%s\n",
+                endpoint.hostHeader, connectedAddress.toString().c_str(), connectMs, tls);
+  publishBreakerState();
+  return true;
+}
 
-  vTaskDelete(nullptr);
+void BackendClient::closeConnection() {
+  netClient.stop();
+  http.reset();
+  pendingPrepareResponses = 0;
+  connectionOpen = false;
 }
@@ -0,0 +1,342 @@
+/*
+ * CardCatalog.cpp
+ *
+ * Implements the flash-backed card catalog and its delta sync.
+ */
+
+#include "CardCatalog.h"
+
+#include <Preferences.h>
+#include <cstring>
+
+namespace {
+constexpr const char *kNamespace = "catalog";
+constexpr const char *kHeaderKey = "header";
+constexpr const char *kCardsKey = "cards";
+constexpr uint32_t    kMagic = 0x54414343;  // "CCAT"
+constexpr uint16_t    kFormatVersion = 1;
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Parses exactly `count` bytes of hex from `text`.
+bool parseHexBytes(const char *text, size_t length, uint8_t *out, size_t count) {
+  if (length != count * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    int high = hexValue(text[2 * i]);
+    int low = hexValue(text[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    out[i] = static_cast<uint8_t>((high << 4) | low);
+  }
+  return true;
+}
+}  // namespace
+
+void CardCatalog::begin() {
+  Preferences prefs;
+  if (!prefs.begin(kNamespace, true)) {
+    Serial.println("[Catalog] No stored catalog; waiting for the first sync");
+    return;
+  }
+
+  StoredHeader header{};
+  bool valid = prefs.getBytes(kHeaderKey, &header, sizeof(header)) == sizeof(header) &&
+               header.magic == kMagic && header.version == kFormatVersion &&
+               header.count <= CARD_CATALOG_CAPACITY;
+  size_t bytes = valid ? header.count * sizeof(Card) : 0;
+  if (valid && bytes > 0) {
+    valid = prefs.getBytesLength(kCardsKey) == bytes &&
+            prefs.getBytes(kCardsKey, _cards, bytes) == bytes;
+  }
+  prefs.end();
+
+  if (!valid) {
+    Serial.println("[Catalog] Stored catalog missing or unreadable; waiting for a full sync");
+    return;
+  }
+
+  portENTER_CRITICAL(&_lock);
+  _count = header.count;
+  _version = header.catalogVersion;
+  _complete = header.complete != 0;
+  portEXIT_CRITICAL(&_lock);
+  Serial.printf("[Catalog] Loaded version %lu with %u card(s)\n",
+                static_cast<unsigned long>(_version), static_cast<unsigned int>(_count));
+}
+
+CardCatalog::Lookup CardCatalog::lookup(const char *uidHex, Card &out) const {
+  Card key;
+  if (!parseUid(uidHex, key)) {
+    return Lookup::Unavailable;
+  }
+
+  Lookup result = Lookup::Unavailable;
+  portENTER_CRITICAL(&_lock);
+  size_t index = lowerBound(key);
+  if (index < _count && compare(_cards[index], key) == 0) {
+    out = _cards[index];
+    result = Lookup::Known;
+  } else if (_complete) {
+    result = Lookup::Unknown;
+  }
+  portEXIT_CRITICAL(&_lock);
+  return result;
+}
+
+uint32_t CardCatalog::version() const {
+  portENTER_CRITICAL(&_lock);
+  uint32_t version = _version;
+  portEXIT_CRITICAL(&_lock);
+  return version;
+}
+
+size_t CardCatalog::size() const {
+  portENTER_CRITICAL(&_lock);
+  size_t count = _count;
+  portEXIT_CRITICAL(&_lock);
+  return count;
+}
+
+bool CardCatalog::parseUid(const char *uidHex, Card &card) {
+  if (uidHex == nullptr) {
+    return false;
+  }
+  size_t length = strlen(uidHex);
+  if (length == 0 || length % 2 != 0 || length / 2 > kMaxUidBytes) {
+    return false;
+  }
+  card = Card();
+  card.uidLength = static_cast<uint8_t>(length / 2);
+  return parseHexBytes(uidHex, length, card.uid, card.uidLength);
+}
+
+void CardCatalog::beginReplace() {
+  // Until the replacement is committed the catalog cannot vouch for
+  // unknown cards, and a restart must ask for a full sync again.
+  portENTER_CRITICAL(&_lock);
+  _count = 0;
+  _version = 0;
+  _complete = false;
+  portEXIT_CRITICAL(&_lock);
+  _overflowed = false;
+}
+
+void CardCatalog::upsert(const Card &card) {
+  portENTER_CRITICAL(&_lock);
+  size_t index = lowerBound(card);
+  bool stored = true;
+  if (index < _count && compare(_cards[index], card) == 0) {
+    _cards[index] = card;
+  } else if (_count < CARD_CATALOG_CAPACITY) {
+    memmove(&_cards[index + 1], &_cards[index], (_count - index) * sizeof(Card));
+    _cards[index] = card;
+    _count++;
+  } else {
+    stored = false;
+    _complete = false;
+  }
+  portEXIT_CRITICAL(&_lock);
+
+  if (!stored && !_overflowed) {
+    Serial.printf("[Catalog] Catalog full (%u cards); unknown cards go to the backend\n",
+                  static_cast<unsigned int>(CARD_CATALOG_CAPACITY));
+    _overflowed = true;
+  }
+}
+
+void CardCatalog::remove(const Card &card) {
+  portENTER_CRITICAL(&_lock);
+  size_t index = lowerBound(card);
+  if (index < _count && compare(_cards[index], card) == 0) {
+    memmove(&_cards[index], &_cards[index + 1], (_count - index - 1) * sizeof(Card));
+    _count--;
+  }
+  portEXIT_CRITICAL(&_lock);
+}
+
+void CardCatalog::finishSync(uint32_t version) {
+  portENTER_CRITICAL(&_lock);
+  _version = version;
+  _complete = !_overflowed;
+  portEXIT_CRITICAL(&_lock);
+  persist();
+}
+
+void CardCatalog::persist() {
+  // Only the worker task modifies the cards, so they can be read here
+  // without the lock.
+  StoredHeader header{};
+  header.magic = kMagic;
+  header.version = kFormatVersion;
+  header.count = static_cast<uint16_t>(_count);
+  header.catalogVersion = _version;
+  header.complete = _complete ? 1 : 0;
+
+  Preferences prefs;
+  if (!prefs.begin(kNamespace, false)) {
+    Serial.println("[Catalog] Failed to open NVS namespace for writing");
+    return;
+  }
+  // The header is written last and is validated against the card blob
+  // on load, so an interrupted write is detected.
+  bool ok = true;
+  if (_count > 0) {
+    size_t bytes = _count * sizeof(Card);
+    ok = prefs.putBytes(kCardsKey, _cards, bytes) == bytes;
+  } else {
+    prefs.remove(kCardsKey);
+  }
+  ok = ok && prefs.putBytes(kHeaderKey, &header, sizeof(header)) == sizeof(header);
+  prefs.end();
+  if (!ok) {
+    Serial.println("[Catalog] Failed to persist catalog");
+  }
+}
+
+size_t CardCatalog::lowerBound(const Card &key) const {
+  size_t low = 0;
+  size_t high = _count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (compare(_cards[mid], key) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+int CardCatalog::compare(const Card &a, const Card &b) {
+  if (a.uidLength != b.uidLength) {
+    return a.uidLength < b.uidLength ? -1 : 1;
+  }
+  return memcmp(a.uid, b.uid, a.uidLength);
+}
+
+bool CardCatalog::Updater::onHeaders(const HttpResponse &response) {
+  // Other statuses are read and discarded so the connection stays usable.
+  _active = response.statusCode == 200;
+  return true;
+}
+
+bool CardCatalog::Updater::onBody(const uint8_t *data, size_t length) {
+  if (!_active) {
+    return true;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    char c = static_cast<char>(data[i]);
+    if (c == '\n') {
+      _line[_lineLength] = '\0';
+      if (!processLine()) {
+        return false;
+      }
+      _lineLength = 0;
+      continue;
+    }
+    if (c == '\r') {
+      continue;
+    }
+    if (_lineLength >= kMaxLineLength) {
+      Serial.println("[Catalog] Sync line too long; aborting");
+      return false;
+    }
+    _line[_lineLength++] = c;
+  }
+  return true;
+}
+
+bool CardCatalog::Updater::processLine() {
+  if (_lineLength == 0 || _line[0] == '#') {
+    return true;
+  }
+
+  if (!_sawHeader) {
+    char mode[8] = {0};
+    unsigned long version = 0;
+    if (sscanf(_line, "catalog %lu %7s", &version, mode) != 2) {
+      Serial.printf("[Catalog] Unexpected sync header: %s\n", _line);
+      return false;
+    }
+    _sawHeader = true;
+    _version = static_cast<uint32_t>(version);
+    _full = strcmp(mode, "full") == 0;
+    if (_full) {
+      _catalog.beginReplace();
+    }
+    return true;
+  }
+
+  // "+ <uid> [rrggbb]" or "- <uid>"
+  char op = _line[0];
+  if ((op != '+' && op != '-') || _line[1] != ' ') {
+    Serial.printf("[Catalog] Malformed sync line: %s\n", _line);
+    return false;
+  }
+  char *uid = _line + 2;
+  char *color = strchr(uid, ' ');
+  if (color != nullptr) {
+    *color++ = '\0';
+  }
+
+  Card card;
+  if (!parseUid(uid, card)) {
+    Serial.printf("[Catalog] Ignoring malformed UID %s\n", uid);
+    return true;
+  }
+  if (op == '-') {
+    _catalog.remove(card);
+    _removed++;
+    return true;
+  }
+
+  uint8_t rgb[3];
+  if (color != nullptr && parseHexBytes(color, strlen(color), rgb, sizeof(rgb))) {
+    card.flags |= kHasColor;
+    card.red = rgb[0];
+    card.green = rgb[1];
+    card.blue = rgb[2];
+  }
+  _catalog.upsert(card);
+  _added++;
+  return true;
+}
+
+bool CardCatalog::Updater::commit() {
+  if (!_active) {
+    return false;
+  }
+  // A final record without a trailing newline still counts.
+  if (_lineLength > 0) {
+    _line[_lineLength] = '\0';
+    bool ok = processLine();
+    _lineLength = 0;
+    if (!ok) {
+      return false;
+    }
+  }
+  if (!_sawHeader) {
+    Serial.println("[Catalog] Sync response without a header");
+    return false;
+  }
+
+  _catalog.finishSync(_version);
+  Serial.printf("[Catalog] Synced to version %lu (%s): +%u -%u, %u card(s)\n",
+                static_cast<unsigned long>(_version), _full ? "full" : "delta", _added,
+                _removed, static_cast<unsigned int>(_catalog.size()));
+  return true;
+}
@@ -0,0 +1,23 @@
+/*
+ * CheckSchedule.cpp
+ *
+ * Implements the jittered schedule for periodic checks.
+ */
+
+#include "CheckSchedule.h"
+
+void CheckSchedule::start(unsigned long now) {
+  if (_started) {
+    return;
+  }
+  _nextAt = now + _randomDelay(_firstSpreadMs);
+  _started = true;
+}
+
+bool CheckSchedule::due(unsigned long now) const {
+  return _started && static_cast<long>(now - _nextAt) >= 0;
+}
+
+void CheckSchedule::attempted(unsigned long now) {
+  _nextAt = now + _intervalMs + _randomDelay(_jitterMs);
+}
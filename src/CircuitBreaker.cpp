@@ -0,0 +1,74 @@
+/*
+ * CircuitBreaker.cpp
+ *
+ * Implements the closed/open/half-open state machine.
+ */
+
+#include "CircuitBreaker.h"
+
+bool CircuitBreaker::allowRequest(unsigned long now) {
+  if (_state != State::Open) {
+    return true;
+  }
+  if (now - _openedAt < _currentOpenMs) {
+    return false;
+  }
+  transition(State::HalfOpen, now);
+  return true;
+}
+
+void CircuitBreaker::recordSuccess() {
+  _consecutiveFailures = 0;
+  if (_state != State::Closed) {
+    transition(State::Closed, millis());
+    _currentOpenMs = _openMs;
+  }
+}
+
+void CircuitBreaker::recordFailure(unsigned long now) {
+  if (_consecutiveFailures < UINT8_MAX) {
+    _consecutiveFailures++;
+  }
+
+  if (_state == State::HalfOpen) {
+    // The probe failed: stay away for longer next time.
+    _currentOpenMs = min(_currentOpenMs * 2, _maxOpenMs);
+    transition(State::Open, now);
+    return;
+  }
+  if (_state == State::Closed && _consecutiveFailures >= _failureThreshold) {
+    transition(State::Open, now);
+  }
+}
+
+unsigned long CircuitBreaker::retryInMs(unsigned long now) const {
+  if (_state != State::Open) {
+    return 0;
+  }
+  unsigned long elapsed = now - _openedAt;
+  return elapsed >= _currentOpenMs ? 0 : _currentOpenMs - elapsed;
+}
+
+const char *CircuitBreaker::stateName(State state) {
+  switch (state) {
+    case State::Closed:
+      return "closed";
+    case State::Open:
+      return "open";
+    case State::HalfOpen:
+      return "half-open";
+  }
+  return "unknown";
+}
+
+void CircuitBreaker::transition(State next, unsigned long now) {
+  if (next == State::Open) {
+    _openedAt = now;
+    _timesOpened++;
+    Serial.printf("[Breaker] %s: %s -> open after %u consecutive failure(s), probing in %lums\n",
+                  _name, stateName(_state), _consecutiveFailures, _currentOpenMs);
+  } else {
+    Serial.printf("[Breaker] %s: %s -> %s\n", _name, stateName(_state), stateName(next));
+  }
+  _state = next;
+}
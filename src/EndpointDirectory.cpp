@@ -0,0 +1,217 @@
+/*
+ * EndpointDirectory.cpp
+ *
+ * Implements backend endpoint ranking and hold-down.
+ */
+
+#include "EndpointDirectory.h"
+
+void EndpointDirectory::addStatic(const char *host, uint16_t port, uint16_t priority) {
+  Endpoint *endpoint = claimSlot();
+  if (endpoint == nullptr) {
+    return;
+  }
+  strncpy(endpoint->host, host, sizeof(endpoint->host) - 1);
+  snprintf(endpoint->hostHeader, sizeof(endpoint->hostHeader), "%s:%u", host, port);
+  endpoint->port = port;
+  endpoint->priority = priority;
+}
+
+void EndpointDirectory::merge(const HostResolver::ServiceInstance *instances, size_t count) {
+  bool seen[kMaxEndpoints] = {false};
+  for (size_t i = 0; i < count; ++i) {
+    const HostResolver::ServiceInstance &instance = instances[i];
+    Endpoint *endpoint = nullptr;
+    for (size_t slot = 0; slot < kMaxEndpoints; ++slot) {
+      Endpoint &candidate = _endpoints[slot];
+      if (candidate.id != 0 && candidate.discovered && candidate.ip == instance.ip &&
+          candidate.port == instance.port) {
+        endpoint = &candidate;
+        seen[slot] = true;
+        break;
+      }
+    }
+    if (endpoint == nullptr) {
+      endpoint = claimSlot();
+      if (endpoint == nullptr) {
+        break;
+      }
+      seen[endpoint - _endpoints] = true;
+      endpoint->discovered = true;
+      endpoint->ip = instance.ip;
+      endpoint->port = instance.port;
+    }
+    strncpy(endpoint->host, instance.host, sizeof(endpoint->host) - 1);
+    snprintf(endpoint->hostHeader, sizeof(endpoint->hostHeader), "%s:%u", instance.host,
+             instance.port);
+    endpoint->priority = instance.priority;
+    endpoint->weight = instance.weight;
+  }
+
+  for (size_t slot = 0; slot < kMaxEndpoints; ++slot) {
+    Endpoint &endpoint = _endpoints[slot];
+    if (endpoint.id != 0 && endpoint.discovered && !seen[slot]) {
+      Serial.printf("[Endpoints] %s is no longer advertised\n", endpoint.hostHeader);
+      endpoint = Endpoint();
+    }
+  }
+}
+
+EndpointDirectory::Endpoint *EndpointDirectory::find(uint32_t id) {
+  if (id == 0) {
+    return nullptr;
+  }
+  for (Endpoint &endpoint : _endpoints) {
+    if (endpoint.id == id) {
+      return &endpoint;
+    }
+  }
+  return nullptr;
+}
+
+EndpointDirectory::Endpoint *EndpointDirectory::best(unsigned long now, const uint32_t *skip,
+                                                     size_t skipCount) {
+  Endpoint *healthy = nullptr;
+  Endpoint *soonest = nullptr;
+  for (Endpoint &endpoint : _endpoints) {
+    if (endpoint.id == 0 || isListed(endpoint.id, skip, skipCount)) {
+      continue;
+    }
+    if (endpoint.isHealthy(now)) {
+      if (healthy == nullptr || ranksBefore(endpoint, *healthy)) {
+        healthy = &endpoint;
+      }
+    } else if (soonest == nullptr ||
+               static_cast<long>(endpoint.downUntil - soonest->downUntil) < 0) {
+      soonest = &endpoint;
+    }
+  }
+  if (healthy == nullptr || !healthy->rtt.hasSamples()) {
+    return healthy != nullptr ? healthy : soonest;
+  }
+
+  // Endpoints the best one would not be switched away for share the
+  // load by weight, as DNS-SD intends (RFC 2782): each is picked with
+  // probability weight / total.
+  uint32_t totalWeight = 0;
+  for (const Endpoint &endpoint : _endpoints) {
+    if (sharesLoadWith(endpoint, *healthy, now) && !isListed(endpoint.id, skip, skipCount)) {
+      totalWeight += endpoint.weight;
+    }
+  }
+  if (totalWeight == 0) {
+    return healthy;
+  }
+  uint32_t pick = static_cast<uint32_t>(random(static_cast<long>(totalWeight)));
+  for (Endpoint &endpoint : _endpoints) {
+    if (!sharesLoadWith(endpoint, *healthy, now) || isListed(endpoint.id, skip, skipCount)) {
+      continue;
+    }
+    if (pick < endpoint.weight) {
+      return &endpoint;
+    }
+    pick -= endpoint.weight;
+  }
+  return healthy;
+}
+
+bool EndpointDirectory::shouldSwitch(const Endpoint &current, const Endpoint &candidate) const {
+  if (candidate.priority != current.priority) {
+    return candidate.priority < current.priority;
+  }
+  // Unmeasured endpoints are only explored on reconnects, never by
+  // dropping a working connection.
+  if (!candidate.rtt.hasSamples() || !current.rtt.hasSamples()) {
+    return false;
+  }
+  return clearlyFaster(candidate, current);
+}
+
+void EndpointDirectory::recordSuccess(Endpoint &endpoint, unsigned long rttMs) {
+  endpoint.rtt.addSample(rttMs);
+  endpoint.consecutiveFailures = 0;
+}
+
+void EndpointDirectory::recordFailure(Endpoint &endpoint, unsigned long now) {
+  if (endpoint.consecutiveFailures < UINT8_MAX) {
+    endpoint.consecutiveFailures++;
+  }
+  endpoint.failures++;
+  endpoint.downUntil = now + BACKEND_ENDPOINT_HOLDDOWN_MS;
+  Serial.printf("[Endpoints] %s failed (%u in a row); holding it down for %lums\n",
+                endpoint.hostHeader, endpoint.consecutiveFailures,
+                BACKEND_ENDPOINT_HOLDDOWN_MS);
+}
+
+size_t EndpointDirectory::size() const {
+  size_t count = 0;
+  for (const Endpoint &endpoint : _endpoints) {
+    count += endpoint.id != 0 ? 1 : 0;
+  }
+  return count;
+}
+
+size_t EndpointDirectory::healthyCount(unsigned long now) const {
+  size_t count = 0;
+  for (const Endpoint &endpoint : _endpoints) {
+    count += endpoint.id != 0 && endpoint.isHealthy(now) ? 1 : 0;
+  }
+  return count;
+}
+
+void EndpointDirectory::log() const {
+  unsigned long now = millis();
+  for (const Endpoint &endpoint : _endpoints) {
+    if (endpoint.id == 0) {
+      continue;
+    }
+    Serial.printf("[Endpoints]   %-28s prio %u weight %u srtt %s%lums %s\n", endpoint.hostHeader,
+                  endpoint.priority, endpoint.weight, endpoint.rtt.hasSamples() ? "" : "~",
+                  endpoint.rtt.srttMs(), endpoint.isHealthy(now) ? "up" : "held down");
+  }
+}
+
+bool EndpointDirectory::clearlyFaster(const Endpoint &a, const Endpoint &b) {
+  return a.rtt.srttMs() * 4 < b.rtt.srttMs() * 3;
+}
+
+bool EndpointDirectory::sharesLoadWith(const Endpoint &endpoint, const Endpoint &best,
+                                       unsigned long now) {
+  return endpoint.id != 0 && endpoint.isHealthy(now) && endpoint.priority == best.priority &&
+         endpoint.rtt.hasSamples() && !clearlyFaster(best, endpoint);
+}
+
+bool EndpointDirectory::isListed(uint32_t id, const uint32_t *ids, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (ids[i] == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool EndpointDirectory::ranksBefore(const Endpoint &a, const Endpoint &b) {
+  if (a.priority != b.priority) {
+    return a.priority < b.priority;
+  }
+  // Within a priority, an endpoint without measurements is tried first
+  // so that every candidate gets an RTT sample.
+  if (a.rtt.hasSamples() != b.rtt.hasSamples()) {
+    return !a.rtt.hasSamples();
+  }
+  if (a.rtt.hasSamples() && a.rtt.srttMs() != b.rtt.srttMs()) {
+    return a.rtt.srttMs() < b.rtt.srttMs();
+  }
+  return a.weight > b.weight;
+}
+
+EndpointDirectory::Endpoint *EndpointDirectory::claimSlot() {
+  for (Endpoint &endpoint : _endpoints) {
+    if (endpoint.id == 0) {
+      endpoint = Endpoint();
+      endpoint.id = _nextId++;
+      return &endpoint;
+    }
+  }
+  return nullptr;
+}
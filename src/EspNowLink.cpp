@@ -0,0 +1,165 @@
+/*
+ * EspNowLink.cpp
+ *
+ * Implements the ESP-NOW HubLink.
+ */
+
+#include "EspNowLink.h"
+
+#include <WiFi.h>
+#include <esp_wifi.h>
+
+namespace {
+// ESP-NOW callbacks carry no context pointer; there is one radio.
+EspNowLink *gLink = nullptr;
+}  // namespace
+
+bool EspNowLink::begin(uint8_t channel) {
+  if (_started) {
+    return true;
+  }
+  // Power save makes the radio sleep between beacons and miss frames.
+  esp_wifi_set_ps(WIFI_PS_NONE);
+  if (channel != 0) {
+    setChannel(channel);
+  }
+  esp_err_t error = esp_now_init();
+  if (error != ESP_OK) {
+    Serial.printf("[Hub] ESP-NOW init failed (%d)\n", static_cast<int>(error));
+    return false;
+  }
+  gLink = this;
+  esp_now_register_recv_cb(receiveCallback);
+  esp_now_register_send_cb(sendCallback);
+  _started = true;
+
+  HubAddress self = localAddress();
+  Serial.printf("[Hub] ESP-NOW up on channel %u as %02X:%02X:%02X:%02X:%02X:%02X\n",
+                this->channel(), self.bytes[0], self.bytes[1], self.bytes[2], self.bytes[3],
+                self.bytes[4], self.bytes[5]);
+  return true;
+}
+
+void EspNowLink::setChannel(uint8_t channel) {
+  // The channel can only be forced while no association owns it.
+  esp_wifi_set_promiscuous(true);
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  esp_wifi_set_promiscuous(false);
+}
+
+uint8_t EspNowLink::findChannel(const char *ssid) {
+  int16_t count = WiFi.scanNetworks();
+  uint8_t channel = 0;
+  int32_t bestRssi = INT32_MIN;
+  for (int16_t i = 0; i < count; ++i) {
+    // Several access points may share the SSID; the gateway most likely
+    // sits on the strongest one.
+    if (WiFi.SSID(i) == ssid && WiFi.RSSI(i) > bestRssi) {
+      bestRssi = WiFi.RSSI(i);
+      channel = static_cast<uint8_t>(WiFi.channel(i));
+    }
+  }
+  WiFi.scanDelete();
+  return channel;
+}
+
+HubAddress EspNowLink::localAddress() const {
+  HubAddress address;
+  esp_wifi_get_mac(WIFI_IF_STA, address.bytes);
+  return address;
+}
+
+uint8_t EspNowLink::channel() const {
+  uint8_t primary = 0;
+  wifi_second_chan_t secondary = WIFI_SECOND_CHAN_NONE;
+  esp_wifi_get_channel(&primary, &secondary);
+  return primary;
+}
+
+bool EspNowLink::send(const HubAddress &to, const uint8_t *data, size_t length) {
+  if (!_started || length > kMaxFrameLength || !ensurePeer(to)) {
+    return false;
+  }
+  if (esp_now_send(to.bytes, data, length) != ESP_OK) {
+    return false;
+  }
+  _sent.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool EspNowLink::receive(HubAddress &from, uint8_t *data, size_t &length) {
+  Frame frame;
+  if (!_received.pop(frame)) {
+    return false;
+  }
+  from = frame.from;
+  length = frame.length < length ? frame.length : length;
+  memcpy(data, frame.data, length);
+  return true;
+}
+
+EspNowLink::Stats EspNowLink::stats() const {
+  Stats stats;
+  stats.sent = _sent.load(std::memory_order_relaxed);
+  stats.notAcknowledged = _notAcknowledged.load(std::memory_order_relaxed);
+  stats.received = _receivedCount.load(std::memory_order_relaxed);
+  stats.overflows = _overflows.load(std::memory_order_relaxed);
+  return stats;
+}
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+void EspNowLink::receiveCallback(const esp_now_recv_info_t *info, const uint8_t *data,
+                                 int length) {
+  const uint8_t *mac = info->src_addr;
+#else
+void EspNowLink::receiveCallback(const uint8_t *mac, const uint8_t *data, int length) {
+#endif
+  // Runs on the Wi-Fi task, the queue's only producer.
+  EspNowLink *link = gLink;
+  if (link == nullptr || length <= 0 || static_cast<size_t>(length) > kMaxFrameLength) {
+    return;
+  }
+  Frame frame;
+  memcpy(frame.from.bytes, mac, HubAddress::kLength);
+  frame.length = static_cast<uint8_t>(length);
+  memcpy(frame.data, data, length);
+  if (!link->_received.push(frame)) {
+    link->_overflows.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  link->_receivedCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EspNowLink::sendCallback(const uint8_t *mac, esp_now_send_status_t status) {
+  EspNowLink *link = gLink;
+  HubAddress to;
+  memcpy(to.bytes, mac, HubAddress::kLength);
+  // Broadcasts are never acknowledged by the radio; only count unicast
+  // frames that went unanswered.
+  if (link != nullptr && status != ESP_NOW_SEND_SUCCESS && !to.isBroadcast()) {
+    link->_notAcknowledged.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool EspNowLink::ensurePeer(const HubAddress &address) {
+  if (esp_now_is_peer_exist(address.bytes)) {
+    return true;
+  }
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, address.bytes, HubAddress::kLength);
+  // Channel 0 means whatever channel the radio is on.
+  peer.channel = 0;
+  peer.ifidx = WIFI_IF_STA;
+  peer.encrypt = false;
+  esp_err_t error = esp_now_add_peer(&peer);
+  if (error == ESP_ERR_ESPNOW_FULL) {
+    // A gateway answers every satellite it hears; make room rather than
+    // go silent. A dropped peer is added again on its next frame.
+    esp_now_peer_info_t first = {};
+    if (esp_now_fetch_peer(true, &first) == ESP_OK) {
+      esp_now_del_peer(first.peer_addr);
+    }
+    error = esp_now_add_peer(&peer);
+  }
+  return error == ESP_OK;
+}
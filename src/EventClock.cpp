@@ -0,0 +1,160 @@
+/*
+ * EventClock.cpp
+ *
+ * Implements the SNTP-fed wall clock model.
+ */
+
+#include "EventClock.h"
+
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <time.h>
+
+#include "Config.h"
+#include "freertos/FreeRTOS.h"
+
+namespace {
+constexpr int64_t kUsPerSecond = 1000000;
+// Drift is only measured over intervals long enough for SNTP's
+// millisecond-level jitter to be small against it.
+constexpr int64_t kMinDriftIntervalUs = 60 * kUsPerSecond;
+constexpr float   kDriftSmoothing = 0.25f;
+// Anything beyond this is a bad sample, not a crystal.
+constexpr float   kMaxDriftPpm = 500.0f;
+
+portMUX_TYPE gLock = portMUX_INITIALIZER_UNLOCKED;
+bool         gStarted = false;
+bool         gSynced = false;
+bool         gHasDrift = false;
+int64_t      gAnchorTimerUs = 0;
+int64_t      gAnchorWallUs = 0;
+float        gDriftPpm = 0.0f;
+int64_t      gLastIssuedUs = 0;
+EventClock::Stats gStats;
+
+// Caller holds gLock.
+int64_t project(int64_t timerUs) {
+  int64_t elapsed = timerUs - gAnchorTimerUs;
+  return gAnchorWallUs + elapsed + static_cast<int64_t>(elapsed * (gDriftPpm / 1e6f));
+}
+}  // namespace
+
+void EventClock::begin() {
+  if (gStarted) {
+    return;
+  }
+  gStarted = true;
+  sntp_set_time_sync_notification_cb(EventClock::onSync);
+  sntp_set_sync_interval(CLOCK_SYNC_INTERVAL_MS);
+  // Only starts the SNTP client; the first sync completes in the
+  // background a few hundred milliseconds later.
+  configTime(0, 0, CLOCK_NTP_SERVER, CLOCK_NTP_FALLBACK_SERVER);
+  Serial.printf("[Clock] SNTP started with %s, %s\n", CLOCK_NTP_SERVER,
+                CLOCK_NTP_FALLBACK_SERVER);
+}
+
+bool EventClock::isSynced() {
+  portENTER_CRITICAL(&gLock);
+  bool synced = gSynced;
+  portEXIT_CRITICAL(&gLock);
+  return synced;
+}
+
+int64_t EventClock::nowUs() {
+  int64_t timerUs = esp_timer_get_time();
+  portENTER_CRITICAL(&gLock);
+  int64_t wallUs = 0;
+  if (gSynced) {
+    wallUs = project(timerUs);
+    if (wallUs < gLastIssuedUs) {
+      wallUs = gLastIssuedUs;
+    }
+    gLastIssuedUs = wallUs;
+  }
+  portEXIT_CRITICAL(&gLock);
+  return wallUs;
+}
+
+int64_t EventClock::wallUsAt(int64_t timerUs) {
+  portENTER_CRITICAL(&gLock);
+  int64_t wallUs = gSynced ? project(timerUs) : 0;
+  portEXIT_CRITICAL(&gLock);
+  return wallUs;
+}
+
+int64_t EventClock::wallUsAtMillis(unsigned long ms) {
+  unsigned long ageMs = millis() - ms;
+  return wallUsAt(esp_timer_get_time() - static_cast<int64_t>(ageMs) * 1000);
+}
+
+const char *EventClock::format(int64_t wallUs, char *out, size_t length) {
+  if (wallUs <= 0) {
+    snprintf(out, length, "unsynced");
+    return out;
+  }
+  time_t seconds = static_cast<time_t>(wallUs / kUsPerSecond);
+  struct tm utc;
+  gmtime_r(&seconds, &utc);
+  snprintf(out, length, "%04d-%02d-%02dT%02d:%02d:%02d.%06luZ", utc.tm_year + 1900,
+           utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+           static_cast<unsigned long>(wallUs % kUsPerSecond));
+  return out;
+}
+
+EventClock::Stats EventClock::stats() {
+  portENTER_CRITICAL(&gLock);
+  Stats stats = gStats;
+  stats.synced = gSynced;
+  stats.driftPpm = gDriftPpm;
+  portEXIT_CRITICAL(&gLock);
+  return stats;
+}
+
+void EventClock::onSync(struct timeval *tv) {
+  // Runs on the lwIP task right after SNTP has set the system time.
+  int64_t timerUs = esp_timer_get_time();
+  int64_t wallUs = static_cast<int64_t>(tv->tv_sec) * kUsPerSecond + tv->tv_usec;
+  addSample(timerUs, wallUs);
+
+  Stats current = stats();
+  char text[32];
+  Serial.printf("[Clock] SNTP sync #%lu: %s, error %lldus, drift %.1f ppm\n",
+                static_cast<unsigned long>(current.syncs), format(wallUs, text, sizeof(text)),
+                static_cast<long long>(current.lastErrorUs), current.driftPpm);
+}
+
+void EventClock::addSample(int64_t timerUs, int64_t wallUs) {
+  portENTER_CRITICAL(&gLock);
+  gStats.syncs++;
+  gStats.lastSyncAtUs = timerUs;
+  if (!gSynced) {
+    gSynced = true;
+    gStats.lastErrorUs = 0;
+  } else {
+    int64_t errorUs = wallUs - project(timerUs);
+    int64_t elapsedUs = timerUs - gAnchorTimerUs;
+    gStats.lastErrorUs = errorUs;
+    if (llabs(errorUs) > static_cast<int64_t>(CLOCK_STEP_THRESHOLD_MS) * 1000) {
+      // Someone moved the clock, or the previous sync was bad: start
+      // over rather than bend the drift estimate.
+      gStats.steps++;
+      gHasDrift = false;
+      gDriftPpm = 0.0f;
+    } else if (elapsedUs >= kMinDriftIntervalUs) {
+      float measured = static_cast<float>(wallUs - gAnchorWallUs - elapsedUs) * 1e6f /
+                       static_cast<float>(elapsedUs);
+      if (measured > -kMaxDriftPpm && measured < kMaxDriftPpm) {
+        gDriftPpm = gHasDrift ? gDriftPpm + kDriftSmoothing * (measured - gDriftPpm) : measured;
+        gHasDrift = true;
+      }
+    } else {
+      // Too soon after the previous sync to learn anything; keep the
+      // anchor so the next interval is long enough.
+      portEXIT_CRITICAL(&gLock);
+      return;
+    }
+  }
+  gAnchorTimerUs = timerUs;
+  gAnchorWallUs = wallUs;
+  portEXIT_CRITICAL(&gLock);
+}
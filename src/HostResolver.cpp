@@ -0,0 +1,399 @@
+/*
+ * HostResolver.cpp
+ *
+ * Implements the shared background hostname resolver with a TTL cache.
+ */
+
+#include "HostResolver.h"
+
+#include <ESPmDNS.h>
+#include <WiFi.h>
+
+#include "Config.h"
+
+namespace {
+constexpr uint32_t      kTaskStackSize = 4096;
+constexpr UBaseType_t   kTaskPriority = 1;
+constexpr unsigned long kIdleWakeMs = 1000;
+constexpr unsigned long kResolvePollMs = 20;
+
+bool isLocalHost(const char *host) {
+  size_t length = strlen(host);
+  return length > 6 && strcmp(host + length - 6, ".local") == 0;
+}
+}  // namespace
+
+void HostResolver::begin() {
+  if (_task != nullptr) {
+    return;
+  }
+
+  if (_mutex == nullptr) {
+    _mutex = xSemaphoreCreateMutex();
+  }
+
+  BaseType_t created = xTaskCreate(HostResolver::taskEntry, "HostResolver",
+                                   kTaskStackSize, this, kTaskPriority, &_task);
+  if (created != pdPASS) {
+    Serial.println("[Resolver] Failed to start resolver task");
+    _task = nullptr;
+  }
+}
+
+void HostResolver::setNetworkAvailable(bool available) {
+  bool wasAvailable = _networkAvailable;
+  _networkAvailable = available;
+  if (available && !wasAvailable && _task != nullptr) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+bool HostResolver::track(const char *host) {
+  IPAddress unused;
+  lookup(host, unused);
+  return host != nullptr && host[0] != '\0' && strlen(host) < kMaxHostLength;
+}
+
+bool HostResolver::lookup(const char *host, IPAddress &out) {
+  if (host == nullptr || host[0] == '\0' || strlen(host) >= kMaxHostLength) {
+    return false;
+  }
+
+  // Literal addresses never need a lookup.
+  IPAddress literal;
+  if (literal.fromString(host)) {
+    out = literal;
+    return true;
+  }
+
+  if (_mutex == nullptr) {
+    return false;
+  }
+
+  unsigned long now = millis();
+  bool found = false;
+  bool claimed = false;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  Entry *entry = findEntry(host);
+  if (entry == nullptr) {
+    entry = claimEntry(host, now);
+    claimed = true;
+  }
+  entry->lastUsedAt = now;
+  if (entry->hasAddress) {
+    out = entry->ip;
+    found = true;
+  }
+  xSemaphoreGive(_mutex);
+
+  if (claimed && _task != nullptr) {
+    xTaskNotifyGive(_task);
+  }
+  return found;
+}
+
+bool HostResolver::resolve(const char *host, IPAddress &out, unsigned long waitMs) {
+  unsigned long start = millis();
+  while (!lookup(host, out)) {
+    if (millis() - start >= waitMs) {
+      Serial.printf("[Resolver] Timed out waiting for %s\n", host ? host : "(null)");
+      return false;
+    }
+    delay(kResolvePollMs);
+  }
+  return true;
+}
+
+void HostResolver::browseService(const char *service, const char *proto) {
+  if (service == nullptr || proto == nullptr || _mutex == nullptr) {
+    return;
+  }
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  strncpy(_service, service, kMaxServiceNameLength - 1);
+  strncpy(_proto, proto, kMaxServiceNameLength - 1);
+  _instanceCount = 0;
+  _instancesGeneration++;
+  _browsed = false;
+  xSemaphoreGive(_mutex);
+  if (_task != nullptr) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+bool HostResolver::fetchServiceInstances(uint32_t &generation, ServiceInstance *out,
+                                         size_t capacity, size_t &countOut) {
+  if (_mutex == nullptr) {
+    return false;
+  }
+  bool changed = false;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  if (generation != _instancesGeneration) {
+    generation = _instancesGeneration;
+    countOut = _instanceCount < capacity ? _instanceCount : capacity;
+    for (size_t i = 0; i < countOut; ++i) {
+      out[i] = _instances[i];
+    }
+    changed = true;
+  }
+  xSemaphoreGive(_mutex);
+  return changed;
+}
+
+bool HostResolver::fetchUpdate(const char *host, Update &out) {
+  if (_mutex == nullptr) {
+    return false;
+  }
+
+  bool changed = false;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  Entry *entry = findEntry(host);
+  if (entry != nullptr) {
+    Status status = statusOf(*entry);
+    if (status != entry->reportedStatus) {
+      entry->reportedStatus = status;
+      out.status = status;
+      out.ip = entry->ip;
+      out.startedAt = entry->startedAt;
+      out.finishedAt = entry->finishedAt;
+      changed = true;
+    }
+  }
+  xSemaphoreGive(_mutex);
+  return changed;
+}
+
+void HostResolver::taskEntry(void *param) {
+  static_cast<HostResolver *>(param)->runTask();
+}
+
+void HostResolver::runTask() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kIdleWakeMs));
+    if (!_networkAvailable) {
+      continue;
+    }
+
+    for (size_t i = 0; i < kMaxEntries; ++i) {
+      char host[kMaxHostLength];
+      bool due = false;
+      unsigned long now = millis();
+
+      xSemaphoreTake(_mutex, portMAX_DELAY);
+      Entry &entry = _entries[i];
+      if (entry.inUse && needsResolution(entry, now)) {
+        due = true;
+        strncpy(host, entry.host, sizeof(host));
+        entry.lastAttemptAt = now;
+        entry.attempted = true;
+        if (!entry.hasAddress) {
+          entry.startedAt = now;
+        }
+      }
+      xSemaphoreGive(_mutex);
+
+      if (!due) {
+        continue;
+      }
+
+      // The lookup itself runs without the lock so that cached reads
+      // are never held up by a slow mDNS query.
+      IPAddress ip;
+      bool ok = resolveNow(host, ip);
+      unsigned long finishedAt = millis();
+
+      xSemaphoreTake(_mutex, portMAX_DELAY);
+      Entry *current = findEntry(host);
+      bool changedAddress = false;
+      if (current != nullptr) {
+        current->finishedAt = finishedAt;
+        if (ok) {
+          changedAddress = !current->hasAddress || current->ip != ip;
+          current->ip = ip;
+          current->hasAddress = true;
+          current->failed = false;
+          current->resolvedAt = finishedAt;
+        } else if (!current->hasAddress) {
+          current->failed = true;
+        }
+      }
+      xSemaphoreGive(_mutex);
+
+      if (ok && changedAddress) {
+        Serial.printf("[Resolver] %s -> %s (%lums)\n", host, ip.toString().c_str(),
+                      finishedAt - now);
+      } else if (!ok) {
+        Serial.printf("[Resolver] Lookup for %s failed after %lums\n", host,
+                      finishedAt - now);
+      }
+    }
+
+    browseIfDue();
+  }
+}
+
+void HostResolver::browseIfDue() {
+  char service[kMaxServiceNameLength];
+  char proto[kMaxServiceNameLength];
+  unsigned long now = millis();
+  bool due = false;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  if (_service[0] != '\0' &&
+      (!_browsed || now - _lastBrowseAt >= HOST_RESOLVER_BROWSE_INTERVAL_MS)) {
+    due = true;
+    _browsed = true;
+    _lastBrowseAt = now;
+    memcpy(service, _service, sizeof(service));
+    memcpy(proto, _proto, sizeof(proto));
+  }
+  xSemaphoreGive(_mutex);
+  if (!due) {
+    return;
+  }
+
+  // Like host lookups, the query runs without the lock.
+  ServiceInstance found[kMaxServiceInstances];
+  size_t foundCount = 0;
+  int results = MDNS.queryService(service, proto);
+  unsigned long finishedAt = millis();
+  for (int i = 0; i < results && foundCount < kMaxServiceInstances; ++i) {
+    ServiceInstance &instance = found[foundCount];
+    instance.ip = MDNS.IP(i);
+    instance.port = MDNS.port(i);
+    if (instance.ip == IPAddress(0, 0, 0, 0) || instance.port == 0) {
+      continue;
+    }
+    snprintf(instance.host, sizeof(instance.host), "%s.local", MDNS.hostname(i).c_str());
+    if (MDNS.hasTxt(i, "priority")) {
+      instance.priority = static_cast<uint16_t>(MDNS.txt(i, "priority").toInt());
+    }
+    if (MDNS.hasTxt(i, "weight")) {
+      instance.weight = static_cast<uint16_t>(MDNS.txt(i, "weight").toInt());
+    }
+    instance.lastSeenAt = finishedAt;
+    foundCount++;
+  }
+
+  bool changed = false;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  for (size_t i = 0; i < foundCount; ++i) {
+    changed = mergeInstance(found[i]) || changed;
+  }
+  // A single missed browse does not drop an instance; only one that has
+  // been silent for a full TTL is forgotten.
+  size_t kept = 0;
+  for (size_t i = 0; i < _instanceCount; ++i) {
+    if (finishedAt - _instances[i].lastSeenAt > HOST_RESOLVER_TTL_MS) {
+      changed = true;
+      continue;
+    }
+    _instances[kept++] = _instances[i];
+  }
+  _instanceCount = kept;
+  if (changed) {
+    _instancesGeneration++;
+  }
+  size_t total = _instanceCount;
+  xSemaphoreGive(_mutex);
+
+  if (changed) {
+    Serial.printf("[Resolver] _%s._%s: %u instance(s) after browse (%lums)\n", service, proto,
+                  static_cast<unsigned int>(total), finishedAt - now);
+  }
+}
+
+bool HostResolver::mergeInstance(const ServiceInstance &instance) {
+  for (size_t i = 0; i < _instanceCount; ++i) {
+    ServiceInstance &known = _instances[i];
+    if (known.ip != instance.ip || known.port != instance.port) {
+      continue;
+    }
+    bool changed = known.priority != instance.priority || known.weight != instance.weight ||
+                   strcmp(known.host, instance.host) != 0;
+    known = instance;
+    return changed;
+  }
+  if (_instanceCount == kMaxServiceInstances) {
+    Serial.printf("[Resolver] Ignoring service instance %s; list is full\n", instance.host);
+    return false;
+  }
+  _instances[_instanceCount++] = instance;
+  return true;
+}
+
+HostResolver::Entry *HostResolver::findEntry(const char *host) {
+  for (Entry &entry : _entries) {
+    if (entry.inUse && strcmp(entry.host, host) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+HostResolver::Entry *HostResolver::claimEntry(const char *host, unsigned long now) {
+  Entry *target = nullptr;
+  for (Entry &entry : _entries) {
+    if (!entry.inUse) {
+      target = &entry;
+      break;
+    }
+    if (target == nullptr || now - entry.lastUsedAt > now - target->lastUsedAt) {
+      target = &entry;
+    }
+  }
+
+  if (target->inUse) {
+    Serial.printf("[Resolver] Cache full, evicting %s\n", target->host);
+  }
+
+  *target = Entry();
+  strncpy(target->host, host, kMaxHostLength - 1);
+  target->inUse = true;
+  target->lastUsedAt = now;
+  return target;
+}
+
+bool HostResolver::needsResolution(const Entry &entry, unsigned long now) const {
+  if (!entry.attempted) {
+    return true;
+  }
+  if (now - entry.lastAttemptAt < HOST_RESOLVER_RETRY_DELAY_MS) {
+    return false;
+  }
+  if (!entry.hasAddress) {
+    return true;
+  }
+  return now - entry.resolvedAt >= HOST_RESOLVER_TTL_MS - HOST_RESOLVER_REFRESH_AHEAD_MS;
+}
+
+bool HostResolver::resolveNow(const char *host, IPAddress &out) {
+  if (isLocalHost(host)) {
+    char name[kMaxHostLength];
+    size_t length = strlen(host) - 6;
+    memcpy(name, host, length);
+    name[length] = '\0';
+
+    IPAddress ip = MDNS.queryHost(name, HOST_RESOLVER_MDNS_TIMEOUT_MS);
+    if (ip == IPAddress(0, 0, 0, 0)) {
+      return false;
+    }
+    out = ip;
+    return true;
+  }
+
+  IPAddress ip;
+  if (WiFi.hostByName(host, ip) != 1 || ip == IPAddress(0, 0, 0, 0)) {
+    return false;
+  }
+  out = ip;
+  return true;
+}
+
+HostResolver::Status HostResolver::statusOf(const Entry &entry) {
+  if (entry.hasAddress) {
+    return Status::Resolved;
+  }
+  if (entry.failed) {
+    return Status::Failed;
+  }
+  return Status::Pending;
+}
@@ -0,0 +1,482 @@
+/*
+ * HubRelay.cpp
+ *
+ * Implements the acknowledged, deduplicated tap relay used in hub mode.
+ */
+
+#include "HubRelay.h"
+
+#include <cstring>
+
+namespace {
+constexpr uint8_t kMagic = 'M';
+constexpr uint8_t kVersion = 1;
+constexpr size_t  kHeaderLength = 7;
+constexpr size_t  kTapFixedLength = 5;
+constexpr size_t  kAckLength = 4;
+constexpr size_t  kResultLength = 5;
+constexpr size_t  kMaxFrameLength = 32;
+constexpr uint8_t kReplayWindow = 32;
+constexpr char    kHexDigits[] = "0123456789ABCDEF";
+
+void putU16(uint8_t *out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void putU32(uint8_t *out, uint32_t value) {
+  putU16(out, static_cast<uint16_t>(value));
+  putU16(out + 2, static_cast<uint16_t>(value >> 16));
+}
+
+uint16_t getU16(const uint8_t *in) {
+  return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+uint32_t getU32(const uint8_t *in) {
+  return getU16(in) | (static_cast<uint32_t>(getU16(in + 2)) << 16);
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+size_t writeHeader(uint8_t *out, uint8_t type, uint16_t bootId, uint16_t seq) {
+  out[0] = kMagic;
+  out[1] = kVersion;
+  out[2] = type;
+  putU16(out + 3, bootId);
+  putU16(out + 5, seq);
+  return kHeaderLength;
+}
+}  // namespace
+
+void HubRelay::begin(uint16_t bootId, const HubAddress &gateway) {
+  _bootId = bootId;
+  _gatewayConfigured = !gateway.isZero() && !gateway.isBroadcast();
+  _gateway = _gatewayConfigured ? gateway : HubAddress::broadcast();
+}
+
+void HubRelay::loop(unsigned long now) {
+  HubAddress from;
+  uint8_t frame[HubLink::kMaxFrameLength];
+  size_t length = sizeof(frame);
+  while (_link.receive(from, frame, length)) {
+    handleFrame(from, frame, length, now);
+    length = sizeof(frame);
+  }
+  retransmitOrExpire(now);
+}
+
+uint32_t HubRelay::sendTap(const char *uid, uint32_t traceId, unsigned long capturedAt,
+                           unsigned long now) {
+  size_t hexLength = uid != nullptr ? strlen(uid) : 0;
+  if (hexLength == 0 || hexLength > kMaxUidLength || hexLength % 2 != 0) {
+    return 0;
+  }
+  Pending *entry = allocate();
+  if (entry == nullptr) {
+    _stats.outboxFull++;
+    return 0;
+  }
+  for (size_t i = 0; i < hexLength / 2; ++i) {
+    int high = hexValue(uid[2 * i]);
+    int low = hexValue(uid[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      entry->used = false;
+      return 0;
+    }
+    entry->uid[i] = static_cast<uint8_t>((high << 4) | low);
+  }
+  entry->type = FrameType::Tap;
+  entry->uidLength = static_cast<uint8_t>(hexLength / 2);
+  entry->seq = nextSeq();
+  entry->requestId = _nextRequestId++;
+  if (_nextRequestId == 0) {
+    _nextRequestId = 1;
+  }
+  entry->traceId = traceId;
+  entry->capturedAt = capturedAt;
+  entry->firstSentAt = now;
+  _stats.tapsSent++;
+  transmit(*entry, now);
+  return entry->requestId;
+}
+
+bool HubRelay::pollResult(Result &out) {
+  if (_resultCount == 0) {
+    return false;
+  }
+  out = _results[_resultHead];
+  _resultHead = (_resultHead + 1) % kOutboxCapacity;
+  _resultCount--;
+  return true;
+}
+
+bool HubRelay::pollTap(Tap &out) {
+  if (_tapCount == 0) {
+    return false;
+  }
+  out = _taps[_tapHead];
+  _tapHead = (_tapHead + 1) % kMaxPeers;
+  _tapCount--;
+  return true;
+}
+
+bool HubRelay::sendResult(const Tap &tap, Status status, unsigned long now) {
+  Pending *entry = allocate();
+  if (entry == nullptr) {
+    _stats.outboxFull++;
+    return false;
+  }
+  entry->type = FrameType::Result;
+  entry->to = tap.from;
+  entry->seq = nextSeq();
+  entry->tapBoot = tap.bootId;
+  entry->tapSeq = tap.seq;
+  entry->status = status;
+  entry->firstSentAt = now;
+  _stats.resultsSent++;
+  transmit(*entry, now);
+  return true;
+}
+
+HubRelay::Stats HubRelay::stats() const {
+  Stats stats = _stats;
+  stats.peers = 0;
+  for (const Peer &peer : _peers) {
+    if (peer.used) {
+      stats.peers++;
+    }
+  }
+  return stats;
+}
+
+size_t HubRelay::peerStats(PeerStats *out, size_t capacity) const {
+  size_t count = 0;
+  for (const Peer &peer : _peers) {
+    if (!peer.used || count >= capacity) {
+      continue;
+    }
+    out[count] = peer.stats;
+    out[count].srttMs = peer.rtt.srttMs();
+    out[count].rttvarMs = peer.rtt.rttvarMs();
+    count++;
+  }
+  return count;
+}
+
+void HubRelay::handleFrame(const HubAddress &from, const uint8_t *data, size_t length,
+                           unsigned long now) {
+  if (length < kHeaderLength || data[0] != kMagic || data[1] != kVersion) {
+    _stats.malformedFrames++;
+    return;
+  }
+  FrameType type = static_cast<FrameType>(data[2]);
+  uint16_t bootId = getU16(data + 3);
+  uint16_t seq = getU16(data + 5);
+  const uint8_t *body = data + kHeaderLength;
+  size_t bodyLength = length - kHeaderLength;
+
+  Peer *peer = peerFor(from, now);
+  if (peer == nullptr) {
+    return;
+  }
+  peer->stats.framesReceived++;
+  peer->stats.lastSeenAt = now;
+
+  switch (type) {
+    case FrameType::Ack:
+      if (bodyLength < kAckLength) {
+        break;
+      }
+      handleAck(from, *peer, getU16(body), getU16(body + 2), now);
+      return;
+    case FrameType::Tap:
+      if (bodyLength < kTapFixedLength || bodyLength < kTapFixedLength + body[4] ||
+          body[4] == 0 || body[4] > kMaxUidLength / 2) {
+        break;
+      }
+      // Acknowledge duplicates too: the previous acknowledgement may be
+      // the frame that got lost.
+      sendAck(from, bootId, seq);
+      if (!acceptSequence(*peer, bootId, seq)) {
+        peer->stats.duplicates++;
+        _stats.duplicates++;
+        return;
+      }
+      handleTap(from, bootId, seq, body, now);
+      return;
+    case FrameType::Result:
+      if (bodyLength < kResultLength) {
+        break;
+      }
+      sendAck(from, bootId, seq);
+      if (!acceptSequence(*peer, bootId, seq)) {
+        peer->stats.duplicates++;
+        _stats.duplicates++;
+        return;
+      }
+      handleResult(getU16(body), getU16(body + 2), body[4], now);
+      return;
+  }
+  _stats.malformedFrames++;
+}
+
+void HubRelay::handleAck(const HubAddress &from, Peer &peer, uint16_t ackedBoot,
+                         uint16_t ackedSeq, unsigned long now) {
+  if (ackedBoot != _bootId) {
+    return;
+  }
+  for (Pending &entry : _outbox) {
+    if (!entry.used || entry.acked || entry.seq != ackedSeq) {
+      continue;
+    }
+    if (entry.to != from && !entry.to.isBroadcast()) {
+      continue;
+    }
+    entry.acked = true;
+    entry.ackedAt = now;
+    // Karn: only unambiguous samples feed the estimate.
+    if (entry.attempts == 1) {
+      unsigned long rttMs = now - entry.lastSentAt;
+      peer.rtt.addSample(rttMs);
+      peer.stats.lastRttMs = rttMs;
+    }
+    if (entry.type == FrameType::Tap && _gateway.isBroadcast()) {
+      _gateway = from;
+    }
+    if (entry.type == FrameType::Result) {
+      entry.used = false;
+    }
+    return;
+  }
+}
+
+void HubRelay::handleTap(const HubAddress &from, uint16_t bootId, uint16_t seq,
+                         const uint8_t *body, unsigned long now) {
+  if (_tapCount >= kMaxPeers) {
+    // The tap is already acknowledged, so tell the satellite now rather
+    // than let it wait for a result that will never come.
+    Tap dropped;
+    dropped.from = from;
+    dropped.bootId = bootId;
+    dropped.seq = seq;
+    sendResult(dropped, Status::Failed, now);
+    return;
+  }
+  Tap &tap = _taps[(_tapHead + _tapCount) % kMaxPeers];
+  tap = Tap();
+  tap.from = from;
+  tap.bootId = bootId;
+  tap.seq = seq;
+  tap.ageMs = getU32(body);
+  tap.receivedAt = now;
+  uint8_t uidLength = body[4];
+  for (uint8_t i = 0; i < uidLength; ++i) {
+    tap.uid[2 * i] = kHexDigits[body[kTapFixedLength + i] >> 4];
+    tap.uid[2 * i + 1] = kHexDigits[body[kTapFixedLength + i] & 0x0F];
+  }
+  tap.uid[2 * uidLength] = '\0';
+  _tapCount++;
+  _stats.tapsRelayed++;
+}
+
+void HubRelay::handleResult(uint16_t tapBoot, uint16_t tapSeq, uint8_t status,
+                            unsigned long now) {
+  if (tapBoot != _bootId) {
+    return;
+  }
+  for (Pending &entry : _outbox) {
+    if (entry.used && entry.type == FrameType::Tap && entry.seq == tapSeq) {
+      if (!entry.acked) {
+        // The acknowledgement was lost but the result made it.
+        entry.acked = true;
+        entry.ackedAt = now;
+      }
+      Status outcome = status <= static_cast<uint8_t>(Status::Cancelled)
+                           ? static_cast<Status>(status)
+                           : Status::Failed;
+      finishTap(entry, outcome, now);
+      return;
+    }
+  }
+}
+
+bool HubRelay::acceptSequence(Peer &peer, uint16_t bootId, uint16_t seq) {
+  if (!peer.hasWindow || peer.bootId != bootId) {
+    peer.hasWindow = true;
+    peer.bootId = bootId;
+    peer.highestSeq = seq;
+    peer.window = 1;
+    return true;
+  }
+  int16_t ahead = static_cast<int16_t>(seq - peer.highestSeq);
+  if (ahead > 0) {
+    peer.window = ahead >= kReplayWindow ? 1 : (peer.window << ahead) | 1;
+    peer.highestSeq = seq;
+    return true;
+  }
+  uint16_t behind = static_cast<uint16_t>(-ahead);
+  if (behind >= kReplayWindow) {
+    return false;
+  }
+  uint32_t bit = 1UL << behind;
+  if (peer.window & bit) {
+    return false;
+  }
+  peer.window |= bit;
+  return true;
+}
+
+void HubRelay::sendAck(const HubAddress &to, uint16_t ackedBoot, uint16_t ackedSeq) {
+  uint8_t frame[kMaxFrameLength];
+  size_t length = writeHeader(frame, static_cast<uint8_t>(FrameType::Ack), _bootId, 0);
+  putU16(frame + length, ackedBoot);
+  putU16(frame + length + 2, ackedSeq);
+  _link.send(to, frame, length + kAckLength);
+}
+
+void HubRelay::transmit(Pending &entry, unsigned long now) {
+  uint8_t frame[kMaxFrameLength];
+  size_t length = writeHeader(frame, static_cast<uint8_t>(entry.type), _bootId, entry.seq);
+  if (entry.type == FrameType::Tap) {
+    // Follows the gateway once discovery has found one.
+    entry.to = _gateway;
+    // The age is refreshed on every attempt so the gateway can place
+    // the read on its own clock.
+    putU32(frame + length, static_cast<uint32_t>(now - entry.capturedAt));
+    frame[length + 4] = entry.uidLength;
+    memcpy(frame + length + kTapFixedLength, entry.uid, entry.uidLength);
+    length += kTapFixedLength + entry.uidLength;
+  } else {
+    putU16(frame + length, entry.tapBoot);
+    putU16(frame + length + 2, entry.tapSeq);
+    frame[length + 4] = static_cast<uint8_t>(entry.status);
+    length += kResultLength;
+  }
+
+  if (entry.attempts > 0) {
+    _stats.retransmits++;
+  }
+  entry.attempts++;
+  entry.lastSentAt = now;
+  Peer *peer = entry.to.isBroadcast() ? nullptr : peerFor(entry.to, now);
+  if (peer != nullptr) {
+    peer->stats.framesSent++;
+    if (entry.attempts > 1) {
+      peer->stats.retransmits++;
+    }
+  }
+  _link.send(entry.to, frame, length);
+}
+
+void HubRelay::retransmitOrExpire(unsigned long now) {
+  for (Pending &entry : _outbox) {
+    if (!entry.used) {
+      continue;
+    }
+    if (entry.acked) {
+      // An acknowledged tap waits for its result.
+      if (entry.type == FrameType::Tap && now - entry.firstSentAt >= _resultTimeoutMs) {
+        _stats.resultsTimedOut++;
+        finishTap(entry, Status::Failed, now);
+      }
+      continue;
+    }
+
+    Peer *peer = entry.to.isBroadcast() ? nullptr : peerFor(entry.to, now);
+    unsigned long timeoutMs = peer != nullptr ? peer->rtt.timeoutMs() : _maxAckTimeoutMs;
+    if (now - entry.lastSentAt < timeoutMs) {
+      continue;
+    }
+    if (peer != nullptr) {
+      peer->rtt.backOff();
+    }
+    if (entry.attempts < _maxAttempts) {
+      transmit(entry, now);
+      continue;
+    }
+
+    _stats.undelivered++;
+    if (peer != nullptr) {
+      peer->stats.undelivered++;
+    }
+    if (entry.type == FrameType::Tap) {
+      if (!_gatewayConfigured) {
+        // The gateway may have moved; go back to discovery.
+        _gateway = HubAddress::broadcast();
+      }
+      finishTap(entry, Status::Failed, now);
+    } else {
+      entry.used = false;
+    }
+  }
+}
+
+void HubRelay::finishTap(Pending &entry, Status status, unsigned long now) {
+  entry.used = false;
+  if (_resultCount >= kOutboxCapacity) {
+    return;
+  }
+  Result &result = _results[(_resultHead + _resultCount) % kOutboxCapacity];
+  result.requestId = entry.requestId;
+  result.traceId = entry.traceId;
+  result.status = status;
+  result.acknowledged = entry.acked;
+  result.ackMs = entry.acked ? entry.ackedAt - entry.firstSentAt : 0;
+  result.resultMs = now - entry.firstSentAt;
+  _resultCount++;
+}
+
+HubRelay::Pending *HubRelay::allocate() {
+  for (Pending &entry : _outbox) {
+    if (!entry.used) {
+      entry = Pending();
+      entry.used = true;
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+HubRelay::Peer *HubRelay::peerFor(const HubAddress &address, unsigned long now) {
+  Peer *slot = nullptr;
+  for (Peer &peer : _peers) {
+    if (peer.used && peer.stats.address == address) {
+      return &peer;
+    }
+    // Prefer a free slot, otherwise replace the peer heard from least
+    // recently.
+    if (slot == nullptr || (slot->used && (!peer.used ||
+                                           peer.stats.lastSeenAt < slot->stats.lastSeenAt))) {
+      slot = &peer;
+    }
+  }
+  if (slot == nullptr) {
+    return nullptr;
+  }
+  *slot = Peer();
+  slot->used = true;
+  slot->rtt = RttEstimator(_minAckTimeoutMs, _maxAckTimeoutMs);
+  slot->stats.address = address;
+  slot->stats.lastSeenAt = now;
+  return slot;
+}
+
+uint16_t HubRelay::nextSeq() {
+  _lastSeq++;
+  if (_lastSeq == 0) {
+    _lastSeq = 1;
+  }
+  return _lastSeq;
+}
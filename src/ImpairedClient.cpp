@@ -0,0 +1,272 @@
+/*
+ * ImpairedClient.cpp
+ *
+ * Implements the link impairment wrapper and its built-in profiles.
+ */
+
+#include "ImpairedClient.h"
+
+#include "freertos/FreeRTOS.h"
+
+namespace {
+// name, latency, jitter, stall permille, stall ms, bytes/s, reset permille
+const ImpairmentProfile kProfiles[] = {
+    {"none", 0, 0, 0, 0, 0, 0},
+    // A busy access point: slow, bursty and occasionally stuck.
+    {"congested", 60, 150, 20, 400, 48 * 1024, 0},
+    // Weak signal: frequent retransmission-timeout sized stalls.
+    {"lossy", 20, 40, 80, 1000, 0, 0},
+    // Long distance through walls: high latency, little bandwidth.
+    {"slow", 150, 50, 0, 0, 12 * 1024, 0},
+    // Roaming or a flapping access point: connections drop mid-stream.
+    {"flaky", 30, 60, 10, 300, 0, 20},
+};
+
+portMUX_TYPE          profileLock = portMUX_INITIALIZER_UNLOCKED;
+ImpairmentProfile     activeProfile;
+std::atomic<uint32_t> connectionCount{0};
+std::atomic<uint32_t> stallCount{0};
+std::atomic<uint32_t> resetCount{0};
+std::atomic<uint32_t> bytesReceived{0};
+
+bool isBefore(unsigned long now, unsigned long deadline) {
+  return static_cast<long>(now - deadline) < 0;
+}
+
+bool roll(uint16_t permille) {
+  return permille > 0 && random(0, 1000) < permille;
+}
+}  // namespace
+
+const ImpairmentProfile *ImpairedClient::profiles(size_t &count) {
+  count = sizeof(kProfiles) / sizeof(kProfiles[0]);
+  return kProfiles;
+}
+
+const ImpairmentProfile *ImpairedClient::findProfile(const char *name) {
+  if (name == nullptr) {
+    return nullptr;
+  }
+  for (const ImpairmentProfile &candidate : kProfiles) {
+    if (strcmp(candidate.name, name) == 0) {
+      return &candidate;
+    }
+  }
+  return nullptr;
+}
+
+void ImpairedClient::setProfile(const ImpairmentProfile &profile) {
+  portENTER_CRITICAL(&profileLock);
+  activeProfile = profile;
+  portEXIT_CRITICAL(&profileLock);
+}
+
+ImpairmentProfile ImpairedClient::profile() {
+  portENTER_CRITICAL(&profileLock);
+  ImpairmentProfile copy = activeProfile;
+  portEXIT_CRITICAL(&profileLock);
+  return copy;
+}
+
+ImpairedClient::Stats ImpairedClient::stats() {
+  Stats stats;
+  stats.connections = connectionCount.load();
+  stats.stalls = stallCount.load();
+  stats.resets = resetCount.load();
+  stats.bytesReceived = bytesReceived.load();
+  return stats;
+}
+
+void ImpairedClient::resetStats() {
+  connectionCount.store(0);
+  stallCount.store(0);
+  resetCount.store(0);
+  bytesReceived.store(0);
+}
+
+int ImpairedClient::connect(IPAddress ip, uint16_t port) {
+  if (NETWORK_IMPAIRMENT_ENABLED && !beginConnection(0)) {
+    return 0;
+  }
+  return _inner.connect(ip, port);
+}
+
+int ImpairedClient::connect(const char *host, uint16_t port) {
+  if (NETWORK_IMPAIRMENT_ENABLED && !beginConnection(0)) {
+    return 0;
+  }
+  return _inner.connect(host, port);
+}
+
+int ImpairedClient::connect(IPAddress ip, uint16_t port, int32_t timeoutMs) {
+  if (NETWORK_IMPAIRMENT_ENABLED && !beginConnection(timeoutMs)) {
+    return 0;
+  }
+  return _inner.connect(ip, port, timeoutMs);
+}
+
+size_t ImpairedClient::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t ImpairedClient::write(const uint8_t *buffer, size_t size) {
+  if (!NETWORK_IMPAIRMENT_ENABLED) {
+    return _inner.write(buffer, size);
+  }
+  if (_wasReset) {
+    return 0;
+  }
+  // Picked up per request so a profile change also reaches a warm
+  // keep-alive connection.
+  _profile = profile();
+  size_t written = _inner.write(buffer, size);
+  if (written > 0) {
+    // The answer to this request cannot arrive before the added delay.
+    unsigned long readableAt = millis() + jitteredLatency();
+    if (isBefore(_readableAt, readableAt)) {
+      _readableAt = readableAt;
+    }
+    // The request itself can be lost or cut off too.
+    impairSegment();
+  }
+  return written;
+}
+
+int ImpairedClient::available() {
+  if (!NETWORK_IMPAIRMENT_ENABLED) {
+    return _inner.available();
+  }
+  if (_wasReset) {
+    return 0;
+  }
+  unsigned long now = millis();
+  if (isBefore(now, _readableAt) || isBefore(now, _stalledUntil)) {
+    return 0;
+  }
+  return releasableBytes();
+}
+
+int ImpairedClient::read() {
+  uint8_t value = 0;
+  return read(&value, 1) == 1 ? value : -1;
+}
+
+int ImpairedClient::read(uint8_t *buffer, size_t size) {
+  if (!NETWORK_IMPAIRMENT_ENABLED) {
+    return _inner.read(buffer, size);
+  }
+  int allowed = available();
+  if (allowed <= 0) {
+    return -1;
+  }
+  int read = _inner.read(buffer, min(size, static_cast<size_t>(allowed)));
+  if (read > 0) {
+    consume(static_cast<size_t>(read));
+  }
+  return read;
+}
+
+int ImpairedClient::peek() {
+  if (NETWORK_IMPAIRMENT_ENABLED && available() <= 0) {
+    return -1;
+  }
+  return _inner.peek();
+}
+
+void ImpairedClient::flush() {
+  _inner.flush();
+}
+
+void ImpairedClient::stop() {
+  _inner.stop();
+  _wasReset = false;
+}
+
+uint8_t ImpairedClient::connected() {
+  if (!NETWORK_IMPAIRMENT_ENABLED) {
+    return _inner.connected();
+  }
+  if (_wasReset) {
+    return 0;
+  }
+  // Data held back by the impairment still has to be delivered after
+  // the peer has closed.
+  return _inner.connected() || _inner.available() > 0 ? 1 : 0;
+}
+
+ImpairedClient::operator bool() {
+  return NETWORK_IMPAIRMENT_ENABLED && _wasReset ? false : static_cast<bool>(_inner);
+}
+
+bool ImpairedClient::beginConnection(int32_t timeoutMs) {
+  _profile = profile();
+  _wasReset = false;
+  _readableAt = millis();
+  _stalledUntil = _readableAt;
+  _segmentBytes = 0;
+  _tokens = static_cast<float>(kSegmentBytes);
+  _tokensUpdatedAt = _readableAt;
+  connectionCount++;
+
+  unsigned long delayMs = jitteredLatency();
+  if (timeoutMs > 0 && delayMs >= static_cast<unsigned long>(timeoutMs)) {
+    delay(static_cast<unsigned long>(timeoutMs));
+    return false;
+  }
+  if (delayMs > 0) {
+    delay(delayMs);
+  }
+  return true;
+}
+
+int ImpairedClient::releasableBytes() {
+  int pending = _inner.available();
+  if (pending <= 0 || _profile.bandwidthBytesPerSecond == 0) {
+    return pending;
+  }
+  unsigned long now = millis();
+  _tokens += static_cast<float>(now - _tokensUpdatedAt) * _profile.bandwidthBytesPerSecond / 1000.0f;
+  _tokensUpdatedAt = now;
+  if (_tokens > kSegmentBytes) {
+    _tokens = static_cast<float>(kSegmentBytes);
+  }
+  int allowed = static_cast<int>(_tokens);
+  return min(pending, allowed);
+}
+
+void ImpairedClient::consume(size_t bytes) {
+  bytesReceived += bytes;
+  if (_profile.bandwidthBytesPerSecond > 0) {
+    _tokens -= static_cast<float>(bytes);
+  }
+  _segmentBytes += bytes;
+  while (_segmentBytes >= kSegmentBytes && !_wasReset) {
+    _segmentBytes -= kSegmentBytes;
+    impairSegment();
+  }
+}
+
+void ImpairedClient::impairSegment() {
+  if (roll(_profile.resetPermille)) {
+    Serial.printf("[Impair] Resetting connection (%s)\n", _profile.name);
+    _inner.stop();
+    _wasReset = true;
+    resetCount++;
+    return;
+  }
+  if (roll(_profile.stallPermille)) {
+    unsigned long stalledUntil = millis() + _profile.stallMs;
+    if (isBefore(_stalledUntil, stalledUntil)) {
+      _stalledUntil = stalledUntil;
+    }
+    stallCount++;
+  }
+}
+
+unsigned long ImpairedClient::jitteredLatency() const {
+  unsigned long latency = _profile.latencyMs;
+  if (_profile.jitterMs > 0) {
+    latency += static_cast<unsigned long>(random(0, static_cast<long>(_profile.jitterMs) + 1));
+  }
+  return latency;
+}
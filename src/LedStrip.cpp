@@ -1,5 +1,7 @@
 #include "LedStrip.h"
 
+#include <esp_timer.h>
+
 LedStrip::LedStrip(uint8_t dataPin, uint16_t ledCount, neoPixelType pixelType)
     : _dataPin(dataPin),
       _ledCount(ledCount),
@@ -39,6 +41,8 @@ void LedStrip::apply() {
     return;
   }
   _strip.show();
+  _lastFrameAtUs = esp_timer_get_time();
+  _frameCount++;
 }
 
 void LedStrip::setBrightness(uint8_t brightness) {
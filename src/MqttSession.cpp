@@ -0,0 +1,337 @@
+/*
+ * MqttSession.cpp
+ *
+ * Implements the persistent MQTT session and its tap outbox.
+ */
+
+#include "MqttSession.h"
+
+#include <ArduinoJson.h>
+#include <cstring>
+
+#include "EventClock.h"
+
+namespace {
+constexpr uint8_t       kQos1 = 1;
+constexpr uint16_t      kSubscribePacketId = 1;
+constexpr unsigned long kConnackPollMs = 2;
+constexpr const char   *kOnline = "online";
+constexpr const char   *kOffline = "offline";
+}  // namespace
+
+void MqttSession::begin(uint64_t deviceId) {
+  char device[13];
+  snprintf(device, sizeof(device), "%012llX", static_cast<unsigned long long>(deviceId));
+  snprintf(_clientId, sizeof(_clientId), "musicbee-%s", device);
+  snprintf(_tapTopic, sizeof(_tapTopic), "%s/%s/taps", MQTT_TOPIC_PREFIX, device);
+  snprintf(_prepareTopic, sizeof(_prepareTopic), "%s/%s/prepare", MQTT_TOPIC_PREFIX, device);
+  snprintf(_removedTopic, sizeof(_removedTopic), "%s/%s/removed", MQTT_TOPIC_PREFIX, device);
+  snprintf(_statusTopic, sizeof(_statusTopic), "%s/%s/status", MQTT_TOPIC_PREFIX, device);
+  snprintf(_inboxTopic, sizeof(_inboxTopic), "%s/%s/inbox", MQTT_TOPIC_PREFIX, device);
+}
+
+void MqttSession::service(unsigned long now, bool networkAvailable) {
+  if (!networkAvailable) {
+    if (_connected) {
+      close();
+    }
+  } else if (!_connected) {
+    if (_lastConnectAttemptAt == 0 || now - _lastConnectAttemptAt >= BACKEND_RECONNECT_DELAY_MS) {
+      _lastConnectAttemptAt = now == 0 ? 1 : now;
+      connect(now);
+    }
+  }
+
+  if (_connected) {
+    readPackets(now);
+  }
+  if (_connected) {
+    unsigned long keepAliveMs = MQTT_KEEPALIVE_S * 1000UL;
+    if (now - _lastReceivedAt >= keepAliveMs + keepAliveMs / 2) {
+      Serial.println("[MQTT] Broker stopped answering, reconnecting");
+      close();
+    } else if (now - _mqtt.lastSentAt() >= keepAliveMs / 2 && !_mqtt.sendPing()) {
+      close();
+    }
+  }
+  expireEntries(now);
+}
+
+bool MqttSession::publishTap(const Tap &tap) {
+  if (!_connected || _pending + _outcomeCount >= MQTT_OUTBOX_CAPACITY) {
+    return false;
+  }
+  for (Entry &entry : _outbox) {
+    if (entry.used) {
+      continue;
+    }
+    entry.packetId = nextPacketId();
+    entry.sentAt = millis();
+    entry.tap = tap;
+    if (!sendTap(entry, false)) {
+      close();
+      return false;
+    }
+    entry.used = true;
+    _pending++;
+    _stats.published++;
+    return true;
+  }
+  return false;
+}
+
+bool MqttSession::publishTapAndWait(const Tap &tap) {
+  if (hasPending() || _outcomeCount > 0 || !publishTap(tap)) {
+    return false;
+  }
+  // expireEntries() bounds the wait.
+  while (hasPending()) {
+    delay(MQTT_POLL_INTERVAL_MS);
+    service(millis(), true);
+  }
+  Outcome outcome;
+  return popOutcome(outcome) && outcome.delivered;
+}
+
+bool MqttSession::publishPrepare(const char *uid) {
+  if (!_connected) {
+    return false;
+  }
+  char payload[48];
+  int length = snprintf(payload, sizeof(payload), "{\"uid\":\"%s\"}", uid);
+  return _mqtt.sendPublish(_prepareTopic, reinterpret_cast<const uint8_t *>(payload),
+                           static_cast<size_t>(length), 0, 0);
+}
+
+bool MqttSession::publishRemoved(const char *uid, uint32_t presentMs) {
+  if (!_connected) {
+    return false;
+  }
+  char payload[64];
+  int length = snprintf(payload, sizeof(payload), "{\"uid\":\"%s\",\"present_ms\":%lu}", uid,
+                        static_cast<unsigned long>(presentMs));
+  return _mqtt.sendPublish(_removedTopic, reinterpret_cast<const uint8_t *>(payload),
+                           static_cast<size_t>(length), 0, 0);
+}
+
+bool MqttSession::popOutcome(Outcome &out) {
+  if (_outcomeCount == 0) {
+    return false;
+  }
+  out = _outcomes[_outcomeHead];
+  _outcomeHead = (_outcomeHead + 1) % MQTT_OUTBOX_CAPACITY;
+  _outcomeCount--;
+  return true;
+}
+
+bool MqttSession::takeCatalogSyncRequest() {
+  bool requested = _catalogSyncRequested;
+  _catalogSyncRequested = false;
+  return requested;
+}
+
+MqttSession::Stats MqttSession::stats() const {
+  Stats stats = _stats;
+  stats.srttMs = _ackRtt.srttMs();
+  stats.connected = _connected;
+  return stats;
+}
+
+bool MqttSession::connect(unsigned long now) {
+  IPAddress address;
+  if (!_resolver.lookup(MQTT_BROKER_HOST, address)) {
+    return false;
+  }
+  if (!_net.connect(address, MQTT_BROKER_PORT, static_cast<int32_t>(MQTT_PUBLISH_TIMEOUT_MS))) {
+    Serial.printf("[MQTT] TCP connect to %s:%u failed\n", MQTT_BROKER_HOST, MQTT_BROKER_PORT);
+    return false;
+  }
+  _net.setNoDelay(true);
+  _mqtt.reset();
+
+  bool sessionPresent = false;
+  if (!_mqtt.sendConnect(_clientId, MQTT_KEEPALIVE_S, false, _statusTopic, kOffline) ||
+      !waitForConnack(sessionPresent)) {
+    _net.stop();
+    return false;
+  }
+  _connected = true;
+  _lastReceivedAt = millis();
+  _stats.connects++;
+
+  // A broker that kept the session also kept the subscription.
+  if (!sessionPresent && !_mqtt.sendSubscribe(kSubscribePacketId, _inboxTopic, kQos1)) {
+    close();
+    return false;
+  }
+  _mqtt.sendPublish(_statusTopic, reinterpret_cast<const uint8_t *>(kOnline), strlen(kOnline), 0,
+                    0, false, true);
+
+  size_t resent = 0;
+  for (Entry &entry : _outbox) {
+    if (entry.used) {
+      if (!sendTap(entry, true)) {
+        close();
+        return false;
+      }
+      resent++;
+    }
+  }
+  _stats.redelivered += resent;
+  Serial.printf("[MQTT] Connected to %s:%u as %s (%s session, %u tap(s) resent) in %lums\n",
+                MQTT_BROKER_HOST, MQTT_BROKER_PORT, _clientId,
+                sessionPresent ? "resumed" : "new", static_cast<unsigned int>(resent),
+                millis() - now);
+  return true;
+}
+
+bool MqttSession::waitForConnack(bool &sessionPresent) {
+  unsigned long start = millis();
+  TinyMqttClient::Packet packet;
+  while (millis() - start < MQTT_PUBLISH_TIMEOUT_MS) {
+    int status = _mqtt.poll(packet);
+    if (status < 0) {
+      Serial.println("[MQTT] Broker closed the connection during CONNECT");
+      return false;
+    }
+    if (status == 0) {
+      delay(kConnackPollMs);
+      continue;
+    }
+    if (packet.type != TinyMqttClient::kConnack || packet.length < 2) {
+      continue;
+    }
+    if (packet.body[1] != 0) {
+      Serial.printf("[MQTT] Broker refused the connection (code %u)\n", packet.body[1]);
+      return false;
+    }
+    sessionPresent = (packet.body[0] & 0x01) != 0;
+    return true;
+  }
+  Serial.println("[MQTT] No CONNACK from broker");
+  return false;
+}
+
+void MqttSession::close() {
+  // Outbox entries stay: they are sent again on the next connection or
+  // expire.
+  _net.stop();
+  _mqtt.reset();
+  _connected = false;
+}
+
+void MqttSession::readPackets(unsigned long now) {
+  TinyMqttClient::Packet packet;
+  for (;;) {
+    int status = _mqtt.poll(packet);
+    if (status < 0) {
+      Serial.println("[MQTT] Broker closed the connection");
+      close();
+      return;
+    }
+    if (status == 0) {
+      return;
+    }
+    _lastReceivedAt = now;
+    if (packet.type == TinyMqttClient::kPuback && packet.length >= 2) {
+      acknowledge(static_cast<uint16_t>((packet.body[0] << 8) | packet.body[1]), now);
+    } else if (packet.type == TinyMqttClient::kPublish) {
+      TinyMqttClient::Message message;
+      if (!TinyMqttClient::decodePublish(packet, message)) {
+        continue;
+      }
+      if (message.qos > 0 && !_mqtt.sendPuback(message.packetId)) {
+        close();
+        return;
+      }
+      handleInbox(message);
+    }
+  }
+}
+
+void MqttSession::handleInbox(const TinyMqttClient::Message &message) {
+  _stats.inboxMessages++;
+  JsonDocument doc;
+  if (deserializeJson(doc, message.payload, message.payloadLength)) {
+    Serial.printf("[MQTT] Ignoring malformed inbox message (%u bytes)\n",
+                  static_cast<unsigned int>(message.payloadLength));
+    return;
+  }
+  const char *type = doc["type"] | "";
+  if (strcmp(type, "sync_catalog") == 0) {
+    _catalogSyncRequested = true;
+  } else if (strcmp(type, "ack") == 0) {
+    bool ok = doc["ok"] | true;
+    if (!ok) {
+      _stats.backendRejections++;
+      Serial.printf("[MQTT] Backend rejected tap %s\n", doc["key"] | "(unknown)");
+    }
+  } else {
+    Serial.printf("[MQTT] Ignoring inbox message of type '%s'\n", type);
+  }
+}
+
+void MqttSession::acknowledge(uint16_t packetId, unsigned long now) {
+  for (Entry &entry : _outbox) {
+    if (entry.used && entry.packetId == packetId) {
+      _stats.acknowledged++;
+      _ackRtt.addSample(now - entry.sentAt);
+      finish(entry, true, now);
+      return;
+    }
+  }
+}
+
+void MqttSession::expireEntries(unsigned long now) {
+  bool expired = false;
+  for (Entry &entry : _outbox) {
+    if (entry.used && now - entry.sentAt >= MQTT_PUBLISH_TIMEOUT_MS) {
+      Serial.printf("[MQTT] Tap %s was not acknowledged in %lums\n", entry.tap.uid,
+                    MQTT_PUBLISH_TIMEOUT_MS);
+      _stats.expired++;
+      finish(entry, false, now);
+      expired = true;
+    }
+  }
+  // The broker acknowledges in order, so a missing PUBACK means the
+  // connection is no longer working.
+  if (expired && _connected) {
+    close();
+  }
+}
+
+bool MqttSession::sendTap(const Entry &entry, bool dup) {
+  // captured_us is 0 until the event clock has synced.
+  int64_t capturedWallUs = entry.tap.capturedWallUs != 0
+                               ? entry.tap.capturedWallUs
+                               : EventClock::wallUsAtMillis(entry.tap.capturedAt);
+  char payload[128];
+  int length = snprintf(payload, sizeof(payload),
+                        "{\"uid\":\"%s\",\"key\":\"%s\",\"trace\":%lu,\"captured_us\":%lld}",
+                        entry.tap.uid, entry.tap.key,
+                        static_cast<unsigned long>(entry.tap.traceId),
+                        static_cast<long long>(capturedWallUs));
+  if (length < 0 || static_cast<size_t>(length) >= sizeof(payload)) {
+    return false;
+  }
+  return _mqtt.sendPublish(_tapTopic, reinterpret_cast<const uint8_t *>(payload),
+                           static_cast<size_t>(length), kQos1, entry.packetId, dup);
+}
+
+void MqttSession::finish(Entry &entry, bool delivered, unsigned long now) {
+  size_t slot = (_outcomeHead + _outcomeCount) % MQTT_OUTBOX_CAPACITY;
+  _outcomes[slot].tap = entry.tap;
+  _outcomes[slot].delivered = delivered;
+  _outcomes[slot].ackMs = now - entry.sentAt;
+  _outcomeCount++;
+  entry.used = false;
+  _pending--;
+}
+
+uint16_t MqttSession::nextPacketId() {
+  // 0 is not a valid id and 1 is used for the subscription.
+  do {
+    _lastPacketId++;
+  } while (_lastPacketId <= kSubscribePacketId);
+  return _lastPacketId;
+}
@@ -6,50 +6,160 @@
 
 #include "OtaUpdater.h"
 
-#include <ArduinoJson.h>
-#include <HttpClient.h>
 #include <Update.h>
 #include <WiFiClient.h>
 
-#include "BackendClient.h"
 #include "Config.h"
+#include "EventClock.h"
+#include "ImpairedClient.h"
+#include "PayloadCodec.h"
+#include "TinyHttp.h"
+#include "TlsClient.h"
 
 namespace {
 constexpr unsigned long kDefaultManifestTimeoutMs = 10000;
+constexpr size_t        kManifestCapacity = 1024;
+constexpr const char   *kGetPattern =
+    "GET {path} HTTP/1.1\r\n"
+    "Host: {host}\r\n"
+    "Accept: {accept}\r\n"
+    "Connection: close\r\n"
+    "User-Agent: MusicBee-OTA/1.0\r\n"
+    "\r\n";
+
+// Uniformly random delay in [0, maxMs].
+unsigned long randomDelay(unsigned long maxMs) {
+  return static_cast<unsigned long>(random(0, static_cast<long>(maxMs) + 1));
 }
 
-OtaUpdater::OtaUpdater() : _lastCheckAt(0), _checkedSinceBoot(false) {}
+unsigned long httpTimeout() {
+  return OTA_HTTP_TIMEOUT_MS > 0 ? OTA_HTTP_TIMEOUT_MS : kDefaultManifestTimeoutMs;
+}
 
-void OtaUpdater::loop(unsigned long now, bool wifiConnected) {
-  if (!wifiConnected) {
-    return;
+// Sends a GET over an already connected client and streams the
+// response into `sink`. Returns the status code or a TinyHttp error.
+int sendGet(Client &client, const char *path, const char *hostHeader, const char *accept,
+            HttpResponse &response, HttpBodySink &sink) {
+  HttpRequestTemplate request;
+  if (!request.compile(kGetPattern)) {
+    return TinyHttpClient::kErrorProtocol;
   }
-  if (!shouldCheck(now)) {
-    return;
+  const char *values[] = {path, hostHeader, accept};
+  size_t length = 0;
+  const char *text = request.render(values, 3, length);
+  if (text == nullptr) {
+    Serial.println("[OTA] ERROR: Request does not fit the request buffer");
+    return TinyHttpClient::kErrorProtocol;
   }
-  checkForUpdates();
-  scheduleAfterAttempt(now);
+
+  TinyHttpClient http(client);
+  if (!http.send(text, length)) {
+    return TinyHttpClient::kErrorConnection;
+  }
+  return http.readResponse(response, &sink, httpTimeout());
 }
 
-bool OtaUpdater::shouldCheck(unsigned long now) const {
-  if (!_checkedSinceBoot) {
+// Collects the manifest into a fixed buffer for PayloadCodec.
+class ManifestSink : public HttpBodySink {
+public:
+  bool onHeaders(const HttpResponse &response) override {
+    return response.statusCode == 200;
+  }
+
+  bool onBody(const uint8_t *data, size_t length) override {
+    if (_length + length > kManifestCapacity) {
+      Serial.println("[OTA] ERROR: Manifest larger than the manifest buffer");
+      return false;
+    }
+    memcpy(_buffer + _length, data, length);
+    _length += length;
     return true;
   }
-  unsigned long elapsed = now - _lastCheckAt;
-  return elapsed >= OTA_CHECK_INTERVAL_MS;
-}
 
-void OtaUpdater::scheduleAfterAttempt(unsigned long now) {
-  _lastCheckAt = now;
-  _checkedSinceBoot = true;
+  const char *data() const { return _buffer; }
+  size_t length() const { return _length; }
+
+private:
+  char   _buffer[kManifestCapacity] = {0};
+  size_t _length = 0;
+};
+
+// Counts the firmware image without storing it.
+class DiscardSink : public HttpBodySink {
+public:
+  bool onHeaders(const HttpResponse &response) override {
+    return response.statusCode == 200;
+  }
+
+  bool onBody(const uint8_t *data, size_t length) override {
+    (void)data;
+    _received += length;
+    return true;
+  }
+
+  size_t received() const { return _received; }
+
+private:
+  size_t _received = 0;
+};
+
+// Writes the firmware image to flash as it arrives.
+class FirmwareSink : public HttpBodySink {
+public:
+  bool onHeaders(const HttpResponse &response) override {
+    if (response.statusCode != 200) {
+      Serial.printf("[OTA] Firmware download failed with HTTP %d\n", response.statusCode);
+      return false;
+    }
+    _contentLength = response.contentLength;
+    if (!Update.begin(_contentLength > 0 ? _contentLength : UPDATE_SIZE_UNKNOWN)) {
+      Serial.println("[OTA] Update.begin() failed.");
+      return false;
+    }
+    _started = true;
+    return true;
+  }
+
+  bool onBody(const uint8_t *data, size_t length) override {
+    size_t written = Update.write(const_cast<uint8_t *>(data), length);
+    _written += written;
+    return written == length;
+  }
+
+  bool started() const { return _started; }
+  long contentLength() const { return _contentLength; }
+  size_t written() const { return _written; }
+
+private:
+  bool   _started = false;
+  long   _contentLength = -1;
+  size_t _written = 0;
+};
+}  // namespace
+
+OtaUpdater::OtaUpdater(HostResolver &resolver)
+    : _resolver(resolver),
+      _checks(OTA_FIRST_CHECK_SPREAD_MS, OTA_CHECK_INTERVAL_MS, OTA_CHECK_JITTER_MS,
+              randomDelay) {}
+
+void OtaUpdater::loop(unsigned long now, bool wifiConnected) {
+  // Counted from boot, not from joining Wi-Fi.
+  _checks.start(now);
+  if (!wifiConnected || !_checks.due(now)) {
+    return;
+  }
+  checkForUpdates();
+  _checks.attempted(now);
 }
 
 void OtaUpdater::checkForUpdates() {
-  Serial.println("[OTA] Checking for firmware updates...");
+  char wallText[32];
+  Serial.printf("[OTA] Checking for firmware updates at %s...\n",
+                EventClock::format(EventClock::nowUs(), wallText, sizeof(wallText)));
 
   String remoteVersion;
   String firmwareUrl;
-  String manifestHost;
+  IPAddress manifestHost;
   if (!fetchManifest(remoteVersion, firmwareUrl, manifestHost)) {
     Serial.println("[OTA] Manifest fetch failed.");
     return;
@@ -64,148 +174,125 @@ void OtaUpdater::checkForUpdates() {
     return;
   }
 
-  Serial.println("[OTA] Newer firmware detected. Starting download...");
+  Serial.printf("[OTA] Newer firmware detected. Starting download at %s...\n",
+                EventClock::format(EventClock::nowUs(), wallText, sizeof(wallText)));
   if (!downloadAndInstall(firmwareUrl, manifestHost, remoteVersion)) {
     Serial.println("[OTA] Firmware download or install failed.");
   }
 }
 
 bool OtaUpdater::fetchManifest(String &versionOut, String &firmwareUrlOut,
-                               String &resolvedHostOut) {
+                               IPAddress &resolvedHostOut) {
   Serial.println("[OTA] ========== MANIFEST FETCH START ==========");
   
   // Resolve hostname
   Serial.printf("[OTA] Resolving hostname: %s\n", BACKEND_HOST);
-  if (!BackendClient::resolveHostname(String(BACKEND_HOST), resolvedHostOut)) {
+  if (!_resolver.resolve(BACKEND_HOST, resolvedHostOut, OTA_HTTP_TIMEOUT_MS)) {
     Serial.println("[OTA] ERROR: Hostname resolution failed");
     return false;
   }
-  Serial.printf("[OTA] Resolved to: %s\n", resolvedHostOut.c_str());
+  String resolvedHostText = resolvedHostOut.toString();
+  Serial.printf("[OTA] Resolved to: %s\n", resolvedHostText.c_str());
 
-  // Setup HTTP client
-  WiFiClient netClient;
-  unsigned long timeout = OTA_HTTP_TIMEOUT_MS > 0 ? OTA_HTTP_TIMEOUT_MS : kDefaultManifestTimeoutMs;
+  WiFiClient socket;
+  unsigned long timeout = httpTimeout();
   Serial.printf("[OTA] Setting network timeout: %lu ms\n", timeout);
-  netClient.setTimeout(timeout);
-  
-  HttpClient httpClient(netClient, resolvedHostOut.c_str(), BACKEND_PORT);
-  httpClient.setTimeout(timeout);
-  Serial.printf("[OTA] HttpClient configured for %s:%d\n", resolvedHostOut.c_str(), BACKEND_PORT);
-
-  // Build manifest path
-  String manifestPath = String(BACKEND_API_PREFIX) + OTA_MANIFEST_PATH;
-  Serial.printf("[OTA] Requesting: %s\n", manifestPath.c_str());
-  Serial.printf("[OTA] Full URL: http://%s:%d%s\n", resolvedHostOut.c_str(), BACKEND_PORT, manifestPath.c_str());
-
-  // Make the request
-  Serial.println("[OTA] Sending GET request...");
-  int statusCode = httpClient.get(manifestPath);
-  if (statusCode < 0) {
-    Serial.printf("[OTA] ERROR: HTTP connection failed with code: %d\n", statusCode);
-    httpClient.stop();
+  socket.setTimeout(timeout);
+  ImpairedClient impairedClient(socket);
+  TlsClient netClient(impairedClient);
+  netClient.setSecure(BACKEND_TLS_ENABLED);
+
+  char manifestPath[128];
+  snprintf(manifestPath, sizeof(manifestPath), "%s%s", BACKEND_API_PREFIX, OTA_MANIFEST_PATH);
+  char hostHeader[96];
+  snprintf(hostHeader, sizeof(hostHeader), "%s:%d", BACKEND_HOST, BACKEND_PORT);
+  Serial.printf("[OTA] Full URL: %s://%s:%d%s\n", BACKEND_TLS_ENABLED ? "https" : "http",
+                resolvedHostText.c_str(), BACKEND_PORT, manifestPath);
+
+  if (!netClient.connect(resolvedHostOut, BACKEND_PORT)) {
+    Serial.println("[OTA] ERROR: Connection to manifest host failed");
+    return false;
+  }
+  // Usually resumes the session of the backend's persistent connection.
+  if (!netClient.handshake(BACKEND_HOST, timeout)) {
+    Serial.println("[OTA] ERROR: TLS handshake with manifest host failed");
     return false;
   }
-  Serial.printf("[OTA] Connection status code: %d\n", statusCode);
 
-  // Get response code
-  int responseCode = httpClient.responseStatusCode();
+  // Make the request
+  Serial.println("[OTA] Sending GET request...");
+  HttpResponse response;
+  ManifestSink manifest;
+  int responseCode = sendGet(netClient, manifestPath, hostHeader,
+                             PayloadCodec::accept(BACKEND_PAYLOAD_FORMAT), response, manifest);
+  netClient.stop();
   Serial.printf("[OTA] HTTP response code: %d\n", responseCode);
-  
+
   if (responseCode != 200) {
-    Serial.printf("[OTA] ERROR: Unexpected response code: %d\n", responseCode);
-    httpClient.stop();
+    if (responseCode < 0 && response.statusCode == 0) {
+      Serial.printf("[OTA] ERROR: HTTP request failed: %s\n",
+                    TinyHttpClient::errorName(responseCode));
+    } else {
+      Serial.printf("[OTA] ERROR: Unexpected response code: %d\n", response.statusCode);
+    }
     return false;
   }
 
-  // Read response body
-  Serial.println("[OTA] Reading response body...");
-  String responseBody = httpClient.responseBody();
-  httpClient.stop();
-  
-  Serial.printf("[OTA] Response body length: %d bytes\n", responseBody.length());
-  
-  if (responseBody.length() == 0) {
+  Serial.printf("[OTA] Response body length: %u bytes\n",
+                static_cast<unsigned int>(manifest.length()));
+
+  if (manifest.length() == 0) {
     Serial.println("[OTA] ERROR: Response body is empty");
     return false;
   }
-  
-  // Print the raw response (truncate if too long)
-  if (responseBody.length() <= 200) {
-    Serial.printf("[OTA] Response body: '%s'\n", responseBody.c_str());
-  } else {
-    Serial.printf("[OTA] Response body (first 200 chars): '%s...'\n", responseBody.substring(0, 200).c_str());
+
+  PayloadFormat format = PayloadCodec::formatOf(response.contentType);
+  if (format == PayloadFormat::Json) {
+    // Print the raw response (truncate if too long)
+    int shown = static_cast<int>(min(manifest.length(), static_cast<size_t>(200)));
+    Serial.printf("[OTA] Response body%s: '%.*s%s'\n",
+                  manifest.length() > 200 ? " (first 200 chars)" : "", shown, manifest.data(),
+                  manifest.length() > 200 ? "..." : "");
   }
-  
+
   // Print hex dump of first 50 bytes to check for hidden characters
   Serial.print("[OTA] Response hex (first 50 bytes): ");
-  for (size_t i = 0; i < min((size_t)50, (size_t)responseBody.length()); i++) {
-    Serial.printf("%02X ", (unsigned char)responseBody[i]);
+  for (size_t i = 0; i < min((size_t)50, manifest.length()); i++) {
+    Serial.printf("%02X ", (unsigned char)manifest.data()[i]);
   }
   Serial.println();
 
-  // Parse JSON
-  Serial.println("[OTA] Parsing JSON...");
-  JsonDocument doc;
-  DeserializationError err = deserializeJson(doc, responseBody);
-  
-  if (err) {
-    Serial.printf("[OTA] ERROR: JSON parsing failed: %s\n", err.c_str());
-    Serial.printf("[OTA] Error code: %d\n", (int)err.code());
+  Serial.printf("[OTA] Parsing %s manifest...\n", PayloadCodec::contentType(format));
+  OtaManifest parsed;
+  if (!PayloadCodec::decodeManifest(format, reinterpret_cast<const uint8_t *>(manifest.data()),
+                                    manifest.length(), parsed)) {
+    Serial.println("[OTA] ERROR: Manifest is malformed or misses 'version'/'firmware_url'");
     return false;
   }
-  
-  Serial.println("[OTA] JSON parsed successfully!");
-
-  // Check for required fields (ArduinoJson v7 style)
-  bool hasVersion = !doc["version"].isNull();
-  bool hasFirmwareUrl = !doc["firmware_url"].isNull();
-  
-  Serial.printf("[OTA] Field 'version' present: %s\n", hasVersion ? "YES" : "NO");
-  Serial.printf("[OTA] Field 'firmware_url' present: %s\n", hasFirmwareUrl ? "YES" : "NO");
+  Serial.printf("[OTA] version value: '%s'\n", parsed.version);
+  Serial.printf("[OTA] firmwareUrl value: '%s'\n", parsed.firmwareUrl);
 
-  // Try to extract fields (ArduinoJson v7 style)
-  const char *version = doc["version"].as<const char*>();
-  const char *firmwareUrl = doc["firmware_url"].as<const char*>();
-  
-  Serial.printf("[OTA] version pointer: %s\n", version ? "NOT NULL" : "NULL");
-  Serial.printf("[OTA] firmwareUrl pointer: %s\n", firmwareUrl ? "NOT NULL" : "NULL");
-  
-  if (version != nullptr) {
-    Serial.printf("[OTA] version value: '%s'\n", version);
-  }
-  
-  if (firmwareUrl != nullptr) {
-    Serial.printf("[OTA] firmwareUrl value: '%s'\n", firmwareUrl);
-  }
-  
-  // Final check
-  if (version == nullptr || firmwareUrl == nullptr) {
-    Serial.println("[OTA] ERROR: Missing required fields");
-    if (version == nullptr) Serial.println("[OTA]   - 'version' is null");
-    if (firmwareUrl == nullptr) Serial.println("[OTA]   - 'firmware_url' is null");
-    return false;
-  }
-
-  versionOut = version;
-  firmwareUrlOut = firmwareUrl;
+  versionOut = parsed.version;
+  firmwareUrlOut = parsed.firmwareUrl;
   
   Serial.println("[OTA] Manifest fetch successful!");
   Serial.println("[OTA] ========== MANIFEST FETCH END ==========");
   return true;
 }
 
-bool OtaUpdater::downloadAndInstall(const String &url,
-                                    const String &manifestHost,
-                                    const String &newVersion) {
+int OtaUpdater::fetchFirmware(const String &url, const IPAddress &manifestHost,
+                              HttpBodySink &sink) {
   struct FirmwareRequest {
-    String connectionHost;
+    IPAddress connectionHost;
     String hostHeader;
+    String serverName;
     uint16_t port;
     String path;
+    bool secure;
   } request;
 
-  auto makeHostHeader = [](const String &host, uint16_t port) {
-    if (port == 80) {
+  auto makeHostHeader = [](const String &host, uint16_t port, bool secure) {
+    if (port == (secure ? 443 : 80)) {
       return host;
     }
     String header(host);
@@ -215,51 +302,53 @@ bool OtaUpdater::downloadAndInstall(const String &url,
   };
 
   request.port = BACKEND_PORT;
+  request.secure = BACKEND_TLS_ENABLED;
   request.connectionHost = manifestHost;
-  request.hostHeader = makeHostHeader(String(BACKEND_HOST), request.port);
+  request.serverName = BACKEND_HOST;
+  request.hostHeader = makeHostHeader(String(BACKEND_HOST), request.port, request.secure);
 
   String trimmedUrl = url;
   trimmedUrl.trim();
   if (trimmedUrl.isEmpty()) {
     Serial.println("[OTA] Firmware URL from manifest was empty.");
-    return false;
+    return 0;
   }
 
   bool isHttpUrl = trimmedUrl.startsWith("http://") ||
                    trimmedUrl.startsWith("https://");
   if (isHttpUrl) {
-    if (trimmedUrl.startsWith("https://")) {
-      Serial.println("[OTA] HTTPS firmware URLs are not supported by the OTA updater.");
-      return false;
-    }
-
-    int schemeLength = 7;  // length of "http://"
+    // https:// hosts must present a certificate from BACKEND_CA_CERT.
+    request.secure = trimmedUrl.startsWith("https://");
+    int schemeLength = request.secure ? 8 : 7;
     int pathIndex = trimmedUrl.indexOf('/', schemeLength);
     String hostPort =
         pathIndex < 0 ? trimmedUrl.substring(schemeLength)
                       : trimmedUrl.substring(schemeLength, pathIndex);
     if (hostPort.isEmpty()) {
       Serial.println("[OTA] Firmware URL missing host component.");
-      return false;
+      return 0;
     }
 
     String path = pathIndex < 0 ? String("/") : trimmedUrl.substring(pathIndex);
     int colonIndex = hostPort.lastIndexOf(':');
     String hostOnly = colonIndex >= 0 ? hostPort.substring(0, colonIndex)
                                       : hostPort;
+    uint16_t defaultPort = request.secure ? 443 : 80;
     uint16_t port = colonIndex >= 0 ? hostPort.substring(colonIndex + 1).toInt()
-                                    : 80;
+                                    : defaultPort;
     if (port == 0) {
-      port = 80;
+      port = defaultPort;
     }
 
-    String resolved;
-    if (!BackendClient::resolveHostname(hostOnly, resolved)) {
-      return false;
+    IPAddress resolved;
+    if (!_resolver.resolve(hostOnly.c_str(), resolved, OTA_HTTP_TIMEOUT_MS)) {
+      Serial.printf("[OTA] Could not resolve firmware host %s\n", hostOnly.c_str());
+      return 0;
     }
 
     request.connectionHost = resolved;
-    request.hostHeader = makeHostHeader(hostOnly, port);
+    request.serverName = hostOnly;
+    request.hostHeader = makeHostHeader(hostOnly, port, request.secure);
     request.port = port;
     request.path = path;
   } else {
@@ -274,113 +363,95 @@ bool OtaUpdater::downloadAndInstall(const String &url,
     }
   }
 
-  WiFiClient downloadClient;
-  downloadClient.setTimeout(OTA_HTTP_TIMEOUT_MS > 0 ? OTA_HTTP_TIMEOUT_MS :
-                                                       kDefaultManifestTimeoutMs);
+  WiFiClient socket;
+  socket.setTimeout(httpTimeout());
+  ImpairedClient impairedClient(socket);
+  TlsClient downloadClient(impairedClient);
+  downloadClient.setSecure(request.secure);
 
   Serial.printf("[OTA] Connecting to %s:%u for firmware download...\n",
-                request.connectionHost.c_str(), request.port);
-  if (!downloadClient.connect(request.connectionHost.c_str(), request.port)) {
+                request.connectionHost.toString().c_str(), request.port);
+  if (!downloadClient.connect(request.connectionHost, request.port)) {
     Serial.println("[OTA] Connection to firmware host failed.");
-    return false;
+    return 0;
   }
-
-  downloadClient.printf("GET %s HTTP/1.1\r\n", request.path.c_str());
-  downloadClient.printf("Host: %s\r\n", request.hostHeader.c_str());
-  downloadClient.print("Connection: close\r\n");
-  downloadClient.print("User-Agent: MusicBee-OTA/1.0\r\n\r\n");
-
-  unsigned long waitStart = millis();
-  while (downloadClient.connected() && !downloadClient.available()) {
-    if (OTA_HTTP_TIMEOUT_MS > 0 &&
-        millis() - waitStart > OTA_HTTP_TIMEOUT_MS) {
-      Serial.println("[OTA] Firmware host timed out before sending data.");
-      downloadClient.stop();
-      return false;
-    }
-    delay(10);
+  if (!downloadClient.handshake(request.serverName.c_str(), httpTimeout())) {
+    Serial.println("[OTA] TLS handshake with firmware host failed.");
+    return 0;
   }
 
-  String statusLine = downloadClient.readStringUntil('\n');
-  statusLine.trim();
-  if (!statusLine.startsWith("HTTP/")) {
-    Serial.println("[OTA] Invalid HTTP response from firmware host.");
-    downloadClient.stop();
-    return false;
-  }
+  HttpResponse response;
+  int statusCode = sendGet(downloadClient, request.path.c_str(), request.hostHeader.c_str(),
+                           "application/octet-stream", response, sink);
+  downloadClient.stop();
+  return statusCode;
+}
 
-  int firstSpace = statusLine.indexOf(' ');
-  int secondSpace = statusLine.indexOf(' ', firstSpace + 1);
-  String codeStr =
-      firstSpace >= 0 ? statusLine.substring(firstSpace + 1, secondSpace > 0
-                                                                ? secondSpace
-                                                                : statusLine.length())
-                      : String();
-  int statusCode = codeStr.toInt();
-  if (statusCode != 200) {
-    Serial.printf("[OTA] Firmware download failed with HTTP %d\n", statusCode);
-    downloadClient.stop();
+bool OtaUpdater::downloadAndInstall(const String &url,
+                                    const IPAddress &manifestHost,
+                                    const String &newVersion) {
+  // The image is streamed from the socket buffer straight into flash.
+  FirmwareSink firmware;
+  int statusCode = fetchFirmware(url, manifestHost, firmware);
+  if (statusCode == 0) {
     return false;
   }
-
-  long contentLength = -1;
-  while (downloadClient.connected()) {
-    String line = downloadClient.readStringUntil('\n');
-    if (line.length() == 0) {
-      break;
-    }
-    line.trim();
-    if (line.length() == 0) {
-      break;
-    }
-
-    int colonIndex = line.indexOf(':');
-    if (colonIndex < 0) {
-      continue;
+  if (statusCode != 200) {
+    if (statusCode < 0 && !firmware.started()) {
+      Serial.printf("[OTA] Firmware request failed: %s\n",
+                    TinyHttpClient::errorName(statusCode));
+    } else if (statusCode < 0) {
+      Serial.printf("[OTA] Firmware download interrupted after %u bytes: %s\n",
+                    static_cast<unsigned int>(firmware.written()),
+                    TinyHttpClient::errorName(statusCode));
     }
-
-    String headerName = line.substring(0, colonIndex);
-    String headerValue = line.substring(colonIndex + 1);
-    headerValue.trim();
-    headerName.toLowerCase();
-    if (headerName == "content-length") {
-      contentLength = headerValue.toInt();
+    if (firmware.started()) {
+      Update.abort();
     }
-  }
-
-  if (!Update.begin(contentLength > 0 ? contentLength : UPDATE_SIZE_UNKNOWN)) {
-    Serial.println("[OTA] Update.begin() failed.");
-    downloadClient.stop();
     return false;
   }
 
-  size_t written = Update.writeStream(downloadClient);
-  if (written == 0) {
+  if (firmware.written() == 0) {
     Serial.println("[OTA] No data written during update.");
-    downloadClient.stop();
+    Update.abort();
     return false;
   }
 
-  if (!Update.end()) {
+  if (!Update.end(firmware.contentLength() <= 0)) {
     Serial.printf("[OTA] Update failed: %s\n", Update.errorString());
-    downloadClient.stop();
     return false;
   }
 
   if (!Update.isFinished()) {
     Serial.println("[OTA] Update did not complete successfully.");
-    downloadClient.stop();
     return false;
   }
 
-  Serial.printf("[OTA] Firmware %s installed successfully. Rebooting...\n",
-                newVersion.c_str());
-  downloadClient.stop();
+  char wallText[32];
+  Serial.printf("[OTA] Firmware %s installed successfully at %s. Rebooting...\n",
+                newVersion.c_str(),
+                EventClock::format(EventClock::nowUs(), wallText, sizeof(wallText)));
   delay(100);
   ESP.restart();
   return true;
 }
 
+bool OtaUpdater::measureDownload(DownloadMeasurement &out) {
+  out = DownloadMeasurement();
+  String remoteVersion;
+  String firmwareUrl;
+  IPAddress manifestHost;
+  if (!fetchManifest(remoteVersion, firmwareUrl, manifestHost)) {
+    return false;
+  }
+  DiscardSink sink;
+  unsigned long start = millis();
+  out.statusCode = fetchFirmware(firmwareUrl, manifestHost, sink);
+  out.elapsedMs = millis() - start;
+  out.bytes = sink.received();
+  return out.statusCode == 200;
+}
+
 int OtaUpdater::compareVersions(const String &lhs, const String &rhs) {
   size_t i = 0;
   size_t j = 0;
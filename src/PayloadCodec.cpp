@@ -0,0 +1,158 @@
+/*
+ * PayloadCodec.cpp
+ *
+ * Implements the JSON and CBOR encodings of backend payloads.
+ */
+
+#include "PayloadCodec.h"
+
+#include <ArduinoJson.h>
+#include <cstring>
+
+#include "TinyCbor.h"
+
+namespace {
+constexpr const char *kAcceptCbor = "application/cbor, application/json;q=0.5";
+constexpr const char *kAcceptJson = "application/json";
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool copyField(const char *value, size_t length, char *out, size_t capacity) {
+  if (value == nullptr || length == 0 || length >= capacity) {
+    return false;
+  }
+  memcpy(out, value, length);
+  out[length] = '\0';
+  return true;
+}
+
+bool keyIs(const char *key, size_t length, const char *expected) {
+  return length == strlen(expected) && memcmp(key, expected, length) == 0;
+}
+
+bool decodeCborManifest(const uint8_t *data, size_t length, OtaManifest &out) {
+  CborReader reader(data, length);
+  size_t entries = 0;
+  if (!reader.readMap(entries)) {
+    return false;
+  }
+  bool hasVersion = false;
+  bool hasUrl = false;
+  for (size_t i = 0; i < entries; ++i) {
+    const char *key = nullptr;
+    size_t keyLength = 0;
+    if (!reader.readText(key, keyLength)) {
+      return false;
+    }
+    const char *value = nullptr;
+    size_t valueLength = 0;
+    if (keyIs(key, keyLength, "version") && reader.peekType() == CborReader::Type::Text) {
+      reader.readText(value, valueLength);
+      hasVersion = copyField(value, valueLength, out.version, sizeof(out.version));
+    } else if (keyIs(key, keyLength, "firmware_url") &&
+               reader.peekType() == CborReader::Type::Text) {
+      reader.readText(value, valueLength);
+      hasUrl = copyField(value, valueLength, out.firmwareUrl, sizeof(out.firmwareUrl));
+    } else if (!reader.skip()) {
+      return false;
+    }
+  }
+  return hasVersion && hasUrl;
+}
+
+bool decodeJsonManifest(const uint8_t *data, size_t length, OtaManifest &out) {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, data, length);
+  if (err) {
+    Serial.printf("[Codec] JSON parsing failed: %s\n", err.c_str());
+    return false;
+  }
+  const char *version = doc["version"].as<const char *>();
+  const char *firmwareUrl = doc["firmware_url"].as<const char *>();
+  return version != nullptr && firmwareUrl != nullptr &&
+         copyField(version, strlen(version), out.version, sizeof(out.version)) &&
+         copyField(firmwareUrl, strlen(firmwareUrl), out.firmwareUrl, sizeof(out.firmwareUrl));
+}
+}  // namespace
+
+bool TapEvent::setUid(const char *hex) {
+  size_t length = hex != nullptr ? strlen(hex) : 0;
+  if (length == 0 || length % 2 != 0 || length / 2 > kMaxUidBytes) {
+    return false;
+  }
+  for (size_t i = 0; i < length / 2; ++i) {
+    int high = hexValue(hex[2 * i]);
+    int low = hexValue(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    uid[i] = static_cast<uint8_t>((high << 4) | low);
+  }
+  uidLength = static_cast<uint8_t>(length / 2);
+  return true;
+}
+
+PayloadFormat PayloadCodec::formatOf(const char *contentType) {
+  if (contentType != nullptr &&
+      strncasecmp(contentType, kCborContentType, strlen(kCborContentType)) == 0) {
+    return PayloadFormat::Cbor;
+  }
+  return PayloadFormat::Json;
+}
+
+const char *PayloadCodec::contentType(PayloadFormat format) {
+  return format == PayloadFormat::Cbor ? kCborContentType : kJsonContentType;
+}
+
+const char *PayloadCodec::accept(PayloadFormat format) {
+  return format == PayloadFormat::Cbor ? kAcceptCbor : kAcceptJson;
+}
+
+size_t PayloadCodec::encodeTap(PayloadFormat format, const TapEvent &tap, uint8_t *out,
+                               size_t capacity) {
+  if (format == PayloadFormat::Cbor) {
+    CborWriter writer(out, capacity);
+    writer.beginMap(4);
+    writer.putText("uid");
+    writer.putBytes(tap.uid, tap.uidLength);
+    writer.putText("age_ms");
+    writer.putUint(tap.ageMs);
+    writer.putText("trace");
+    writer.putUint(tap.traceId);
+    writer.putText("captured_us");
+    writer.putUint(tap.capturedAtUs);
+    return writer.ok() ? writer.length() : 0;
+  }
+
+  char uidHex[TapEvent::kMaxUidBytes * 2 + 1] = {0};
+  for (size_t i = 0; i < tap.uidLength; ++i) {
+    snprintf(uidHex + 2 * i, 3, "%02X", tap.uid[i]);
+  }
+  JsonDocument doc;
+  doc["uid"] = uidHex;
+  doc["age_ms"] = tap.ageMs;
+  doc["trace"] = tap.traceId;
+  doc["captured_us"] = tap.capturedAtUs;
+  size_t length = serializeJson(doc, reinterpret_cast<char *>(out), capacity);
+  return length < capacity ? length : 0;
+}
+
+bool PayloadCodec::decodeManifest(PayloadFormat format, const uint8_t *data, size_t length,
+                                  OtaManifest &out) {
+  out = OtaManifest();
+  if (format == PayloadFormat::Cbor) {
+    return decodeCborManifest(data, length, out);
+  }
+  return decodeJsonManifest(data, length, out);
+}
@@ -2,7 +2,8 @@
  * RfidReader.cpp
  *
  * Backend-agnostic RFID/NFC reader façade. Selects the correct backend
- * implementation at compile time based on Config.h constants.
+ * implementation at compile time based on Config.h constants and polls
+ * it from a dedicated task.
  */
 
 #include "RfidReader.h"
@@ -28,11 +29,18 @@
 #endif
 
 #include <array>
+#include <atomic>
+#include <esp_timer.h>
 
 #include "Config.h"
+#include "Telemetry.h"
 
 namespace {
 
+constexpr uint32_t kRfidTaskStackSize = 4096;
+// A field event older than this belongs to a read that never finished.
+constexpr int64_t kMaxFieldToUidUs = 500000;
+
 #if defined(USE_PN532)
 static constexpr unsigned long PN532_ASYNC_RESTART_DELAY_MS = 5;
 static constexpr unsigned long PN532_ASYNC_RESPONSE_TIMEOUT_MS = 75;
@@ -40,6 +48,31 @@ static constexpr unsigned long PN532_POST_BUS_DELAY_MS = 100;
 static constexpr unsigned long PN532_POST_BEGIN_DELAY_MS = 100;
 static constexpr unsigned long PN532_FIRMWARE_RETRY_DELAY_MS = 500;
 static constexpr uint8_t       PN532_FIRMWARE_MAX_ATTEMPTS = 3;
+// In IRQ mode the PN532 searches on its own; detection is only re-armed
+// this long after the last command, in case the chip was reset.
+static constexpr unsigned long PN532_IRQ_REARM_MS = 10000;
+// In low-power mode, and while a card is present, a detection command
+// gives up after one try instead of searching forever, so a card that
+// has left is noticed. In low-power mode the chip is then powered down
+// until the next probe, waking on host interface traffic (I2C, SPI or
+// HSU).
+static constexpr uint8_t PN532_PROBE_RETRIES = 0x01;
+static constexpr uint8_t PN532_DEFAULT_RETRIES = 0xFF;
+static constexpr uint8_t PN532_WAKE_ON_HOST = 0xB0;
+// PowerDown answers with a frame of its own before the chip sleeps,
+// and GetFirmwareVersion is used to see whether IRQ is wired.
+static constexpr unsigned long PN532_RESPONSE_TIMEOUT_MS = 5;
+static constexpr size_t        PN532_POWERDOWN_RESPONSE_LENGTH = 9;
+static constexpr size_t        PN532_FIRMWARE_RESPONSE_LENGTH = 12;
+static constexpr uint8_t       PN532_GET_FIRMWARE_VERSION = 0x02;
+#  if defined(USE_PN532_SPI)
+static constexpr uint32_t PN532_SPI_CLOCK_HZ = 1000000;
+static constexpr uint8_t  PN532_SPI_STATUS_READ = 0x02;
+static constexpr uint8_t  PN532_SPI_DATA_READ = 0x03;
+#  else
+static constexpr uint8_t PN532_I2C_ADDRESS = 0x24;
+#  endif
+static constexpr uint8_t PN532_STATUS_READY = 0x01;
 #endif
 
 String bytesToHexString(const uint8_t *buffer, size_t length) {
@@ -56,6 +89,50 @@ String bytesToHexString(const uint8_t *buffer, size_t length) {
 }
 
 #if defined(USE_RC522)
+// The MFRC522 timer runs at 40 kHz after PCD_Init(); a reload of 200
+// gives up on a silent card after 5 ms instead of the library's 25 ms.
+// A card answers REQA, anticollision and SELECT within about 1 ms.
+static constexpr uint16_t RC522_TIMER_RELOAD = 200;
+// Software backstop in case the timer interrupt is never seen.
+static constexpr uint32_t RC522_COMMAND_DEADLINE_US = 10000;
+
+static constexpr byte RC522_IRQ_RX_IDLE = 0x30;     // ComIrqReg RxIRq | IdleIRq
+static constexpr byte RC522_IRQ_TIMER = 0x01;       // ComIrqReg TimerIRq
+static constexpr byte RC522_ERROR_FATAL = 0x13;     // ErrorReg BufferOvfl | ParityErr | ProtocolErr
+static constexpr byte RC522_ERROR_COLLISION = 0x08;  // ErrorReg CollErr
+static constexpr byte RC522_POWER_DOWN = 0x10;      // CommandReg PowerDown
+static constexpr byte RC522_CASCADE_TAG = 0x88;
+static constexpr byte RC522_SAK_CASCADE = 0x04;
+
+// ISO/IEC 14443-3 CRC_A, computed here so a SELECT or HLTA frame never
+// waits for the coprocessor.
+void crcA(const byte *data, size_t length, byte *out) {
+  uint16_t crc = 0x6363;
+  for (size_t i = 0; i < length; ++i) {
+    byte b = data[i] ^ static_cast<byte>(crc & 0xFF);
+    b ^= static_cast<byte>(b << 4);
+    crc = (crc >> 8) ^ (static_cast<uint16_t>(b) << 8) ^ (static_cast<uint16_t>(b) << 3) ^
+          (b >> 4);
+  }
+  out[0] = static_cast<byte>(crc & 0xFF);
+  out[1] = static_cast<byte>(crc >> 8);
+}
+
+/*
+ * Drives the MFRC522 at register level instead of through the blocking
+ * PICC_IsNewCardPresent()/PICC_ReadCardSerial(). Each readCard() either
+ * starts a transceive or checks ComIrqReg for the one in flight, so a
+ * call costs a few SPI transfers and never waits for the card.
+ *
+ * Probes use WUPA rather than REQA so a card halted after its read
+ * still answers. While the last card read stays in the field it is
+ * re-selected directly by its known UID, skipping anticollision, and
+ * halted again; readCard() then returns its UID without any events.
+ *
+ * The MFRC522 has no hardware card detection while asleep, so in
+ * low-power mode it spends the time between probes in soft power-down
+ * (oscillator and antenna off) and is woken for one REQA per poll.
+ */
 class Rc522Backend final : public IRfidBackend {
 public:
   Rc522Backend(uint8_t ssPin, uint8_t rstPin)
@@ -86,33 +163,125 @@ public:
 
     Serial.println("- OK!");
     _mfrc522.PCD_DumpVersionToSerial();
+    _mfrc522.PCD_WriteRegister(MFRC522::TReloadRegH, RC522_TIMER_RELOAD >> 8);
+    _mfrc522.PCD_WriteRegister(MFRC522::TReloadRegL, RC522_TIMER_RELOAD & 0xFF);
     _initialised = true;
     return true;
   }
 
   bool readCard(String &uidHex) override {
-    if (!_mfrc522.PICC_IsNewCardPresent()) {
+    if (!_initialised) {
       return false;
     }
 
-    Serial.println("[RFID] New card detected, attempting to read...");
+    switch (_state) {
+      case ReadState::Idle:
+        startRequest();
+        return false;
+      case ReadState::PoweredDown:
+        // Clearing PowerDown starts the oscillator; the bit reads back as
+        // set until the chip is up.
+        _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+        _state = ReadState::Waking;
+        return false;
+      case ReadState::Waking:
+        if (_mfrc522.PCD_ReadRegister(MFRC522::CommandReg) & RC522_POWER_DOWN) {
+          return false;
+        }
+        startRequest();
+        return false;
+      default:
+        break;
+    }
 
-    if (!_mfrc522.PICC_ReadCardSerial()) {
-      Serial.println("[RFID] Failed to read card serial");
+    Outcome outcome = pollCommand();
+    if (outcome == Outcome::Pending) {
       return false;
     }
+    uint32_t elapsedUs = static_cast<uint32_t>(esp_timer_get_time() - _commandStartedAtUs);
+
+    switch (_state) {
+      case ReadState::Request:
+        // A collision in the ATQA just means several cards answered.
+        if (outcome != Outcome::Ok && outcome != Outcome::Collision) {
+          _trackedLength = 0;
+          if (_lowPower) {
+            _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, RC522_POWER_DOWN);
+            _state = ReadState::PoweredDown;
+          } else {
+            _state = ReadState::Idle;
+          }
+          return false;
+        }
+        recordStep(RfidStep::Request, elapsedUs);
+        if (_trackedLength > 0) {
+          _keepAliveStartedAtUs = _commandStartedAtUs;
+          startKeepAlive(0);
+          return false;
+        }
+        _fieldAtUs = esp_timer_get_time();
+        notify(RfidCardEvent::FieldDetected);
+        Serial.println("[RFID] New card detected, attempting to read...");
+        _uidLength = 0;
+        startCascadeLevel(0);
+        return false;
+
+      case ReadState::Anticollision:
+        recordStep(RfidStep::Anticollision, elapsedUs);
+        if (outcome == Outcome::Collision) {
+          if (!resolveCollision()) {
+            failRead("anticollision");
+          }
+          return false;
+        }
+        if (outcome != Outcome::Ok) {
+          failRead("anticollision");
+          return false;
+        }
+        startSelect();
+        return false;
 
-    Serial.printf("[RFID] Card read successfully, UID size: %d bytes\n", _mfrc522.uid.size);
+      case ReadState::KeepAlive:
+        // Someone else answered the wake-up, or the card is going; read
+        // whatever is there in full next time.
+        if (outcome != Outcome::Ok || !sakValid()) {
+          _trackedLength = 0;
+          _state = ReadState::Idle;
+          return false;
+        }
+        if (_sak[0] & RC522_SAK_CASCADE) {
+          startKeepAlive(_level + 1);
+          return false;
+        }
+        recordStep(RfidStep::KeepAlive,
+                   static_cast<uint32_t>(esp_timer_get_time() - _keepAliveStartedAtUs));
+        uidHex = bytesToHexString(_trackedUid, _trackedLength);
+        startHalt();
+        return true;
 
-    uidHex = bytesToHexString(_mfrc522.uid.uidByte, _mfrc522.uid.size);
-    Serial.printf("[RFID] UID as hex string: %s\n", uidHex.c_str());
+      case ReadState::Select:
+        recordStep(RfidStep::Select, elapsedUs);
+        if (outcome != Outcome::Ok || !acceptSak()) {
+          failRead("select");
+          return false;
+        }
+        if (_sak[0] & RC522_SAK_CASCADE) {
+          startCascadeLevel(_level + 1);
+          return false;
+        }
+        return finishRead(uidHex);
 
-    MFRC522::PICC_Type piccType = _mfrc522.PICC_GetType(_mfrc522.uid.sak);
-    Serial.printf("[RFID] Card type: %s\n", _mfrc522.PICC_GetTypeName(piccType));
+      case ReadState::Halt:
+        // A halted card does not answer, so a timeout is success.
+        recordStep(RfidStep::Halt, elapsedUs);
+        _mfrc522.PCD_StopCrypto1();
+        _state = ReadState::Idle;
+        return false;
 
-    _mfrc522.PICC_HaltA();
-    _mfrc522.PCD_StopCrypto1();
-    return true;
+      default:
+        break;
+    }
+    return false;
   }
 
   bool isReady() const override {
@@ -123,12 +292,249 @@ public:
     return _initialisationFailed;
   }
 
+  bool isBusy() const override {
+    return _state != ReadState::Idle && _state != ReadState::PoweredDown;
+  }
+
+  // Every busy state waits on one frame or on the oscillator, each well
+  // under the 5 ms response timer.
+  bool hasFrameInFlight() const override {
+    return isBusy();
+  }
+
+  void setLowPower(bool enabled) override {
+    _lowPower = enabled;
+  }
+
 private:
+  enum class ReadState {
+    Idle,
+    PoweredDown,
+    Waking,
+    Request,
+    Anticollision,
+    Select,
+    KeepAlive,
+    Halt
+  };
+  enum class Outcome { Pending, Ok, Collision, Timeout, Error };
+
+  void startTransceive(byte *data, byte length, byte txLastBits, byte *rx, byte rxCapacity,
+                       byte rxAlign) {
+    _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    _mfrc522.PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    _mfrc522.PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    _mfrc522.PCD_WriteRegister(MFRC522::FIFODataReg, length, data);
+    _mfrc522.PCD_WriteRegister(MFRC522::BitFramingReg,
+                               static_cast<byte>((rxAlign << 4) + txLastBits));
+    _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    _mfrc522.PCD_SetRegisterBitMask(MFRC522::BitFramingReg, 0x80);  // StartSend
+    _rx = rx;
+    _rxCapacity = rxCapacity;
+    _rxAlign = rxAlign;
+    _rxLength = 0;
+    _commandStartedAtUs = esp_timer_get_time();
+  }
+
+  Outcome pollCommand() {
+    byte irq = _mfrc522.PCD_ReadRegister(MFRC522::ComIrqReg);
+    if (!(irq & RC522_IRQ_RX_IDLE)) {
+      if ((irq & RC522_IRQ_TIMER) ||
+          esp_timer_get_time() - _commandStartedAtUs >= RC522_COMMAND_DEADLINE_US) {
+        _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+        return Outcome::Timeout;
+      }
+      return Outcome::Pending;
+    }
+
+    byte error = _mfrc522.PCD_ReadRegister(MFRC522::ErrorReg);
+    if (error & RC522_ERROR_FATAL) {
+      return Outcome::Error;
+    }
+    byte length = _mfrc522.PCD_ReadRegister(MFRC522::FIFOLevelReg);
+    if (length > _rxCapacity) {
+      return Outcome::Error;
+    }
+    _mfrc522.PCD_ReadRegister(MFRC522::FIFODataReg, length, _rx, _rxAlign);
+    _rxLength = length;
+    _rxValidBits = _mfrc522.PCD_ReadRegister(MFRC522::ControlReg) & 0x07;
+    return (error & RC522_ERROR_COLLISION) ? Outcome::Collision : Outcome::Ok;
+  }
+
+  void startRequest() {
+    _frame[0] = MFRC522::PICC_CMD_WUPA;
+    // Bits received after a collision are cleared, as the library does.
+    _mfrc522.PCD_ClearRegisterBitMask(MFRC522::CollReg, 0x80);
+    startTransceive(_frame, 1, 7, _atqa, sizeof(_atqa), 0);
+    _state = ReadState::Request;
+  }
+
+  void startCascadeLevel(uint8_t level) {
+    static constexpr byte kSelect[] = {MFRC522::PICC_CMD_SEL_CL1, MFRC522::PICC_CMD_SEL_CL2,
+                                       MFRC522::PICC_CMD_SEL_CL3};
+    _level = level;
+    _knownBits = 0;
+    memset(_frame, 0, sizeof(_frame));
+    _frame[0] = kSelect[level];
+    sendAnticollision();
+  }
+
+  // _frame[2..6] holds the UID bits known so far at this cascade level;
+  // the card sends the rest.
+  void sendAnticollision() {
+    byte txLastBits = _knownBits % 8;
+    byte index = 2 + _knownBits / 8;
+    _frame[1] = static_cast<byte>((index << 4) + txLastBits);  // NVB
+    byte length = index + (txLastBits ? 1 : 0);
+    startTransceive(_frame, length, txLastBits, _frame + index, sizeof(_frame) - index,
+                    txLastBits);
+    _state = ReadState::Anticollision;
+  }
+
+  // Keep the bits before the collision, choose 1 for the colliding bit
+  // and ask again; the card whose UID has that bit set answers.
+  bool resolveCollision() {
+    byte coll = _mfrc522.PCD_ReadRegister(MFRC522::CollReg);
+    if (coll & 0x20) {  // CollPosNotValid
+      return false;
+    }
+    byte position = coll & 0x1F;
+    if (position == 0) {
+      position = 32;
+    }
+    if (position <= _knownBits) {
+      return false;
+    }
+    _knownBits = position;
+    byte index = 1 + _knownBits / 8 + ((_knownBits % 8) ? 1 : 0);
+    _frame[index] |= static_cast<byte>(1 << ((_knownBits - 1) % 8));
+    sendAnticollision();
+    return true;
+  }
+
+  void startSelect() {
+    byte bcc = _frame[2] ^ _frame[3] ^ _frame[4] ^ _frame[5];
+    if (_frame[6] != bcc) {
+      failRead("UID checksum");
+      return;
+    }
+    _frame[1] = 0x70;  // NVB: all 40 bits
+    crcA(_frame, 7, _frame + 7);
+    startTransceive(_frame, 9, 0, _sak, sizeof(_sak), 0);
+    _state = ReadState::Select;
+  }
+
+  // SELECT of the tracked card at `level`: the known UID bytes, behind
+  // a cascade tag on every level but the last.
+  void startKeepAlive(uint8_t level) {
+    static constexpr byte kSelect[] = {MFRC522::PICC_CMD_SEL_CL1, MFRC522::PICC_CMD_SEL_CL2,
+                                       MFRC522::PICC_CMD_SEL_CL3};
+    byte levels = _trackedLength == 4 ? 1 : (_trackedLength == 7 ? 2 : 3);
+    _level = level;
+    _frame[0] = kSelect[level];
+    _frame[1] = 0x70;
+    const byte *uid = _trackedUid + level * 3;
+    if (level + 1 < levels) {
+      _frame[2] = RC522_CASCADE_TAG;
+      memcpy(_frame + 3, uid, 3);
+    } else {
+      memcpy(_frame + 2, uid, 4);
+    }
+    _frame[6] = _frame[2] ^ _frame[3] ^ _frame[4] ^ _frame[5];
+    crcA(_frame, 7, _frame + 7);
+    startTransceive(_frame, 9, 0, _sak, sizeof(_sak), 0);
+    _state = ReadState::KeepAlive;
+  }
+
+  bool sakValid() {
+    if (_rxLength != 3 || _rxValidBits != 0) {
+      return false;
+    }
+    byte crc[2];
+    crcA(_sak, 1, crc);
+    return crc[0] == _sak[1] && crc[1] == _sak[2];
+  }
+
+  bool acceptSak() {
+    if (!sakValid()) {
+      return false;
+    }
+    // A cascade tag means the UID continues on the next level.
+    const byte *uid = _frame + 2;
+    byte count = 4;
+    if (_sak[0] & RC522_SAK_CASCADE) {
+      if (_frame[2] != RC522_CASCADE_TAG || _level >= 2) {
+        return false;
+      }
+      uid++;
+      count = 3;
+    }
+    memcpy(_uid + _uidLength, uid, count);
+    _uidLength += count;
+    return true;
+  }
+
+  bool finishRead(String &uidHex) {
+    uidHex = bytesToHexString(_uid, _uidLength);
+    notify(RfidCardEvent::UidRead, uidHex.c_str());
+    uint32_t fieldToUidUs = static_cast<uint32_t>(esp_timer_get_time() - _fieldAtUs);
+    recordStep(RfidStep::FieldToUid, fieldToUidUs);
+    Serial.printf("[RFID] Card read successfully, UID size: %d bytes, %luus after detection\n",
+                  _uidLength, static_cast<unsigned long>(fieldToUidUs));
+    Serial.printf("[RFID] UID as hex string: %s\n", uidHex.c_str());
+
+    MFRC522::PICC_Type piccType = _mfrc522.PICC_GetType(_sak[0]);
+    Serial.printf("[RFID] Card type: %s\n", _mfrc522.PICC_GetTypeName(piccType));
+
+    memcpy(_trackedUid, _uid, _uidLength);
+    _trackedLength = _uidLength;
+    startHalt();
+    return true;
+  }
+
+  void startHalt() {
+    _frame[0] = MFRC522::PICC_CMD_HLTA;
+    _frame[1] = 0;
+    crcA(_frame, 2, _frame + 2);
+    startTransceive(_frame, 4, 0, _sak, sizeof(_sak), 0);
+    _state = ReadState::Halt;
+  }
+
+  void failRead(const char *step) {
+    Serial.printf("[RFID] Failed to read card serial (%s)\n", step);
+    Telemetry::count(Telemetry::Counter::RfidReadErrors);
+    _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    _state = ReadState::Idle;
+  }
+
   uint8_t  _ssPin;
   uint8_t  _rstPin;
   MFRC522 _mfrc522;
   bool     _initialised = false;
   bool     _initialisationFailed = false;
+
+  ReadState _state = ReadState::Idle;
+  bool      _lowPower = false;
+  int64_t   _commandStartedAtUs = 0;
+  int64_t   _fieldAtUs = 0;
+  // Frame being sent; during anticollision the card's answer is merged
+  // into it at the first unknown bit.
+  byte      _frame[9] = {0};
+  byte      _atqa[2] = {0};
+  byte      _sak[3] = {0};
+  byte     *_rx = nullptr;
+  byte      _rxCapacity = 0;
+  byte      _rxAlign = 0;
+  byte      _rxLength = 0;
+  byte      _rxValidBits = 0;
+  uint8_t   _level = 0;
+  byte      _knownBits = 0;
+  byte      _uid[10] = {0};
+  byte      _uidLength = 0;
+  // The last card read, re-selected while it stays in the field.
+  byte      _trackedUid[10] = {0};
+  byte      _trackedLength = 0;
+  int64_t   _keepAliveStartedAtUs = 0;
 };
 #endif  // defined(USE_RC522)
 
@@ -175,6 +581,9 @@ public:
         Serial.printf("[RFID] Initializing PN532 SPI (IRQ=%d, RST=%d, SS=%d, SCK=%d, MOSI=%d, MISO=%d)\n",
                       _irqPin, _resetPin, _ssPin, _sckPin, _mosiPin, _misoPin);
         SPI.begin(_sckPin, _misoPin, _mosiPin, _ssPin);
+        // The SPI driver ignores IRQ; it is only read for field detection
+        // and, with PN532_IRQ_DETECTION, to know when a card was found.
+        pinMode(_irqPin, INPUT_PULLUP);
         Serial.println("[RFID] SPI bus initialized");
 #  else
         Serial.printf("[RFID] Initializing PN532 I2C (IRQ=%d, RST=%d, SDA=%d, SCL=%d)\n",
@@ -240,6 +649,18 @@ public:
           return false;
         }
 
+        _irqDetection = PN532_IRQ_DETECTION && irqSignalsResponses();
+        if (PN532_IRQ_DETECTION && !_irqDetection) {
+          Serial.printf("[RFID] PN532 IRQ on pin %d never went low, polling instead\n", _irqPin);
+        }
+        if (_irqDetection) {
+          // Retry forever, so one InListPassiveTarget waits for the next
+          // card however long that takes.
+          _pn532.setPassiveActivationRetries(0xFF);
+          attachInterruptArg(digitalPinToInterrupt(_irqPin), Pn532Backend::onIrq, this,
+                             FALLING);
+          Serial.printf("[RFID] PN532 IRQ detection on pin %d\n", _irqPin);
+        }
         Serial.println("[RFID] PN532 ready for passive reads");
         _initialised = true;
         _beginState = BeginState::Ready;
@@ -266,7 +687,24 @@ public:
         return false;
       }
 
-      if (!_pn532.startPassiveTargetIDDetection(PN532_MIFARE_ISO14443A)) {
+      // Waking and changing the retry count are short blocking
+      // exchanges, paid once per idle probe or mode change.
+      if (_poweredDown.load()) {
+        _pn532.wakeup();
+        _poweredDown.store(false);
+      }
+      uint8_t retries =
+          _lowPower || _trackedLength > 0 ? PN532_PROBE_RETRIES : PN532_DEFAULT_RETRIES;
+      if (retries != _passiveRetries && _pn532.setPassiveActivationRetries(retries)) {
+        _passiveRetries = retries;
+      }
+
+      int64_t commandStartedAtUs = esp_timer_get_time();
+      bool started = _pn532.startPassiveTargetIDDetection(PN532_MIFARE_ISO14443A);
+      recordStep(RfidStep::Request,
+                 static_cast<uint32_t>(esp_timer_get_time() - commandStartedAtUs));
+      if (!started) {
+        Telemetry::count(Telemetry::Counter::RfidReadErrors);
         if (!_loggedStartFailure) {
           Serial.println("[RFID] PN532 failed to start passive target detection");
           _loggedStartFailure = true;
@@ -278,16 +716,66 @@ public:
       _awaitingPassiveTarget = true;
       _lastDetectionCommandMs = now;
       _loggedStartFailure = false;
+      // The command's ACK also pulls IRQ low; only edges after it count.
+      _irqSeen.store(false);
       return false;
     }
 
+    // IRQ goes low once the PN532 has found a target and its response
+    // is ready; report that before spending time on the transfer.
+    bool responseReady = digitalRead(_irqPin) == LOW;
+    if (_irqDetection) {
+      // Nothing to fetch yet: leave the bus alone. IRQ stays low until
+      // the response is read, so the level is checked as well as the
+      // edge, in case the edge came before _irqSeen was cleared.
+      bool irqSeen = _irqSeen.exchange(false);
+      if (!responseReady && !irqSeen) {
+        if (now - _lastDetectionCommandMs >= PN532_IRQ_REARM_MS) {
+          _awaitingPassiveTarget = false;
+        }
+        return false;
+      }
+      if (!irqSeen) {
+        _irqAtUs.store(static_cast<uint32_t>(esp_timer_get_time()));
+      }
+      responseReady = true;
+    }
+    int64_t readStartedAtUs = esp_timer_get_time();
+    if (responseReady && _trackedLength == 0) {
+      notify(RfidCardEvent::FieldDetected);
+    }
+
     std::array<uint8_t, 10> uid{};
     uint8_t uidLength = 0;
 
     bool success = _pn532.readDetectedPassiveTargetID(uid.data(), &uidLength);
+    if (success) {
+      recordStep(RfidStep::Select,
+                 static_cast<uint32_t>(esp_timer_get_time() - readStartedAtUs));
+    }
 
     if (!success) {
-      if (now - _lastDetectionCommandMs >= PN532_ASYNC_RESPONSE_TIMEOUT_MS) {
+      // A bounded probe has given up without a card: the tracked card,
+      // if any, has left.
+      bool probeDone = _irqDetection ||
+                       now - _lastDetectionCommandMs >= PN532_ASYNC_RESPONSE_TIMEOUT_MS;
+      if ((_lowPower || _trackedLength > 0) && probeDone) {
+        _trackedLength = 0;
+        if (_lowPower) {
+          powerDown();
+        } else {
+          _awaitingPassiveTarget = false;
+        }
+        _lastDetectionCommandMs = now;
+        return false;
+      }
+      // In IRQ mode a response was waiting, so a failed read needs a new
+      // detection command rather than another attempt.
+      if (_irqDetection) {
+        Telemetry::count(Telemetry::Counter::RfidReadErrors);
+        _awaitingPassiveTarget = false;
+        _lastDetectionCommandMs = now;
+      } else if (now - _lastDetectionCommandMs >= PN532_ASYNC_RESPONSE_TIMEOUT_MS) {
         _awaitingPassiveTarget = false;
         _lastDetectionCommandMs = now;
       }
@@ -300,11 +788,30 @@ public:
     if (uidLength > uid.size()) {
       Serial.printf("[RFID] PN532 UID length %d exceeds buffer size %u, aborting read\n",
                     uidLength, static_cast<unsigned int>(uid.size()));
+      Telemetry::count(Telemetry::Counter::RfidReadErrors);
       return false;
     }
 
-    Serial.printf("[RFID] PN532 detected card, UID length: %d bytes\n", uidLength);
     uidHex = bytesToHexString(uid.data(), uidLength);
+    if (_trackedLength > 0 && uidLength == _trackedLength &&
+        memcmp(uid.data(), _trackedUid.data(), uidLength) == 0) {
+      recordStep(RfidStep::KeepAlive,
+                 static_cast<uint32_t>(esp_timer_get_time() - readStartedAtUs));
+      return true;
+    }
+    _trackedUid = uid;
+    _trackedLength = uidLength;
+    notify(RfidCardEvent::UidRead, uidHex.c_str());
+    if (_irqDetection) {
+      uint32_t irqToUidUs = static_cast<uint32_t>(esp_timer_get_time()) - _irqAtUs.load();
+      recordStep(RfidStep::FieldToUid, irqToUidUs);
+      Serial.printf("[RFID] PN532 detected card, UID length: %d bytes, %luus after IRQ\n",
+                    uidLength, static_cast<unsigned long>(irqToUidUs));
+    } else {
+      recordStep(RfidStep::FieldToUid,
+                 static_cast<uint32_t>(esp_timer_get_time() - readStartedAtUs));
+      Serial.printf("[RFID] PN532 detected card, UID length: %d bytes\n", uidLength);
+    }
     Serial.printf("[RFID] UID as hex string: %s\n", uidHex.c_str());
     return true;
   }
@@ -317,6 +824,14 @@ public:
     return _initialisationFailed;
   }
 
+  bool isBusy() const override {
+    return _lowPower && _awaitingPassiveTarget;
+  }
+
+  void setLowPower(bool enabled) override {
+    _lowPower = enabled;
+  }
+
 private:
   enum class BeginState {
     Idle,
@@ -327,6 +842,119 @@ private:
     Failed
   };
 
+  static void IRAM_ATTR onIrq(void *arg) {
+    Pn532Backend *backend = static_cast<Pn532Backend *>(arg);
+    // Nothing the chip signals while asleep is a card.
+    if (backend->_poweredDown.load()) {
+      return;
+    }
+    backend->_irqAtUs.store(static_cast<uint32_t>(esp_timer_get_time()));
+    backend->_irqSeen.store(true);
+    TaskHandle_t task = backend->wakeTask();
+    if (task != nullptr) {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(task, &woken);
+      portYIELD_FROM_ISR(woken);
+    }
+  }
+
+  // The PowerDown response has to be read before the chip sleeps. Left
+  // pending it would hold IRQ low and be taken for the ACK of the next
+  // command after waking.
+  void powerDown() {
+    uint8_t command[] = {PN532_COMMAND_POWERDOWN, PN532_WAKE_ON_HOST};
+    _awaitingPassiveTarget = false;
+    uint8_t response[PN532_POWERDOWN_RESPONSE_LENGTH];
+    if (!_pn532.sendCommandCheckAck(command, sizeof(command)) ||
+        !readResponse(response, sizeof(response))) {
+      Telemetry::count(Telemetry::Counter::RfidReadErrors);
+      return;
+    }
+    // 00 00 FF LEN LCS D5 17 Status DCS
+    if (response[5] != 0xD5 || response[6] != PN532_COMMAND_POWERDOWN + 1 ||
+        (response[7] & 0x3F) != 0) {
+      Serial.printf("[RFID] PN532 refused PowerDown (status 0x%02X)\n", response[7]);
+      Telemetry::count(Telemetry::Counter::RfidReadErrors);
+      return;
+    }
+    // The response pulled IRQ low too; that was not a card.
+    _irqSeen.store(false);
+    _poweredDown.store(true);
+  }
+
+  // A board without IRQ wired leaves the line high, so with
+  // PN532_IRQ_DETECTION alone no card would ever be seen. IRQ must fall
+  // when the response to a harmless command is ready, and rise again
+  // once it has been read.
+  bool irqSignalsResponses() {
+    uint8_t command[] = {PN532_GET_FIRMWARE_VERSION};
+    pinMode(_irqPin, INPUT_PULLUP);
+    if (!_pn532.sendCommandCheckAck(command, sizeof(command))) {
+      return false;
+    }
+    bool fell = false;
+    const unsigned long startedAt = millis();
+    while (!fell && millis() - startedAt < PN532_RESPONSE_TIMEOUT_MS) {
+      fell = digitalRead(_irqPin) == LOW;
+    }
+    uint8_t response[PN532_FIRMWARE_RESPONSE_LENGTH];
+    return readResponse(response, sizeof(response)) && fell && digitalRead(_irqPin) == HIGH;
+  }
+
+  // Waits for the pending response frame and reads it. The library
+  // keeps its own frame reads private, so this speaks the PN532 host
+  // protocol directly: a status byte that turns 0x01 once the frame is
+  // ready, then the frame.
+  bool readResponse(uint8_t *frame, size_t length) {
+    const unsigned long startedAt = millis();
+#  if defined(USE_PN532_SPI)
+    const SPISettings settings(PN532_SPI_CLOCK_HZ, SPI_LSBFIRST, SPI_MODE0);
+    for (;;) {
+      SPI.beginTransaction(settings);
+      digitalWrite(_ssPin, LOW);
+      SPI.transfer(PN532_SPI_STATUS_READ);
+      bool ready = SPI.transfer(0x00) == PN532_STATUS_READY;
+      if (ready) {
+        digitalWrite(_ssPin, HIGH);
+        delayMicroseconds(1);
+        digitalWrite(_ssPin, LOW);
+        SPI.transfer(PN532_SPI_DATA_READ);
+        for (size_t i = 0; i < length; ++i) {
+          frame[i] = SPI.transfer(0x00);
+        }
+      }
+      digitalWrite(_ssPin, HIGH);
+      SPI.endTransaction();
+      if (ready) {
+        return true;
+      }
+      if (millis() - startedAt >= PN532_RESPONSE_TIMEOUT_MS) {
+        return false;
+      }
+      delay(1);
+    }
+#  else
+    // Every I2C read starts with the status byte, then the frame from
+    // its beginning.
+    for (;;) {
+      size_t received = Wire.requestFrom(PN532_I2C_ADDRESS, static_cast<uint8_t>(length + 1));
+      if (received == length + 1 && Wire.read() == PN532_STATUS_READY) {
+        for (size_t i = 0; i < length; ++i) {
+          frame[i] = static_cast<uint8_t>(Wire.read());
+        }
+        return true;
+      }
+      while (Wire.available() > 0) {
+        Wire.read();
+      }
+      if (millis() - startedAt >= PN532_RESPONSE_TIMEOUT_MS) {
+        return false;
+      }
+      delay(1);
+    }
+#  endif
+  }
+
   void logFirmwareFailure() {
     if (_firmwareFailureLogged) {
       return;
@@ -363,12 +991,227 @@ private:
   uint8_t        _firmwareAttempts = 0;
   bool           _initialisationFailed = false;
   bool           _firmwareFailureLogged = false;
+  // Written by onIrq(); the low 32 bits of esp_timer are enough for the
+  // IRQ-to-UID time and stay lock-free in the ISR.
+  std::atomic<bool>     _irqSeen{false};
+  std::atomic<uint32_t> _irqAtUs{0};
+  // Read by onIrq() too.
+  std::atomic<bool>     _poweredDown{false};
+  bool                  _lowPower = false;
+  uint8_t               _passiveRetries = PN532_DEFAULT_RETRIES;
+  // PN532_IRQ_DETECTION, once begin() has seen IRQ work.
+  bool                  _irqDetection = false;
+  // The last card read; a detection of the same UID is a keep-alive.
+  std::array<uint8_t, 10> _trackedUid{};
+  uint8_t                 _trackedLength = 0;
 };
 #endif  // defined(USE_PN532)
 
 }  // namespace
 
+const char *rfidStepName(RfidStep step) {
+  switch (step) {
+    case RfidStep::Poll:
+      return "poll";
+    case RfidStep::Request:
+      return "request";
+    case RfidStep::Anticollision:
+      return "anticollision";
+    case RfidStep::Select:
+      return "select";
+    case RfidStep::Halt:
+      return "halt";
+    case RfidStep::FieldToUid:
+      return "field_to_uid";
+    case RfidStep::KeepAlive:
+      return "keepalive";
+    case RfidStep::Removal:
+      return "removal";
+    case RfidStep::Count:
+      break;
+  }
+  return "unknown";
+}
+
+void IRfidBackend::recordStep(RfidStep step, uint32_t durationUs) {
+  if (step == RfidStep::Count) {
+    return;
+  }
+  portENTER_CRITICAL(&_stepLock);
+  _steps[static_cast<size_t>(step)].record(durationUs);
+  portEXIT_CRITICAL(&_stepLock);
+}
+
+LatencyHistogram IRfidBackend::stepTiming(RfidStep step) const {
+  LatencyHistogram histogram;
+  if (step == RfidStep::Count) {
+    return histogram;
+  }
+  portENTER_CRITICAL(&_stepLock);
+  histogram = _steps[static_cast<size_t>(step)];
+  portEXIT_CRITICAL(&_stepLock);
+  return histogram;
+}
+
+void IRfidBackend::resetStepTimings() {
+  portENTER_CRITICAL(&_stepLock);
+  for (LatencyHistogram &histogram : _steps) {
+    histogram.reset();
+  }
+  portEXIT_CRITICAL(&_stepLock);
+}
+
 void RfidReader::begin() {
+  if (_task != nullptr) {
+    return;
+  }
+  BaseType_t created = xTaskCreate(RfidReader::taskEntry, "RfidReader", kRfidTaskStackSize,
+                                   this, RFID_TASK_PRIORITY, &_task);
+  if (created != pdPASS) {
+    Serial.println("[RFID] Failed to start RFID task");
+    _task = nullptr;
+  }
+}
+
+bool RfidReader::pollCard(RfidCardRead &out) {
+  return _reads.pop(out);
+}
+
+void RfidReader::setEventListener(RfidCardEventListener listener, void *context) {
+  _listener = listener;
+  _listenerContext = context;
+}
+
+RfidReader::Stats RfidReader::stats() const {
+  Stats stats;
+  stats.polls = _polls.load(std::memory_order_relaxed);
+  stats.cards = _cards.load(std::memory_order_relaxed);
+  stats.keepAlives = _keepAlives.load(std::memory_order_relaxed);
+  stats.removals = _removals.load(std::memory_order_relaxed);
+  stats.dropped = _dropped.load(std::memory_order_relaxed);
+  stats.maxPollGapUs = _maxPollGapUs.load(std::memory_order_relaxed);
+  stats.intervalMs = _intervalMs.load(std::memory_order_relaxed);
+  stats.lowPower = _lowPowerActive.load();
+  return stats;
+}
+
+void RfidReader::setPowerProfile(RfidPowerProfile profile) {
+  _profile.store(profile);
+  if (_task != nullptr) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+RfidPowerProfile RfidReader::powerProfile() const {
+  return _profile.load();
+}
+
+LatencyHistogram RfidReader::stepTiming(RfidStep step) const {
+  if (!_backendReady) {
+    return LatencyHistogram();
+  }
+  return _backend->stepTiming(step);
+}
+
+void RfidReader::resetStats() {
+  _polls.store(0);
+  _cards.store(0);
+  _keepAlives.store(0);
+  _removals.store(0);
+  _dropped.store(0);
+  _maxPollGapUs.store(0);
+  if (_backendReady) {
+    _backend->resetStepTimings();
+  }
+}
+
+void RfidReader::taskEntry(void *param) {
+  static_cast<RfidReader *>(param)->runTask();
+}
+
+void RfidReader::runTask() {
+  int64_t nextPollAtUs = esp_timer_get_time();
+  for (;;) {
+    bool activity = true;
+    if (!_backendReady) {
+      beginBackend();
+      if (_backendFailed) {
+        Serial.println("[RFID] No usable reader, stopping RFID task");
+        vTaskDelete(nullptr);
+        return;
+      }
+    }
+    if (_backendReady) {
+      activity = poll();
+    }
+
+    unsigned long intervalMs = nextInterval(activity);
+    int64_t now = esp_timer_get_time();
+    if (intervalMs == 0) {
+      // A frame takes about a millisecond, so waiting a whole poll
+      // interval per step would add tens of ms to every read.
+      nextPollAtUs = now;
+      ulTaskNotifyTake(pdTRUE, 1);
+      continue;
+    }
+    // Polls keep their cadence however long the read took. An
+    // interrupt from the backend ends the wait early.
+    nextPollAtUs += static_cast<int64_t>(intervalMs) * 1000;
+    if (nextPollAtUs < now) {
+      nextPollAtUs = now;
+    }
+    TickType_t waitTicks = pdMS_TO_TICKS((nextPollAtUs - now) / 1000);
+    if (waitTicks > 0) {
+      ulTaskNotifyTake(pdTRUE, waitTicks);
+    } else {
+      // Let equal-priority tasks run even when a read overran.
+      taskYIELD();
+    }
+  }
+}
+
+unsigned long RfidReader::nextInterval(bool activity) {
+  const RfidPollProfile &profile = RFID_POLL_PROFILES[static_cast<size_t>(_profile.load())];
+  int64_t now = esp_timer_get_time();
+  unsigned long interval = _intervalMs.load(std::memory_order_relaxed);
+  if (activity || interval == 0) {
+    _lastActivityAtUs = now;
+    interval = profile.activeIntervalMs;
+  } else if (now - _lastActivityAtUs >= static_cast<int64_t>(profile.activeHoldMs) * 1000) {
+    interval *= 2;
+  }
+  // Also brings the interval into range after a profile switch.
+  if (interval < profile.activeIntervalMs) {
+    interval = profile.activeIntervalMs;
+  } else if (interval > profile.idleIntervalMs) {
+    interval = profile.idleIntervalMs;
+  }
+  _intervalMs.store(interval, std::memory_order_relaxed);
+
+  if (!_backendReady) {
+    return interval;
+  }
+  // A card on the reader keeps it awake.
+  bool lowPower = profile.lowPowerDetect && !activity && !_present &&
+                  interval >= profile.idleIntervalMs;
+  if (lowPower != _lowPowerActive.load()) {
+    Serial.printf("[RFID] %s low-power detection\n", lowPower ? "Entering" : "Leaving");
+    _backend->setLowPower(lowPower);
+    _lowPowerActive.store(lowPower);
+  }
+  // A read in progress is followed up quickly without resetting the
+  // decay, so an idle probe does not count as activity. A present card
+  // is checked at its own rate.
+  if (_backend->hasFrameInFlight()) {
+    return 0;
+  }
+  if (_backend->isBusy()) {
+    return profile.activeIntervalMs;
+  }
+  return _present ? RFID_PRESENCE_CHECK_MS : interval;
+}
+
+void RfidReader::beginBackend() {
   if (_backendReady || _backendFailed) {
     return;
   }
@@ -402,10 +1245,8 @@ void RfidReader::begin() {
         _backendFailed = true;
         return;
     }
-  }
-
-  if (!_backend) {
-    return;
+    _backend->setEventListener(RfidReader::handleBackendEvent, this);
+    _backend->setWakeTask(xTaskGetCurrentTaskHandle());
   }
 
   if (_backend->begin()) {
@@ -415,23 +1256,119 @@ void RfidReader::begin() {
 
   if (_backend->hasFailed()) {
     Serial.println("[RFID] Backend initialisation failed");
+    Telemetry::count(Telemetry::Counter::RfidInitFailures);
     _backend.reset();
     _backendFailed = true;
   }
 }
 
-bool RfidReader::readCard(String &uidHex) {
-  if (!_backendReady) {
-    begin();
-    if (!_backendReady) {
-      return false;
+bool RfidReader::poll() {
+  int64_t startedAt = esp_timer_get_time();
+  if (_lastPollAtUs != 0) {
+    uint32_t gapUs = static_cast<uint32_t>(startedAt - _lastPollAtUs);
+    if (gapUs > _maxPollGapUs.load(std::memory_order_relaxed)) {
+      _maxPollGapUs.store(gapUs, std::memory_order_relaxed);
     }
   }
+  _lastPollAtUs = startedAt;
+  _polls.fetch_add(1, std::memory_order_relaxed);
 
-  if (!_backend) {
-    Serial.println("[RFID] No reader backend is initialised");
-    return false;
+  // A read spans several polls, so the field stamp is kept until the
+  // UID arrives; one from an abandoned read is discarded later.
+  _uidReadAtUs = 0;
+  _activitySeen = false;
+  String uidHex;
+  bool cardRead = _backend->readCard(uidHex);
+  int64_t now = esp_timer_get_time();
+  _backend->recordStep(RfidStep::Poll, static_cast<uint32_t>(now - startedAt));
+
+  if (cardRead && (uidHex.length() == 0 || uidHex.length() > RfidCardRead::kMaxUidLength)) {
+    Telemetry::count(Telemetry::Counter::RfidReadErrors);
+    cardRead = false;
   }
+  bool changed = false;
+  if (cardRead) {
+    changed = !_present || strcmp(_presentUid, uidHex.c_str()) != 0;
+    trackPresence(uidHex, now);
+  } else if (_present &&
+             now - _lastSeenAtUs >= static_cast<int64_t>(RFID_REMOVAL_TIMEOUT_MS) * 1000) {
+    reportRemoval(now);
+    changed = true;
+  }
+  return changed || _activitySeen;
+}
 
-  return _backend->readCard(uidHex);
+void RfidReader::trackPresence(const String &uidHex, int64_t now) {
+  if (_present && strcmp(_presentUid, uidHex.c_str()) == 0) {
+    _lastSeenAtUs = now;
+    _keepAlives.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // A different card replaced the one on the reader without a gap.
+  if (_present) {
+    reportRemoval(now);
+  }
+
+  RfidCardRead read;
+  read.presence = RfidPresence::Arrived;
+  memcpy(read.uid, uidHex.c_str(), uidHex.length() + 1);
+  read.readAt = millis();
+  read.uidReadAtUs = _uidReadAtUs != 0 ? _uidReadAtUs : now;
+  if (_fieldDetectedAtUs != 0 && read.uidReadAtUs - _fieldDetectedAtUs < kMaxFieldToUidUs) {
+    read.fieldDetectedAtUs = _fieldDetectedAtUs;
+  }
+  _fieldDetectedAtUs = 0;
+
+  _present = true;
+  memcpy(_presentUid, read.uid, sizeof(_presentUid));
+  _presentSinceUs = read.uidReadAtUs;
+  _lastSeenAtUs = now;
+  _cards.fetch_add(1, std::memory_order_relaxed);
+  publish(read);
+}
+
+void RfidReader::reportRemoval(int64_t now) {
+  RfidCardRead read;
+  read.presence = RfidPresence::Removed;
+  memcpy(read.uid, _presentUid, sizeof(read.uid));
+  read.readAt = millis();
+  read.uidReadAtUs = _lastSeenAtUs;
+  read.presentMs = static_cast<uint32_t>((_lastSeenAtUs - _presentSinceUs) / 1000);
+
+  uint32_t detectUs = static_cast<uint32_t>(now - _lastSeenAtUs);
+  _backend->recordStep(RfidStep::Removal, detectUs);
+  Serial.printf("[RFID] Card %s removed after %lums, noticed %luus after its last answer\n",
+                read.uid, static_cast<unsigned long>(read.presentMs),
+                static_cast<unsigned long>(detectUs));
+  _present = false;
+  _presentUid[0] = '\0';
+  _removals.fetch_add(1, std::memory_order_relaxed);
+  publish(read);
+}
+
+void RfidReader::publish(const RfidCardRead &read) {
+  if (!_reads.push(read)) {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    Serial.printf("[RFID] Card queue full, dropping %s\n", read.uid);
+  }
+}
+
+void RfidReader::handleBackendEvent(RfidCardEvent event, const char *uidHex, void *context) {
+  RfidReader *reader = static_cast<RfidReader *>(context);
+  int64_t now = esp_timer_get_time();
+  if (event == RfidCardEvent::FieldDetected) {
+    reader->_fieldDetectedAtUs = now;
+  } else {
+    reader->_uidReadAtUs = now;
+  }
+  // A backend that lost track of the card re-reads it in full; that is
+  // not a new tap, so the listener does not hear about it.
+  if (reader->_present &&
+      (event == RfidCardEvent::FieldDetected || strcmp(uidHex, reader->_presentUid) == 0)) {
+    return;
+  }
+  reader->_activitySeen = true;
+  if (reader->_listener != nullptr) {
+    reader->_listener(event, uidHex, reader->_listenerContext);
+  }
 }
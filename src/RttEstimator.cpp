@@ -0,0 +1,49 @@
+/*
+ * RttEstimator.cpp
+ *
+ * Implements the RFC 6298 style smoothed RTT and timeout calculation.
+ */
+
+#include "RttEstimator.h"
+
+namespace {
+constexpr float kAlpha = 1.0f / 8.0f;
+constexpr float kBeta = 1.0f / 4.0f;
+constexpr float kVarianceFactor = 4.0f;
+}  // namespace
+
+void RttEstimator::addSample(unsigned long rttMs) {
+  float sample = static_cast<float>(rttMs);
+  if (!_hasSamples) {
+    _srttMs = sample;
+    _rttvarMs = sample / 2.0f;
+    _hasSamples = true;
+  } else {
+    float error = sample > _srttMs ? sample - _srttMs : _srttMs - sample;
+    _rttvarMs = (1.0f - kBeta) * _rttvarMs + kBeta * error;
+    _srttMs = (1.0f - kAlpha) * _srttMs + kAlpha * sample;
+  }
+  _backoffShift = 0;
+}
+
+void RttEstimator::backOff() {
+  if (_backoffShift < kMaxBackoffShift) {
+    _backoffShift++;
+  }
+}
+
+unsigned long RttEstimator::timeoutMs() const {
+  if (!_hasSamples) {
+    return _maxTimeoutMs;
+  }
+  unsigned long timeout =
+      static_cast<unsigned long>(_srttMs + kVarianceFactor * _rttvarMs + 0.5f);
+  timeout <<= _backoffShift;
+  if (timeout < _minTimeoutMs) {
+    timeout = _minTimeoutMs;
+  }
+  if (timeout > _maxTimeoutMs) {
+    timeout = _maxTimeoutMs;
+  }
+  return timeout;
+}
@@ -0,0 +1,192 @@
+/*
+ * TapJournal.cpp
+ *
+ * Implements the NVS-backed ring buffer of undelivered card taps.
+ */
+
+#include "TapJournal.h"
+
+#include <Preferences.h>
+
+#include "EventClock.h"
+
+namespace {
+constexpr const char *kNamespace = "tapjournal";
+constexpr const char *kJournalKey = "ring";
+constexpr const char *kBootKey = "boot";
+constexpr uint32_t    kMagic = 0x4A504154;  // "TAPJ"
+constexpr uint16_t    kVersion = 3;
+}  // namespace
+
+void TapJournal::begin() {
+  if (_loaded) {
+    return;
+  }
+  _loaded = true;
+
+  Preferences prefs;
+  if (!prefs.begin(kNamespace, false)) {
+    Serial.println("[Journal] Failed to open NVS namespace; journal is RAM-only");
+    return;
+  }
+
+  _bootId = static_cast<uint16_t>(prefs.getUShort(kBootKey, 0) + 1);
+  prefs.putUShort(kBootKey, _bootId);
+
+  StoredJournal stored;
+  size_t length = prefs.getBytesLength(kJournalKey);
+  if (length == sizeof(stored) &&
+      prefs.getBytes(kJournalKey, &stored, sizeof(stored)) == sizeof(stored) &&
+      stored.magic == kMagic && stored.version == kVersion &&
+      stored.count <= TAP_JOURNAL_CAPACITY) {
+    for (size_t i = 0; i < stored.count; ++i) {
+      _entries[i] = stored.entries[i];
+      _entries[i].uid[kMaxUidLength] = '\0';
+    }
+    _head = 0;
+    _count = stored.count;
+    _nextSeq = stored.nextSeq;
+  } else if (length != 0) {
+    Serial.println("[Journal] Discarding journal with unexpected format");
+    prefs.remove(kJournalKey);
+  }
+  prefs.end();
+
+  Serial.printf("[Journal] Boot %u, %u undelivered tap(s) in journal\n", _bootId,
+                static_cast<unsigned int>(_count));
+}
+
+void TapJournal::append(const char *uid, unsigned long capturedAtMs, uint32_t tapId) {
+  if (uid == nullptr || uid[0] == '\0') {
+    return;
+  }
+
+  if (_count == TAP_JOURNAL_CAPACITY) {
+    Serial.printf("[Journal] Journal full, dropping oldest tap %s\n", at(0).uid);
+    dropOldest();
+  }
+
+  Entry &entry = _entries[(_head + _count) % TAP_JOURNAL_CAPACITY];
+  entry = Entry();
+  entry.seq = _nextSeq++;
+  entry.capturedAtMs = static_cast<uint32_t>(capturedAtMs);
+  entry.capturedWallUs = EventClock::wallUsAtMillis(capturedAtMs);
+  entry.tapId = tapId;
+  entry.bootId = _bootId;
+  strncpy(entry.uid, uid, kMaxUidLength);
+  _count++;
+  _dirty = true;
+
+  Serial.printf("[Journal] Recorded tap %s (#%lu), %u pending\n", entry.uid,
+                static_cast<unsigned long>(entry.seq), static_cast<unsigned int>(_count));
+}
+
+bool TapJournal::peekOldest(Entry &out) const {
+  if (_count == 0) {
+    return false;
+  }
+  out = at(0);
+  return true;
+}
+
+void TapJournal::dropOldest() {
+  if (_count == 0) {
+    return;
+  }
+  _head = (_head + 1) % TAP_JOURNAL_CAPACITY;
+  _count--;
+  _dirty = true;
+}
+
+void TapJournal::dropCapturedBefore(unsigned long capturedAtMs) {
+  size_t kept = 0;
+  for (size_t i = 0; i < _count; ++i) {
+    const Entry &entry = at(i);
+    // An entry from an earlier boot was captured before any tap of this
+    // one, however old it turns out to be.
+    bool older = entry.bootId != _bootId || entry.capturedAtMs < capturedAtMs;
+    if (older) {
+      continue;
+    }
+    _entries[(_head + kept) % TAP_JOURNAL_CAPACITY] = entry;
+    kept++;
+  }
+
+  if (kept != _count) {
+    Serial.printf("[Journal] Dropped %u tap(s) superseded by a newer delivery\n",
+                  static_cast<unsigned int>(_count - kept));
+    _count = kept;
+    _dirty = true;
+  }
+}
+
+TapJournal::Freshness TapJournal::freshness(const Entry &entry, unsigned long now,
+                                            uint32_t &ageMsOut) const {
+  uint64_t ageMs = 0;
+  if (entry.bootId == _bootId) {
+    ageMs = now - entry.capturedAtMs;
+  } else if (now > TAP_JOURNAL_MAX_AGE_MS || entry.capturedWallUs == 0) {
+    // Either it was captured before this boot began, longer ago than
+    // the limit, or it was never dated and its age cannot be known.
+    return Freshness::Expired;
+  } else if (!EventClock::isSynced()) {
+    return Freshness::Unknown;
+  } else {
+    // At least as old as this boot, even if the clock has been stepped.
+    int64_t ageUs = EventClock::nowUs() - entry.capturedWallUs;
+    ageMs = ageUs > static_cast<int64_t>(now) * 1000 ? static_cast<uint64_t>(ageUs / 1000) : now;
+  }
+  if (ageMs > TAP_JOURNAL_MAX_AGE_MS) {
+    return Freshness::Expired;
+  }
+  ageMsOut = static_cast<uint32_t>(ageMs);
+  return Freshness::Fresh;
+}
+
+void TapJournal::flush(unsigned long now, bool force) {
+  // Taps journaled before the clock synced are dated as soon as it has,
+  // so they can still be aged if they outlive this boot.
+  if (EventClock::isSynced()) {
+    for (size_t i = 0; i < _count; ++i) {
+      Entry &entry = _entries[(_head + i) % TAP_JOURNAL_CAPACITY];
+      if (entry.bootId == _bootId && entry.capturedWallUs == 0) {
+        entry.capturedWallUs = EventClock::wallUsAtMillis(entry.capturedAtMs);
+        _dirty = true;
+      }
+    }
+  }
+  if (!_dirty) {
+    return;
+  }
+  if (!force && _lastFlushAt != 0 && now - _lastFlushAt < TAP_JOURNAL_MIN_FLUSH_INTERVAL_MS) {
+    return;
+  }
+
+  StoredJournal stored{};
+  stored.magic = kMagic;
+  stored.version = kVersion;
+  stored.count = static_cast<uint16_t>(_count);
+  stored.nextSeq = _nextSeq;
+  for (size_t i = 0; i < _count; ++i) {
+    stored.entries[i] = at(i);
+  }
+
+  Preferences prefs;
+  if (!prefs.begin(kNamespace, false)) {
+    Serial.println("[Journal] Failed to open NVS namespace for writing");
+    return;
+  }
+  size_t written = prefs.putBytes(kJournalKey, &stored, sizeof(stored));
+  prefs.end();
+
+  _lastFlushAt = now == 0 ? 1 : now;
+  if (written != sizeof(stored)) {
+    Serial.println("[Journal] Failed to persist journal");
+    return;
+  }
+  _dirty = false;
+}
+
+const TapJournal::Entry &TapJournal::at(size_t index) const {
+  return _entries[(_head + index) % TAP_JOURNAL_CAPACITY];
+}
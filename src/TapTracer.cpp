@@ -0,0 +1,254 @@
+/*
+ * TapTracer.cpp
+ *
+ * Implements tap traces and their latency histograms.
+ */
+
+#include "TapTracer.h"
+
+#include <esp_timer.h>
+
+#include "Config.h"
+#include "EventClock.h"
+
+namespace {
+constexpr size_t kSubBucketBits = 2;
+constexpr size_t kSubBuckets = 1u << kSubBucketBits;
+}  // namespace
+
+size_t LatencyHistogram::bucketFor(uint32_t valueUs) {
+  if (valueUs < kSubBuckets) {
+    return valueUs;
+  }
+  size_t msb = 31 - __builtin_clz(valueUs);
+  size_t sub = (valueUs >> (msb - kSubBucketBits)) & (kSubBuckets - 1);
+  size_t bucket = (msb - kSubBucketBits + 1) * kSubBuckets + sub;
+  return bucket < kBucketCount ? bucket : kBucketCount - 1;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return static_cast<uint32_t>(bucket);
+  }
+  size_t shift = bucket / kSubBuckets - 1;
+  size_t sub = bucket % kSubBuckets;
+  uint32_t lower = static_cast<uint32_t>((kSubBuckets + sub) << shift);
+  return lower + (1u << shift) - 1;
+}
+
+void LatencyHistogram::record(uint32_t valueUs) {
+  _buckets[bucketFor(valueUs)]++;
+  _count++;
+  _sumUs += valueUs;
+  if (valueUs > _maxUs) {
+    _maxUs = valueUs;
+  }
+}
+
+void LatencyHistogram::reset() {
+  *this = LatencyHistogram();
+}
+
+uint32_t LatencyHistogram::percentile(float percent) const {
+  if (_count == 0) {
+    return 0;
+  }
+  uint32_t rank = static_cast<uint32_t>(percent / 100.0f * _count + 0.5f);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint32_t seen = 0;
+  for (size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+    seen += _buckets[bucket];
+    if (seen >= rank) {
+      uint32_t bound = bucketUpperBound(bucket);
+      return bound < _maxUs ? bound : _maxUs;
+    }
+  }
+  return _maxUs;
+}
+
+uint32_t TapTracer::begin() {
+  portENTER_CRITICAL(&_lock);
+  uint32_t id = _nextId++;
+  if (_nextId == 0) {
+    _nextId = 1;
+  }
+  // Reuse a free slot, or the one holding the oldest trace.
+  Trace *slot = &_open[0];
+  for (Trace &trace : _open) {
+    if (trace.id == 0) {
+      slot = &trace;
+      break;
+    }
+    if (trace.id < slot->id) {
+      slot = &trace;
+    }
+  }
+  *slot = Trace();
+  slot->id = id;
+  portEXIT_CRITICAL(&_lock);
+  return id;
+}
+
+void TapTracer::mark(uint32_t traceId, Stage stage) {
+  if (traceId == 0) {
+    return;
+  }
+  markAt(traceId, stage, esp_timer_get_time());
+}
+
+void TapTracer::markAt(uint32_t traceId, Stage stage, int64_t timestampUs) {
+  if (traceId == 0 || stage == Stage::Count) {
+    return;
+  }
+  portENTER_CRITICAL(&_lock);
+  Trace *trace = find(traceId);
+  if (trace != nullptr && trace->stampUs[static_cast<size_t>(stage)] == 0) {
+    trace->stampUs[static_cast<size_t>(stage)] = timestampUs;
+  }
+  portEXIT_CRITICAL(&_lock);
+}
+
+void TapTracer::finish(uint32_t traceId) {
+  if (traceId == 0) {
+    return;
+  }
+
+  Trace trace;
+  portENTER_CRITICAL(&_lock);
+  Trace *open = find(traceId);
+  if (open != nullptr) {
+    trace = *open;
+    *open = Trace();
+  }
+  portEXIT_CRITICAL(&_lock);
+  if (trace.id == 0) {
+    return;
+  }
+
+  // Stages are recorded as the time since the previous stamped stage,
+  // so skipped stages (a warm connection needs no connect) simply fold
+  // into the next one.
+  char summary[160];
+  int length = snprintf(summary, sizeof(summary), "[Trace] Tap #%lu:",
+                        static_cast<unsigned long>(traceId));
+  int64_t first = 0;
+  int64_t previous = 0;
+  for (size_t i = 0; i < kStageCount; ++i) {
+    int64_t stamp = trace.stampUs[i];
+    if (stamp == 0) {
+      continue;
+    }
+    if (previous == 0) {
+      first = stamp;
+    } else {
+      uint32_t deltaUs = static_cast<uint32_t>(stamp - previous);
+      _stages[i].record(deltaUs);
+      if (length > 0 && static_cast<size_t>(length) < sizeof(summary)) {
+        length += snprintf(summary + length, sizeof(summary) - length, " %s +%.1f",
+                           stageName(static_cast<Stage>(i)), deltaUs / 1000.0f);
+      }
+    }
+    previous = stamp;
+  }
+  if (previous == first) {
+    return;
+  }
+
+  uint32_t totalUs = static_cast<uint32_t>(previous - first);
+  _total.record(totalUs);
+  _finished++;
+  // The wall-clock time of the first stage lines the trace up with the
+  // backend's logs.
+  char capturedText[32];
+  Serial.printf("%s = %.1f ms (read at %s)\n", summary, totalUs / 1000.0f,
+                EventClock::format(EventClock::wallUsAt(first), capturedText,
+                                   sizeof(capturedText)));
+
+  if (TAP_TRACE_DUMP_EVERY > 0 && _finished % TAP_TRACE_DUMP_EVERY == 0) {
+    dump(Serial);
+  }
+}
+
+void TapTracer::abandon(uint32_t traceId) {
+  if (traceId == 0) {
+    return;
+  }
+  portENTER_CRITICAL(&_lock);
+  Trace *trace = find(traceId);
+  if (trace != nullptr) {
+    *trace = Trace();
+  }
+  portEXIT_CRITICAL(&_lock);
+}
+
+void TapTracer::reset() {
+  for (LatencyHistogram &histogram : _stages) {
+    histogram.reset();
+  }
+  _total.reset();
+  _finished = 0;
+}
+
+void TapTracer::dump(Print &out) const {
+  out.printf("[Trace] Tap latency over %lu tap(s), ms (p50 / p95 / p99 / max):\n",
+             static_cast<unsigned long>(_finished));
+  auto printRow = [&out](const char *name, const LatencyHistogram &histogram) {
+    if (histogram.count() == 0) {
+      return;
+    }
+    out.printf("[Trace]   %-14s %8.1f %8.1f %8.1f %8.1f  (n=%lu)\n", name,
+               histogram.percentile(50) / 1000.0f, histogram.percentile(95) / 1000.0f,
+               histogram.percentile(99) / 1000.0f, histogram.maxUs() / 1000.0f,
+               static_cast<unsigned long>(histogram.count()));
+  };
+  for (size_t i = 0; i < kStageCount; ++i) {
+    printRow(stageName(static_cast<Stage>(i)), _stages[i]);
+  }
+  printRow("total", _total);
+}
+
+const LatencyHistogram &TapTracer::histogram(Stage stage) const {
+  if (stage == Stage::Count) {
+    return _total;
+  }
+  return _stages[static_cast<size_t>(stage)];
+}
+
+const char *TapTracer::stageName(Stage stage) {
+  switch (stage) {
+    case Stage::FieldDetected:
+      return "field";
+    case Stage::UidRead:
+      return "uid_read";
+    case Stage::CardProcessed:
+      return "processed";
+    case Stage::Resolved:
+      return "resolved";
+    case Stage::Connected:
+      return "connected";
+    case Stage::Secured:
+      return "tls";
+    case Stage::RequestSent:
+      return "sent";
+    case Stage::FirstByte:
+      return "first_byte";
+    case Stage::Completed:
+      return "completed";
+    case Stage::FirstFrame:
+      return "first_frame";
+    case Stage::Count:
+      break;
+  }
+  return "total";
+}
+
+TapTracer::Trace *TapTracer::find(uint32_t traceId) {
+  for (Trace &trace : _open) {
+    if (trace.id == traceId) {
+      return &trace;
+    }
+  }
+  return nullptr;
+}
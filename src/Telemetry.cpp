@@ -0,0 +1,354 @@
+/*
+ * Telemetry.cpp
+ *
+ * Implements the telemetry windows and their JSON batch encoding.
+ */
+
+#include "Telemetry.h"
+
+#include <WiFi.h>
+#include <stdarg.h>
+
+#include "Config.h"
+#include "freertos/FreeRTOS.h"
+
+namespace {
+// Upper bounds of the bounded histogram buckets, in ms.
+constexpr unsigned long kBucketBoundsMs[Telemetry::kBucketCount - 1] = {50,  100,  200, 400,
+                                                                        800, 1600, 3200};
+// Room for one rendered window; a window never gets near it.
+constexpr size_t kMaxWindowLength = 512;
+
+struct Window {
+  uint32_t      seq = 0;
+  unsigned long startedAt = 0;
+  unsigned long endedAt = 0;
+  uint32_t      counters[Telemetry::kCounterCount] = {0};
+  uint32_t      buckets[Telemetry::kHistogramCount][Telemetry::kBucketCount] = {{0}};
+  int8_t        rssiMin = 0;
+  int8_t        rssiMax = 0;
+  int32_t       rssiSum = 0;
+  uint16_t      rssiSamples = 0;
+  uint32_t      heapMin = 0;
+};
+
+portMUX_TYPE  gLock = portMUX_INITIALIZER_UNLOCKED;
+bool          gStarted = false;
+Window        gCurrent;
+Window        gClosed[TELEMETRY_MAX_WINDOWS];
+size_t        gHead = 0;
+size_t        gCount = 0;
+uint32_t      gLastSeq = 0;
+unsigned long gLastSampleAt = 0;
+bool          gUploadRequested = false;
+Telemetry::Stats gStats;
+
+size_t bucketFor(unsigned long durationMs) {
+  size_t bucket = 0;
+  while (bucket < Telemetry::kBucketCount - 1 && durationMs > kBucketBoundsMs[bucket]) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+// Appends to `out` and returns false once it no longer fits.
+bool append(char *out, size_t capacity, size_t &length, const char *format, ...) {
+  if (length >= capacity) {
+    return false;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(out + length, capacity - length, format, args);
+  va_end(args);
+  if (written < 0 || static_cast<size_t>(written) >= capacity - length) {
+    length = capacity;
+    return false;
+  }
+  length += static_cast<size_t>(written);
+  return true;
+}
+
+size_t renderWindow(const Window &window, char *out, size_t capacity) {
+  size_t length = 0;
+  append(out, capacity, length, "{\"seq\":%lu,\"start_ms\":%lu,\"end_ms\":%lu,\"counters\":{",
+         static_cast<unsigned long>(window.seq), window.startedAt, window.endedAt);
+  // Zero counters are left out; most windows only have a few.
+  bool first = true;
+  for (size_t i = 0; i < Telemetry::kCounterCount; ++i) {
+    if (window.counters[i] == 0) {
+      continue;
+    }
+    append(out, capacity, length, "%s\"%s\":%lu", first ? "" : ",",
+           Telemetry::counterName(static_cast<Telemetry::Counter>(i)),
+           static_cast<unsigned long>(window.counters[i]));
+    first = false;
+  }
+  append(out, capacity, length, "},\"histograms\":{");
+  first = true;
+  for (size_t h = 0; h < Telemetry::kHistogramCount; ++h) {
+    uint32_t total = 0;
+    for (size_t b = 0; b < Telemetry::kBucketCount; ++b) {
+      total += window.buckets[h][b];
+    }
+    if (total == 0) {
+      continue;
+    }
+    append(out, capacity, length, "%s\"%s\":[", first ? "" : ",",
+           Telemetry::histogramName(static_cast<Telemetry::Histogram>(h)));
+    for (size_t b = 0; b < Telemetry::kBucketCount; ++b) {
+      append(out, capacity, length, "%s%lu", b == 0 ? "" : ",",
+             static_cast<unsigned long>(window.buckets[h][b]));
+    }
+    append(out, capacity, length, "]");
+    first = false;
+  }
+  append(out, capacity, length, "}");
+  if (window.rssiSamples > 0) {
+    append(out, capacity, length, ",\"rssi\":{\"min\":%d,\"avg\":%ld,\"max\":%d}",
+           window.rssiMin, static_cast<long>(window.rssiSum / window.rssiSamples),
+           window.rssiMax);
+  }
+  if (window.heapMin != 0) {
+    append(out, capacity, length, ",\"heap_min\":%lu", static_cast<unsigned long>(window.heapMin));
+  }
+  if (!append(out, capacity, length, "}")) {
+    return 0;
+  }
+  return length;
+}
+}  // namespace
+
+void Telemetry::count(Counter counter, uint32_t amount) {
+  if (!TELEMETRY_ENABLED || counter >= Counter::Count) {
+    return;
+  }
+  portENTER_CRITICAL(&gLock);
+  gCurrent.counters[static_cast<size_t>(counter)] += amount;
+  portEXIT_CRITICAL(&gLock);
+}
+
+void Telemetry::observe(Histogram histogram, unsigned long durationMs) {
+  if (!TELEMETRY_ENABLED || histogram >= Histogram::Count) {
+    return;
+  }
+  size_t bucket = bucketFor(durationMs);
+  portENTER_CRITICAL(&gLock);
+  gCurrent.buckets[static_cast<size_t>(histogram)][bucket]++;
+  portEXIT_CRITICAL(&gLock);
+}
+
+void Telemetry::loop(unsigned long now, bool wifiConnected) {
+  if (!TELEMETRY_ENABLED) {
+    return;
+  }
+  if (!gStarted) {
+    portENTER_CRITICAL(&gLock);
+    gCurrent.startedAt = now;
+    portEXIT_CRITICAL(&gLock);
+    gStarted = true;
+  }
+
+  if (gLastSampleAt == 0 || now - gLastSampleAt >= TELEMETRY_SAMPLE_INTERVAL_MS) {
+    gLastSampleAt = now;
+    // Read outside the lock; both calls take a few microseconds.
+    int8_t rssi = wifiConnected ? static_cast<int8_t>(WiFi.RSSI()) : 0;
+    uint32_t heap = ESP.getFreeHeap();
+    portENTER_CRITICAL(&gLock);
+    // RSSI 0 means the driver has no reading.
+    if (rssi != 0) {
+      if (gCurrent.rssiSamples == 0 || rssi < gCurrent.rssiMin) {
+        gCurrent.rssiMin = rssi;
+      }
+      if (gCurrent.rssiSamples == 0 || rssi > gCurrent.rssiMax) {
+        gCurrent.rssiMax = rssi;
+      }
+      gCurrent.rssiSum += rssi;
+      gCurrent.rssiSamples++;
+    }
+    if (gCurrent.heapMin == 0 || heap < gCurrent.heapMin) {
+      gCurrent.heapMin = heap;
+    }
+    portEXIT_CRITICAL(&gLock);
+  }
+
+  if (now - gCurrent.startedAt >= TELEMETRY_INTERVAL_MS) {
+    closeWindow(now);
+  }
+}
+
+void Telemetry::flush(unsigned long now) {
+  if (!TELEMETRY_ENABLED) {
+    return;
+  }
+  closeWindow(now);
+  portENTER_CRITICAL(&gLock);
+  gUploadRequested = true;
+  portEXIT_CRITICAL(&gLock);
+}
+
+bool Telemetry::takeUploadRequest() {
+  portENTER_CRITICAL(&gLock);
+  bool requested = gUploadRequested;
+  gUploadRequested = false;
+  portEXIT_CRITICAL(&gLock);
+  return requested;
+}
+
+size_t Telemetry::pendingWindows() {
+  portENTER_CRITICAL(&gLock);
+  size_t count = gCount;
+  portEXIT_CRITICAL(&gLock);
+  return count;
+}
+
+size_t Telemetry::renderBatch(const char *deviceId, uint16_t bootId, char *out, size_t capacity,
+                              uint32_t &lastSeqOut) {
+  lastSeqOut = 0;
+  if (pendingWindows() == 0) {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&gLock);
+  uint32_t dropped = gStats.windowsDropped;
+  portEXIT_CRITICAL(&gLock);
+  size_t length = 0;
+  append(out, capacity, length,
+         "{\"device\":\"%s\",\"boot\":%u,\"fw\":\"%s\",\"uptime_ms\":%lu,\"dropped\":%lu,"
+         "\"buckets_ms\":[",
+         deviceId, bootId, CURRENT_FIRMWARE_VERSION, millis(), static_cast<unsigned long>(dropped));
+  for (size_t b = 0; b < kBucketCount - 1; ++b) {
+    append(out, capacity, length, "%s%lu", b == 0 ? "" : ",", kBucketBoundsMs[b]);
+  }
+  if (!append(out, capacity, length, "],\"windows\":[")) {
+    return 0;
+  }
+
+  // Windows are copied out one at a time so the lock is never held
+  // while formatting.
+  char rendered[kMaxWindowLength];
+  size_t included = 0;
+  for (size_t i = 0;; ++i) {
+    Window window;
+    portENTER_CRITICAL(&gLock);
+    bool found = i < gCount;
+    if (found) {
+      window = gClosed[(gHead + i) % TELEMETRY_MAX_WINDOWS];
+    }
+    portEXIT_CRITICAL(&gLock);
+    if (!found) {
+      break;
+    }
+    size_t windowLength = renderWindow(window, rendered, sizeof(rendered));
+    // Keep room for the separator and the closing "]}".
+    if (windowLength == 0 || length + windowLength + 3 >= capacity) {
+      break;
+    }
+    if (included > 0) {
+      out[length++] = ',';
+    }
+    memcpy(out + length, rendered, windowLength);
+    length += windowLength;
+    lastSeqOut = window.seq;
+    ++included;
+  }
+  if (included == 0 || !append(out, capacity, length, "]}")) {
+    return 0;
+  }
+  return length;
+}
+
+void Telemetry::acknowledge(uint32_t lastSeq, unsigned long now) {
+  portENTER_CRITICAL(&gLock);
+  // Windows dropped while the upload was in flight are already gone.
+  while (gCount > 0 && gClosed[gHead].seq <= lastSeq) {
+    gHead = (gHead + 1) % TELEMETRY_MAX_WINDOWS;
+    gCount--;
+  }
+  gStats.uploads++;
+  gStats.lastUploadAt = now;
+  portEXIT_CRITICAL(&gLock);
+}
+
+void Telemetry::recordUploadFailure() {
+  portENTER_CRITICAL(&gLock);
+  gStats.uploadFailures++;
+  portEXIT_CRITICAL(&gLock);
+}
+
+Telemetry::Stats Telemetry::stats() {
+  portENTER_CRITICAL(&gLock);
+  Stats stats = gStats;
+  stats.pendingWindows = static_cast<uint8_t>(gCount);
+  portEXIT_CRITICAL(&gLock);
+  return stats;
+}
+
+uint32_t Telemetry::currentCount(Counter counter) {
+  if (counter >= Counter::Count) {
+    return 0;
+  }
+  portENTER_CRITICAL(&gLock);
+  uint32_t value = gCurrent.counters[static_cast<size_t>(counter)];
+  portEXIT_CRITICAL(&gLock);
+  return value;
+}
+
+const char *Telemetry::counterName(Counter counter) {
+  switch (counter) {
+    case Counter::Taps:
+      return "taps";
+    case Counter::TapsDelivered:
+      return "delivered";
+    case Counter::TapsRejected:
+      return "rejected";
+    case Counter::TapsFailed:
+      return "failed";
+    case Counter::TapsJournaled:
+      return "journaled";
+    case Counter::BackendRetries:
+      return "retries";
+    case Counter::BackendTimeouts:
+      return "timeouts";
+    case Counter::BreakerFastFailures:
+      return "fast_failures";
+    case Counter::WifiDisconnects:
+      return "wifi_disconnects";
+    case Counter::RfidReadErrors:
+      return "rfid_read_errors";
+    case Counter::RfidInitFailures:
+      return "rfid_init_failures";
+    case Counter::Count:
+      break;
+  }
+  return "unknown";
+}
+
+const char *Telemetry::histogramName(Histogram histogram) {
+  switch (histogram) {
+    case Histogram::TapToResult:
+      return "tap_ms";
+    case Histogram::Request:
+      return "request_ms";
+    case Histogram::Count:
+      break;
+  }
+  return "unknown";
+}
+
+void Telemetry::closeWindow(unsigned long now) {
+  portENTER_CRITICAL(&gLock);
+  gCurrent.seq = ++gLastSeq;
+  gCurrent.endedAt = now;
+  if (gCount == TELEMETRY_MAX_WINDOWS) {
+    // Offline for too long: the newest windows are worth more.
+    gHead = (gHead + 1) % TELEMETRY_MAX_WINDOWS;
+    gCount--;
+    gStats.windowsDropped++;
+  }
+  gClosed[(gHead + gCount) % TELEMETRY_MAX_WINDOWS] = gCurrent;
+  gCount++;
+  gStats.windowsClosed++;
+  gCurrent = Window();
+  gCurrent.startedAt = now;
+  portEXIT_CRITICAL(&gLock);
+}
@@ -0,0 +1,245 @@
+/*
+ * TinyCbor.cpp
+ *
+ * Implements the CBOR writer and the pull reader.
+ */
+
+#include "TinyCbor.h"
+
+#include <cstring>
+
+namespace {
+constexpr uint8_t kMajorUint = 0;
+constexpr uint8_t kMajorNegativeInt = 1;
+constexpr uint8_t kMajorBytes = 2;
+constexpr uint8_t kMajorText = 3;
+constexpr uint8_t kMajorArray = 4;
+constexpr uint8_t kMajorMap = 5;
+constexpr uint8_t kMajorTag = 6;
+constexpr uint8_t kMajorSimple = 7;
+
+constexpr uint8_t kSimpleFalse = 20;
+constexpr uint8_t kSimpleTrue = 21;
+constexpr uint8_t kAdditionalOneByte = 24;
+constexpr uint8_t kAdditionalEightBytes = 27;
+// Bounds skip() on hostile input: more pending items than bytes left
+// can never be satisfied.
+constexpr uint64_t kMaxPendingItems = 0xFFFF;
+}  // namespace
+
+bool CborWriter::beginMap(size_t entries) {
+  return putHeader(kMajorMap, entries);
+}
+
+bool CborWriter::beginArray(size_t items) {
+  return putHeader(kMajorArray, items);
+}
+
+bool CborWriter::putUint(uint64_t value) {
+  return putHeader(kMajorUint, value);
+}
+
+bool CborWriter::putBool(bool value) {
+  uint8_t byte = static_cast<uint8_t>((kMajorSimple << 5) | (value ? kSimpleTrue : kSimpleFalse));
+  return putRaw(&byte, 1);
+}
+
+bool CborWriter::putText(const char *text) {
+  return putText(text, strlen(text));
+}
+
+bool CborWriter::putText(const char *text, size_t length) {
+  return putHeader(kMajorText, length) && putRaw(text, length);
+}
+
+bool CborWriter::putBytes(const uint8_t *data, size_t length) {
+  return putHeader(kMajorBytes, length) && putRaw(data, length);
+}
+
+bool CborWriter::putHeader(uint8_t major, uint64_t value) {
+  uint8_t header[9];
+  size_t size = 1;
+  if (value < kAdditionalOneByte) {
+    header[0] = static_cast<uint8_t>((major << 5) | value);
+  } else {
+    // Shortest of the 1, 2, 4 and 8 byte forms (additional info 24-27).
+    uint8_t shift = value <= 0xFF ? 0 : value <= 0xFFFF ? 1 : value <= 0xFFFFFFFFULL ? 2 : 3;
+    uint8_t extra = static_cast<uint8_t>(1 << shift);
+    uint8_t additional = static_cast<uint8_t>(kAdditionalOneByte + shift);
+    header[0] = static_cast<uint8_t>((major << 5) | additional);
+    for (uint8_t i = 0; i < extra; ++i) {
+      header[1 + i] = static_cast<uint8_t>(value >> (8 * (extra - 1 - i)));
+    }
+    size += extra;
+  }
+  return putRaw(header, size);
+}
+
+bool CborWriter::putRaw(const void *data, size_t length) {
+  if (_overflow || _length + length > _capacity) {
+    _overflow = true;
+    return false;
+  }
+  if (length > 0) {
+    memcpy(_buffer + _length, data, length);
+    _length += length;
+  }
+  return true;
+}
+
+CborReader::Type CborReader::peekType() const {
+  if (atEnd()) {
+    return Type::Invalid;
+  }
+  switch (_data[_offset] >> 5) {
+    case kMajorUint:
+      return Type::Uint;
+    case kMajorNegativeInt:
+      return Type::NegativeInt;
+    case kMajorBytes:
+      return Type::Bytes;
+    case kMajorText:
+      return Type::Text;
+    case kMajorArray:
+      return Type::Array;
+    case kMajorMap:
+      return Type::Map;
+    case kMajorTag:
+      return Type::Tag;
+    default:
+      return Type::Simple;
+  }
+}
+
+bool CborReader::readUint(uint64_t &out) {
+  uint8_t major = 0;
+  uint64_t value = 0;
+  size_t size = decodeHeader(_offset, major, value);
+  if (size == 0 || major != kMajorUint) {
+    return false;
+  }
+  _offset += size;
+  out = value;
+  return true;
+}
+
+bool CborReader::readBool(bool &out) {
+  if (atEnd()) {
+    return false;
+  }
+  uint8_t byte = _data[_offset];
+  if (byte != ((kMajorSimple << 5) | kSimpleFalse) && byte != ((kMajorSimple << 5) | kSimpleTrue)) {
+    return false;
+  }
+  out = (byte & 0x1F) == kSimpleTrue;
+  _offset++;
+  return true;
+}
+
+bool CborReader::readText(const char *&text, size_t &length) {
+  const uint8_t *data = nullptr;
+  if (!readString(kMajorText, data, length)) {
+    return false;
+  }
+  text = reinterpret_cast<const char *>(data);
+  return true;
+}
+
+bool CborReader::readBytes(const uint8_t *&data, size_t &length) {
+  return readString(kMajorBytes, data, length);
+}
+
+bool CborReader::readMap(size_t &entries) {
+  return readContainer(kMajorMap, entries);
+}
+
+bool CborReader::readArray(size_t &items) {
+  return readContainer(kMajorArray, items);
+}
+
+bool CborReader::skip() {
+  // Items still to consume; containers add their children.
+  uint64_t pending = 1;
+  size_t offset = _offset;
+  while (pending > 0) {
+    uint8_t major = 0;
+    uint64_t value = 0;
+    size_t size = decodeHeader(offset, major, value);
+    if (size == 0) {
+      return false;
+    }
+    offset += size;
+    pending--;
+    if (major == kMajorBytes || major == kMajorText) {
+      if (value > _length - offset) {
+        return false;
+      }
+      offset += static_cast<size_t>(value);
+    } else if (major == kMajorArray || major == kMajorMap) {
+      // Checked before adding, so a huge count cannot wrap `pending`.
+      if (value > kMaxPendingItems) {
+        return false;
+      }
+      pending += major == kMajorMap ? value * 2 : value;
+    } else if (major == kMajorTag) {
+      pending += 1;
+    }
+    if (pending > kMaxPendingItems || pending > _length - offset) {
+      return false;
+    }
+  }
+  _offset = offset;
+  return true;
+}
+
+size_t CborReader::decodeHeader(size_t offset, uint8_t &major, uint64_t &value) const {
+  if (offset >= _length) {
+    return 0;
+  }
+  uint8_t initial = _data[offset];
+  major = initial >> 5;
+  uint8_t additional = initial & 0x1F;
+  if (additional < kAdditionalOneByte) {
+    value = additional;
+    return 1;
+  }
+  if (additional > kAdditionalEightBytes) {
+    // 28-30 are reserved; 31 is an indefinite length or a break.
+    return 0;
+  }
+  size_t extra = static_cast<size_t>(1) << (additional - kAdditionalOneByte);
+  if (extra > _length - offset - 1) {
+    return 0;
+  }
+  value = 0;
+  for (size_t i = 0; i < extra; ++i) {
+    value = (value << 8) | _data[offset + 1 + i];
+  }
+  return 1 + extra;
+}
+
+bool CborReader::readString(uint8_t major, const uint8_t *&data, size_t &length) {
+  uint8_t actual = 0;
+  uint64_t value = 0;
+  size_t size = decodeHeader(_offset, actual, value);
+  if (size == 0 || actual != major || value > _length - _offset - size) {
+    return false;
+  }
+  data = _data + _offset + size;
+  length = static_cast<size_t>(value);
+  _offset += size + length;
+  return true;
+}
+
+bool CborReader::readContainer(uint8_t major, size_t &count) {
+  uint8_t actual = 0;
+  uint64_t value = 0;
+  size_t size = decodeHeader(_offset, actual, value);
+  // Every entry takes at least one byte.
+  if (size == 0 || actual != major || value > _length - _offset - size) {
+    return false;
+  }
+  _offset += size;
+  count = static_cast<size_t>(value);
+  return true;
+}
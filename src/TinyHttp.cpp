@@ -0,0 +1,374 @@
+/*
+ * TinyHttp.cpp
+ *
+ * Implements request templates, the incremental response parser and
+ * the Client-based transport described in TinyHttp.h.
+ */
+
+#include "TinyHttp.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+constexpr unsigned long kIdlePollMs = 1;
+
+bool headerNameIs(const char *line, size_t nameLength, const char *name) {
+  return strlen(name) == nameLength && strncasecmp(line, name, nameLength) == 0;
+}
+
+bool containsToken(const char *value, const char *token) {
+  size_t tokenLength = strlen(token);
+  for (const char *p = value; *p != '\0'; ++p) {
+    if (strncasecmp(p, token, tokenLength) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+bool HttpRequestTemplate::compile(const char *pattern) {
+  _compiled = false;
+  _slotCount = 0;
+
+  size_t literalLength = 0;
+  const char *p = pattern;
+  while (*p != '\0') {
+    if (*p == '{' && p[1] != '}') {
+      const char *close = strchr(p, '}');
+      if (close == nullptr) {
+        return false;
+      }
+      if (_slotCount == kMaxSlots) {
+        return false;
+      }
+      _segmentEnd[_slotCount++] = static_cast<uint16_t>(literalLength);
+      p = close + 1;
+      continue;
+    }
+    if (literalLength >= kCapacity) {
+      return false;
+    }
+    _literals[literalLength++] = *p++;
+  }
+  _segmentEnd[_slotCount] = static_cast<uint16_t>(literalLength);
+
+  // The leading literal never changes; keep it in the output buffer.
+  memcpy(_output, _literals, _segmentEnd[0]);
+  _compiled = true;
+  return true;
+}
+
+const char *HttpRequestTemplate::render(const char *const *values, size_t count,
+                                        size_t &lengthOut) {
+  lengthOut = 0;
+  if (!_compiled || count != _slotCount) {
+    return nullptr;
+  }
+
+  size_t position = _segmentEnd[0];
+  for (size_t slot = 0; slot < _slotCount; ++slot) {
+    const char *value = values[slot] != nullptr ? values[slot] : "";
+    size_t valueLength = strlen(value);
+    size_t literalStart = _segmentEnd[slot];
+    size_t literalLength = _segmentEnd[slot + 1] - literalStart;
+    if (position + valueLength + literalLength >= kCapacity) {
+      return nullptr;
+    }
+    memcpy(_output + position, value, valueLength);
+    position += valueLength;
+    memcpy(_output + position, _literals + literalStart, literalLength);
+    position += literalLength;
+  }
+  _output[position] = '\0';
+  lengthOut = position;
+  return _output;
+}
+
+void HttpResponseParser::reset(HttpResponse *response, HttpBodySink *sink) {
+  _response = response;
+  _sink = sink;
+  _state = State::StatusLine;
+  _lineLength = 0;
+  _lineOverflow = false;
+  _remaining = 0;
+  _untilClose = false;
+  _abortedBySink = false;
+  _receivedAnything = false;
+  if (_response != nullptr) {
+    *_response = HttpResponse();
+  }
+}
+
+size_t HttpResponseParser::feed(const uint8_t *data, size_t length) {
+  size_t consumed = 0;
+  if (length > 0) {
+    _receivedAnything = true;
+  }
+
+  while (consumed < length && _state != State::Done && _state != State::Error) {
+    if (_state == State::Body || _state == State::ChunkData) {
+      size_t available = length - consumed;
+      size_t take = _untilClose ? available : min(available, _remaining);
+      if (_sink != nullptr && take > 0 && !_sink->onBody(data + consumed, take)) {
+        _abortedBySink = true;
+        _state = State::Error;
+        break;
+      }
+      _response->bodyBytes += take;
+      consumed += take;
+      if (_untilClose) {
+        continue;
+      }
+      _remaining -= take;
+      if (_remaining == 0) {
+        _state = _state == State::Body ? State::Done : State::ChunkDataEnd;
+      }
+      continue;
+    }
+
+    char c = static_cast<char>(data[consumed++]);
+    if (c != '\n') {
+      if (_lineLength < kMaxLineLength - 1) {
+        _line[_lineLength++] = c;
+      } else {
+        _lineOverflow = true;
+      }
+      continue;
+    }
+
+    if (_lineLength > 0 && _line[_lineLength - 1] == '\r') {
+      _lineLength--;
+    }
+    _line[_lineLength] = '\0';
+    if (!processLine()) {
+      _state = State::Error;
+    }
+    _lineLength = 0;
+    _lineOverflow = false;
+  }
+  return consumed;
+}
+
+void HttpResponseParser::finishOnClose() {
+  if (_state == State::Body && _untilClose) {
+    _state = State::Done;
+    return;
+  }
+  if (_state != State::Done) {
+    _state = State::Error;
+  }
+}
+
+bool HttpResponseParser::processLine() {
+  switch (_state) {
+    case State::StatusLine:
+      return processStatusLine();
+    case State::Headers:
+      return processHeaderLine();
+    case State::ChunkSize:
+      return processChunkSize();
+    case State::ChunkDataEnd:
+      if (_lineLength != 0) {
+        return false;
+      }
+      _state = State::ChunkSize;
+      return true;
+    case State::Trailers:
+      if (_lineLength == 0) {
+        _state = State::Done;
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool HttpResponseParser::processStatusLine() {
+  // "HTTP/1.1 200 OK"
+  if (_lineLength < 12 || strncmp(_line, "HTTP/1.", 7) != 0 || _line[8] != ' ') {
+    return false;
+  }
+  int code = atoi(_line + 9);
+  if (code < 100 || code > 999) {
+    return false;
+  }
+  _response->statusCode = code;
+  _response->keepAlive = _line[7] != '0';
+  _state = State::Headers;
+  return true;
+}
+
+bool HttpResponseParser::processHeaderLine() {
+  if (_lineLength == 0) {
+    return finishHeaders();
+  }
+  if (_lineOverflow) {
+    // Nothing we parse is this long; skip the header.
+    return true;
+  }
+
+  const char *colon = strchr(_line, ':');
+  if (colon == nullptr) {
+    return true;
+  }
+  size_t nameLength = static_cast<size_t>(colon - _line);
+  const char *value = colon + 1;
+  while (*value == ' ' || *value == '\t') {
+    ++value;
+  }
+
+  if (headerNameIs(_line, nameLength, "content-length")) {
+    char *end = nullptr;
+    long length = strtol(value, &end, 10);
+    if (end == value || length < 0) {
+      return false;
+    }
+    _response->contentLength = length;
+  } else if (headerNameIs(_line, nameLength, "transfer-encoding")) {
+    _response->chunked = containsToken(value, "chunked");
+  } else if (headerNameIs(_line, nameLength, "connection")) {
+    if (containsToken(value, "close")) {
+      _response->keepAlive = false;
+    } else if (containsToken(value, "keep-alive")) {
+      _response->keepAlive = true;
+    }
+  } else if (headerNameIs(_line, nameLength, "content-type")) {
+    strncpy(_response->contentType, value, HttpResponse::kMaxContentTypeLength - 1);
+    _response->contentType[HttpResponse::kMaxContentTypeLength - 1] = '\0';
+  }
+  return true;
+}
+
+bool HttpResponseParser::finishHeaders() {
+  int code = _response->statusCode;
+  if (code >= 100 && code < 200) {
+    // Interim response; the real one follows.
+    bool keepAlive = _response->keepAlive;
+    *_response = HttpResponse();
+    _response->keepAlive = keepAlive;
+    _state = State::StatusLine;
+    return true;
+  }
+
+  if (_sink != nullptr && !_sink->onHeaders(*_response)) {
+    _abortedBySink = true;
+    return false;
+  }
+
+  if (code == 204 || code == 304) {
+    _state = State::Done;
+  } else if (_response->chunked) {
+    _state = State::ChunkSize;
+  } else if (_response->contentLength >= 0) {
+    _remaining = static_cast<size_t>(_response->contentLength);
+    _state = _remaining == 0 ? State::Done : State::Body;
+  } else {
+    _untilClose = true;
+    _response->keepAlive = false;
+    _state = State::Body;
+  }
+  return true;
+}
+
+bool HttpResponseParser::processChunkSize() {
+  if (_lineOverflow) {
+    return false;
+  }
+  char *end = nullptr;
+  unsigned long size = strtoul(_line, &end, 16);
+  if (end == _line) {
+    return false;
+  }
+  if (size == 0) {
+    _state = State::Trailers;
+    return true;
+  }
+  _remaining = size;
+  _state = State::ChunkData;
+  return true;
+}
+
+bool TinyHttpClient::send(const char *data, size_t length) {
+  if (data == nullptr || !_client.connected()) {
+    return false;
+  }
+  return _client.write(reinterpret_cast<const uint8_t *>(data), length) == length;
+}
+
+int TinyHttpClient::readResponse(HttpResponse &response, HttpBodySink *sink,
+                                 unsigned long timeoutMs) {
+  HttpResponseParser parser;
+  parser.reset(&response, sink);
+  unsigned long lastActivityAt = millis();
+
+  while (!parser.done()) {
+    if (_bufferOffset == _bufferLength) {
+      _bufferOffset = 0;
+      _bufferLength = 0;
+      int available = _client.available();
+      if (available > 0) {
+        size_t want = min(static_cast<size_t>(available), kReadChunk);
+        int read = _client.read(_buffer, want);
+        if (read > 0) {
+          _bufferLength = static_cast<size_t>(read);
+          lastActivityAt = millis();
+        }
+      }
+    }
+
+    if (_bufferOffset < _bufferLength) {
+      _bufferOffset += parser.feed(_buffer + _bufferOffset, _bufferLength - _bufferOffset);
+      if (parser.failed()) {
+        reset();
+        return parser.abortedBySink() ? kErrorAborted : kErrorProtocol;
+      }
+      continue;
+    }
+
+    if (!_client.connected()) {
+      parser.finishOnClose();
+      if (parser.done()) {
+        break;
+      }
+      return parser.receivedAnything() ? kErrorProtocol : kErrorConnection;
+    }
+    if (millis() - lastActivityAt >= timeoutMs) {
+      return kErrorTimeout;
+    }
+    delay(kIdlePollMs);
+  }
+
+  return response.statusCode;
+}
+
+void TinyHttpClient::reset() {
+  _bufferOffset = 0;
+  _bufferLength = 0;
+}
+
+const char *TinyHttpClient::errorName(int code) {
+  switch (code) {
+    case kErrorConnection:
+      return "connection closed";
+    case kErrorTimeout:
+      return "timeout";
+    case kErrorProtocol:
+      return "malformed response";
+    case kErrorAborted:
+      return "aborted";
+    default:
+      return "unknown error";
+  }
+}
+
+bool HttpPreviewSink::onBody(const uint8_t *data, size_t length) {
+  size_t room = kCapacity - _length;
+  size_t take = min(length, room);
+  memcpy(_text + _length, data, take);
+  _length += take;
+  _text[_length] = '\0';
+  return true;
+}
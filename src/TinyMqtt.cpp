@@ -0,0 +1,247 @@
+/*
+ * TinyMqtt.cpp
+ *
+ * Implements the MQTT 3.1.1 packet encoder and the incremental packet
+ * reader.
+ */
+
+#include "TinyMqtt.h"
+
+#include <cstring>
+
+namespace {
+constexpr uint8_t kConnectHeader = 0x10;
+constexpr uint8_t kPublishHeader = 0x30;
+constexpr uint8_t kPubackHeader = 0x40;
+constexpr uint8_t kSubscribeHeader = 0x82;
+constexpr uint8_t kPingreqHeader = 0xC0;
+constexpr uint8_t kDisconnectHeader = 0xE0;
+
+constexpr uint8_t kCleanSessionFlag = 0x02;
+constexpr uint8_t kWillFlag = 0x04;
+constexpr uint8_t kWillRetainFlag = 0x20;
+constexpr uint8_t kProtocolLevel = 4;  // 3.1.1
+
+constexpr size_t  kMaxLengthBytes = 4;
+constexpr size_t  kReadChunk = 64;
+
+size_t stringSize(const char *text) {
+  return 2 + strlen(text);
+}
+}  // namespace
+
+bool TinyMqttClient::sendConnect(const char *clientId, uint16_t keepAliveS, bool cleanSession,
+                                 const char *willTopic, const char *willMessage) {
+  bool hasWill = willTopic != nullptr && willMessage != nullptr;
+  size_t length = 10 + stringSize(clientId);
+  if (hasWill) {
+    length += stringSize(willTopic) + stringSize(willMessage);
+  }
+  uint8_t flags = cleanSession ? kCleanSessionFlag : 0;
+  if (hasWill) {
+    flags |= kWillFlag | kWillRetainFlag;
+  }
+  const uint8_t protocol[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', kProtocolLevel, flags};
+  beginPacket(kConnectHeader, length);
+  putBytes(protocol, sizeof(protocol));
+  putUint16(keepAliveS);
+  putString(clientId);
+  if (hasWill) {
+    putString(willTopic);
+    putString(willMessage);
+  }
+  return flushPacket();
+}
+
+bool TinyMqttClient::sendPublish(const char *topic, const uint8_t *payload, size_t length,
+                                 uint8_t qos, uint16_t packetId, bool dup, bool retain) {
+  uint8_t header = kPublishHeader | static_cast<uint8_t>((qos & 0x03) << 1);
+  if (dup) {
+    header |= 0x08;
+  }
+  if (retain) {
+    header |= 0x01;
+  }
+  beginPacket(header, stringSize(topic) + (qos > 0 ? 2 : 0) + length);
+  putString(topic);
+  if (qos > 0) {
+    putUint16(packetId);
+  }
+  putBytes(payload, length);
+  return flushPacket();
+}
+
+bool TinyMqttClient::sendPuback(uint16_t packetId) {
+  beginPacket(kPubackHeader, 2);
+  putUint16(packetId);
+  return flushPacket();
+}
+
+bool TinyMqttClient::sendSubscribe(uint16_t packetId, const char *topic, uint8_t qos) {
+  beginPacket(kSubscribeHeader, 2 + stringSize(topic) + 1);
+  putUint16(packetId);
+  putString(topic);
+  putBytes(&qos, 1);
+  return flushPacket();
+}
+
+bool TinyMqttClient::sendPing() {
+  beginPacket(kPingreqHeader, 0);
+  return flushPacket();
+}
+
+bool TinyMqttClient::sendDisconnect() {
+  beginPacket(kDisconnectHeader, 0);
+  return flushPacket();
+}
+
+int TinyMqttClient::poll(Packet &out) {
+  for (;;) {
+    int available = _client.available();
+    if (available <= 0) {
+      return _client.connected() ? 0 : -1;
+    }
+
+    if (_readState == ReadState::Header) {
+      int value = _client.read();
+      if (value < 0) {
+        return 0;
+      }
+      _rxHeader = static_cast<uint8_t>(value);
+      _rxExpected = 0;
+      _lengthShift = 0;
+      _readState = ReadState::Length;
+      continue;
+    }
+
+    if (_readState == ReadState::Length) {
+      int value = _client.read();
+      if (value < 0) {
+        return 0;
+      }
+      _rxExpected |= static_cast<size_t>(value & 0x7F) << _lengthShift;
+      _lengthShift += 7;
+      if ((value & 0x80) != 0) {
+        if (_lengthShift >= 7 * kMaxLengthBytes) {
+          return -1;  // malformed length; the stream cannot be resynchronised
+        }
+        continue;
+      }
+      _rxLength = 0;
+      _rxSkipping = _rxExpected > kCapacity;
+      _readState = ReadState::Body;
+      if (_rxExpected > 0) {
+        continue;
+      }
+    }
+
+    while (_rxLength < _rxExpected) {
+      size_t want = _rxExpected - _rxLength;
+      if (_rxSkipping) {
+        uint8_t scratch[kReadChunk];
+        want = min(want, sizeof(scratch));
+        int read = _client.read(scratch, min(want, static_cast<size_t>(_client.available())));
+        if (read <= 0) {
+          return 0;
+        }
+        _rxLength += static_cast<size_t>(read);
+        continue;
+      }
+      int read = _client.read(_rx + _rxLength, min(want, static_cast<size_t>(_client.available())));
+      if (read <= 0) {
+        return 0;
+      }
+      _rxLength += static_cast<size_t>(read);
+    }
+
+    _readState = ReadState::Header;
+    if (_rxSkipping) {
+      Serial.printf("[MQTT] Skipped a %u byte packet\n", static_cast<unsigned int>(_rxExpected));
+      continue;
+    }
+    out.type = _rxHeader >> 4;
+    out.flags = _rxHeader & 0x0F;
+    out.body = _rx;
+    out.length = _rxLength;
+    return 1;
+  }
+}
+
+bool TinyMqttClient::decodePublish(const Packet &packet, Message &out) {
+  if (packet.type != kPublish || packet.length < 2) {
+    return false;
+  }
+  size_t topicLength = (static_cast<size_t>(packet.body[0]) << 8) | packet.body[1];
+  size_t offset = 2 + topicLength;
+  out.qos = (packet.flags >> 1) & 0x03;
+  if (out.qos > 0) {
+    offset += 2;
+  }
+  if (offset > packet.length) {
+    return false;
+  }
+  out.topic = reinterpret_cast<const char *>(packet.body + 2);
+  out.topicLength = topicLength;
+  out.packetId = out.qos > 0 ? static_cast<uint16_t>((packet.body[2 + topicLength] << 8) |
+                                                     packet.body[3 + topicLength])
+                             : 0;
+  out.payload = packet.body + offset;
+  out.payloadLength = packet.length - offset;
+  return true;
+}
+
+void TinyMqttClient::reset() {
+  _readState = ReadState::Header;
+  _rxLength = 0;
+  _rxExpected = 0;
+  _rxSkipping = false;
+}
+
+bool TinyMqttClient::beginPacket(uint8_t header, size_t remainingLength) {
+  _txLength = 0;
+  _txOverflow = false;
+  putBytes(&header, 1);
+  do {
+    uint8_t digit = remainingLength & 0x7F;
+    remainingLength >>= 7;
+    if (remainingLength > 0) {
+      digit |= 0x80;
+    }
+    putBytes(&digit, 1);
+  } while (remainingLength > 0);
+  return !_txOverflow;
+}
+
+bool TinyMqttClient::putBytes(const void *data, size_t length) {
+  if (_txLength + length > kCapacity) {
+    _txOverflow = true;
+    return false;
+  }
+  if (length > 0) {
+    memcpy(_tx + _txLength, data, length);
+    _txLength += length;
+  }
+  return true;
+}
+
+bool TinyMqttClient::putString(const char *text) {
+  size_t length = strlen(text);
+  return putUint16(static_cast<uint16_t>(length)) && putBytes(text, length);
+}
+
+bool TinyMqttClient::putUint16(uint16_t value) {
+  const uint8_t bytes[] = {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value & 0xFF)};
+  return putBytes(bytes, sizeof(bytes));
+}
+
+bool TinyMqttClient::flushPacket() {
+  if (_txOverflow) {
+    Serial.println("[MQTT] Packet does not fit the send buffer");
+    return false;
+  }
+  if (!_client.connected() || _client.write(_tx, _txLength) != _txLength) {
+    return false;
+  }
+  _lastSentAt = millis();
+  return true;
+}
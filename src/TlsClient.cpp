@@ -0,0 +1,477 @@
+/*
+ * TlsClient.cpp
+ *
+ * Implements TLS over ImpairedClient and the shared session cache.
+ */
+
+#include "TlsClient.h"
+
+#include <cstring>
+#include <esp_random.h>
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/version.h>
+
+#include "Config.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+namespace {
+constexpr unsigned long kPollIntervalMs = 1;
+
+struct CachedSession {
+  char          serverName[TlsClient::kMaxServerNameLength + 1] = {0};
+  uint16_t      port = 0;
+  // 0 when the slot is unused.
+  uint16_t      length = 0;
+  unsigned long savedAt = 0;
+  unsigned char data[TlsClient::kMaxSessionBytes] = {0};
+};
+
+CachedSession    gSessions[TLS_SESSION_CACHE_SIZE];
+TlsClient::Stats gStats;
+
+// Guards gSessions and gStats. A mutex rather than a critical section,
+// because loading and saving sessions allocates.
+SemaphoreHandle_t cacheMutex() {
+  static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+  return mutex;
+}
+
+// Caller holds the cache mutex.
+CachedSession *findSession(const char *serverName, uint16_t port) {
+  for (CachedSession &entry : gSessions) {
+    if (entry.length > 0 && entry.port == port && strcmp(entry.serverName, serverName) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+// Unused slot, or else the least recently saved one.
+CachedSession &slotFor(const char *serverName, uint16_t port) {
+  CachedSession *existing = findSession(serverName, port);
+  if (existing != nullptr) {
+    return *existing;
+  }
+  CachedSession *oldest = &gSessions[0];
+  for (CachedSession &entry : gSessions) {
+    if (entry.length == 0) {
+      return entry;
+    }
+    if (static_cast<long>(entry.savedAt - oldest->savedAt) < 0) {
+      oldest = &entry;
+    }
+  }
+  return *oldest;
+}
+
+// The hardware RNG is a true random source while the radio is on,
+// which it is whenever there is a connection to secure.
+int randomCallback(void *context, unsigned char *out, size_t length) {
+  (void)context;
+  esp_fill_random(out, length);
+  return 0;
+}
+
+void logTlsError(const char *what, const char *serverName, int code) {
+  char text[96];
+  mbedtls_strerror(code, text, sizeof(text));
+  Serial.printf("[TLS] %s %s: -0x%04X %s\n", what, serverName, static_cast<unsigned int>(-code),
+                text);
+}
+}  // namespace
+
+TlsClient::TlsClient(ImpairedClient &inner) : _inner(inner) {
+  mbedtls_ssl_config_init(&_config);
+  mbedtls_x509_crt_init(&_ca);
+  mbedtls_ssl_init(&_ssl);
+}
+
+TlsClient::~TlsClient() {
+  releaseSession();
+  mbedtls_ssl_free(&_ssl);
+  mbedtls_x509_crt_free(&_ca);
+  mbedtls_ssl_config_free(&_config);
+}
+
+TlsClient::Stats TlsClient::stats() {
+  xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+  Stats stats = gStats;
+  stats.cachedSessions = 0;
+  for (const CachedSession &entry : gSessions) {
+    if (entry.length > 0) {
+      stats.cachedSessions++;
+    }
+  }
+  xSemaphoreGive(cacheMutex());
+  return stats;
+}
+
+void TlsClient::resetStats() {
+  xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+  gStats = Stats();
+  xSemaphoreGive(cacheMutex());
+}
+
+void TlsClient::clearSessions() {
+  xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+  for (CachedSession &entry : gSessions) {
+    entry.length = 0;
+  }
+  xSemaphoreGive(cacheMutex());
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+  releaseSession();
+  _port = port;
+  return _inner.connect(ip, port);
+}
+
+int TlsClient::connect(const char *host, uint16_t port) {
+  releaseSession();
+  _port = port;
+  return _inner.connect(host, port);
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port, int32_t timeoutMs) {
+  releaseSession();
+  _port = port;
+  return _inner.connect(ip, port, timeoutMs);
+}
+
+bool TlsClient::handshake(const char *serverName, unsigned long timeoutMs) {
+  if (!_secure) {
+    return true;
+  }
+  _handshake = Handshake();
+  if (serverName == nullptr || strlen(serverName) > kMaxServerNameLength) {
+    Serial.println("[TLS] Server name missing or too long");
+    stop();
+    return false;
+  }
+  strncpy(_serverName, serverName, kMaxServerNameLength);
+  _serverName[kMaxServerNameLength] = '\0';
+  if (!configure()) {
+    stop();
+    return false;
+  }
+
+  releaseSession();
+  _sessionActive = true;
+  int result = mbedtls_ssl_setup(&_ssl, &_config);
+  if (result == 0) {
+    result = mbedtls_ssl_set_hostname(&_ssl, _serverName);
+  }
+  if (result != 0) {
+    logTlsError("Could not set up TLS for", _serverName, result);
+    stop();
+    return false;
+  }
+  mbedtls_ssl_set_bio(&_ssl, this, sendCallback, receiveCallback, nullptr);
+
+  bool offered = offerCachedSession();
+  _certificateVerified = false;
+  _timeoutMs = timeoutMs;
+  bool timedOut = false;
+  unsigned long start = millis();
+  while ((result = mbedtls_ssl_handshake(&_ssl)) != 0) {
+    if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      break;
+    }
+    if (millis() - start >= timeoutMs) {
+      timedOut = true;
+      break;
+    }
+    delay(kPollIntervalMs);
+  }
+
+  if (result != 0) {
+    if (timedOut) {
+      Serial.printf("[TLS] Handshake with %s timed out after %lums\n", _serverName, timeoutMs);
+    } else {
+      logTlsError("Handshake failed with", _serverName, result);
+      uint32_t flags = mbedtls_ssl_get_verify_result(&_ssl);
+      if (_certificateVerified && flags != 0) {
+        char reason[128];
+        mbedtls_x509_crt_verify_info(reason, sizeof(reason), "", flags);
+        Serial.printf("[TLS] Certificate rejected: %s", reason);
+      }
+    }
+    xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+    gStats.failedHandshakes++;
+    xSemaphoreGive(cacheMutex());
+    stop();
+    return false;
+  }
+
+  _established = true;
+  _peerClosed = false;
+  // A resumed handshake carries no Certificate message, so the verify
+  // callback only runs during full ones.
+  _handshake.durationMs = millis() - start;
+  _handshake.resumed = offered && !_certificateVerified;
+  _handshake.resumeRejected = offered && _certificateVerified;
+  cacheSession();
+
+  xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+  if (_handshake.resumed) {
+    gStats.resumedHandshakes++;
+    gStats.totalResumedMs += _handshake.durationMs;
+    gStats.lastResumedMs = _handshake.durationMs;
+  } else {
+    gStats.fullHandshakes++;
+    gStats.totalFullMs += _handshake.durationMs;
+    gStats.lastFullMs = _handshake.durationMs;
+    if (_handshake.resumeRejected) {
+      gStats.resumesRejected++;
+    }
+  }
+  xSemaphoreGive(cacheMutex());
+
+  Serial.printf("[TLS] %s handshake with %s in %lums (%s)\n",
+                _handshake.resumed ? "Resumed" : "Full", _serverName, _handshake.durationMs,
+                mbedtls_ssl_get_ciphersuite(&_ssl));
+  if (_handshake.resumeRejected) {
+    Serial.printf("[TLS] %s did not resume the cached session\n", _serverName);
+  }
+  return true;
+}
+
+size_t TlsClient::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buffer, size_t size) {
+  if (!_secure) {
+    return _inner.write(buffer, size);
+  }
+  if (!_established) {
+    return 0;
+  }
+  size_t sent = 0;
+  unsigned long start = millis();
+  while (sent < size) {
+    int result = mbedtls_ssl_write(&_ssl, buffer + sent, size - sent);
+    if (result > 0) {
+      sent += static_cast<size_t>(result);
+      continue;
+    }
+    if ((result != MBEDTLS_ERR_SSL_WANT_WRITE && result != MBEDTLS_ERR_SSL_WANT_READ) ||
+        millis() - start >= _timeoutMs) {
+      break;
+    }
+    delay(kPollIntervalMs);
+  }
+  return sent;
+}
+
+int TlsClient::available() {
+  if (!_secure) {
+    return _inner.available();
+  }
+  if (!_established) {
+    return 0;
+  }
+  size_t pending = mbedtls_ssl_get_bytes_avail(&_ssl);
+  if (pending == 0 && !_peerClosed && _inner.available() > 0) {
+    // A zero-length read decrypts the next record without consuming
+    // any of its data.
+    int result = mbedtls_ssl_read(&_ssl, nullptr, 0);
+    if (result < 0 && result != MBEDTLS_ERR_SSL_WANT_READ &&
+        result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      _peerClosed = true;
+    }
+    pending = mbedtls_ssl_get_bytes_avail(&_ssl);
+  }
+  return static_cast<int>(pending);
+}
+
+int TlsClient::read() {
+  uint8_t value = 0;
+  return read(&value, 1) == 1 ? value : -1;
+}
+
+int TlsClient::read(uint8_t *buffer, size_t size) {
+  if (!_secure) {
+    return _inner.read(buffer, size);
+  }
+  if (available() <= 0) {
+    return -1;
+  }
+  int result = mbedtls_ssl_read(&_ssl, buffer, size);
+  if (result > 0) {
+    return result;
+  }
+  if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    _peerClosed = true;
+  }
+  return -1;
+}
+
+int TlsClient::peek() {
+  // Not needed by TinyHttp, and mbedTLS has no way to look ahead.
+  return _secure ? -1 : _inner.peek();
+}
+
+void TlsClient::flush() {
+  _inner.flush();
+}
+
+void TlsClient::stop() {
+  if (_established && !_peerClosed) {
+    // Best effort; the socket is closed right after.
+    mbedtls_ssl_close_notify(&_ssl);
+  }
+  releaseSession();
+  _inner.stop();
+}
+
+uint8_t TlsClient::connected() {
+  if (!_secure || !_established) {
+    return _inner.connected();
+  }
+  // Records already decrypted can still be read after the peer closed.
+  if (mbedtls_ssl_get_bytes_avail(&_ssl) > 0) {
+    return 1;
+  }
+  return !_peerClosed && _inner.connected() ? 1 : 0;
+}
+
+TlsClient::operator bool() {
+  return connected() != 0;
+}
+
+int TlsClient::sendCallback(void *context, const unsigned char *data, size_t length) {
+  TlsClient *self = static_cast<TlsClient *>(context);
+  size_t written = self->_inner.write(data, length);
+  if (written > 0) {
+    return static_cast<int>(written);
+  }
+  return self->_inner.connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int TlsClient::receiveCallback(void *context, unsigned char *data, size_t length) {
+  TlsClient *self = static_cast<TlsClient *>(context);
+  int available = self->_inner.available();
+  if (available <= 0) {
+    // 0 tells mbedTLS the connection has been closed.
+    return self->_inner.connected() ? MBEDTLS_ERR_SSL_WANT_READ : 0;
+  }
+  int received = self->_inner.read(data, min(length, static_cast<size_t>(available)));
+  return received > 0 ? received : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+int TlsClient::verifyCallback(void *context, mbedtls_x509_crt *certificate, int depth,
+                              uint32_t *flags) {
+  (void)certificate;
+  (void)depth;
+  (void)flags;
+  static_cast<TlsClient *>(context)->_certificateVerified = true;
+  // mbedTLS still rejects the chain if `flags` is set.
+  return 0;
+}
+
+bool TlsClient::configure() {
+  if (_configured) {
+    return _ready;
+  }
+  _configured = true;
+  if (BACKEND_CA_CERT == nullptr) {
+    Serial.println("[TLS] No CA certificate configured (SECRET_BACKEND_CA_CERT in secrets.h)");
+    return false;
+  }
+  int result = mbedtls_x509_crt_parse(&_ca, reinterpret_cast<const unsigned char *>(BACKEND_CA_CERT),
+                                      strlen(BACKEND_CA_CERT) + 1);
+  if (result != 0) {
+    logTlsError("Could not parse", "the CA certificate", result);
+    return false;
+  }
+  result = mbedtls_ssl_config_defaults(&_config, MBEDTLS_SSL_IS_CLIENT,
+                                       MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+  if (result != 0) {
+    logTlsError("Could not configure", "TLS", result);
+    return false;
+  }
+  mbedtls_ssl_conf_authmode(&_config, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&_config, &_ca, nullptr);
+  mbedtls_ssl_conf_rng(&_config, randomCallback, nullptr);
+  mbedtls_ssl_conf_verify(&_config, verifyCallback, this);
+  // TLS 1.2 only: its tickets and session IDs resume within the
+  // handshake, where TLS 1.3 tickets arrive after it.
+#if MBEDTLS_VERSION_MAJOR >= 3
+  mbedtls_ssl_conf_min_tls_version(&_config, MBEDTLS_SSL_VERSION_TLS1_2);
+  mbedtls_ssl_conf_max_tls_version(&_config, MBEDTLS_SSL_VERSION_TLS1_2);
+#else
+  mbedtls_ssl_conf_min_version(&_config, MBEDTLS_SSL_MAJOR_VERSION_3,
+                               MBEDTLS_SSL_MINOR_VERSION_3);
+  mbedtls_ssl_conf_max_version(&_config, MBEDTLS_SSL_MAJOR_VERSION_3,
+                               MBEDTLS_SSL_MINOR_VERSION_3);
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&_config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+  _ready = true;
+  return true;
+}
+
+bool TlsClient::offerCachedSession() {
+  bool offered = false;
+  xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+  CachedSession *entry = findSession(_serverName, _port);
+  if (entry != nullptr && millis() - entry->savedAt > TLS_SESSION_MAX_AGE_MS) {
+    entry->length = 0;
+    entry = nullptr;
+  }
+  if (entry != nullptr) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    offered = mbedtls_ssl_session_load(&session, entry->data, entry->length) == 0 &&
+              mbedtls_ssl_set_session(&_ssl, &session) == 0;
+    mbedtls_ssl_session_free(&session);
+    if (!offered) {
+      entry->length = 0;
+    }
+  }
+  xSemaphoreGive(cacheMutex());
+  return offered;
+}
+
+void TlsClient::cacheSession() {
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  if (mbedtls_ssl_get_session(&_ssl, &session) != 0) {
+    mbedtls_ssl_session_free(&session);
+    return;
+  }
+
+  xSemaphoreTake(cacheMutex(), portMAX_DELAY);
+  CachedSession &entry = slotFor(_serverName, _port);
+  size_t length = 0;
+  int result = mbedtls_ssl_session_save(&session, entry.data, sizeof(entry.data), &length);
+  if (result == 0) {
+    strncpy(entry.serverName, _serverName, kMaxServerNameLength);
+    entry.port = _port;
+    entry.length = static_cast<uint16_t>(length);
+    entry.savedAt = millis();
+  } else {
+    entry.length = 0;
+  }
+  xSemaphoreGive(cacheMutex());
+  mbedtls_ssl_session_free(&session);
+
+  if (result == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
+    Serial.printf("[TLS] Session for %s needs %u bytes, more than the cache holds\n",
+                  _serverName, static_cast<unsigned int>(length));
+  }
+}
+
+void TlsClient::releaseSession() {
+  if (_sessionActive) {
+    mbedtls_ssl_free(&_ssl);
+    mbedtls_ssl_init(&_ssl);
+    _sessionActive = false;
+  }
+  _established = false;
+  _peerClosed = false;
+}
@@ -6,6 +6,7 @@
 
 #include <Arduino.h>
 #include <ESPmDNS.h>
+#include <esp_timer.h>
 #include <cstring>
 #include <cstdlib>
 #include <memory>
@@ -16,8 +17,19 @@
 #include "WifiManager.h"
 #include "RfidReader.h"
 #include "BackendClient.h"
+#include "CardCatalog.h"
+#include "EventClock.h"
 #include "EffectManager.h"
+#include "EspNowLink.h"
+#include "HostResolver.h"
+#include "HubRelay.h"
+#include "ImpairedClient.h"
 #include "OtaUpdater.h"
+#include "PayloadCodec.h"
+#include "TapTracer.h"
+#include "Telemetry.h"
+#include "TinyCbor.h"
+#include "TlsClient.h"
 
 #if ENABLE_DEBUG_ACTIONS
 #  include "DebugActionServer.h"
@@ -25,9 +37,15 @@
 
 static WifiManager wifi;
 static RfidReader rfid;
-static BackendClient backend;
+static HostResolver resolver;
+static TapTracer tracer;
+static CardCatalog catalog;
+static BackendClient backend(resolver, tracer, catalog);
 static EffectManager effects(LED_DATA_PIN, LED_COUNT_DEFAULT, LED_BRIGHTNESS_DEFAULT);
-static OtaUpdater otaUpdater;
+static OtaUpdater otaUpdater(resolver);
+static EspNowLink hubLink;
+static HubRelay hub(hubLink, HUB_MAX_ATTEMPTS, HUB_MIN_ACK_TIMEOUT_MS, HUB_MAX_ACK_TIMEOUT_MS,
+                    HUB_RESULT_TIMEOUT_MS);
 
 namespace {
 constexpr float kTailPrimaryFactor = 0.5f;
@@ -37,6 +55,9 @@ constexpr unsigned long kSuccessSpinIntervalMs = 28;
 constexpr unsigned long kErrorFadeDurationMs = 300;
 constexpr unsigned long kTransientEffectDurationMs = 2500;
 constexpr unsigned long kCardRainbowIntervalMs = 15;
+// How often a satellite that cannot reach its gateway looks for the
+// access point's channel again; a scan blocks the loop for seconds.
+constexpr unsigned long kHubRescanIntervalMs = 30000;
 }
 
 enum class VisualState {
@@ -45,6 +66,7 @@ enum class VisualState {
   WifiConnected,
   WifiError,
   CardDetected,
+  CardUnknown,
   CardScanning,
   BackendSuccess,
   BackendError,
@@ -105,21 +127,48 @@ public:
     setBaseState(target, now);
   }
 
-  void onBackendRequestStarted(unsigned long now) {
+  // Colour of the card being handled, taken from the catalog. Card
+  // states fall back to their default colours without one.
+  void setCardColor(bool hasColor, uint8_t red, uint8_t green, uint8_t blue, unsigned long now) {
+    bool changed = hasColor != _hasCardColor ||
+                   (hasColor && (red != _cardRed || green != _cardGreen || blue != _cardBlue));
+    _hasCardColor = hasColor;
+    _cardRed = red;
+    _cardGreen = green;
+    _cardBlue = blue;
+    if (changed && _initialized &&
+        (_currentState == VisualState::CardDetected ||
+         _currentState == VisualState::CardScanning ||
+         _currentState == VisualState::BackendSuccess)) {
+      applyState(_currentState, now);
+    }
+  }
+
+  void onBackendRequestStarted(uint32_t requestId, unsigned long now) {
+    _activeRequestId = requestId;
     _backendPending = true;
     setState(VisualState::CardScanning, now);
   }
 
-  void onBackendRequestFinished(bool success, unsigned long now) {
+  // Completions are matched against the most recent request so that a
+  // superseded request finishing late cannot overwrite the LED state.
+  bool onBackendRequestFinished(uint32_t requestId, bool success, unsigned long now) {
+    if (requestId != _activeRequestId) {
+      Serial.printf("[State] Ignoring stale completion for request #%lu (current #%lu)\n",
+                    static_cast<unsigned long>(requestId),
+                    static_cast<unsigned long>(_activeRequestId));
+      return false;
+    }
     _backendPending = false;
     setState(success ? VisualState::BackendSuccess : VisualState::BackendError, now);
+    return true;
   }
 
   bool isBackendPending() const { return _backendPending; }
 
   static bool isCardFlowState(VisualState state) {
-    return state == VisualState::CardDetected || state == VisualState::BackendSuccess ||
-           state == VisualState::BackendError;
+    return state == VisualState::CardDetected || state == VisualState::CardUnknown ||
+           state == VisualState::BackendSuccess || state == VisualState::BackendError;
   }
 
   static bool isTransientState(VisualState state) {
@@ -140,6 +189,8 @@ private:
         return "WifiError";
       case VisualState::CardDetected:
         return "CardDetected";
+      case VisualState::CardUnknown:
+        return "CardUnknown";
       case VisualState::CardScanning:
         return "CardScanning";
       case VisualState::BackendSuccess:
@@ -174,14 +225,32 @@ private:
         _effects.showFade(255, 0, 0, 80, 0, 0, kErrorFadeDurationMs, now);
         break;
       case VisualState::CardDetected:
-        _effects.showRainbow(kCardRainbowIntervalMs, now);
+        if (_hasCardColor) {
+          _effects.showSolidColor(_cardRed, _cardGreen, _cardBlue, now);
+        } else {
+          _effects.showRainbow(kCardRainbowIntervalMs, now);
+        }
+        break;
+      case VisualState::CardUnknown:
+        _effects.showFade(255, 96, 0, 0, 0, 0, kErrorFadeDurationMs, now);
         break;
       case VisualState::CardScanning:
-        _effects.showRainbow(kCardRainbowIntervalMs, now);
+        if (_hasCardColor) {
+          _effects.showComet(_cardRed, _cardGreen, _cardBlue,
+                             kTailPrimaryFactor, kTailSecondaryFactor,
+                             CometEffect::Direction::Clockwise,
+                             kWifiCometIntervalMs, now);
+        } else {
+          _effects.showRainbow(kCardRainbowIntervalMs, now);
+        }
         break;
       case VisualState::BackendSuccess:
         _effects.snakeEffect().setInterval(kSuccessSpinIntervalMs);
-        _effects.showSnake(0, 255, 0, now);
+        if (_hasCardColor) {
+          _effects.showSnake(_cardRed, _cardGreen, _cardBlue, now);
+        } else {
+          _effects.showSnake(0, 255, 0, now);
+        }
         break;
       case VisualState::BackendError:
         _effects.showFade(255, 0, 0, 0, 0, 0, kErrorFadeDurationMs, now);
@@ -205,52 +274,21 @@ private:
   VisualState _baseState = VisualState::WifiConnecting;
   VisualState _currentState = VisualState::WifiConnecting;
   unsigned long _stateChangedAt = 0;
+  uint32_t _activeRequestId = 0;
   bool _backendPending = false;
   bool _initialized = false;
+  bool _hasCardColor = false;
+  uint8_t _cardRed = 0;
+  uint8_t _cardGreen = 0;
+  uint8_t _cardBlue = 0;
 };
 
 static VisualStateController visualState(effects);
 static bool wifiPreviouslyConnected = false;
-static constexpr UBaseType_t MDNS_QUERY_TASK_PRIORITY = 1;
-static constexpr uint16_t MDNS_QUERY_TASK_STACK_SIZE = 4096;
-
-enum class MdnsQueryState {
-  Idle,
-  NotRequired,
-  Pending,
-  Success,
-  Failure
-};
-
-struct MdnsQueryUpdate {
-  MdnsQueryState state = MdnsQueryState::Idle;
-  String hostname;
-  IPAddress resolvedIp;
-  unsigned long startedAt = 0;
-  unsigned long finishedAt = 0;
-};
-
-static volatile MdnsQueryState mdnsQueryState = MdnsQueryState::Idle;
-static MdnsQueryState lastReportedMdnsState = MdnsQueryState::Idle;
-static TaskHandle_t mdnsQueryTaskHandle = nullptr;
-static String mdnsQueryHostname;
-static IPAddress mdnsResolvedIp;
-static unsigned long mdnsQueryFinishedAt = 0;
-static unsigned long mdnsQueryStartedAt = 0;
-
-static bool scheduleMdnsQueryTask(const String &hostname, unsigned long now);
-static void mdnsQueryTask(void *param);
 static void setVisualState(VisualState state, unsigned long now);
 
-static void resetMdnsQueryState() {
-  if (mdnsQueryTaskHandle == nullptr) {
-    mdnsQueryHostname = "";
-  }
-  mdnsResolvedIp = IPAddress();
-  mdnsQueryFinishedAt = 0;
-  mdnsQueryStartedAt = 0;
-  mdnsQueryState = MdnsQueryState::Idle;
-  lastReportedMdnsState = MdnsQueryState::Idle;
+static bool backendUsesMdns() {
+  return String(BACKEND_HOST).endsWith(".local");
 }
 
 static void showMdnsVisualState(VisualState state, unsigned long now) {
@@ -259,40 +297,23 @@ static void showMdnsVisualState(VisualState state, unsigned long now) {
   }
 }
 
-static bool fetchMdnsQueryUpdate(MdnsQueryUpdate &out) {
-  MdnsQueryState state = mdnsQueryState;
-  if (state == lastReportedMdnsState) {
-    return false;
-  }
-
-  lastReportedMdnsState = state;
-  out.state = state;
-  out.hostname = mdnsQueryHostname;
-  out.resolvedIp = mdnsResolvedIp;
-  out.startedAt = mdnsQueryStartedAt;
-  out.finishedAt = mdnsQueryFinishedAt;
-  return true;
-}
-
-static void applyMdnsUpdateFeedback(const MdnsQueryUpdate &update, unsigned long now) {
-  switch (update.state) {
-    case MdnsQueryState::Pending:
-      Serial.printf("[mDNS] Resolving %s.local asynchronously...\n",
-                    update.hostname.c_str());
+static void applyMdnsUpdateFeedback(const HostResolver::Update &update, unsigned long now) {
+  switch (update.status) {
+    case HostResolver::Status::Pending:
+      Serial.printf("[mDNS] Resolving %s asynchronously...\n", BACKEND_HOST);
       showMdnsVisualState(VisualState::MdnsResolving, now);
       break;
-    case MdnsQueryState::Success:
-      Serial.printf("[mDNS] %s.local resolved to %s\n",
-                    update.hostname.c_str(), update.resolvedIp.toString().c_str());
+    case HostResolver::Status::Resolved:
+      Serial.printf("[mDNS] %s resolved to %s\n",
+                    BACKEND_HOST, update.ip.toString().c_str());
       if (update.startedAt != 0 && update.finishedAt >= update.startedAt) {
         Serial.printf("[mDNS] Query completed in %lums\n",
                       update.finishedAt - update.startedAt);
       }
       showMdnsVisualState(VisualState::MdnsSuccess, now);
       break;
-    case MdnsQueryState::Failure:
-      Serial.printf("[WARNING] Could not resolve %s.local via mDNS\n",
-                    update.hostname.c_str());
+    case HostResolver::Status::Failed:
+      Serial.printf("[WARNING] Could not resolve %s via mDNS\n", BACKEND_HOST);
       Serial.println("Make sure your backend server is running and mDNS is enabled");
       if (update.startedAt != 0 && update.finishedAt >= update.startedAt) {
         Serial.printf("[mDNS] Query failed after %lums\n",
@@ -300,28 +321,11 @@ static void applyMdnsUpdateFeedback(const MdnsQueryUpdate &update, unsigned long
       }
       showMdnsVisualState(VisualState::MdnsError, now);
       break;
-    case MdnsQueryState::NotRequired:
-    case MdnsQueryState::Idle:
+    case HostResolver::Status::Unknown:
       break;
   }
 }
 
-static void mdnsQueryTask(void *param) {
-  std::unique_ptr<char, void (*)(void *)> hostnamePtr(static_cast<char *>(param), free);
-  const char *hostnameCStr = hostnamePtr.get();
-  IPAddress resolved = MDNS.queryHost(hostnameCStr ? hostnameCStr : "");
-
-  mdnsResolvedIp = resolved;
-  mdnsQueryFinishedAt = millis();
-  if (resolved == IPAddress(0, 0, 0, 0)) {
-    mdnsQueryState = MdnsQueryState::Failure;
-  } else {
-    mdnsQueryState = MdnsQueryState::Success;
-  }
-  mdnsQueryTaskHandle = nullptr;
-  vTaskDelete(nullptr);
-}
-
 static void setVisualState(VisualState state, unsigned long now) {
   visualState.setState(state, now);
 }
@@ -338,79 +342,171 @@ static void updateWifiVisualState(bool isConnected, unsigned long now) {
   visualState.updateWifiState(isConnected, wifiPreviouslyConnected, now);
 }
 
-// Variables to handle debouncing of repeated card reads
-static String lastUid = "";
-static unsigned long lastReadTime = 0;
 static unsigned long lastDebugTime = 0;
+static uint32_t lastBackendRequestId = 0;
+// Trace of the card currently being read, and of a finished tap whose
+// result has not reached the LEDs yet.
+static uint32_t currentTraceId = 0;
+static uint32_t frameTraceId = 0;
+static uint32_t frameCountAtResult = 0;
 static bool mdnsStarted = false;
+static bool hubStarted = false;
+static bool hubGatewayKnown = false;
+static unsigned long hubLastScanAt = 0;
+
+// Satellite taps the gateway has handed to its backend, by request id.
+struct RelayedTap {
+  uint32_t      requestId = 0;
+  HubRelay::Tap tap;
+};
+static RelayedTap relayedTaps[BACKEND_REQUEST_QUEUE_DEPTH];
 
 #if ENABLE_DEBUG_ACTIONS
 static DebugActionServer debugServer(DEBUG_SERVER_PORT);
 #endif
 
 enum class CardProcessResult {
-  DuplicateIgnored,
   BackendSkipped,
   BackendPending,
   BackendFailure,
   WifiDisconnected,
-  BackendBusy
+  BackendBusy,
+  BackendUnavailable,
+  CardUnknown
 };
 
-static void handleBackendCompletion(bool success, unsigned long now);
-static CardProcessResult startBackendRequest(const String &uid);
+static void handleBackendCompletion(const BackendClient::Result &result, unsigned long now);
+static CardProcessResult startBackendRequest(const String &uid, unsigned long readAt);
+static CardProcessResult startRelayedRequest(const String &uid, unsigned long readAt);
+
+static uint32_t ensureCurrentTrace() {
+  if (currentTraceId == 0) {
+    currentTraceId = tracer.begin();
+  }
+  return currentTraceId;
+}
+
+static void dropCurrentTrace() {
+  tracer.abandon(currentTraceId);
+  currentTraceId = 0;
+}
+
+// Closes the trace of the last result once its LED state has been
+// pushed to the strip.
+static void finishFrameTrace() {
+  LedStrip &strip = effects.strip();
+  if (frameTraceId == 0 || strip.frameCount() == frameCountAtResult) {
+    return;
+  }
+  tracer.markAt(frameTraceId, TapTracer::Stage::FirstFrame, strip.lastFrameAtUs());
+  tracer.finish(frameTraceId);
+  frameTraceId = 0;
+}
+
+// Runs on the RFID task while it reads a card: lets the backend get
+// ready before loop() sees the UID. The reader stamps both events for
+// the trace itself.
+static void handleRfidCardEvent(RfidCardEvent event, const char *uidHex, void *context) {
+  (void)context;
+  if (event == RfidCardEvent::FieldDetected) {
+    backend.notifyCardApproaching();
+    return;
+  }
+  // A card processCardUid() is about to refuse would leave the backend
+  // buffering a stream nobody commits.
+  CardCatalog::Card card;
+  if (CARD_CATALOG_REJECT_UNKNOWN &&
+      catalog.lookup(uidHex, card) == CardCatalog::Lookup::Unknown) {
+    return;
+  }
+  backend.prepareCard(uidHex);
+}
 
+// `readAt` is the millis() time the card was read, which is earlier
+// than `now` when loop() was held up; the backend is given that time.
 static CardProcessResult processCardUid(const String &uid, unsigned long now,
-                                       bool bypassDebounce, bool sendToBackend) {
+                                       unsigned long readAt, bool sendToBackend) {
   Serial.println("*** CARD DETECTED ***");
   Serial.printf("Raw UID: %s (length: %d)\n", uid.c_str(), uid.length());
 
-  setVisualState(VisualState::CardDetected, now);
+  // The catalog answers in microseconds, so a known card shows its
+  // colour and an unknown one is refused before any network I/O.
+  CardCatalog::Card card;
+  CardCatalog::Lookup lookup = catalog.lookup(uid.c_str(), card);
+  bool isKnown = lookup == CardCatalog::Lookup::Known;
+  bool rejectUnknown = CARD_CATALOG_REJECT_UNKNOWN && lookup == CardCatalog::Lookup::Unknown;
+  visualState.setCardColor(isKnown && card.hasColor(), card.red, card.green, card.blue, now);
+  setVisualState(rejectUnknown ? VisualState::CardUnknown : VisualState::CardDetected, now);
+
+  tracer.mark(ensureCurrentTrace(), TapTracer::Stage::CardProcessed);
+  Telemetry::count(Telemetry::Counter::Taps);
+  Serial.printf("Card accepted: UID=%s\n", uid.c_str());
 
-  bool isDuplicate = !bypassDebounce && uid == lastUid &&
-                     (now - lastReadTime) < CARD_DEBOUNCE_MS;
-  if (isDuplicate) {
-    Serial.printf("[DEBOUNCE] Ignoring repeated read (last read %lu ms ago)\n",
-                  now - lastReadTime);
-    return CardProcessResult::DuplicateIgnored;
+  if (rejectUnknown) {
+    // The card may have been registered since the last sync; fetch the
+    // changes now so the next tap finds it.
+    Serial.printf("[Catalog] Card %s is not in catalog version %lu; rejected locally\n",
+                  uid.c_str(), static_cast<unsigned long>(catalog.version()));
+    backend.requestCatalogSync();
+    dropCurrentTrace();
+    Serial.println("*** END CARD PROCESSING ***\n");
+    return CardProcessResult::CardUnknown;
   }
 
-  lastUid = uid;
-  lastReadTime = now;
-  Serial.printf("Card accepted: UID=%s\n", uid.c_str());
-
   if (!sendToBackend) {
     Serial.println("[DEBUG] Backend request skipped (sendToBackend=false).");
+    dropCurrentTrace();
     unsigned long updatedNow = millis();
     setVisualState(VisualState::BackendSuccess, updatedNow);
     Serial.println("*** END CARD PROCESSING ***\n");
     return CardProcessResult::BackendSkipped;
   }
 
-  CardProcessResult backendResult = startBackendRequest(uid);
+  CardProcessResult backendResult = startBackendRequest(uid, readAt);
   if (backendResult != CardProcessResult::BackendPending) {
+    dropCurrentTrace();
     Serial.println("*** END CARD PROCESSING ***\n");
   }
   return backendResult;
 }
 
-static CardProcessResult startBackendRequest(const String &uid) {
+static CardProcessResult startBackendRequest(const String &uid, unsigned long readAt) {
+  if (HUB_ROLE == HubRole::Satellite) {
+    return startRelayedRequest(uid, readAt);
+  }
+
   if (!wifi.isConnected()) {
-    Serial.println("[ERROR] Not connected to Wi-Fi. Skipping backend request.");
+    Serial.println("[ERROR] Not connected to Wi-Fi. Journaling tap for replay.");
+    backend.journalTap(uid, readAt);
     unsigned long now = millis();
     setVisualState(VisualState::BackendError, now);
     return CardProcessResult::WifiDisconnected;
   }
 
-  if (visualState.isBackendPending() || backend.isBusy()) {
-    Serial.println("[Backend] Request already in progress. Ignoring new card.");
+  if (backend.isCircuitOpen()) {
+    // The backend keeps failing; don't make the user wait for another
+    // timeout. The worker replays the tap once the circuit closes.
+    Serial.println("[Backend] Circuit open. Journaling tap for replay.");
+    Telemetry::count(Telemetry::Counter::BreakerFastFailures);
+    backend.journalTap(uid, readAt);
+    unsigned long now = millis();
+    setVisualState(VisualState::BackendError, now);
+    return CardProcessResult::BackendUnavailable;
+  }
+
+  if (!backend.hasCapacity()) {
+    Serial.println("[Backend] Too many requests in flight. Ignoring new card.");
     return CardProcessResult::BackendBusy;
   }
 
   Serial.println("Starting asynchronous request to backend...");
-  if (backend.beginPostPlayAsync(uid)) {
+  uint32_t requestId = backend.beginPostPlayAsync(uid, currentTraceId, readAt);
+  if (requestId != 0) {
+    // The trace now travels with the request.
+    currentTraceId = 0;
+    lastBackendRequestId = requestId;
     unsigned long now = millis();
-    visualState.onBackendRequestStarted(now);
+    visualState.onBackendRequestStarted(requestId, now);
     return CardProcessResult::BackendPending;
   }
 
@@ -420,13 +516,202 @@ static CardProcessResult startBackendRequest(const String &uid) {
   return CardProcessResult::BackendFailure;
 }
 
-static void handleBackendCompletion(bool success, unsigned long now) {
-  if (success) {
+// Satellite: hands the tap to the gateway instead of the backend. The
+// result comes back through serviceHub() like a backend completion.
+static CardProcessResult startRelayedRequest(const String &uid, unsigned long readAt) {
+  unsigned long now = millis();
+  uint32_t requestId = hubStarted ? hub.sendTap(uid.c_str(), currentTraceId, readAt, now) : 0;
+  if (requestId == 0) {
+    Serial.println("[Hub] Could not hand the tap to the gateway");
+    setVisualState(VisualState::BackendError, now);
+    return CardProcessResult::BackendFailure;
+  }
+  Serial.printf("[Hub] Tap #%lu sent to %s\n", static_cast<unsigned long>(requestId),
+                hub.gatewayKnown() ? "the gateway" : "any gateway (broadcast)");
+  currentTraceId = 0;
+  lastBackendRequestId = requestId;
+  visualState.onBackendRequestStarted(requestId, now);
+  return CardProcessResult::BackendPending;
+}
+
+static const char *formatHubAddress(const HubAddress &address, char *out, size_t length) {
+  snprintf(out, length, "%02X:%02X:%02X:%02X:%02X:%02X", address.bytes[0], address.bytes[1],
+           address.bytes[2], address.bytes[3], address.bytes[4], address.bytes[5]);
+  return out;
+}
+
+// Gateway: sends a satellite's tap to the backend on its behalf. The
+// satellite's read time is carried over, so the backend sees when the
+// card was actually read.
+static void forwardRelayedTap(const HubRelay::Tap &tap, unsigned long now) {
+  char from[18];
+  Serial.printf("[Hub] Tap %s from satellite %s, read %lums ago\n", tap.uid,
+                formatHubAddress(tap.from, from, sizeof(from)),
+                static_cast<unsigned long>(tap.ageMs));
+  unsigned long capturedAt = tap.receivedAt - tap.ageMs;
+  uint32_t requestId = 0;
+  if (!wifi.isConnected() || backend.isCircuitOpen()) {
+    backend.journalTap(tap.uid, capturedAt);
+  } else {
+    requestId = backend.beginPostPlayAsync(tap.uid, 0, capturedAt);
+  }
+  if (requestId == 0) {
+    hub.sendResult(tap, HubRelay::Status::Failed, now);
+    return;
+  }
+
+  RelayedTap *slot = &relayedTaps[0];
+  for (RelayedTap &candidate : relayedTaps) {
+    if (candidate.requestId == 0) {
+      slot = &candidate;
+      break;
+    }
+    if (candidate.requestId < slot->requestId) {
+      slot = &candidate;
+    }
+  }
+  if (slot->requestId != 0) {
+    // Only happens when older requests never completed; their
+    // satellites time out on their own.
+    Serial.printf("[Hub] Forgetting relayed request #%lu\n",
+                  static_cast<unsigned long>(slot->requestId));
+  }
+  slot->requestId = requestId;
+  slot->tap = tap;
+}
+
+// Gateway: reports a finished relayed request to its satellite. Returns
+// false if the request was not a relayed one.
+static bool finishRelayedTap(const BackendClient::Result &result, unsigned long now) {
+  for (RelayedTap &slot : relayedTaps) {
+    if (slot.requestId == 0 || slot.requestId != result.requestId) {
+      continue;
+    }
+    HubRelay::Status status = result.cancelled  ? HubRelay::Status::Cancelled
+                              : result.success ? HubRelay::Status::Delivered
+                                               : HubRelay::Status::Failed;
+    char to[18];
+    Serial.printf("[Hub] Request #%lu for satellite %s %s after %lums\n",
+                  static_cast<unsigned long>(result.requestId),
+                  formatHubAddress(slot.tap.from, to, sizeof(to)),
+                  result.cancelled ? "superseded" : (result.success ? "succeeded" : "failed"),
+                  now - slot.tap.receivedAt);
+    hub.sendResult(slot.tap, status, now);
+    slot.requestId = 0;
+    return true;
+  }
+  return false;
+}
+
+static void startHub(unsigned long now) {
+  if (HUB_ROLE == HubRole::Standalone || hubStarted) {
+    return;
+  }
+  uint8_t channel = 0;
+  if (HUB_ROLE == HubRole::Satellite) {
+    hubLastScanAt = now;
+    channel = HUB_CHANNEL;
+    if (channel == 0) {
+      channel = EspNowLink::findChannel(WIFI_SSID);
+      if (channel == 0) {
+        Serial.printf("[Hub] %s not found; cannot tell the gateway's channel yet\n", WIFI_SSID);
+        return;
+      }
+    }
+  }
+  if (!hubLink.begin(channel)) {
+    return;
+  }
+  HubAddress gateway;
+  memcpy(gateway.bytes, HUB_GATEWAY_MAC, HubAddress::kLength);
+  hub.begin(static_cast<uint16_t>(random(1, 0x10000)), gateway);
+  hubStarted = true;
+  Serial.printf("[Hub] Running as %s\n",
+                HUB_ROLE == HubRole::Gateway ? "gateway" : "satellite");
+}
+
+// Satellite: the gateway stopped answering. It may have followed its
+// access point to another channel.
+static void rescanHubChannel(unsigned long now) {
+  if (HUB_CHANNEL != 0 || now - hubLastScanAt < kHubRescanIntervalMs) {
+    return;
+  }
+  hubLastScanAt = now;
+  uint8_t channel = EspNowLink::findChannel(WIFI_SSID);
+  if (channel != 0) {
+    hubLink.setChannel(channel);
+    Serial.printf("[Hub] Listening for the gateway on channel %u\n", channel);
+  }
+}
+
+static void serviceHub(unsigned long now) {
+  if (!hubStarted) {
+    if (HUB_ROLE == HubRole::Satellite && now - hubLastScanAt >= kHubRescanIntervalMs) {
+      startHub(now);
+    }
+    return;
+  }
+  hub.loop(now);
+
+  if (HUB_ROLE == HubRole::Gateway) {
+    HubRelay::Tap tap;
+    while (hub.pollTap(tap)) {
+      forwardRelayedTap(tap, now);
+    }
+    return;
+  }
+
+  if (hub.gatewayKnown() != hubGatewayKnown) {
+    hubGatewayKnown = hub.gatewayKnown();
+    Serial.println(hubGatewayKnown ? "[Hub] Gateway answered; sending taps to it directly"
+                                   : "[Hub] Gateway lost; broadcasting taps");
+  }
+  HubRelay::Result relayed;
+  while (hub.pollResult(relayed)) {
+    Serial.printf("[Hub] Tap #%lu %s: gateway ack %lums, result %lums\n",
+                  static_cast<unsigned long>(relayed.requestId),
+                  relayed.status == HubRelay::Status::Delivered   ? "delivered"
+                  : relayed.status == HubRelay::Status::Cancelled ? "superseded"
+                                                                  : "failed",
+                  relayed.ackMs, relayed.resultMs);
+    BackendClient::Result result;
+    result.requestId = relayed.requestId;
+    result.traceId = relayed.traceId;
+    result.success = relayed.status == HubRelay::Status::Delivered;
+    result.cancelled = relayed.status == HubRelay::Status::Cancelled;
+    if (!relayed.acknowledged) {
+      rescanHubChannel(now);
+    }
+    handleBackendCompletion(result, millis());
+  }
+}
+
+static void handleBackendCompletion(const BackendClient::Result &result, unsigned long now) {
+  if (finishRelayedTap(result, now)) {
+    return;
+  }
+  if (result.cancelled) {
+    Serial.printf("[Backend] Request #%lu was superseded by a newer card\n",
+                  static_cast<unsigned long>(result.requestId));
+    tracer.abandon(result.traceId);
+    return;
+  }
+  tracer.mark(result.traceId, TapTracer::Stage::Completed);
+  if (result.success) {
     Serial.println("[SUCCESS] Backend request successful");
   } else {
     Serial.println("[ERROR] Backend request failed");
   }
-  visualState.onBackendRequestFinished(success, now);
+  uint32_t framesBefore = effects.strip().frameCount();
+  if (visualState.onBackendRequestFinished(result.requestId, result.success, now)) {
+    if (frameTraceId != 0) {
+      tracer.finish(frameTraceId);
+    }
+    frameTraceId = result.traceId;
+    frameCountAtResult = framesBefore;
+  } else {
+    tracer.finish(result.traceId);
+  }
   Serial.println("*** END CARD PROCESSING ***\n");
 }
 
@@ -455,6 +740,10 @@ static bool parseVisualState(const String &value, VisualState &state) {
     state = VisualState::CardDetected;
     return true;
   }
+  if (normalized == "card_unknown") {
+    state = VisualState::CardUnknown;
+    return true;
+  }
   if (normalized == "backend_success") {
     state = VisualState::BackendSuccess;
     return true;
@@ -570,23 +859,29 @@ static bool handleSimulateCard(JsonVariantConst payload, String &message) {
     return false;
   }
 
-  bool bypassDebounce = obj["bypass_debounce"] | false;
   bool sendToBackend = obj["send_to_backend"] | true;
 
   unsigned long now = millis();
-  CardProcessResult result =
-      processCardUid(String(uidValue), now, bypassDebounce, sendToBackend);
+  CardProcessResult result = processCardUid(String(uidValue), now, now, sendToBackend);
 
   if (result == CardProcessResult::BackendPending) {
-    bool success = false;
     Serial.println("[Debug] Waiting for backend request triggered via debug action...");
-    while (!backend.pollResult(success)) {
-      delay(10);
-      yield();
+    uint32_t requestId = lastBackendRequestId;
+    BackendClient::Result completion;
+    do {
+      while (!backend.pollResult(completion)) {
+        delay(10);
+        yield();
+      }
+      // Earlier requests finishing in the meantime take the normal path.
+      unsigned long completionNow = millis();
+      handleBackendCompletion(completion, completionNow);
+    } while (completion.requestId != requestId);
+    if (completion.cancelled) {
+      message = "Backend request was superseded by a newer card.";
+      return false;
     }
-    unsigned long completionNow = millis();
-    handleBackendCompletion(success, completionNow);
-    if (success) {
+    if (completion.success) {
       message = "Backend request completed successfully.";
       return true;
     }
@@ -595,9 +890,6 @@ static bool handleSimulateCard(JsonVariantConst payload, String &message) {
   }
 
   switch (result) {
-    case CardProcessResult::DuplicateIgnored:
-      message = "Duplicate UID ignored due to debounce.";
-      return false;
     case CardProcessResult::BackendSkipped:
       message = "Simulated card processed without backend call.";
       return true;
@@ -605,70 +897,573 @@ static bool handleSimulateCard(JsonVariantConst payload, String &message) {
       message = "Failed to start backend request.";
       return false;
     case CardProcessResult::WifiDisconnected:
-      message = "Wi-Fi is disconnected; backend request skipped.";
+      message = "Wi-Fi is disconnected; tap journaled for replay.";
       return false;
     case CardProcessResult::BackendBusy:
       message = "Backend request already in progress.";
       return false;
+    case CardProcessResult::BackendUnavailable:
+      message = "Backend circuit is open; tap journaled for replay.";
+      return false;
+    case CardProcessResult::CardUnknown:
+      message = "Card is not in the local catalog; rejected without a backend call.";
+      return false;
   }
 
   message = "Unknown result.";
   return false;
 }
-#endif
+static bool handleTapLatency(JsonVariantConst payload, String &message) {
+  tracer.dump(Serial);
+
+  message = "";
+  char line[96];
+  for (size_t i = 0; i <= TapTracer::kStageCount; ++i) {
+    TapTracer::Stage stage = static_cast<TapTracer::Stage>(i);
+    const LatencyHistogram &histogram = tracer.histogram(stage);
+    if (histogram.count() == 0) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "%s p50=%.1f p95=%.1f p99=%.1f ms; ",
+             TapTracer::stageName(stage), histogram.percentile(50) / 1000.0f,
+             histogram.percentile(95) / 1000.0f, histogram.percentile(99) / 1000.0f);
+    message += line;
+  }
+  if (message.length() == 0) {
+    message = "No taps traced yet.";
+  }
+
+  bool reset = payload["reset"] | false;
+  if (reset) {
+    tracer.reset();
+    message += " Histograms reset.";
+  }
+  return true;
+}
+
+struct BenchmarkRun {
+  uint32_t succeeded = 0;
+  uint32_t connectsOpened = 0;
+  uint32_t tlsResumed = 0;
+  uint32_t retries = 0;
+  uint32_t timeouts = 0;
+};
 
-static bool scheduleMdnsQueryTask(const String &hostname, unsigned long now) {
-  if (hostname.isEmpty()) {
+// Sends `count` play requests back to back through the real backend
+// worker, recording each one's latency. Returns false if a request
+// could not be queued.
+static bool runPlayBurst(const char *uid, uint32_t count, unsigned long intervalMs,
+                         LatencyHistogram &latency, BenchmarkRun &run) {
+  BackendClient::ConnectionStats connectionsBefore = backend.connectionStats();
+  BackendClient::ResilienceStats resilienceBefore = backend.resilienceStats();
+  for (uint32_t i = 0; i < count; ++i) {
+    while (!backend.hasCapacity()) {
+      delay(1);
+    }
+    int64_t startUs = esp_timer_get_time();
+    uint32_t requestId = backend.beginPostPlayAsync(String(uid));
+    if (requestId == 0) {
+      return false;
+    }
+    BackendClient::Result completion;
+    for (;;) {
+      if (!backend.pollResult(completion)) {
+        delay(1);
+        continue;
+      }
+      if (completion.requestId == requestId) {
+        break;
+      }
+      handleBackendCompletion(completion, millis());
+    }
+    latency.record(static_cast<uint32_t>(esp_timer_get_time() - startUs));
+    run.succeeded += completion.success ? 1 : 0;
+    if (intervalMs > 0) {
+      delay(intervalMs);
+    }
+  }
+  BackendClient::ResilienceStats resilienceAfter = backend.resilienceStats();
+  BackendClient::ConnectionStats connectionsAfter = backend.connectionStats();
+  run.connectsOpened = connectionsAfter.connectsOpened - connectionsBefore.connectsOpened;
+  run.tlsResumed = connectionsAfter.resumedHandshakes - connectionsBefore.resumedHandshakes;
+  run.retries = resilienceAfter.retries - resilienceBefore.retries;
+  run.timeouts = resilienceAfter.timeouts - resilienceBefore.timeouts;
+  return true;
+}
+
+// Runs the burst (and optionally an OTA download) once per impairment
+// profile and prints one table row per profile.
+static bool runProfileSweep(JsonArrayConst names, const char *uid, uint32_t count,
+                            unsigned long intervalMs, bool download, String &message) {
+  for (JsonVariantConst name : names) {
+    if (ImpairedClient::findProfile(name.as<const char *>()) == nullptr) {
+      message = "Unknown impairment profile '";
+      message += name.as<const char *>() != nullptr ? name.as<const char *>() : "";
+      message += "'.";
+      return false;
+    }
+  }
+
+  static LatencyHistogram latency;
+  ImpairmentProfile previous = ImpairedClient::profile();
+  Serial.printf("[Benchmark] %-10s %7s %7s %7s %7s %7s %5s %5s %5s %5s %5s %8s\n", "profile",
+                "ok", "p50", "p95", "p99", "max", "retry", "tmo", "conn", "stall", "reset",
+                "KB/s");
+  message = "";
+  bool ok = true;
+  for (JsonVariantConst name : names) {
+    const ImpairmentProfile *profile = ImpairedClient::findProfile(name.as<const char *>());
+    ImpairedClient::setProfile(*profile);
+    ImpairedClient::Stats impairBefore = ImpairedClient::stats();
+    latency.reset();
+    BenchmarkRun run;
+    if (!runPlayBurst(uid, count, intervalMs, latency, run)) {
+      message = "Failed to queue a benchmark request.";
+      ok = false;
+      break;
+    }
+    char throughput[12] = "-";
+    if (download) {
+      OtaUpdater::DownloadMeasurement measurement;
+      if (otaUpdater.measureDownload(measurement) && measurement.elapsedMs > 0) {
+        snprintf(throughput, sizeof(throughput), "%.1f",
+                 measurement.bytes / 1024.0f / (measurement.elapsedMs / 1000.0f));
+      } else {
+        snprintf(throughput, sizeof(throughput), "err %d", measurement.statusCode);
+      }
+    }
+    ImpairedClient::Stats impairAfter = ImpairedClient::stats();
+
+    char okText[16];
+    snprintf(okText, sizeof(okText), "%lu/%lu", static_cast<unsigned long>(run.succeeded),
+             static_cast<unsigned long>(count));
+    Serial.printf("[Benchmark] %-10s %7s %7.1f %7.1f %7.1f %7.1f %5lu %5lu %5lu %5lu %5lu %8s\n",
+                  profile->name, okText, latency.percentile(50) / 1000.0f,
+                  latency.percentile(95) / 1000.0f, latency.percentile(99) / 1000.0f,
+                  latency.maxUs() / 1000.0f, static_cast<unsigned long>(run.retries),
+                  static_cast<unsigned long>(run.timeouts),
+                  static_cast<unsigned long>(run.connectsOpened),
+                  static_cast<unsigned long>(impairAfter.stalls - impairBefore.stalls),
+                  static_cast<unsigned long>(impairAfter.resets - impairBefore.resets),
+                  throughput);
+
+    char summary[96];
+    snprintf(summary, sizeof(summary), "%s%s: %s ok p95=%.0fms %s KB/s",
+             message.isEmpty() ? "" : "; ", profile->name, okText,
+             latency.percentile(95) / 1000.0f, throughput);
+    message += summary;
+  }
+  ImpairedClient::setProfile(previous);
+  return ok;
+}
+
+// Sends `count` play requests back to back through the real backend
+// worker and reports their latency. Meant to run against the backend
+// stand-in in tools/backend_standin; blocks the loop while it runs.
+// With "profiles", the burst is repeated under each network impairment
+// profile and a table is printed over serial.
+static bool handleBackendBenchmark(JsonVariantConst payload, String &message) {
+  constexpr uint32_t kMaxBenchmarkRequests = 500;
+  const char *uid = payload["uid"] | "04A224D9123480";
+  uint32_t count = payload["count"] | 20;
+  unsigned long intervalMs = payload["interval_ms"] | 0;
+  JsonArrayConst profiles = payload["profiles"].as<JsonArrayConst>();
+  bool download = payload["download"] | false;
+  if (count == 0 || count > kMaxBenchmarkRequests) {
+    message = "'count' must be between 1 and 500.";
+    return false;
+  }
+  if (!wifi.isConnected()) {
+    message = "Wi-Fi is disconnected.";
     return false;
   }
+  if (!profiles.isNull()) {
+    if (!NETWORK_IMPAIRMENT_ENABLED) {
+      message = "NETWORK_IMPAIRMENT_ENABLED is off in Config.h.";
+      return false;
+    }
+    return runProfileSweep(profiles, uid, count, intervalMs, download, message);
+  }
 
-  if (mdnsQueryTaskHandle != nullptr) {
-    Serial.println("[WARNING] Previous mDNS query still running; skipping new task");
+  static LatencyHistogram latency;
+  latency.reset();
+  BenchmarkRun run;
+  if (!runPlayBurst(uid, count, intervalMs, latency, run)) {
+    message = "Failed to queue a benchmark request.";
     return false;
   }
 
-  mdnsQueryHostname = hostname;
+  char text[200];
+  snprintf(text, sizeof(text),
+           "%lu/%lu ok; p50=%.1f p95=%.1f p99=%.1f max=%.1f mean=%.1f ms; %lu new connection(s), "
+           "%lu TLS resumed",
+           static_cast<unsigned long>(run.succeeded), static_cast<unsigned long>(count),
+           latency.percentile(50) / 1000.0f, latency.percentile(95) / 1000.0f,
+           latency.percentile(99) / 1000.0f, latency.maxUs() / 1000.0f,
+           latency.meanUs() / 1000.0f, static_cast<unsigned long>(run.connectsOpened),
+           static_cast<unsigned long>(run.tlsResumed));
+  message = text;
+  Serial.printf("[Benchmark] %s\n", text);
+  return true;
+}
 
-  size_t bufferSize = hostname.length() + 1;
-  char *hostnameCopy = static_cast<char *>(malloc(bufferSize));
-  if (hostnameCopy == nullptr) {
-    Serial.println("[WARNING] Insufficient memory for mDNS query task");
-    mdnsQueryState = MdnsQueryState::Failure;
-    mdnsQueryStartedAt = 0;
-    mdnsQueryFinishedAt = now;
+static bool handleNetworkImpairment(JsonVariantConst payload, String &message) {
+  if (!NETWORK_IMPAIRMENT_ENABLED) {
+    message = "NETWORK_IMPAIRMENT_ENABLED is off in Config.h.";
     return false;
   }
+  const char *name = payload["profile"] | static_cast<const char *>(nullptr);
+  if (name != nullptr) {
+    const ImpairmentProfile *profile = ImpairedClient::findProfile(name);
+    if (profile == nullptr) {
+      message = "Unknown profile. Use one of:";
+      size_t count = 0;
+      const ImpairmentProfile *all = ImpairedClient::profiles(count);
+      for (size_t i = 0; i < count; ++i) {
+        message += ' ';
+        message += all[i].name;
+      }
+      return false;
+    }
+    ImpairedClient::setProfile(*profile);
+  } else if (payload.as<JsonObjectConst>().size() > 0) {
+    ImpairmentProfile custom;
+    custom.name = "custom";
+    custom.latencyMs = payload["latency_ms"] | 0;
+    custom.jitterMs = payload["jitter_ms"] | 0;
+    custom.stallPermille = payload["stall_permille"] | 0;
+    custom.stallMs = payload["stall_ms"] | 0;
+    custom.bandwidthBytesPerSecond = payload["bandwidth_bytes_per_second"] | 0;
+    custom.resetPermille = payload["reset_permille"] | 0;
+    if (custom.stallPermille > 1000 || custom.resetPermille > 1000) {
+      message = "'stall_permille' and 'reset_permille' must be at most 1000.";
+      return false;
+    }
+    ImpairedClient::setProfile(custom);
+  }
 
-  hostname.toCharArray(hostnameCopy, bufferSize);
+  ImpairmentProfile active = ImpairedClient::profile();
+  ImpairedClient::Stats stats = ImpairedClient::stats();
+  char text[240];
+  snprintf(text, sizeof(text),
+           "profile=%s latency=%u+%ums stall=%u/1000 for %ums bandwidth=%lu B/s reset=%u/1000; "
+           "connections=%lu stalls=%lu resets=%lu received=%lu bytes",
+           active.name, active.latencyMs, active.jitterMs, active.stallPermille, active.stallMs,
+           static_cast<unsigned long>(active.bandwidthBytesPerSecond), active.resetPermille,
+           static_cast<unsigned long>(stats.connections), static_cast<unsigned long>(stats.stalls),
+           static_cast<unsigned long>(stats.resets),
+           static_cast<unsigned long>(stats.bytesReceived));
+  message = text;
+  Serial.printf("[Impair] %s\n", text);
+  return true;
+}
 
-  mdnsQueryState = MdnsQueryState::Pending;
-  mdnsQueryStartedAt = now;
-  mdnsQueryFinishedAt = 0;
+static bool handleTapTransport(JsonVariantConst payload, String &message) {
+  const char *name = payload["transport"] | static_cast<const char *>(nullptr);
+  if (name != nullptr) {
+    if (strcmp(name, "http") == 0) {
+      backend.setTransport(TapTransport::Http);
+    } else if (strcmp(name, "mqtt") == 0) {
+      backend.setTransport(TapTransport::Mqtt);
+    } else {
+      message = "'transport' must be \"http\" or \"mqtt\".";
+      return false;
+    }
+  }
+
+  MqttSession::Stats mqtt = backend.mqttStats();
+  char text[240];
+  snprintf(text, sizeof(text),
+           "transport=%s; mqtt %s connects=%lu published=%lu acked=%lu redelivered=%lu "
+           "expired=%lu inbox=%lu rejected=%lu srtt=%lums",
+           backend.tapTransport() == TapTransport::Mqtt ? "mqtt" : "http",
+           mqtt.connected ? "connected" : "disconnected",
+           static_cast<unsigned long>(mqtt.connects), static_cast<unsigned long>(mqtt.published),
+           static_cast<unsigned long>(mqtt.acknowledged),
+           static_cast<unsigned long>(mqtt.redelivered), static_cast<unsigned long>(mqtt.expired),
+           static_cast<unsigned long>(mqtt.inboxMessages),
+           static_cast<unsigned long>(mqtt.backendRejections), mqtt.srttMs);
+  message = text;
+  Serial.printf("[MQTT] %s\n", text);
+  return true;
+}
+
+// Average time per call of `operation` over `iterations` runs, in µs.
+template <typename Operation>
+static float timePerCallUs(uint32_t iterations, Operation operation) {
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    operation();
+  }
+  return static_cast<float>(esp_timer_get_time() - start) / static_cast<float>(iterations);
+}
+
+static bool handlePayloadCodec(JsonVariantConst payload, String &message) {
+  static constexpr uint32_t kMaxIterations = 20000;
+  static constexpr const char *kManifestVersion = "1.0.1";
+  static constexpr const char *kManifestUrl = "/api/v1/firmware/firmware.bin";
+  static constexpr const char *kManifestSha =
+      "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08";
 
-  BaseType_t taskCreated = xTaskCreate(mdnsQueryTask, "MdnsQuery",
-                                       MDNS_QUERY_TASK_STACK_SIZE, hostnameCopy,
-                                       MDNS_QUERY_TASK_PRIORITY,
-                                       &mdnsQueryTaskHandle);
-  if (taskCreated != pdPASS) {
-    Serial.println("[WARNING] Failed to start mDNS query task");
-    free(hostnameCopy);
-    mdnsQueryState = MdnsQueryState::Failure;
-    mdnsQueryFinishedAt = now;
-    mdnsQueryStartedAt = 0;
-    mdnsQueryTaskHandle = nullptr;
+  uint32_t iterations = payload["iterations"] | 1000U;
+  if (iterations == 0 || iterations > kMaxIterations) {
+    message = "'iterations' must be between 1 and 20000.";
     return false;
   }
 
+  TapEvent tap;
+  tap.setUid("04A224D9123480");
+  tap.ageMs = 12;
+  tap.traceId = 17;
+  tap.capturedAtUs = 1767225600123456ULL;
+  uint8_t tapJson[PayloadCodec::kMaxTapLength];
+  uint8_t tapCbor[PayloadCodec::kMaxTapLength];
+  size_t tapJsonLength = 0;
+  size_t tapCborLength = 0;
+  float tapJsonUs = timePerCallUs(iterations, [&] {
+    tapJsonLength = PayloadCodec::encodeTap(PayloadFormat::Json, tap, tapJson, sizeof(tapJson));
+  });
+  float tapCborUs = timePerCallUs(iterations, [&] {
+    tapCborLength = PayloadCodec::encodeTap(PayloadFormat::Cbor, tap, tapCbor, sizeof(tapCbor));
+  });
+
+  // The same manifest in both formats, with a field the device ignores.
+  char manifestJson[200];
+  int manifestJsonLength =
+      snprintf(manifestJson, sizeof(manifestJson),
+               "{\"version\":\"%s\",\"firmware_url\":\"%s\",\"sha256\":\"%s\"}",
+               kManifestVersion, kManifestUrl, kManifestSha);
+  uint8_t manifestCbor[200];
+  CborWriter writer(manifestCbor, sizeof(manifestCbor));
+  writer.beginMap(3);
+  writer.putText("version");
+  writer.putText(kManifestVersion);
+  writer.putText("firmware_url");
+  writer.putText(kManifestUrl);
+  writer.putText("sha256");
+  writer.putText(kManifestSha);
+
+  OtaManifest manifest;
+  bool decoded = true;
+  float manifestJsonUs = timePerCallUs(iterations, [&] {
+    decoded &= PayloadCodec::decodeManifest(
+        PayloadFormat::Json, reinterpret_cast<const uint8_t *>(manifestJson),
+        static_cast<size_t>(manifestJsonLength), manifest);
+  });
+  float manifestCborUs = timePerCallUs(iterations, [&] {
+    decoded &= PayloadCodec::decodeManifest(PayloadFormat::Cbor, manifestCbor, writer.length(),
+                                            manifest);
+  });
+  if (tapJsonLength == 0 || tapCborLength == 0 || !writer.ok() || !decoded) {
+    message = "Codec self-check failed.";
+    return false;
+  }
+
+  char text[200];
+  snprintf(text, sizeof(text),
+           "tap encode: json %uB %.2fus, cbor %uB %.2fus; manifest decode: json %dB %.2fus, "
+           "cbor %uB %.2fus (%lu iterations)",
+           static_cast<unsigned int>(tapJsonLength), tapJsonUs,
+           static_cast<unsigned int>(tapCborLength), tapCborUs, manifestJsonLength,
+           manifestJsonUs, static_cast<unsigned int>(writer.length()), manifestCborUs,
+           static_cast<unsigned long>(iterations));
+  message = text;
+  Serial.printf("[Codec] %s\n", text);
   return true;
 }
 
+static bool handleEventClock(JsonVariantConst payload, String &message) {
+  (void)payload;
+  EventClock::Stats clock = EventClock::stats();
+  char now[32];
+  char text[200];
+  snprintf(text, sizeof(text),
+           "now=%s synced=%s syncs=%lu steps=%lu drift=%.2fppm last_error=%lldus "
+           "last_sync=%lus ago",
+           EventClock::format(EventClock::nowUs(), now, sizeof(now)),
+           clock.synced ? "yes" : "no", static_cast<unsigned long>(clock.syncs),
+           static_cast<unsigned long>(clock.steps), clock.driftPpm,
+           static_cast<long long>(clock.lastErrorUs),
+           clock.syncs > 0
+               ? static_cast<unsigned long>((esp_timer_get_time() - clock.lastSyncAtUs) / 1000000)
+               : 0UL);
+  message = text;
+  Serial.printf("[Clock] %s\n", text);
+  return true;
+}
+
+static bool handleTlsSessions(JsonVariantConst payload, String &message) {
+  if (payload["clear"] | false) {
+    TlsClient::clearSessions();
+  }
+  if (payload["reset"] | false) {
+    TlsClient::resetStats();
+  }
+  TlsClient::Stats tls = TlsClient::stats();
+  char text[240];
+  snprintf(text, sizeof(text),
+           "tls=%s cached=%u; full=%lu avg=%lums last=%lums; resumed=%lu avg=%lums last=%lums; "
+           "resume_rejected=%lu failed=%lu",
+           BACKEND_TLS_ENABLED ? "on" : "off", tls.cachedSessions,
+           static_cast<unsigned long>(tls.fullHandshakes),
+           tls.fullHandshakes > 0 ? tls.totalFullMs / tls.fullHandshakes : 0UL, tls.lastFullMs,
+           static_cast<unsigned long>(tls.resumedHandshakes),
+           tls.resumedHandshakes > 0 ? tls.totalResumedMs / tls.resumedHandshakes : 0UL,
+           tls.lastResumedMs, static_cast<unsigned long>(tls.resumesRejected),
+           static_cast<unsigned long>(tls.failedHandshakes));
+  message = text;
+  Serial.printf("[TLS] %s\n", text);
+  return true;
+}
+
+static bool handleHubStatus(JsonVariantConst payload, String &message) {
+  (void)payload;
+  if (HUB_ROLE == HubRole::Standalone) {
+    message = "HUB_ROLE is Standalone in Config.h.";
+    return false;
+  }
+  HubRelay::Stats stats = hub.stats();
+  EspNowLink::Stats radio = hubLink.stats();
+  char text[200];
+  snprintf(text, sizeof(text),
+           "channel=%u relayed=%lu results=%lu duplicates=%lu retransmits=%lu undelivered=%lu "
+           "malformed=%lu; radio sent=%lu unacked=%lu received=%lu overflows=%lu",
+           hubStarted ? hubLink.channel() : 0, static_cast<unsigned long>(stats.tapsRelayed),
+           static_cast<unsigned long>(stats.resultsSent), static_cast<unsigned long>(stats.duplicates),
+           static_cast<unsigned long>(stats.retransmits), static_cast<unsigned long>(stats.undelivered),
+           static_cast<unsigned long>(stats.malformedFrames), static_cast<unsigned long>(radio.sent),
+           static_cast<unsigned long>(radio.notAcknowledged),
+           static_cast<unsigned long>(radio.received), static_cast<unsigned long>(radio.overflows));
+  message = text;
+
+  HubRelay::PeerStats peers[HubRelay::kMaxPeers];
+  size_t count = hub.peerStats(peers, HubRelay::kMaxPeers);
+  unsigned long now = millis();
+  for (size_t i = 0; i < count; ++i) {
+    char address[18];
+    char line[160];
+    snprintf(line, sizeof(line),
+             "; %s srtt=%lums rttvar=%lums last_rtt=%lums frames=%lu duplicates=%lu "
+             "retransmits=%lu seen=%lus ago",
+             formatHubAddress(peers[i].address, address, sizeof(address)), peers[i].srttMs,
+             peers[i].rttvarMs, peers[i].lastRttMs,
+             static_cast<unsigned long>(peers[i].framesReceived),
+             static_cast<unsigned long>(peers[i].duplicates),
+             static_cast<unsigned long>(peers[i].retransmits),
+             (now - peers[i].lastSeenAt) / 1000);
+    message += line;
+  }
+  Serial.printf("[Hub] %s\n", message.c_str());
+  return true;
+}
+
+static bool handleTelemetry(JsonVariantConst payload, String &message) {
+  if (!TELEMETRY_ENABLED) {
+    message = "TELEMETRY_ENABLED is false in Config.h.";
+    return false;
+  }
+  if (payload["flush"] | false) {
+    Telemetry::flush(millis());
+  }
+  Telemetry::Stats stats = Telemetry::stats();
+  char lastUpload[16] = "never";
+  if (stats.uploads > 0) {
+    snprintf(lastUpload, sizeof(lastUpload), "%lus ago", (millis() - stats.lastUploadAt) / 1000);
+  }
+  char text[160];
+  snprintf(text, sizeof(text), "pending=%u closed=%lu dropped=%lu uploads=%lu failed=%lu last_upload=%s",
+           stats.pendingWindows, static_cast<unsigned long>(stats.windowsClosed),
+           static_cast<unsigned long>(stats.windowsDropped),
+           static_cast<unsigned long>(stats.uploads),
+           static_cast<unsigned long>(stats.uploadFailures), lastUpload);
+  message = text;
+  message += "; current";
+  for (size_t i = 0; i < Telemetry::kCounterCount; ++i) {
+    Telemetry::Counter counter = static_cast<Telemetry::Counter>(i);
+    char entry[40];
+    snprintf(entry, sizeof(entry), " %s=%lu", Telemetry::counterName(counter),
+             static_cast<unsigned long>(Telemetry::currentCount(counter)));
+    message += entry;
+  }
+  Serial.printf("[Telemetry] %s\n", message.c_str());
+  return true;
+}
+
+static bool handleRfidStatus(JsonVariantConst payload, String &message) {
+  constexpr size_t kProfileCount = sizeof(RFID_POLL_PROFILES) / sizeof(RFID_POLL_PROFILES[0]);
+  const char *name = payload["profile"] | static_cast<const char *>(nullptr);
+  if (name != nullptr) {
+    size_t index = 0;
+    while (index < kProfileCount && strcmp(RFID_POLL_PROFILES[index].name, name) != 0) {
+      ++index;
+    }
+    if (index == kProfileCount) {
+      message = "Unknown profile. Use one of:";
+      for (const RfidPollProfile &profile : RFID_POLL_PROFILES) {
+        message += ' ';
+        message += profile.name;
+      }
+      return false;
+    }
+    rfid.setPowerProfile(static_cast<RfidPowerProfile>(index));
+  }
+
+  RfidReader::Stats stats = rfid.stats();
+  const RfidPollProfile &profile = RFID_POLL_PROFILES[static_cast<size_t>(rfid.powerProfile())];
+  char text[224];
+  snprintf(text, sizeof(text),
+           "profile=%s interval=%lums low_power=%s; polls=%lu cards=%lu keepalives=%lu "
+           "removals=%lu dropped=%lu max_poll_gap=%.1fms",
+           profile.name, static_cast<unsigned long>(stats.intervalMs),
+           stats.lowPower ? "on" : "off", static_cast<unsigned long>(stats.polls),
+           static_cast<unsigned long>(stats.cards), static_cast<unsigned long>(stats.keepAlives),
+           static_cast<unsigned long>(stats.removals), static_cast<unsigned long>(stats.dropped),
+           stats.maxPollGapUs / 1000.0f);
+  message = text;
+  char line[96];
+  for (size_t i = 0; i < IRfidBackend::kStepCount; ++i) {
+    RfidStep step = static_cast<RfidStep>(i);
+    LatencyHistogram timing = rfid.stepTiming(step);
+    if (timing.count() == 0) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "; %s p50=%luus p95=%luus max=%luus", rfidStepName(step),
+             static_cast<unsigned long>(timing.percentile(50)),
+             static_cast<unsigned long>(timing.percentile(95)),
+             static_cast<unsigned long>(timing.maxUs()));
+    message += line;
+  }
+  if (payload["reset"] | false) {
+    rfid.resetStats();
+    message += "; counters reset";
+  }
+  Serial.printf("[RFID] %s\n", message.c_str());
+  return true;
+}
+
+static bool handleBackendHealth(JsonVariantConst, String &message) {
+  BackendClient::ResilienceStats health = backend.resilienceStats();
+  char text[320];
+  snprintf(text, sizeof(text),
+           "endpoint=%s (%u/%u healthy); breaker=%s opened=%lu; srtt=%lums rttvar=%lums "
+           "timeout=%lums; attempts=%lu retries=%lu failovers=%lu timeouts=%lu fast_failures=%lu",
+           health.endpoint[0] != '\0' ? health.endpoint : "(none)", health.endpointsHealthy,
+           health.endpointsKnown, CircuitBreaker::stateName(health.breakerState),
+           static_cast<unsigned long>(health.breakerOpenings), health.srttMs, health.rttvarMs,
+           health.timeoutMs, static_cast<unsigned long>(health.attempts),
+           static_cast<unsigned long>(health.retries), static_cast<unsigned long>(health.failovers),
+           static_cast<unsigned long>(health.timeouts),
+           static_cast<unsigned long>(health.fastFailures));
+  message = text;
+  return true;
+}
+#endif
+
 static void initializeMdns() {
   if (mdnsStarted) {
     return;
   }
 
-  resetMdnsQueryState();
-
   Serial.println("Initializing mDNS...");
   if (!MDNS.begin("nfc-jukebox")) {
     Serial.println("Error starting mDNS responder");
@@ -678,20 +1473,6 @@ static void initializeMdns() {
   mdnsStarted = true;
   Serial.println("mDNS responder started");
   Serial.println("ESP32 is now discoverable as nfc-jukebox.local");
-
-  String backendHost = String(BACKEND_HOST);
-  if (!backendHost.endsWith(".local")) {
-    mdnsQueryState = MdnsQueryState::NotRequired;
-    mdnsQueryStartedAt = 0;
-    mdnsQueryFinishedAt = 0;
-    return;
-  }
-
-  backendHost.replace(".local", "");
-  unsigned long now = millis();
-  if (!scheduleMdnsQueryTask(backendHost, now)) {
-    mdnsQueryFinishedAt = millis();
-  }
 }
 
 void setup() {
@@ -705,27 +1486,61 @@ void setup() {
   Serial.println("Jukebox NFC starting...");
   Serial.println("=================================");
 
+  // The resolver and backend worker tasks start idle and begin looking
+  // up and connecting to the backend once Wi-Fi is available. A hub
+  // satellite never talks to the backend itself.
+  bool satellite = HUB_ROLE == HubRole::Satellite;
+  if (!satellite) {
+    resolver.begin();
+    resolver.track(BACKEND_HOST);
+    if (BACKEND_DISCOVERY_ENABLED) {
+      resolver.browseService(BACKEND_SERVICE_NAME, BACKEND_SERVICE_PROTOCOL);
+    }
+  }
+  catalog.begin();
+  if (!satellite) {
+    backend.begin();
+  }
+
   Serial.println("Initializing LED strip...");
   unsigned long now = millis();
   effects.begin(now);
   setVisualState(VisualState::WifiConnecting, now);
 
-  // Connect to Wi-Fi
-  Serial.println("Starting Wi-Fi connection...");
-  bool wifiReady = wifi.begin();
-  if (wifiReady) {
-    Serial.println("Wi-Fi connected successfully!");
-    unsigned long connectedNow = millis();
-    updateWifiVisualState(true, connectedNow);
-    initializeMdns();
+  bool wifiReady = false;
+  if (satellite) {
+    // The radio stays in station mode without associating; taps go to
+    // the gateway over ESP-NOW.
+    Serial.println("Hub satellite: skipping Wi-Fi, looking for the gateway's channel...");
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
+    startHub(millis());
+    wifiReady = hubStarted;
+    updateWifiVisualState(wifiReady, millis());
   } else {
-    Serial.println("Wi-Fi connection in progress...");
+    // Connect to Wi-Fi
+    Serial.println("Starting Wi-Fi connection...");
+    wifiReady = wifi.begin();
+    if (wifiReady) {
+      Serial.println("Wi-Fi connected successfully!");
+      unsigned long connectedNow = millis();
+      updateWifiVisualState(true, connectedNow);
+      initializeMdns();
+      EventClock::begin();
+      resolver.setNetworkAvailable(true);
+    } else {
+      Serial.println("Wi-Fi connection in progress...");
+    }
+    // ESP-NOW shares the station interface and follows the access
+    // point's channel, so the gateway can listen before it associates.
+    startHub(millis());
   }
 
   wifiPreviouslyConnected = wifiReady;
 
   // Initialise NFC reader
   Serial.println("Initializing NFC reader...");
+  rfid.setEventListener(handleRfidCardEvent);
   rfid.begin();
   Serial.println("NFC reader initialization in progress");
 
@@ -739,6 +1554,39 @@ void setup() {
   debugServer.registerAction({"simulate_card",
                               "Simulate an NFC card scan with an arbitrary UID.",
                               handleSimulateCard});
+  debugServer.registerAction({"tap_latency",
+                              "Report tap latency percentiles per stage; {\"reset\": true} clears them.",
+                              handleTapLatency});
+  debugServer.registerAction({"backend_benchmark",
+                              "Time a burst of play requests, optionally per impairment profile.",
+                              handleBackendBenchmark});
+  debugServer.registerAction({"network_impairment",
+                              "Select a link impairment profile or set custom values.",
+                              handleNetworkImpairment});
+  debugServer.registerAction({"tap_transport",
+                              "Switch taps between HTTP and MQTT and report MQTT session counters.",
+                              handleTapTransport});
+  debugServer.registerAction({"payload_codec",
+                              "Compare JSON and CBOR payload sizes and encode/decode times.",
+                              handlePayloadCodec});
+  debugServer.registerAction({"event_clock",
+                              "Report wall clock sync state, drift estimate and last correction.",
+                              handleEventClock});
+  debugServer.registerAction({"tls_sessions",
+                              "Report TLS handshake timings and cached sessions; {\"clear\": true} drops them.",
+                              handleTlsSessions});
+  debugServer.registerAction({"hub_status",
+                              "Report hub relay counters and per-satellite round-trip times.",
+                              handleHubStatus});
+  debugServer.registerAction({"telemetry",
+                              "Report telemetry windows and upload counters; {\"flush\": true} uploads now.",
+                              handleTelemetry});
+  debugServer.registerAction({"rfid_status",
+                              "Report RFID task counters and read step timings; {\"profile\": name} switches the poll profile.",
+                              handleRfidStatus});
+  debugServer.registerAction({"backend_health",
+                              "Report the backend endpoint, circuit breaker, RTT estimate and retry counters.",
+                              handleBackendHealth});
   debugServer.begin();
   if (wifi.isConnected()) {
     debugServer.start();
@@ -753,31 +1601,44 @@ void setup() {
 }
 
 void loop() {
+  bool satellite = HUB_ROLE == HubRole::Satellite;
   // Maintain Wi-Fi connection
-  wifi.loop();
+  if (!satellite) {
+    wifi.loop();
+  }
 
   unsigned long now = millis();
 
-  rfid.begin();
+  serviceHub(now);
 
-  bool isConnected = wifi.isConnected();
-  if (isConnected && !wifiPreviouslyConnected) {
-    initializeMdns();
+  // A satellite is "connected" once its radio link is up.
+  bool isConnected = satellite ? hubStarted : wifi.isConnected();
+  if (satellite) {
+    updateWifiVisualState(isConnected, now);
+    wifiPreviouslyConnected = isConnected;
+  } else {
+    if (isConnected && !wifiPreviouslyConnected) {
+      initializeMdns();
+      EventClock::begin();
 #if ENABLE_DEBUG_ACTIONS
-    debugServer.start();
+      debugServer.start();
 #endif
-  } else if (!isConnected && wifiPreviouslyConnected) {
-    mdnsStarted = false;
-    resetMdnsQueryState();
-  }
-  updateWifiVisualState(isConnected, now);
-  wifiPreviouslyConnected = isConnected;
+    } else if (!isConnected && wifiPreviouslyConnected) {
+      mdnsStarted = false;
+      Telemetry::count(Telemetry::Counter::WifiDisconnects);
+    }
+    resolver.setNetworkAvailable(isConnected);
+    updateWifiVisualState(isConnected, now);
+    wifiPreviouslyConnected = isConnected;
 
-  otaUpdater.loop(now, isConnected);
+    backend.loop(now, isConnected);
+    otaUpdater.loop(now, isConnected);
+    Telemetry::loop(now, isConnected);
 
-  MdnsQueryUpdate mdnsUpdate;
-  if (fetchMdnsQueryUpdate(mdnsUpdate)) {
-    applyMdnsUpdateFeedback(mdnsUpdate, now);
+    HostResolver::Update mdnsUpdate;
+    if (backendUsesMdns() && resolver.fetchUpdate(BACKEND_HOST, mdnsUpdate)) {
+      applyMdnsUpdateFeedback(mdnsUpdate, now);
+    }
   }
 
 #if ENABLE_DEBUG_ACTIONS
@@ -787,29 +1648,46 @@ void loop() {
   // Print periodic status (every 10 seconds)
   if (now - lastDebugTime > 10000) {
     lastDebugTime = now;
-    Serial.printf("[DEBUG] Still running... WiFi: %s\n",
-                  isConnected ? "Connected" : "Disconnected");
-  }
-
-  // Try to read a card
-  String uid;
-  bool cardRead = false;
-  if (!VisualStateController::isCardFlowState(visualState.currentState())) {
-    cardRead = rfid.readCard(uid);
+    if (satellite) {
+      Serial.printf("[DEBUG] Still running... Hub: %s\n",
+                    !hubStarted ? "radio down"
+                    : hub.gatewayKnown() ? "gateway known" : "searching for gateway");
+    } else {
+      Serial.printf("[DEBUG] Still running... WiFi: %s\n",
+                    isConnected ? "Connected" : "Disconnected");
+    }
   }
 
-  if (cardRead) {
+  // Take the arrivals and removals the RFID task has seen. A card that
+  // stays on the reader arrives once, so every arrival is a tap, even
+  // one made while the last tap is still being shown.
+  RfidCardRead cardRead;
+  while (rfid.pollCard(cardRead)) {
+    if (cardRead.presence == RfidPresence::Removed) {
+      // Removals only matter to the backend; satellites do not relay them.
+      if (!satellite) {
+        backend.notifyCardRemoved(cardRead.uid, cardRead.presentMs);
+      }
+      continue;
+    }
     now = millis();
-    processCardUid(uid, now, false, true);
+    uint32_t traceId = ensureCurrentTrace();
+    if (cardRead.fieldDetectedAtUs != 0) {
+      tracer.markAt(traceId, TapTracer::Stage::FieldDetected, cardRead.fieldDetectedAtUs);
+    }
+    tracer.markAt(traceId, TapTracer::Stage::UidRead, cardRead.uidReadAtUs);
+    processCardUid(String(cardRead.uid), now, cardRead.readAt, true);
   }
 
-  bool success = false;
-  if (backend.pollResult(success)) {
+  BackendClient::Result backendResult;
+  while (!satellite && backend.pollResult(backendResult)) {
     now = millis();
-    handleBackendCompletion(success, now);
+    handleBackendCompletion(backendResult, now);
   }
+  finishFrameTrace();
 
   now = millis();
   refreshVisualState(now);
   effects.update(now);
+  finishFrameTrace();
 }
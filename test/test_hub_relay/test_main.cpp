@@ -0,0 +1,461 @@
+/*
+ * test_main.cpp
+ *
+ * Host tests for HubRelay over a simulated HubLink. Two or more relays
+ * share an in-memory "air" that delivers frames on the receiver's next
+ * loop() and can drop frames by type or at random, so acknowledgement,
+ * retransmission, the replay window and reboots can be exercised
+ * without radios. Run with `pio test -e native`.
+ */
+
+#include <unity.h>
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#include "HubRelay.h"
+
+namespace {
+constexpr uint8_t       kMaxAttempts = 6;
+constexpr unsigned long kMinAckTimeoutMs = 20;
+constexpr unsigned long kMaxAckTimeoutMs = 200;
+constexpr unsigned long kResultTimeoutMs = 2000;
+constexpr unsigned long kTickMs = 5;
+
+// Frame types on the wire (byte 2 of the header).
+constexpr uint8_t kTapFrame = 1;
+constexpr uint8_t kAckFrame = 2;
+constexpr uint8_t kResultFrame = 3;
+
+HubAddress addressOf(uint8_t last) {
+  HubAddress address;
+  address.bytes[0] = 0x02;
+  address.bytes[5] = last;
+  return address;
+}
+
+const HubAddress kSatellite = addressOf(1);
+const HubAddress kGateway = addressOf(2);
+
+class SimLink;
+
+/**
+ * Shared medium. Frames are queued for every attached link they are
+ * addressed to and dropped according to the current loss settings.
+ */
+class SimAir {
+public:
+  void attach(SimLink *link) { _links.push_back(link); }
+  void detach(SimLink *link);
+  void transmit(const HubAddress &from, const HubAddress &to, const uint8_t *data,
+                size_t length);
+
+  // Drop the next `count` frames of `type`.
+  void dropNext(uint8_t type, unsigned count) { _drops[type] += count; }
+
+  // Drop each frame with probability `percent`, from a fixed seed.
+  void setLossPercent(unsigned percent) { _lossPercent = percent; }
+
+  unsigned sent(uint8_t type) const { return _sent[type]; }
+
+private:
+  bool lose(uint8_t type);
+
+  std::vector<SimLink *> _links;
+  unsigned               _drops[4] = {0};
+  unsigned               _sent[4] = {0};
+  unsigned               _lossPercent = 0;
+  uint32_t               _seed = 12345;
+};
+
+class SimLink : public HubLink {
+public:
+  struct Frame {
+    HubAddress           from;
+    std::vector<uint8_t> data;
+  };
+
+  SimLink(SimAir &air, const HubAddress &address) : _air(air), _address(address) {
+    _air.attach(this);
+  }
+  ~SimLink() override { _air.detach(this); }
+
+  bool send(const HubAddress &to, const uint8_t *data, size_t length) override {
+    _air.transmit(_address, to, data, length);
+    return true;
+  }
+
+  bool receive(HubAddress &from, uint8_t *data, size_t &length) override {
+    if (_inbox.empty()) {
+      return false;
+    }
+    const Frame &frame = _inbox.front();
+    from = frame.from;
+    length = frame.data.size();
+    std::copy(frame.data.begin(), frame.data.end(), data);
+    _inbox.pop_front();
+    return true;
+  }
+
+  const HubAddress &address() const { return _address; }
+  void deliver(const HubAddress &from, const uint8_t *data, size_t length) {
+    _inbox.push_back(Frame{from, std::vector<uint8_t>(data, data + length)});
+  }
+
+private:
+  SimAir           &_air;
+  HubAddress        _address;
+  std::deque<Frame> _inbox;
+};
+
+void SimAir::detach(SimLink *link) {
+  for (auto it = _links.begin(); it != _links.end(); ++it) {
+    if (*it == link) {
+      _links.erase(it);
+      return;
+    }
+  }
+}
+
+void SimAir::transmit(const HubAddress &from, const HubAddress &to, const uint8_t *data,
+                      size_t length) {
+  uint8_t type = length > 2 && data[2] < 4 ? data[2] : 0;
+  _sent[type]++;
+  if (lose(type)) {
+    return;
+  }
+  for (SimLink *link : _links) {
+    if (link->address() != from && (to.isBroadcast() || link->address() == to)) {
+      link->deliver(from, data, length);
+    }
+  }
+}
+
+bool SimAir::lose(uint8_t type) {
+  if (_drops[type] > 0) {
+    _drops[type]--;
+    return true;
+  }
+  if (_lossPercent == 0) {
+    return false;
+  }
+  _seed = _seed * 1103515245u + 12345u;
+  return (_seed >> 16) % 100 < _lossPercent;
+}
+
+HubRelay makeRelay(SimLink &link) {
+  return HubRelay(link, kMaxAttempts, kMinAckTimeoutMs, kMaxAckTimeoutMs, kResultTimeoutMs);
+}
+
+/**
+ * Build a raw tap frame as a satellite would send it, for tests that
+ * need to choose the sequence numbers themselves.
+ */
+size_t tapFrame(uint8_t *out, uint16_t bootId, uint16_t seq, uint8_t uidByte) {
+  const uint8_t frame[] = {'M', 1, kTapFrame,
+                           static_cast<uint8_t>(bootId), static_cast<uint8_t>(bootId >> 8),
+                           static_cast<uint8_t>(seq), static_cast<uint8_t>(seq >> 8),
+                           0, 0, 0, 0,  // ageMs
+                           4, uidByte, 0x01, 0x02, 0x03};
+  std::copy(frame, frame + sizeof(frame), out);
+  return sizeof(frame);
+}
+
+void run(HubRelay &satellite, HubRelay &gateway, unsigned long &now, unsigned long forMs) {
+  for (unsigned long end = now + forMs; now < end; now += kTickMs) {
+    satellite.loop(now);
+    gateway.loop(now);
+  }
+}
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_tap_is_acknowledged_and_answered() {
+  SimAir air;
+  SimLink satelliteLink(air, kSatellite);
+  SimLink gatewayLink(air, kGateway);
+  HubRelay satellite = makeRelay(satelliteLink);
+  HubRelay gateway = makeRelay(gatewayLink);
+  satellite.begin(1, HubAddress());
+  gateway.begin(7, HubAddress());
+  unsigned long now = 1000;
+
+  uint32_t requestId = satellite.sendTap("04A1B2C3", 42, now - 30, now);
+  TEST_ASSERT_NOT_EQUAL(0, requestId);
+  run(satellite, gateway, now, 20);
+  TEST_ASSERT_TRUE(satellite.gatewayKnown());
+
+  HubRelay::Tap tap;
+  TEST_ASSERT_TRUE(gateway.pollTap(tap));
+  TEST_ASSERT_EQUAL_STRING("04A1B2C3", tap.uid);
+  TEST_ASSERT_EQUAL_UINT32(30, tap.ageMs);
+  TEST_ASSERT_FALSE(gateway.pollTap(tap));
+
+  TEST_ASSERT_TRUE(gateway.sendResult(tap, HubRelay::Status::Delivered, now));
+  run(satellite, gateway, now, 20);
+  HubRelay::Result result;
+  TEST_ASSERT_TRUE(satellite.pollResult(result));
+  TEST_ASSERT_EQUAL_UINT32(requestId, result.requestId);
+  TEST_ASSERT_EQUAL_UINT32(42, result.traceId);
+  TEST_ASSERT_TRUE(result.acknowledged);
+  TEST_ASSERT_TRUE(result.status == HubRelay::Status::Delivered);
+  TEST_ASSERT_EQUAL_UINT32(0, satellite.stats().retransmits);
+  TEST_ASSERT_EQUAL_UINT32(0, gateway.stats().retransmits);
+
+  // The broadcast tap was answered by the gateway, which is now the
+  // one peer and has an RTT sample.
+  HubRelay::PeerStats peer;
+  TEST_ASSERT_EQUAL(1, satellite.peerStats(&peer, 1));
+  TEST_ASSERT_TRUE(peer.address == kGateway);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, peer.lastRttMs);
+}
+
+void test_lost_tap_is_retransmitted() {
+  SimAir air;
+  SimLink satelliteLink(air, kSatellite);
+  SimLink gatewayLink(air, kGateway);
+  HubRelay satellite = makeRelay(satelliteLink);
+  HubRelay gateway = makeRelay(gatewayLink);
+  satellite.begin(1, kGateway);
+  gateway.begin(7, HubAddress());
+  unsigned long now = 1000;
+
+  air.dropNext(kTapFrame, 1);
+  satellite.sendTap("04A1B2C3", 1, now, now);
+  run(satellite, gateway, now, kMaxAckTimeoutMs - kTickMs);
+  HubRelay::Tap tap;
+  TEST_ASSERT_FALSE(gateway.pollTap(tap));
+
+  run(satellite, gateway, now, 2 * kTickMs);
+  TEST_ASSERT_TRUE(gateway.pollTap(tap));
+  TEST_ASSERT_EQUAL_UINT32(1, satellite.stats().retransmits);
+  TEST_ASSERT_EQUAL_UINT32(0, gateway.stats().duplicates);
+}
+
+void test_lost_ack_is_not_delivered_twice() {
+  SimAir air;
+  SimLink satelliteLink(air, kSatellite);
+  SimLink gatewayLink(air, kGateway);
+  HubRelay satellite = makeRelay(satelliteLink);
+  HubRelay gateway = makeRelay(gatewayLink);
+  satellite.begin(1, kGateway);
+  gateway.begin(7, HubAddress());
+  unsigned long now = 1000;
+
+  air.dropNext(kAckFrame, 2);
+  uint32_t requestId = satellite.sendTap("04A1B2C3", 1, now, now);
+  run(satellite, gateway, now, 4 * kMaxAckTimeoutMs);
+
+  // Three transmissions reached the gateway; only the first is a tap.
+  TEST_ASSERT_EQUAL_UINT32(2, satellite.stats().retransmits);
+  TEST_ASSERT_EQUAL_UINT32(2, gateway.stats().duplicates);
+  TEST_ASSERT_EQUAL_UINT32(1, gateway.stats().tapsRelayed);
+  HubRelay::Tap tap;
+  TEST_ASSERT_TRUE(gateway.pollTap(tap));
+  TEST_ASSERT_FALSE(gateway.pollTap(tap));
+
+  // Karn: the retransmitted tap gave no RTT sample.
+  HubRelay::PeerStats peer;
+  TEST_ASSERT_EQUAL(1, satellite.peerStats(&peer, 1));
+  TEST_ASSERT_EQUAL_UINT32(0, peer.lastRttMs);
+
+  // A lost result is retransmitted and only reported once.
+  air.dropNext(kResultFrame, 1);
+  gateway.sendResult(tap, HubRelay::Status::Delivered, now);
+  run(satellite, gateway, now, 4 * kMaxAckTimeoutMs);
+  HubRelay::Result result;
+  TEST_ASSERT_TRUE(satellite.pollResult(result));
+  TEST_ASSERT_EQUAL_UINT32(requestId, result.requestId);
+  TEST_ASSERT_FALSE(satellite.pollResult(result));
+  TEST_ASSERT_EQUAL_UINT32(1, gateway.stats().retransmits);
+}
+
+void test_replay_window() {
+  SimAir air;
+  SimLink satelliteLink(air, kSatellite);
+  SimLink gatewayLink(air, kGateway);
+  HubRelay gateway = makeRelay(gatewayLink);
+  gateway.begin(7, HubAddress());
+  unsigned long now = 1000;
+  uint8_t frame[HubLink::kMaxFrameLength];
+  HubRelay::Tap tap;
+
+  struct Step {
+    uint16_t seq;
+    bool     delivered;
+  };
+  const Step steps[] = {
+      {40, true},   // First frame from this boot sets the window.
+      {40, false},  // Exact duplicate.
+      {10, true},   // 30 behind: inside the window, not seen yet.
+      {10, false},  // ...and now seen.
+      {8, false},   // 32 behind: outside the window, treated as a replay.
+      {41, true},   // Slides the window by one.
+      {9, false},   // Now 32 behind as well.
+      {100, true},  // A jump larger than the window resets it.
+      {69, true},   // 31 behind the new highest.
+      {68, false},
+  };
+  for (const Step &step : steps) {
+    size_t length = tapFrame(frame, 1, step.seq, static_cast<uint8_t>(step.seq));
+    satelliteLink.send(kGateway, frame, length);
+    gateway.loop(now);
+    char message[32];
+    snprintf(message, sizeof(message), "seq %u", step.seq);
+    TEST_ASSERT_EQUAL_MESSAGE(step.delivered, gateway.pollTap(tap), message);
+    now += kTickMs;
+  }
+  // Every frame was acknowledged, duplicates included.
+  TEST_ASSERT_EQUAL_UINT32(sizeof(steps) / sizeof(steps[0]), air.sent(kAckFrame));
+}
+
+void test_reboot_starts_a_new_window() {
+  SimAir air;
+  SimLink gatewayLink(air, kGateway);
+  HubRelay gateway = makeRelay(gatewayLink);
+  gateway.begin(7, HubAddress());
+  unsigned long now = 1000;
+  HubRelay::Tap first;
+
+  {
+    SimLink satelliteLink(air, kSatellite);
+    HubRelay satellite = makeRelay(satelliteLink);
+    satellite.begin(1, kGateway);
+    satellite.sendTap("04A1B2C3", 1, now, now);
+    run(satellite, gateway, now, 20);
+    TEST_ASSERT_TRUE(gateway.pollTap(first));
+    TEST_ASSERT_EQUAL_UINT16(1, first.bootId);
+  }
+
+  // The satellite reboots with a new boot id and starts its sequence
+  // numbers over; its first tap is new, not a replay of the old one.
+  SimLink satelliteLink(air, kSatellite);
+  HubRelay satellite = makeRelay(satelliteLink);
+  satellite.begin(2, kGateway);
+  uint32_t requestId = satellite.sendTap("04D4E5F6", 2, now, now);
+  run(satellite, gateway, now, 20);
+  HubRelay::Tap second;
+  TEST_ASSERT_TRUE(gateway.pollTap(second));
+  TEST_ASSERT_EQUAL_UINT16(2, second.bootId);
+  TEST_ASSERT_EQUAL_UINT16(first.seq, second.seq);
+  TEST_ASSERT_EQUAL_STRING("04D4E5F6", second.uid);
+  TEST_ASSERT_EQUAL_UINT32(0, gateway.stats().duplicates);
+
+  // The result for the previous boot's tap must not complete the new
+  // boot's tap with the same sequence number.
+  gateway.sendResult(first, HubRelay::Status::Delivered, now);
+  run(satellite, gateway, now, 20);
+  HubRelay::Result result;
+  TEST_ASSERT_FALSE(satellite.pollResult(result));
+
+  gateway.sendResult(second, HubRelay::Status::Cancelled, now);
+  run(satellite, gateway, now, 20);
+  TEST_ASSERT_TRUE(satellite.pollResult(result));
+  TEST_ASSERT_EQUAL_UINT32(requestId, result.requestId);
+  TEST_ASSERT_TRUE(result.status == HubRelay::Status::Cancelled);
+}
+
+void test_unanswered_tap_fails_and_rediscovers() {
+  SimAir air;
+  SimLink satelliteLink(air, kSatellite);
+  SimLink gatewayLink(air, kGateway);
+  HubRelay satellite = makeRelay(satelliteLink);
+  HubRelay gateway = makeRelay(gatewayLink);
+  satellite.begin(1, HubAddress());
+  gateway.begin(7, HubAddress());
+  unsigned long now = 1000;
+
+  satellite.sendTap("04A1B2C3", 1, now, now);
+  run(satellite, gateway, now, 20);
+  TEST_ASSERT_TRUE(satellite.gatewayKnown());
+
+  // The gateway goes silent: every attempt at the next tap is lost.
+  air.dropNext(kTapFrame, kMaxAttempts);
+  uint32_t requestId = satellite.sendTap("04D4E5F6", 2, now, now);
+  run(satellite, gateway, now, kMaxAttempts * 16 * kMaxAckTimeoutMs);
+  HubRelay::Result result;
+  bool found = false;
+  while (satellite.pollResult(result)) {
+    if (result.requestId == requestId) {
+      found = true;
+      TEST_ASSERT_FALSE(result.acknowledged);
+      TEST_ASSERT_TRUE(result.status == HubRelay::Status::Failed);
+    }
+  }
+  TEST_ASSERT_TRUE(found);
+  TEST_ASSERT_EQUAL_UINT32(1, satellite.stats().undelivered);
+  TEST_ASSERT_FALSE(satellite.gatewayKnown());
+}
+
+void test_lossy_link_delivers_each_tap_once() {
+  SimAir air;
+  SimLink satelliteLink(air, kSatellite);
+  SimLink gatewayLink(air, kGateway);
+  HubRelay satellite = makeRelay(satelliteLink);
+  HubRelay gateway = makeRelay(gatewayLink);
+  satellite.begin(1, kGateway);
+  gateway.begin(7, HubAddress());
+  air.setLossPercent(30);
+  unsigned long now = 1000;
+
+  constexpr unsigned kTaps = 40;
+  unsigned relayed[kTaps] = {0};
+  std::deque<HubRelay::Tap> answers;
+  unsigned finished = 0;
+  unsigned delivered = 0;
+  unsigned sent = 0;
+  while (finished < kTaps) {
+    if (sent < kTaps) {
+      char uid[9];
+      snprintf(uid, sizeof(uid), "0400%04X", sent);
+      if (satellite.sendTap(uid, sent, now, now) != 0) {
+        sent++;
+      }
+    }
+    run(satellite, gateway, now, kTickMs);
+    HubRelay::Tap tap;
+    while (gateway.pollTap(tap)) {
+      unsigned index = 0;
+      sscanf(tap.uid + 4, "%4X", &index);
+      TEST_ASSERT_LESS_THAN_UINT32(kTaps, index);
+      relayed[index]++;
+      answers.push_back(tap);
+    }
+    // Results still waiting for acknowledgement can fill the gateway's
+    // outbox; hold the rest back until a slot frees up.
+    while (!answers.empty() &&
+           gateway.sendResult(answers.front(), HubRelay::Status::Delivered, now)) {
+      answers.pop_front();
+    }
+    HubRelay::Result result;
+    while (satellite.pollResult(result)) {
+      finished++;
+      if (result.status == HubRelay::Status::Delivered) {
+        delivered++;
+      }
+    }
+    TEST_ASSERT_LESS_THAN_UINT32(1000000, now);
+  }
+
+  for (unsigned i = 0; i < kTaps; ++i) {
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, relayed[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(kTaps, delivered);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, satellite.stats().retransmits);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, gateway.stats().duplicates);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_tap_is_acknowledged_and_answered);
+  RUN_TEST(test_lost_tap_is_retransmitted);
+  RUN_TEST(test_lost_ack_is_not_delivered_twice);
+  RUN_TEST(test_replay_window);
+  RUN_TEST(test_reboot_starts_a_new_window);
+  RUN_TEST(test_unanswered_tap_fails_and_rediscovers);
+  RUN_TEST(test_lossy_link_delivers_each_tap_once);
+  return UNITY_END();
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Creates a throwaway CA and a server certificate signed by it, for
+# running the stand-in with TLS:
+#
+#   tools/backend_standin/make_test_ca.sh /tmp/musicbee-tls musicbee.local 192.168.1.50
+#
+# Every name becomes a DNS subject alternative name; give the exact
+# SECRET_BACKEND_HOST the firmware connects to (mbedTLS compares it as
+# text, so an IP address works as long as it is listed verbatim). Keys
+# are ECDSA P-256, which the ESP32-S3 verifies much faster than RSA.
+#
+# Writes ca.pem, ca.key, server.pem, server.key, and ca_cert.h holding
+# the SECRET_BACKEND_CA_CERT definition to paste into include/secrets.h.
+set -e
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <output dir> <server name> [more names...]" >&2
+  exit 1
+fi
+out=$1
+shift
+
+mkdir -p "$out"
+san=""
+for name in "$@"; do
+  san="${san:+$san,}DNS:$name"
+done
+
+openssl ecparam -name prime256v1 -genkey -noout -out "$out/ca.key"
+openssl req -x509 -new -key "$out/ca.key" -sha256 -days 825 \
+  -subj "/CN=MusicBee test CA" -out "$out/ca.pem"
+
+openssl ecparam -name prime256v1 -genkey -noout -out "$out/server.key"
+openssl req -new -key "$out/server.key" -subj "/CN=$1" -out "$out/server.csr"
+printf 'subjectAltName=%s\nextendedKeyUsage=serverAuth\n' "$san" > "$out/server.ext"
+openssl x509 -req -in "$out/server.csr" -CA "$out/ca.pem" -CAkey "$out/ca.key" \
+  -CAcreateserial -days 825 -sha256 -extfile "$out/server.ext" -out "$out/server.pem"
+rm -f "$out/server.csr" "$out/server.ext"
+
+{
+  echo '#define SECRET_BACKEND_CA_CERT \'
+  sed 's/.*/  "&\\n" \\/' "$out/ca.pem"
+  echo '  ""'
+} > "$out/ca_cert.h"
+
+echo "CA: $out/ca.pem; server certificate for $*: $out/server.pem"
+echo "Paste $out/ca_cert.h into include/secrets.h."
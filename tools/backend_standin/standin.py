@@ -0,0 +1,626 @@
+#!/usr/bin/env python3
+"""
+Stand-in for the MusicBee backend, used to benchmark BackendClient and
+OtaUpdater on a desk without the real service.
+
+It speaks just enough HTTP/1.1 to serve the endpoints the firmware uses:
+
+  POST /api/v1/cards/{uid}/play
+  POST /api/v1/cards/{uid}/prepare
+  POST /api/v1/cards/{uid}/removed
+  GET  /api/v1/cards/catalog?since=N
+  GET  /api/v1/firmware/manifest.json
+  GET  /api/v1/firmware/firmware.bin
+  POST /api/v1/devices/{id}/telemetry
+
+Play bodies and manifests are also spoken in CBOR when the firmware
+asks for it through Content-Type/Accept, unless the scenario sets
+"accept_cbor": false, in which case CBOR play requests get 415.
+
+How each route responds is scriptable: latency and jitter, injected
+errors, dropped or hung connections, chunked encoding, keep-alive
+limits and slow-drip bodies. Behaviour comes from a JSON scenario file
+and can be changed while the server runs through the control endpoints
+under /_standin/. Every request is timed and can be appended to a JSON
+Lines log; a per-route latency summary is printed on exit.
+
+With --tls-cert and --tls-key the server speaks TLS 1.2 and records
+whether each connection resumed an earlier session, which is how the
+firmware's session cache is checked (see make_test_ca.sh).
+
+Only the Python standard library is needed. See README.md for details.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import signal
+import ssl
+import sys
+import time
+from dataclasses import dataclass, field, fields, replace
+from urllib.parse import parse_qs, urlsplit
+
+API_PREFIX = "/api/v1"
+CBOR = "application/cbor"
+TELEMETRY_WINDOWS_KEPT = 100  # per device, for /_standin/telemetry
+ROUTES = ("play", "prepare", "removed", "catalog", "manifest", "firmware", "telemetry", "other")
+
+
+@dataclass
+class Behaviour:
+    """How a route answers. Rates are probabilities between 0 and 1."""
+
+    latency_ms: float = 0.0         # delay before the status line
+    jitter_ms: float = 0.0          # uniform extra delay in [0, jitter_ms]
+    error_rate: float = 0.0         # answer with error_status instead
+    error_status: int = 503
+    drop_rate: float = 0.0          # close the connection without answering
+    hang_rate: float = 0.0          # never answer; the client has to time out
+    status: int = 0                 # force a status (0 = route default)
+    chunked: bool = False           # Transfer-Encoding: chunked
+    chunk_size: int = 256
+    keep_alive: bool = True
+    max_requests_per_connection: int = 0  # 0 = unlimited
+    drip_bytes: int = 0             # write the response in pieces this big...
+    drip_interval_ms: float = 0.0   # ...with this pause between them
+
+    def merged(self, overrides):
+        known = {f.name for f in fields(self)}
+        unknown = set(overrides) - known
+        if unknown:
+            raise ValueError(f"unknown behaviour keys: {', '.join(sorted(unknown))}")
+        return replace(self, **overrides)
+
+
+def cbor_encode(value):
+    """Encodes the few types the stand-in sends (dict, str, bytes, bool, int >= 0)."""
+    def head(major, n):
+        if n < 24:
+            return bytes([major << 5 | n])
+        for extra, info in ((1, 24), (2, 25), (4, 26), (8, 27)):
+            if n < 1 << (8 * extra):
+                return bytes([major << 5 | info]) + n.to_bytes(extra, "big")
+        raise ValueError("integer too large")
+    if isinstance(value, bool):
+        return bytes([0xF5 if value else 0xF4])
+    if isinstance(value, int):
+        return head(0, value)
+    if isinstance(value, bytes):
+        return head(2, len(value)) + value
+    if isinstance(value, str):
+        data = value.encode()
+        return head(3, len(data)) + data
+    if isinstance(value, dict):
+        return head(5, len(value)) + b"".join(cbor_encode(k) + cbor_encode(v)
+                                               for k, v in value.items())
+    raise ValueError(f"cannot encode {type(value).__name__}")
+
+
+def cbor_decode(data):
+    """Decodes one definite-length CBOR item; raises ValueError if malformed."""
+    def item(offset):
+        if offset >= len(data):
+            raise ValueError("truncated CBOR")
+        major, info = data[offset] >> 5, data[offset] & 0x1F
+        offset += 1
+        if info < 24:
+            n = info
+        elif info <= 27:
+            size = 1 << (info - 24)
+            if offset + size > len(data):
+                raise ValueError("truncated CBOR")
+            n = int.from_bytes(data[offset:offset + size], "big")
+            offset += size
+        else:
+            raise ValueError("indefinite or reserved CBOR length")
+        if major == 0:
+            return n, offset
+        if major == 1:
+            return -1 - n, offset
+        if major in (2, 3):
+            if offset + n > len(data):
+                raise ValueError("truncated CBOR")
+            chunk = data[offset:offset + n]
+            return (chunk if major == 2 else chunk.decode()), offset + n
+        if major == 4:
+            items = []
+            for _ in range(n):
+                value, offset = item(offset)
+                items.append(value)
+            return items, offset
+        if major == 5:
+            result = {}
+            for _ in range(n):
+                key, offset = item(offset)
+                result[key], offset = item(offset)
+            return result, offset
+        if major == 7 and info in (20, 21):
+            return info == 21, offset
+        raise ValueError(f"unsupported CBOR major type {major}")
+    value, end = item(0)
+    if end != len(data):
+        raise ValueError("trailing bytes after CBOR item")
+    return value
+
+
+def int_or_zero(value):
+    try:
+        return int(value or 0)
+    except (TypeError, ValueError):
+        return 0
+
+
+@dataclass
+class RequestRecord:
+    at: float
+    connection: int
+    sequence: int
+    method: str
+    path: str
+    route: str
+    status: int = 0
+    outcome: str = "ok"
+    idempotency_key: str = ""
+    trace_id: str = ""
+    body_format: str = ""           # "cbor" for CBOR play bodies
+    tls: str = ""                   # "full" or "resumed" handshake, "" without TLS
+    captured_us: int = 0            # reader's wall-clock read time, 0 if unsynced
+    capture_age_ms: float = 0.0     # card read to request arrival, on wall clocks
+    ttfb_ms: float = 0.0            # end of request to first response byte
+    total_ms: float = 0.0           # end of request to last response byte
+    response_bytes: int = 0
+
+
+@dataclass
+class Catalog:
+    version: int = 1
+    cards: dict = field(default_factory=dict)  # uid -> colour ("" for none)
+    history: list = field(default_factory=list)  # (version, op, uid, colour)
+
+    def apply(self, upsert, remove):
+        self.version += 1
+        for uid, colour in upsert.items():
+            uid = uid.upper()
+            self.cards[uid] = colour or ""
+            self.history.append((self.version, "+", uid, colour or ""))
+        for uid in remove:
+            uid = uid.upper()
+            self.cards.pop(uid, None)
+            self.history.append((self.version, "-", uid, ""))
+
+    def render(self, since):
+        """Body for a sync request, or None when `since` is current."""
+        if since == self.version:
+            return None
+        oldest = self.history[0][0] if self.history else self.version + 1
+        if since <= 0 or since > self.version or since < oldest - 1:
+            lines = [f"catalog {self.version} full"]
+            lines += [f"+ {uid} {colour}".rstrip() for uid, colour in sorted(self.cards.items())]
+        else:
+            lines = [f"catalog {self.version} delta"]
+            for version, op, uid, colour in self.history:
+                if version > since:
+                    lines.append(f"{op} {uid} {colour}".rstrip())
+        return ("\n".join(lines) + "\n").encode()
+
+
+class StandIn:
+    def __init__(self, scenario, firmware, log_path, quiet):
+        self.default = Behaviour()
+        self.routes = {}
+        self.rng = random.Random()
+        self.catalog = Catalog()
+        self.firmware_version = "0.0.0"
+        self.accept_cbor = True
+        self.firmware = firmware
+        self.records = []
+        self.seen_keys = {}
+        self.connections = 0
+        self.connection_tls = {}
+        self.tls_handshakes = {"full": 0, "resumed": 0}
+        self.telemetry = {}
+        self.quiet = quiet
+        self.log = open(log_path, "a", encoding="utf-8") if log_path else None
+        self.load_scenario(scenario)
+
+    # -- configuration -------------------------------------------------
+
+    def load_scenario(self, scenario):
+        self.rng.seed(scenario.get("seed", 1))
+        self.default = Behaviour().merged(scenario.get("default", {}))
+        self.routes = {}
+        for route, overrides in scenario.get("routes", {}).items():
+            if route not in ROUTES:
+                raise ValueError(f"unknown route '{route}' (expected one of {', '.join(ROUTES)})")
+            self.routes[route] = self.default.merged(overrides)
+        catalog = scenario.get("catalog", {})
+        self.catalog = Catalog(version=catalog.get("version", 1),
+                               cards={uid.upper(): colour for uid, colour in
+                                      catalog.get("cards", {}).items()})
+        self.firmware_version = scenario.get("firmware_version", self.firmware_version)
+        self.accept_cbor = scenario.get("accept_cbor", True)
+        if "firmware_size" in scenario and self.firmware is None:
+            # Not a valid image: the download is timed, the install fails.
+            self.firmware = bytes(self.rng.getrandbits(8) for _ in range(scenario["firmware_size"]))
+
+    def behaviour(self, route):
+        return self.routes.get(route, self.default)
+
+    # -- connection handling -------------------------------------------
+
+    async def handle_connection(self, reader, writer):
+        self.connections += 1
+        connection = self.connections
+        # asyncio finishes the TLS handshake before calling us.
+        ssl_object = writer.get_extra_info("ssl_object")
+        if ssl_object is not None:
+            tls = "resumed" if ssl_object.session_reused else "full"
+            self.connection_tls[connection] = tls
+            self.tls_handshakes[tls] += 1
+            if not self.quiet:
+                print(f"#{connection} TLS {tls} handshake ({ssl_object.version()})")
+        sequence = 0
+        try:
+            while True:
+                request = await self.read_request(reader)
+                if request is None:
+                    break
+                sequence += 1
+                keep_open = await self.serve(connection, sequence, request, reader, writer)
+                if not keep_open:
+                    break
+        except (ConnectionError, ssl.SSLError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            writer.close()
+            try:
+                await writer.wait_closed()
+            except (ConnectionError, ssl.SSLError):
+                pass
+
+    async def read_request(self, reader):
+        try:
+            request_line = await reader.readline()
+        except ConnectionError:
+            return None
+        if not request_line:
+            return None
+        parts = request_line.decode("latin-1").strip().split(" ")
+        if len(parts) != 3:
+            return None
+        method, target, _version = parts
+        headers = {}
+        while True:
+            line = await reader.readline()
+            if not line or line in (b"\r\n", b"\n"):
+                break
+            name, _, value = line.decode("latin-1").partition(":")
+            headers[name.strip().lower()] = value.strip()
+        body = b""
+        length = int(headers.get("content-length", "0") or 0)
+        if length > 0:
+            body = await reader.readexactly(length)
+        return method, target, headers, body, time.perf_counter()
+
+    async def serve(self, connection, sequence, request, reader, writer):
+        method, target, headers, body, received_at = request
+        url = urlsplit(target)
+        path = url.path
+
+        if path.startswith("/_standin/"):
+            status, content_type, payload = self.control(method, path, body)
+            await self.write_response(writer, status, content_type, payload, Behaviour(),
+                                      keep_alive=True)
+            return True
+
+        route, default_status, content_type, payload = self.route(method, path, url.query,
+                                                                  headers, body)
+        behaviour = self.behaviour(route)
+        record = RequestRecord(at=time.time(), connection=connection, sequence=sequence,
+                               method=method, path=path, route=route,
+                               idempotency_key=headers.get("idempotency-key", ""),
+                               trace_id=headers.get("x-trace-id", ""),
+                               captured_us=int_or_zero(headers.get("x-captured-at")),
+                               tls=self.connection_tls.get(connection, ""))
+        if headers.get("content-type", "").startswith(CBOR) and body:
+            record.body_format = "cbor"
+            try:
+                tap = cbor_decode(body)
+                record.trace_id = str(tap.get("trace", ""))
+                record.captured_us = int_or_zero(tap.get("captured_us"))
+            except (ValueError, AttributeError):
+                record.body_format = "cbor (malformed)"
+        if record.captured_us > 0:
+            record.capture_age_ms = round(record.at * 1000.0 - record.captured_us / 1000.0, 1)
+
+        delay = behaviour.latency_ms + self.rng.uniform(0, behaviour.jitter_ms)
+        roll = self.rng.random()
+        if roll < behaviour.hang_rate:
+            record.outcome = "hung"
+            self.finish(record)
+            # Hold the connection until the client gives up.
+            await reader.read()
+            return False
+        if delay > 0:
+            await asyncio.sleep(delay / 1000.0)
+        if roll < behaviour.hang_rate + behaviour.drop_rate:
+            record.outcome = "dropped"
+            record.total_ms = (time.perf_counter() - received_at) * 1000.0
+            self.finish(record)
+            return False
+
+        status = behaviour.status or default_status
+        if roll < behaviour.hang_rate + behaviour.drop_rate + behaviour.error_rate:
+            status = behaviour.error_status
+            content_type, payload = "application/json", b'{"error":"injected"}'
+            record.outcome = "error"
+
+        keep_alive = (behaviour.keep_alive and headers.get("connection", "").lower() != "close"
+                      and (behaviour.max_requests_per_connection == 0
+                           or sequence < behaviour.max_requests_per_connection))
+        first_byte_at, written = await self.write_response(writer, status, content_type, payload,
+                                                           behaviour, keep_alive)
+        done_at = time.perf_counter()
+        record.status = status
+        record.ttfb_ms = (first_byte_at - received_at) * 1000.0
+        record.total_ms = (done_at - received_at) * 1000.0
+        record.response_bytes = written
+        self.finish(record)
+        return keep_alive
+
+    def route(self, method, path, query, headers, body=b""):
+        """Returns (route, status, content type, body) for a request."""
+        if path.startswith(API_PREFIX + "/cards/") and method == "POST":
+            uid = path[len(API_PREFIX + "/cards/"):].rsplit("/", 1)[0]
+            if path.endswith("/play"):
+                if headers.get("content-type", "").startswith(CBOR) and not self.accept_cbor:
+                    return "play", 415, "text/plain", b"CBOR not supported\n"
+                key = headers.get("idempotency-key", "")
+                duplicate = bool(key) and key in self.seen_keys
+                if key:
+                    self.seen_keys[key] = self.seen_keys.get(key, 0) + 1
+                return ("play", 200) + self.encode(headers, {"uid": uid, "playing": True,
+                                                             "duplicate": duplicate})
+            if path.endswith("/prepare"):
+                return "prepare", 202, "application/json", b"{}"
+            if path.endswith("/removed"):
+                return "removed", 204, "text/plain", b""
+        if path == API_PREFIX + "/cards/catalog" and method == "GET":
+            since = int(parse_qs(query).get("since", ["0"])[0] or 0)
+            body = self.catalog.render(since)
+            if body is None:
+                return "catalog", 304, "text/plain", b""
+            return "catalog", 200, "text/plain", body
+        if path == API_PREFIX + "/firmware/manifest.json" and method == "GET":
+            manifest = {"version": self.firmware_version,
+                        "firmware_url": API_PREFIX + "/firmware/firmware.bin"}
+            return ("manifest", 200) + self.encode(headers, manifest)
+        if path == API_PREFIX + "/firmware/firmware.bin" and method == "GET":
+            if self.firmware is None:
+                return "firmware", 404, "text/plain", b"no firmware image loaded\n"
+            return "firmware", 200, "application/octet-stream", self.firmware
+        if (path.startswith(API_PREFIX + "/devices/") and path.endswith("/telemetry")
+                and method == "POST"):
+            try:
+                batch = json.loads(body or b"{}")
+            except ValueError:
+                return "telemetry", 400, "text/plain", b"malformed batch\n"
+            self.store_telemetry(batch)
+            return "telemetry", 204, "text/plain", b""
+        return "other", 404, "text/plain", b"not found\n"
+
+    def store_telemetry(self, batch):
+        """Keeps the windows of a batch per device, skipping ones already seen."""
+        device = self.telemetry.setdefault(str(batch.get("device", "")),
+                                           {"boot": None, "last_seq": 0, "batches": 0,
+                                            "windows": [], "repeated_windows": 0})
+        if device["boot"] != batch.get("boot"):
+            device["boot"] = batch.get("boot")
+            device["last_seq"] = 0
+        device["batches"] += 1
+        device["dropped"] = batch.get("dropped", 0)
+        device["fw"] = batch.get("fw", "")
+        for window in batch.get("windows", []):
+            # A batch is sent again when its answer was lost.
+            if window.get("seq", 0) <= device["last_seq"]:
+                device["repeated_windows"] += 1
+                continue
+            device["last_seq"] = window.get("seq", 0)
+            device["windows"].append(window)
+            if not self.quiet:
+                print(f"  telemetry {batch.get('device')} window #{window.get('seq')}: "
+                      f"{window.get('counters', {})} rssi {window.get('rssi', {})}")
+        del device["windows"][:-TELEMETRY_WINDOWS_KEPT]
+
+    def encode(self, headers, value):
+        """(content type, body) in CBOR if the client accepts it, else JSON."""
+        if self.accept_cbor and CBOR in headers.get("accept", ""):
+            return CBOR, cbor_encode(value)
+        return "application/json", json.dumps(value).encode()
+
+    async def write_response(self, writer, status, content_type, payload, behaviour, keep_alive):
+        reason = {200: "OK", 202: "Accepted", 204: "No Content", 304: "Not Modified", 404: "Not Found",
+                  415: "Unsupported Media Type",
+                  500: "Internal Server Error", 503: "Service Unavailable"}.get(status, "Status")
+        head = [f"HTTP/1.1 {status} {reason}", f"Content-Type: {content_type}",
+                f"Connection: {'keep-alive' if keep_alive else 'close'}"]
+        if status == 304:
+            body = b""
+        elif behaviour.chunked:
+            head.append("Transfer-Encoding: chunked")
+            body = b""
+            for offset in range(0, len(payload), max(1, behaviour.chunk_size)):
+                piece = payload[offset:offset + max(1, behaviour.chunk_size)]
+                body += f"{len(piece):X}\r\n".encode() + piece + b"\r\n"
+            body += b"0\r\n\r\n"
+        else:
+            head.append(f"Content-Length: {len(payload)}")
+            body = payload
+        data = ("\r\n".join(head) + "\r\n\r\n").encode() + body
+
+        first_byte_at = time.perf_counter()
+        if behaviour.drip_bytes > 0:
+            for offset in range(0, len(data), behaviour.drip_bytes):
+                writer.write(data[offset:offset + behaviour.drip_bytes])
+                await writer.drain()
+                if offset == 0:
+                    first_byte_at = time.perf_counter()
+                if offset + behaviour.drip_bytes < len(data):
+                    await asyncio.sleep(behaviour.drip_interval_ms / 1000.0)
+        else:
+            writer.write(data)
+            await writer.drain()
+        return first_byte_at, len(data)
+
+    # -- control endpoints ---------------------------------------------
+
+    def control(self, method, path, body):
+        try:
+            payload = json.loads(body or b"{}")
+            if path == "/_standin/stats" and method == "GET":
+                return 200, "application/json", json.dumps(self.summary(), indent=2).encode()
+            if path == "/_standin/telemetry" and method == "GET":
+                return 200, "application/json", json.dumps(self.telemetry, indent=2).encode()
+            if path == "/_standin/reset" and method == "POST":
+                self.records.clear()
+                self.seen_keys.clear()
+                self.tls_handshakes = {"full": 0, "resumed": 0}
+                self.telemetry.clear()
+                return 200, "application/json", b'{"ok":true}'
+            if path == "/_standin/behaviour" and method == "POST":
+                # {"default": {...}, "routes": {"play": {...}}} merged into
+                # the current behaviour.
+                self.default = self.default.merged(payload.get("default", {}))
+                for route, overrides in payload.get("routes", {}).items():
+                    if route not in ROUTES:
+                        raise ValueError(f"unknown route '{route}'")
+                    self.routes[route] = self.behaviour(route).merged(overrides)
+                return 200, "application/json", b'{"ok":true}'
+            if path == "/_standin/catalog" and method == "POST":
+                self.catalog.apply(payload.get("upsert", {}), payload.get("remove", []))
+                body = json.dumps({"version": self.catalog.version})
+                return 200, "application/json", body.encode()
+        except (ValueError, TypeError) as error:
+            return 400, "application/json", json.dumps({"error": str(error)}).encode()
+        return 404, "text/plain", b"unknown control endpoint\n"
+
+    # -- recording -----------------------------------------------------
+
+    def finish(self, record):
+        self.records.append(record)
+        if self.log:
+            self.log.write(json.dumps(record.__dict__) + "\n")
+            self.log.flush()
+        if not self.quiet:
+            print(f"#{record.connection}.{record.sequence} {record.method} {record.path} "
+                  f"-> {record.status or record.outcome} ttfb {record.ttfb_ms:.1f}ms "
+                  f"total {record.total_ms:.1f}ms"
+                  + (f" key {record.idempotency_key}" if record.idempotency_key else ""))
+
+    def summary(self):
+        routes = {}
+        for route in ROUTES:
+            records = [r for r in self.records if r.route == route]
+            if not records:
+                continue
+            totals = sorted(r.total_ms for r in records if r.outcome in ("ok", "error"))
+            outcomes = {}
+            for r in records:
+                key = str(r.status) if r.outcome in ("ok", "error") else r.outcome
+                outcomes[key] = outcomes.get(key, 0) + 1
+            routes[route] = {
+                "requests": len(records),
+                "outcomes": outcomes,
+                "p50_ms": percentile(totals, 50),
+                "p95_ms": percentile(totals, 95),
+                "p99_ms": percentile(totals, 99),
+                "max_ms": round(totals[-1], 2) if totals else 0.0,
+            }
+        connections = {r.connection for r in self.records}
+        return {
+            "requests": len(self.records),
+            "connections": len(connections),
+            "requests_per_connection": round(len(self.records) / len(connections), 2)
+            if connections else 0.0,
+            "duplicate_play_keys": sum(1 for count in self.seen_keys.values() if count > 1),
+            "tls_handshakes": dict(self.tls_handshakes),
+            "routes": routes,
+        }
+
+
+def percentile(values, percent):
+    if not values:
+        return 0.0
+    rank = max(1, round(percent / 100.0 * len(values)))
+    return round(values[min(rank, len(values)) - 1], 2)
+
+
+def print_summary(summary):
+    print(f"\n{summary['requests']} request(s) on {summary['connections']} connection(s), "
+          f"{summary['requests_per_connection']} per connection, "
+          f"{summary['duplicate_play_keys']} duplicate play key(s)")
+    tls = summary["tls_handshakes"]
+    if tls["full"] or tls["resumed"]:
+        print(f"TLS handshakes: {tls['full']} full, {tls['resumed']} resumed")
+    print(f"{'route':<10} {'n':>6} {'p50':>8} {'p95':>8} {'p99':>8} {'max':>8}  outcomes")
+    for route, stats in summary["routes"].items():
+        print(f"{route:<10} {stats['requests']:>6} {stats['p50_ms']:>8.1f} {stats['p95_ms']:>8.1f} "
+              f"{stats['p99_ms']:>8.1f} {stats['max_ms']:>8.1f}  {stats['outcomes']}")
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=3000)
+    parser.add_argument("--scenario", help="JSON scenario file (see scenarios/)")
+    parser.add_argument("--firmware", help="firmware image served for OTA downloads")
+    parser.add_argument("--log", help="append one JSON line per request to this file")
+    parser.add_argument("--quiet", action="store_true", help="do not print every request")
+    parser.add_argument("--tls-cert", help="PEM server certificate (chain); enables TLS")
+    parser.add_argument("--tls-key", help="PEM private key for --tls-cert")
+    args = parser.parse_args()
+    if bool(args.tls_cert) != bool(args.tls_key):
+        parser.error("--tls-cert and --tls-key go together")
+
+    scenario = {}
+    if args.scenario:
+        with open(args.scenario, encoding="utf-8") as handle:
+            scenario = json.load(handle)
+    firmware = None
+    if args.firmware:
+        with open(args.firmware, "rb") as handle:
+            firmware = handle.read()
+
+    standin = StandIn(scenario, firmware, args.log, args.quiet)
+    context = None
+    if args.tls_cert:
+        # TLS 1.2 like the firmware; OpenSSL resumes both session IDs and
+        # tickets by default.
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.maximum_version = ssl.TLSVersion.TLSv1_2
+        context.load_cert_chain(args.tls_cert, args.tls_key)
+    server = await asyncio.start_server(standin.handle_connection, args.host, args.port,
+                                        ssl=context)
+    print(f"Backend stand-in listening on {args.host}:{args.port}"
+          + (" with TLS" if context else "")
+          + (f" with scenario {args.scenario}" if args.scenario else ""))
+
+    stop = asyncio.Event()
+    loop = asyncio.get_running_loop()
+    for signum in (signal.SIGINT, signal.SIGTERM):
+        try:
+            loop.add_signal_handler(signum, stop.set)
+        except NotImplementedError:
+            pass
+    async with server:
+        await stop.wait()
+    print_summary(standin.summary())
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        sys.exit(0)
@@ -0,0 +1,771 @@
+#!/usr/bin/env python3
+"""
+Fleet simulator: many readers against one backend, on a virtual clock.
+
+Each simulated device follows the firmware's request scheduling: the
+backend worker's play requests with retries, full-jitter backoff,
+adaptive timeouts and the circuit breaker; the tap journal and its
+replay; card catalog syncs; and OTA manifest checks followed by a
+firmware download and reboot when a release is published. Timing
+constants are read from include/Config.h so the simulation follows the
+firmware configuration.
+
+The backend is a pool of workers with a bounded queue (503 once the
+queue is full) plus an uplink shared by the firmware downloads. The run
+reports per-route request-rate peaks, client-observed latency
+percentiles, tap delivery outcomes and OTA concurrency, so scheduling
+changes can be compared with --compare (as configured vs. no jitter).
+
+Only the Python standard library is needed. --parity also needs a C++
+compiler: it builds the firmware's RttEstimator, CircuitBreaker and
+CheckSchedule on the host (tools/fleet_sim/parity.cpp) and checks the
+models below against them. See README.md for details.
+"""
+
+import argparse
+import heapq
+import math
+import random
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+from collections import defaultdict
+from pathlib import Path
+
+REPO_PATH = Path(__file__).resolve().parents[2]
+CONFIG_PATH = REPO_PATH / "include" / "Config.h"
+ROUTES = ("play", "prepare", "catalog", "manifest", "firmware")
+JITTER_KEYS = ("CARD_CATALOG_SYNC_JITTER_MS", "OTA_FIRST_CHECK_SPREAD_MS", "OTA_CHECK_JITTER_MS")
+
+
+def load_config(path):
+    """Numeric and boolean `static constexpr` constants from Config.h."""
+    text = re.sub(r"//[^\n]*", "", Path(path).read_text(encoding="utf-8"))
+    config = {}
+    for name, expr in re.findall(r"static\s+constexpr\s+[\w\s:*]+?\b([A-Z][A-Z0-9_]+)\s*=\s*([^;]+);",
+                                 text):
+        expr = expr.strip()
+        if expr in ("true", "false"):
+            config[name] = expr == "true"
+            continue
+        expr = re.sub(r"(\d)(?:UL|ULL|U|L)\b", r"\1", expr)
+        if re.fullmatch(r"[\d\s*+\-/()]+", expr):
+            config[name] = int(eval(expr, {"__builtins__": {}}))  # digits and operators only
+    return config
+
+
+# -- statistics ----------------------------------------------------------
+
+
+def percentile(sorted_values, percent):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, max(0, math.ceil(percent / 100 * len(sorted_values)) - 1))
+    return sorted_values[index]
+
+
+class Stats:
+    def __init__(self):
+        self.arrivals = defaultdict(lambda: defaultdict(int))  # route -> second -> count
+        self.latency = defaultdict(list)                         # route -> ms (answered)
+        self.errors = defaultdict(int)
+        self.timeouts = defaultdict(int)
+        self.taps = defaultdict(int)
+        self.breaker_opens = 0
+        self.downloads_active = 0
+        self.downloads_peak = 0
+        self.downloads_peak_at = 0
+        self.updated = 0
+        self.last_update_at = 0
+        self.queue_peak = 0
+
+    def arrival(self, route, now):
+        self.arrivals[route][int(now // 1000)] += 1
+
+
+# -- backend ------------------------------------------------------------
+
+
+class Backend:
+    """Worker pool with a bounded queue plus a shared download uplink."""
+
+    def __init__(self, sim, args):
+        self.sim = sim
+        self.args = args
+        self.busy = 0
+        self.queue = []
+        self.downloads = {}          # id -> [remaining bytes, on_done]
+        self.download_version = 0
+        self.download_clock = 0
+        self.next_download = 0
+
+    def rtt(self):
+        return self.args.network_rtt_ms * (0.5 + self.sim.rng.random())
+
+    def service_ms(self, route):
+        median = {"play": self.args.play_ms, "prepare": self.args.prepare_ms,
+                  "catalog": self.args.catalog_ms, "manifest": self.args.manifest_ms}[route]
+        return median * math.exp(self.sim.rng.gauss(0, self.args.service_sigma))
+
+    def submit(self, route, on_response):
+        """Deliver one request; on_response(status) fires when the answer arrives."""
+        sim = self.sim
+        sim.stats.arrival(route, sim.now)
+        half_rtt = self.rtt() / 2
+
+        def arrive():
+            if self.busy < self.args.workers:
+                self.start(route, half_rtt, on_response)
+            elif len(self.queue) < self.args.queue_limit:
+                self.queue.append((route, half_rtt, on_response))
+                sim.stats.queue_peak = max(sim.stats.queue_peak, len(self.queue))
+            else:
+                sim.after(half_rtt, lambda: on_response(503))
+
+        sim.after(half_rtt, arrive)
+
+    def start(self, route, half_rtt, on_response):
+        self.busy += 1
+
+        def done():
+            self.busy -= 1
+            if self.queue:
+                self.start(*self.queue.pop(0))
+            self.sim.after(half_rtt, lambda: on_response(200))
+
+        self.sim.after(self.service_ms(route), done)
+
+    # Downloads share the uplink equally, each capped at the client's
+    # own throughput.
+    def download(self, size_bytes, on_done):
+        self.sim.stats.arrival("firmware", self.sim.now)
+        self.advance_downloads()
+        self.next_download += 1
+        self.downloads[self.next_download] = [float(size_bytes), on_done]
+        self.reschedule_downloads()
+
+    def download_rate(self):
+        # Bytes per millisecond for each active download.
+        uplink = self.args.uplink_mbps * 125.0
+        client = self.args.client_mbps * 125.0
+        return min(client, uplink / max(1, len(self.downloads)))
+
+    def advance_downloads(self):
+        elapsed = self.sim.now - self.download_clock
+        self.download_clock = self.sim.now
+        if elapsed > 0 and self.downloads:
+            moved = elapsed * self.download_rate()
+            for entry in self.downloads.values():
+                entry[0] -= moved
+
+    def reschedule_downloads(self):
+        stats = self.sim.stats
+        stats.downloads_active = len(self.downloads)
+        if stats.downloads_active > stats.downloads_peak:
+            stats.downloads_peak = stats.downloads_active
+            stats.downloads_peak_at = self.sim.now
+        self.download_version += 1
+        if not self.downloads:
+            return
+        version = self.download_version
+        remaining = min(entry[0] for entry in self.downloads.values())
+        self.sim.after(max(0.0, remaining / self.download_rate()),
+                       lambda: self.finish_downloads(version))
+
+    def finish_downloads(self, version):
+        if version != self.download_version:
+            return
+        self.advance_downloads()
+        finished = [key for key, entry in self.downloads.items() if entry[0] <= 0.5]
+        callbacks = [self.downloads.pop(key)[1] for key in finished]
+        self.reschedule_downloads()
+        for callback in callbacks:
+            callback()
+
+
+# -- device -------------------------------------------------------------
+
+
+# The models below mirror the firmware classes named in their
+# docstrings; `--parity` checks them against the C++.
+
+_FLOAT = struct.Struct("<f")
+
+
+def f32(value):
+    """Round to single precision, as the firmware's float arithmetic does."""
+    return _FLOAT.unpack(_FLOAT.pack(value))[0]
+
+
+class RttEstimator:
+    """Mirrors src/RttEstimator.cpp."""
+
+    def __init__(self, min_ms, max_ms):
+        self.min_ms, self.max_ms = min_ms, max_ms
+        self.srtt = None
+        self.rttvar = 0.0
+        self.shift = 0
+
+    def add(self, rtt_ms):
+        sample = f32(int(rtt_ms))  # whole milliseconds, like millis()
+        if self.srtt is None:
+            self.srtt, self.rttvar = sample, f32(sample / 2)
+        else:
+            error = f32(abs(sample - self.srtt))
+            self.rttvar = f32(f32(0.75 * self.rttvar) + f32(0.25 * error))
+            self.srtt = f32(f32(0.875 * self.srtt) + f32(0.125 * sample))
+        self.shift = 0
+
+    def back_off(self):
+        self.shift = min(self.shift + 1, 4)
+
+    def timeout(self):
+        if self.srtt is None:
+            return self.max_ms
+        timeout = int(f32(f32(self.srtt + 4 * self.rttvar) + 0.5)) << self.shift
+        return min(self.max_ms, max(self.min_ms, timeout))
+
+
+class CircuitBreaker:
+    """Mirrors src/CircuitBreaker.cpp."""
+
+    def __init__(self, threshold, open_ms, max_open_ms, stats=None):
+        self.threshold = threshold
+        self.open_ms = open_ms
+        self.max_open_ms = max_open_ms
+        self.current_open_ms = self.open_ms
+        self.state = "closed"
+        self.failures = 0
+        self.opened_at = 0
+        self.stats = stats
+
+    def allow(self, now):
+        if self.state != "open":
+            return True
+        if now - self.opened_at < self.current_open_ms:
+            return False
+        self.state = "half-open"
+        return True
+
+    def retry_in(self, now):
+        if self.state != "open":
+            return 0
+        return max(0, self.current_open_ms - (now - self.opened_at))
+
+    def is_open(self, now):
+        return self.retry_in(now) > 0
+
+    def success(self):
+        self.failures = 0
+        if self.state != "closed":
+            self.state = "closed"
+            self.current_open_ms = self.open_ms
+
+    def failure(self, now):
+        self.failures = min(self.failures + 1, 255)
+        if self.state == "half-open":
+            self.current_open_ms = min(self.current_open_ms * 2, self.max_open_ms)
+            self.open(now)
+        elif self.state == "closed" and self.failures >= self.threshold:
+            self.open(now)
+
+    def open(self, now):
+        self.state = "open"
+        self.opened_at = now
+        if self.stats is not None:
+            self.stats.breaker_opens += 1
+
+
+class CheckSchedule:
+    """Mirrors src/CheckSchedule.cpp; `draw(max_ms)` is the random delay."""
+
+    def __init__(self, first_spread_ms, interval_ms, jitter_ms, draw):
+        self.first_spread_ms = first_spread_ms
+        self.interval_ms = interval_ms
+        self.jitter_ms = jitter_ms
+        self.draw = draw
+        self.next_at = 0
+        self.started = False
+
+    def start(self, now):
+        if self.started:
+            return
+        self.next_at = now + self.draw(self.first_spread_ms)
+        self.started = True
+
+    def due(self, now):
+        return self.started and now >= self.next_at
+
+    def attempted(self, now):
+        self.next_at = now + self.interval_ms + self.draw(self.jitter_ms)
+
+
+class Device:
+    def __init__(self, sim, index):
+        self.sim = sim
+        self.index = index
+        self.config = sim.config
+        self.firmware = 0
+        self.generation = 0
+        self.catalog_version = 0 if sim.args.fresh_catalog else 1
+
+    # Boot and reboot share one path; timers from a previous generation
+    # are ignored.
+    def boot(self):
+        config, sim = self.config, self.sim
+        self.generation += 1
+        self.busy = False
+        self.jobs = []
+        self.journal = []
+        self.connection_warm_until = -1
+        self.rtt = RttEstimator(config["BACKEND_MIN_TIMEOUT_MS"], config["BACKEND_HTTP_TIMEOUT_MS"])
+        self.breaker = CircuitBreaker(config["BACKEND_BREAKER_FAILURE_THRESHOLD"],
+                                      config["BACKEND_BREAKER_OPEN_MS"],
+                                      config["BACKEND_BREAKER_MAX_OPEN_MS"], sim.stats)
+        # OtaUpdater::loop() runs from boot, so the first check's spread
+        # is counted from boot, not from joining Wi-Fi.
+        self.ota = CheckSchedule(config["OTA_FIRST_CHECK_SPREAD_MS"],
+                                 config["OTA_CHECK_INTERVAL_MS"], config["OTA_CHECK_JITTER_MS"],
+                                 sim.random_delay)
+        self.ota.start(sim.now)
+        wifi_ms = sim.rng.uniform(sim.args.wifi_min_ms, sim.args.wifi_max_ms)
+        first_sync = 0 if self.catalog_version == 0 else sim.jitter("CARD_CATALOG_SYNC_JITTER_MS")
+        self.next_catalog_sync = sim.now + wifi_ms + first_sync
+        self.timer(max(wifi_ms, self.ota.next_at - sim.now), self.check_ota)
+        self.timer(wifi_ms, self.worker_tick)
+        self.timer(wifi_ms + sim.next_tap_delay(), self.tap)
+
+    def timer(self, delay_ms, callback):
+        generation = self.generation
+        self.sim.after(delay_ms, lambda: generation == self.generation and callback())
+
+    # -- worker task: one request at a time on one connection ----------
+
+    def worker_tick(self):
+        """Idle work the worker does between taps: replay and catalog sync."""
+        now = self.sim.now
+        if not self.busy and not self.jobs:
+            self.journal = [entry for entry in self.journal
+                            if now - entry < self.config["TAP_JOURNAL_MAX_AGE_MS"]]
+            if self.journal and not self.breaker.is_open(now):
+                self.run_job(("replay", self.journal.pop(0)))
+            elif (self.sim.catalog_sync and now >= self.next_catalog_sync
+                  and not self.breaker.is_open(now)):
+                self.run_job(("catalog", None))
+        self.timer(self.config["TAP_JOURNAL_REPLAY_RETRY_MS"], self.worker_tick)
+
+    def tap(self):
+        sim = self.sim
+        sim.stats.taps["taps"] += 1
+        if self.breaker.is_open(sim.now):
+            # processCardUid() journals the tap without a request.
+            sim.stats.taps["journaled while breaker open"] += 1
+            self.journal_tap(sim.now)
+        else:
+            if self.config.get("BACKEND_SEND_PREPARE_HINT", False):
+                sim.backend.submit("prepare", lambda status: None)
+            self.jobs.append(("play", sim.now))
+            self.next_job()
+        self.timer(sim.next_tap_delay(), self.tap)
+
+    def journal_tap(self, captured_at):
+        self.journal.append(captured_at)
+        if len(self.journal) > self.config["TAP_JOURNAL_CAPACITY"]:
+            self.journal.pop(0)
+            self.sim.stats.taps["dropped from full journal"] += 1
+
+    def next_job(self):
+        if not self.busy and self.jobs:
+            self.run_job(self.jobs.pop(0))
+
+    def run_job(self, job):
+        self.busy = True
+        kind, captured_at = job
+        if kind == "catalog":
+            self.send("catalog", self.finish_catalog)
+        else:
+            self.attempt_play(kind, captured_at, 1)
+
+    def finish_job(self):
+        self.busy = False
+        self.next_job()
+
+    def send(self, route, on_result):
+        """One request with the adaptive timeout; on_result(ok, latency_ms)."""
+        sim, generation = self.sim, self.generation
+        started = sim.now
+        connect_ms = 0 if sim.now < self.connection_warm_until else sim.backend.rtt()
+        timeout = self.rtt.timeout()
+        state = {"done": False}
+
+        def respond(status):
+            if state["done"] or generation != self.generation:
+                return
+            state["done"] = True
+            latency = sim.now - started
+            sim.stats.latency[route].append(latency)
+            if status != 200:
+                sim.stats.errors[route] += 1
+                self.connection_warm_until = sim.now + sim.args.server_keepalive_ms
+                on_result(False)
+                return
+            self.rtt.add(latency - connect_ms)
+            self.connection_warm_until = sim.now + sim.args.server_keepalive_ms
+            on_result(True)
+
+        def expire():
+            if state["done"] or generation != self.generation:
+                return
+            state["done"] = True
+            sim.stats.timeouts[route] += 1
+            self.rtt.back_off()
+            self.connection_warm_until = -1
+            on_result(False)
+
+        sim.after(connect_ms, lambda: sim.backend.submit(route, respond))
+        sim.after(connect_ms + timeout, expire)
+
+    def attempt_play(self, kind, captured_at, attempt):
+        sim, config = self.sim, self.config
+        if not self.breaker.allow(sim.now):
+            self.journal_tap(captured_at)
+            sim.stats.taps["journaled while breaker open"] += 1
+            self.finish_job()
+            return
+
+        def result(ok):
+            if ok:
+                self.breaker.success()
+                label = "replayed" if kind == "replay" else (
+                    "delivered first try" if attempt == 1 else "delivered after retry")
+                sim.stats.taps[label] += 1
+                self.finish_job()
+                return
+            self.breaker.failure(sim.now)
+            if attempt >= config["BACKEND_MAX_ATTEMPTS"] or self.breaker.state == "open":
+                self.journal_tap(captured_at)
+                sim.stats.taps["journaled after failures"] += 1
+                self.finish_job()
+                return
+            ceiling = min(config["BACKEND_RETRY_BASE_DELAY_MS"] << (attempt - 1),
+                          config["BACKEND_RETRY_MAX_DELAY_MS"])
+            self.timer(sim.rng.uniform(0, ceiling),
+                       lambda: self.attempt_play(kind, captured_at, attempt + 1))
+
+        self.send("play", result)
+
+    def finish_catalog(self, ok):
+        # Failed syncs wait for the regular interval too.
+        sim, config = self.sim, self.config
+        if ok:
+            self.catalog_version = max(self.catalog_version, 1)
+        self.next_catalog_sync = (sim.now + config["CARD_CATALOG_SYNC_INTERVAL_MS"]
+                                  + sim.jitter("CARD_CATALOG_SYNC_JITTER_MS"))
+        self.finish_job()
+
+    # -- OTA: runs from loop() on its own connection --------------------
+
+    def check_ota(self):
+        sim, config = self.sim, self.config
+        self.ota.attempted(sim.now)
+        self.timer(self.ota.next_at - sim.now, self.check_ota)
+        generation = self.generation
+        started = sim.now
+
+        def manifest(status):
+            if generation != self.generation:
+                return
+            if sim.now - started > config["OTA_HTTP_TIMEOUT_MS"]:
+                sim.stats.timeouts["manifest"] += 1
+                return
+            sim.stats.latency["manifest"].append(sim.now - started)
+            if status != 200:
+                sim.stats.errors["manifest"] += 1
+                return
+            if sim.release_published() and self.firmware < 1:
+                sim.backend.download(sim.args.firmware_kb * 1024, installed)
+
+        def installed():
+            if generation != self.generation:
+                return
+            self.firmware = 1
+            sim.stats.updated += 1
+            sim.stats.last_update_at = sim.now
+            self.generation += 1  # drop the old firmware's timers
+            sim.after(sim.args.reboot_ms, self.boot)
+
+        sim.after(sim.backend.rtt(), lambda: sim.backend.submit("manifest", manifest))
+
+
+# -- simulation ---------------------------------------------------------
+
+
+class Simulation:
+    def __init__(self, config, args, jitter):
+        self.config = config
+        self.args = args
+        self.use_jitter = jitter
+        self.catalog_sync = args.catalog_sync or config.get("CARD_CATALOG_SYNC_ENABLED", True)
+        self.rng = random.Random(args.seed)
+        self.now = 0.0
+        self.events = []
+        self.sequence = 0
+        self.stats = Stats()
+        self.backend = Backend(self, args)
+        self.devices = [Device(self, index) for index in range(args.devices)]
+
+    def after(self, delay_ms, callback):
+        self.sequence += 1
+        heapq.heappush(self.events, (self.now + max(0.0, delay_ms), self.sequence, callback))
+
+    def random_delay(self, max_ms):
+        return self.rng.uniform(0, max_ms) if self.use_jitter else 0.0
+
+    def jitter(self, key):
+        return self.random_delay(self.config[key])
+
+    def next_tap_delay(self):
+        # Poisson taps per device.
+        rate_per_ms = self.args.taps_per_hour / 3_600_000
+        return self.rng.expovariate(rate_per_ms) if rate_per_ms > 0 else float("inf")
+
+    def release_published(self):
+        return self.args.release_at_h >= 0 and self.now >= self.args.release_at_h * 3_600_000
+
+    def run(self):
+        for device in self.devices:
+            self.after(self.rng.uniform(0, self.args.boot_spread_ms), device.boot)
+        end = self.args.hours * 3_600_000
+        while self.events and self.events[0][0] <= end:
+            self.now, _, callback = heapq.heappop(self.events)
+            callback()
+        self.now = end
+        return self.stats
+
+
+def report(stats, args, label):
+    print(f"== {label}: {args.devices} devices, {args.hours:g} h, seed {args.seed}")
+    print(f"{'route':<10}{'requests':>10}{'peak/s':>8}{'at':>10}"
+          f"{'p50':>9}{'p95':>9}{'p99':>9}{'max':>9}{'errors':>8}{'timeouts':>9}")
+    overall = defaultdict(int)
+    for route in ROUTES:
+        per_second = stats.arrivals[route]
+        for second, count in per_second.items():
+            overall[second] += count
+        if not per_second:
+            continue
+        peak_second, peak = max(per_second.items(), key=lambda item: (item[1], -item[0]))
+        latencies = sorted(stats.latency[route])
+        cells = "".join(f"{percentile(latencies, p):9.0f}" for p in (50, 95, 99, 100))
+        if route == "firmware":
+            cells = f"{'(see OTA)':>36}"
+        print(f"{route:<10}{sum(per_second.values()):>10}{peak:>8}{format_time(peak_second):>10}"
+              f"{cells}{stats.errors[route]:>8}{stats.timeouts[route]:>9}")
+    if overall:
+        peak_second, peak = max(overall.items(), key=lambda item: (item[1], -item[0]))
+        print(f"backend peak {peak} req/s at {format_time(peak_second)}, "
+              f"deepest queue {stats.queue_peak}")
+    print("taps: " + ", ".join(f"{name} {count}" for name, count in stats.taps.items()))
+    print(f"breaker opened {stats.breaker_opens} time(s)")
+    if args.release_at_h >= 0:
+        print(f"OTA: peak {stats.downloads_peak} concurrent download(s) at "
+              f"{format_time(stats.downloads_peak_at / 1000)}, {stats.updated}/{args.devices} "
+              f"updated, last at {format_time(stats.last_update_at / 1000)}")
+    print()
+
+
+def format_time(seconds):
+    seconds = int(seconds)
+    return f"{seconds // 3600}:{seconds // 60 % 60:02d}:{seconds % 60:02d}"
+
+
+def write_timeline(stats, path):
+    seconds = sorted({second for route in ROUTES for second in stats.arrivals[route]})
+    with open(path, "w", encoding="utf-8") as out:
+        out.write("second," + ",".join(ROUTES) + "\n")
+        for second in seconds:
+            out.write(f"{second}," + ",".join(str(stats.arrivals[route].get(second, 0))
+                                              for route in ROUTES) + "\n")
+
+
+# -- parity with the firmware -------------------------------------------
+
+
+PARITY_SOURCES = ("tools/fleet_sim/parity.cpp", "src/RttEstimator.cpp", "src/CircuitBreaker.cpp",
+                  "src/CheckSchedule.cpp")
+
+
+def parity_script(rng, config, rounds):
+    """Random command lines for parity.cpp, seeded from Config.h values."""
+    lines = []
+    for _ in range(rounds):
+        low = rng.randint(1, config["BACKEND_MIN_TIMEOUT_MS"] * 2)
+        lines.append(f"rtt {low} {low + rng.randint(0, config['BACKEND_HTTP_TIMEOUT_MS'])}")
+        typical = rng.randint(1, 2000)
+        for _ in range(rng.randint(1, 60)):
+            if rng.random() < 0.2:
+                lines.append("rtt.backoff")
+            else:
+                lines.append(f"rtt.sample {max(0, int(rng.gauss(typical, typical / 3)))}")
+
+        open_ms = rng.randint(1, config["BACKEND_BREAKER_OPEN_MS"] * 2)
+        lines.append(f"breaker {rng.randint(1, config['BACKEND_BREAKER_FAILURE_THRESHOLD'] * 2)} "
+                     f"{open_ms} {open_ms * rng.randint(1, 16)}")
+        # Some rounds only fail, to reach the failure counter's limit.
+        kinds = ("failure",) if rng.random() < 0.1 else \
+            ("allow", "allow", "failure", "failure", "success")
+        now = 0
+        for _ in range(rng.randint(1, 300)):
+            now += rng.randint(0, open_ms)
+            lines.append(f"breaker.{rng.choice(kinds)} {now}")
+
+        spread, interval, jitter = (rng.randint(0, config[key]) for key in
+                                    ("OTA_FIRST_CHECK_SPREAD_MS", "OTA_CHECK_INTERVAL_MS",
+                                     "OTA_CHECK_JITTER_MS"))
+        lines.append(f"schedule {spread} {interval} {jitter}")
+        now = rng.randint(0, 10_000)
+        lines.append(f"schedule.due {now}")
+        lines.append(f"schedule.start {now} {rng.randint(0, spread)}")
+        for _ in range(rng.randint(1, 20)):
+            now += rng.randint(0, interval + jitter)
+            kind = rng.choice(("due", "attempted", "start"))
+            draw = rng.randint(0, jitter if kind == "attempted" else spread)
+            lines.append(f"schedule.{kind} {now}" + ("" if kind == "due" else f" {draw}"))
+    return lines
+
+
+def run_models(script):
+    """The Python models' answers to a parity script, as parity.cpp prints them."""
+    output = []
+    rtt = breaker = schedule = None
+    draws = []
+    for line in script:
+        command, *values = line.split()
+        values = [int(value) for value in values]
+        if command.startswith("rtt"):
+            if command == "rtt":
+                rtt = RttEstimator(*values)
+            elif command == "rtt.sample":
+                rtt.add(values[0])
+            else:
+                rtt.back_off()
+            srtt = int(rtt.srtt) if rtt.srtt is not None else 0
+            output.append(f"{rtt.timeout()} {srtt} {int(rtt.rttvar)}")
+        elif command.startswith("breaker"):
+            allowed, now = "-", 0
+            if command == "breaker":
+                breaker = CircuitBreaker(*values)
+            else:
+                now = values[0]
+                if command == "breaker.allow":
+                    allowed = "1" if breaker.allow(now) else "0"
+                elif command == "breaker.success":
+                    breaker.success()
+                else:
+                    breaker.failure(now)
+            output.append(f"{allowed} {breaker.state} {breaker.failures} {breaker.retry_in(now)}")
+        elif command.startswith("schedule"):
+            now = values[0] if command != "schedule" else 0
+            if command == "schedule":
+                schedule = CheckSchedule(*values, lambda max_ms: draws.pop())
+            elif command == "schedule.start":
+                draws.append(values[1])
+                schedule.start(now)
+                draws.clear()
+            elif command == "schedule.attempted":
+                draws.append(values[1])
+                schedule.attempted(now)
+            output.append(f"{int(schedule.started)} {schedule.next_at} {int(schedule.due(now))}")
+    return output
+
+
+def parity(config, args):
+    """Build parity.cpp and compare its output with the models'; returns an exit code."""
+    compiler = os.environ.get("CXX", "c++")
+    with tempfile.TemporaryDirectory() as build:
+        binary = Path(build) / "parity"
+        command = [compiler, "-std=gnu++17", "-O1", f"-I{REPO_PATH / 'include'}",
+                   f"-I{REPO_PATH / 'tools' / 'fleet_sim' / 'host'}", "-o", str(binary)]
+        command += [str(REPO_PATH / source) for source in PARITY_SOURCES]
+        try:
+            subprocess.run(command, check=True)
+        except (OSError, subprocess.CalledProcessError) as error:
+            sys.exit(f"could not build the parity harness with {compiler}: {error}")
+
+        script = parity_script(random.Random(args.seed), config, args.parity)
+        result = subprocess.run([str(binary)], input="\n".join(script) + "\n",
+                                capture_output=True, text=True, check=True)
+    firmware = result.stdout.splitlines()
+    models = run_models(script)
+    for index, line in enumerate(script):
+        if index >= len(firmware) or firmware[index] != models[index]:
+            print(f"parity: mismatch at line {index + 1}: {line}")
+            print(f"  firmware: {firmware[index] if index < len(firmware) else '(no output)'}")
+            print(f"  model:    {models[index]}")
+            return 1
+    print(f"parity: {len(script)} operations in {args.parity} rounds match the firmware")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--devices", type=int, default=300)
+    parser.add_argument("--hours", type=float, default=26)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--config", default=str(CONFIG_PATH), help="Config.h to read")
+    parser.add_argument("--taps-per-hour", type=float, default=6, help="per device")
+    parser.add_argument("--boot-spread-ms", type=float, default=2000,
+                        help="devices power up within this window (0 = all at once)")
+    parser.add_argument("--wifi-min-ms", type=float, default=1500)
+    parser.add_argument("--wifi-max-ms", type=float, default=4000)
+    parser.add_argument("--catalog-sync", action="store_true",
+                        help="model catalog syncs even without CARD_CATALOG_SYNC_ENABLED")
+    parser.add_argument("--fresh-catalog", action="store_true",
+                        help="devices boot without a stored catalog")
+    parser.add_argument("--release-at-h", type=float, default=1,
+                        help="publish new firmware at this hour (-1 = never)")
+    parser.add_argument("--firmware-kb", type=int, default=1400)
+    parser.add_argument("--reboot-ms", type=float, default=3000)
+    parser.add_argument("--workers", type=int, default=8, help="backend concurrency")
+    parser.add_argument("--queue-limit", type=int, default=64, help="queued requests before 503")
+    parser.add_argument("--play-ms", type=float, default=30, help="median service time")
+    parser.add_argument("--prepare-ms", type=float, default=5)
+    parser.add_argument("--catalog-ms", type=float, default=15)
+    parser.add_argument("--manifest-ms", type=float, default=5)
+    parser.add_argument("--service-sigma", type=float, default=0.5,
+                        help="log-normal spread of service times")
+    parser.add_argument("--network-rtt-ms", type=float, default=8)
+    parser.add_argument("--server-keepalive-ms", type=float, default=60000)
+    parser.add_argument("--uplink-mbps", type=float, default=100)
+    parser.add_argument("--client-mbps", type=float, default=4)
+    parser.add_argument("--no-jitter", action="store_true",
+                        help="zero " + ", ".join(JITTER_KEYS))
+    parser.add_argument("--compare", action="store_true",
+                        help="run as configured and without jitter, same seed")
+    parser.add_argument("--timeline", help="write per-second request counts to this CSV")
+    parser.add_argument("--parity", type=int, metavar="ROUNDS",
+                        help="check the RttEstimator, CircuitBreaker and CheckSchedule models "
+                             "against the firmware's C++ for this many random rounds, then exit")
+    args = parser.parse_args()
+
+    config = load_config(args.config)
+    if args.parity:
+        sys.exit(parity(config, args))
+    missing = [key for key in JITTER_KEYS if key not in config]
+    if missing:
+        sys.exit(f"{args.config} does not define {', '.join(missing)}")
+
+    runs = [("as configured", True), ("no jitter", False)] if args.compare else \
+        [("no jitter" if args.no_jitter else "as configured", not args.no_jitter)]
+    for label, jitter in runs:
+        stats = Simulation(config, args, jitter).run()
+        report(stats, args, label)
+        if args.timeline and len(runs) == 1:
+            write_timeline(stats, args.timeline)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,23 @@
+/*
+ * Arduino.h (host)
+ *
+ * The few Arduino definitions CircuitBreaker uses, so parity.cpp can
+ * build it on the host. Log lines are discarded and millis() reads the
+ * harness's clock.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+using std::min;
+
+unsigned long millis();
+
+struct HostSerial {
+  template <typename... Args>
+  void printf(const char *, Args...) {}
+};
+
+inline HostSerial Serial;
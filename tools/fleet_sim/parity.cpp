@@ -0,0 +1,103 @@
+/*
+ * parity.cpp
+ *
+ * Runs the firmware's RttEstimator, CircuitBreaker and CheckSchedule on
+ * a script read from stdin, so fleet_sim.py --parity can check its
+ * Python models against them. Each line is a command and produces one
+ * line of output:
+ *
+ *   rtt MIN MAX | rtt.sample MS | rtt.backoff
+ *       -> timeout srtt rttvar
+ *   breaker THRESHOLD OPEN_MS MAX_OPEN_MS | breaker.allow NOW |
+ *   breaker.success NOW | breaker.failure NOW
+ *       -> allowed state failures retry_in   (allowed is - unless asked)
+ *   schedule SPREAD INTERVAL JITTER | schedule.start NOW DRAW |
+ *   schedule.attempted NOW DRAW | schedule.due NOW
+ *       -> started next_at due
+ *
+ * DRAW is the value the random delay returns for that call. Built and
+ * run by fleet_sim.py; see README.md.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "CheckSchedule.h"
+#include "CircuitBreaker.h"
+#include "RttEstimator.h"
+
+namespace {
+unsigned long clockMs = 0;
+unsigned long nextDraw = 0;
+
+unsigned long scriptedDelay(unsigned long maxMs) {
+  if (nextDraw > maxMs) {
+    fprintf(stderr, "draw %lu exceeds %lu\n", nextDraw, maxMs);
+  }
+  return nextDraw;
+}
+}  // namespace
+
+unsigned long millis() { return clockMs; }
+
+int main() {
+  std::unique_ptr<RttEstimator> rtt;
+  std::unique_ptr<CircuitBreaker> breaker;
+  std::unique_ptr<CheckSchedule> schedule;
+
+  char line[128];
+  while (fgets(line, sizeof(line), stdin) != nullptr) {
+    char command[32] = {0};
+    unsigned long a = 0, b = 0, c = 0;
+    int fields = sscanf(line, "%31s %lu %lu %lu", command, &a, &b, &c);
+    if (fields < 1) {
+      continue;
+    }
+
+    if (strncmp(command, "rtt", 3) == 0) {
+      if (strcmp(command, "rtt") == 0) {
+        rtt.reset(new RttEstimator(a, b));
+      } else if (strcmp(command, "rtt.sample") == 0) {
+        rtt->addSample(a);
+      } else {
+        rtt->backOff();
+      }
+      printf("%lu %lu %lu\n", rtt->timeoutMs(), rtt->srttMs(), rtt->rttvarMs());
+    } else if (strncmp(command, "breaker", 7) == 0) {
+      const char *allowed = "-";
+      unsigned long now = 0;
+      if (strcmp(command, "breaker") == 0) {
+        breaker.reset(new CircuitBreaker("parity", static_cast<uint8_t>(a), b, c));
+      } else {
+        now = clockMs = a;
+        if (strcmp(command, "breaker.allow") == 0) {
+          allowed = breaker->allowRequest(now) ? "1" : "0";
+        } else if (strcmp(command, "breaker.success") == 0) {
+          breaker->recordSuccess();
+        } else {
+          breaker->recordFailure(now);
+        }
+      }
+      printf("%s %s %u %lu\n", allowed, CircuitBreaker::stateName(breaker->state()),
+             breaker->consecutiveFailures(), breaker->retryInMs(now));
+    } else if (strncmp(command, "schedule", 8) == 0) {
+      unsigned long now = a;
+      if (strcmp(command, "schedule") == 0) {
+        schedule.reset(new CheckSchedule(a, b, c, scriptedDelay));
+        now = 0;
+      } else if (strcmp(command, "schedule.start") == 0) {
+        nextDraw = b;
+        schedule->start(now);
+      } else if (strcmp(command, "schedule.attempted") == 0) {
+        nextDraw = b;
+        schedule->attempted(now);
+      }
+      printf("%d %lu %d\n", schedule->started(), schedule->nextAt(), schedule->due(now));
+    } else {
+      fprintf(stderr, "unknown command: %s\n", command);
+      return 1;
+    }
+  }
+  return 0;
+}